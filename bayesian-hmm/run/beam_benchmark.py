@@ -0,0 +1,46 @@
+import argparse, os, time, array
+import bhmm
+
+# ビームサーチによるビタビアルゴリズムの速度と厳密解との一致率を測る
+def decode(model, word_ids, offsets, num_threads):
+	start = time.time()
+	tags = model.viterbi_decode_batch(word_ids, offsets, num_threads)
+	return tags, time.time() - start
+
+def main(args):
+	dictionary = bhmm.dictionary()
+	dictionary.load(os.path.join(args.working_directory, "bhmm.dict"))
+	model = bhmm.model(os.path.join(args.working_directory, "bhmm.model"))
+	model.freeze_for_decoding()
+	word_ids = array.array("i")
+	offsets = array.array("i", [0])
+	with open(args.filename, "r") as f:
+		for line in f:
+			words = line.strip().lower().split()
+			if len(words) == 0:
+				continue
+			for word in words:
+				word_ids.append(dictionary.string_to_word_id(word))
+			offsets.append(len(word_ids))
+	print("#sentences:", len(offsets) - 1, "#words:", len(word_ids), "#tags:", model.get_num_tags())
+
+	exact_tags, exact_time = decode(model, word_ids, offsets, args.num_threads)
+	print("exact: {:.3f} sec".format(exact_time))
+	settings = [("width", width) for width in args.beam_widths] + [("threshold", threshold) for threshold in args.beam_thresholds]
+	for kind, value in settings:
+		model.set_beam_width(value if kind == "width" else 0)
+		model.set_beam_threshold(value if kind == "threshold" else 0)
+		tags, elapsed_time = decode(model, word_ids, offsets, args.num_threads)
+		num_agreed = sum(1 for tag, exact_tag in zip(tags, exact_tags) if tag == exact_tag)
+		print("{}={}: {:.3f} sec speedup={:.2f}x agreement={:.4f}".format(kind, value, elapsed_time, exact_time / elapsed_time, num_agreed / len(exact_tags)))
+	model.set_beam_width(0)
+	model.set_beam_threshold(0)
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("-cwd", "--working-directory", type=str, default="out", help="ワーキングディレクトリ.")
+	parser.add_argument("-f", "--filename", type=str, default="../../text/alice.txt", help="品詞を推定するテキストファイル.")
+	parser.add_argument("-thread", "--num-threads", type=int, default=1, help="スレッド数.")
+	parser.add_argument("-width", "--beam-widths", type=int, nargs="*", default=[1, 2, 4, 8, 16, 32, 64], help="試すビーム幅.")
+	parser.add_argument("-threshold", "--beam-thresholds", type=float, nargs="*", default=[2.0, 5.0, 10.0], help="試す対数確率の閾値.")
+	main(parser.parse_args())
@@ -0,0 +1,19 @@
+import argparse, os
+import bhmm
+
+# Boost.Serializationの旧形式で保存したモデルを独自のバイナリ形式に書き直す
+# 読み込みは形式を判別するので、旧形式のままでも使える
+def main(args):
+	input_filename = os.path.join(args.working_directory, args.input)
+	output_filename = os.path.join(args.working_directory, args.output if args.output else args.input)
+	model = bhmm.model(input_filename)
+	if model.save(output_filename) == False:
+		raise Exception("could not write {}".format(output_filename))
+	print("{} -> {}".format(input_filename, output_filename))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("-cwd", "--working-directory", type=str, default="out", help="ワーキングディレクトリ.")
+	parser.add_argument("-i", "--input", type=str, default="bhmm.model", help="変換するモデル.")
+	parser.add_argument("-o", "--output", type=str, default=None, help="書き出し先. 省略すると上書きする.")
+	main(parser.parse_args())
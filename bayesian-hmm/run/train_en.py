@@ -1,4 +1,4 @@
-import argparse, sys, os, time, codecs, random
+import argparse, sys, os, time, codecs, random, array
 import treetaggerwrapper
 import bhmm
 
@@ -119,7 +119,40 @@ def build_corpus(filename):
 		# Wtに制限をかけない場合
 		Wt = [int(len(word_count) / args.num_tags)] * args.num_tags
 
-	return corpus, Wt
+	return corpus, Wt, Wt_count
+
+# 訓練データで各単語が取りうる品詞の一覧をCSR形式で作る
+# 品詞IDはWt_countの順に1から振る. 一覧が空の単語は全ての品詞を取りうる
+def build_tag_dictionary(Wt_count, dictionary, num_words):
+	tags_of_word = [[] for word_id in range(num_words)]
+	for tag_id, (tag, words) in enumerate(Wt_count.items(), start=1):
+		for word in words:
+			if dictionary.is_unk(word):
+				continue
+			tags_of_word[dictionary.string_to_word_id(word)].append(tag_id)
+	offsets = array.array("i", [0])
+	tags = array.array("i")
+	for word_tags in tags_of_word:
+		tags.extend(word_tags)
+		offsets.append(len(tags))
+	return offsets, tags
+
+# 変分ベイズEM. 変分下界の相対的な増加がvb_tolerance以下になったら止める
+def train_variational(trainer, model, dictionary):
+	previous = None
+	for iteration in range(1, args.vb_iterations + 1):
+		start = time.time()
+		lower_bound = trainer.variational_em()
+		elapsed_time = time.time() - start
+		print("Iteration {} / {} - lower_bound {} - {:.3f} sec".format(iteration, args.vb_iterations, lower_bound, elapsed_time))
+		if previous is not None and abs(lower_bound - previous) <= args.vb_tolerance * abs(previous):
+			print("converged at iteration {}".format(iteration))
+			break
+		previous = lower_bound
+	model.print_typical_words_assigned_to_each_tag(20, dictionary)
+	print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
+	trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))
+	trainer.wait_for_save()
 
 def main():
 	assert args.train_filename is not None
@@ -129,7 +162,7 @@ def main():
 		pass
 
 	# 訓練データを追加
-	corpus, Wt = build_corpus(args.train_filename)
+	corpus, Wt, Wt_count = build_corpus(args.train_filename)
 	dataset = bhmm.dataset(corpus, args.train_split, args.unknown_threshold)	# 低頻度語を全て<unk>に置き換える
 
 	# 単語辞書を保存
@@ -137,8 +170,12 @@ def main():
 	dictionary.save(os.path.join(args.working_directory, "bhmm.dict"))
 
 	# モデル
-	num_tags = len(Wt) if args.supervised else args.num_tags
-	model = bhmm.model(num_tags, dataset, Wt)
+	if args.supervised:
+		# 各単語は訓練データで現れた品詞だけを取る
+		offsets, tags = build_tag_dictionary(Wt_count, dictionary, dataset.get_num_words())
+		model = bhmm.model(len(Wt), dataset, Wt, offsets, tags)
+	else:
+		model = bhmm.model(args.num_tags, dataset, Wt)
 
 	# ハイパーパラメータの設定
 	model.set_temperature(args.start_temperature)		# 温度の初期設定
@@ -148,12 +185,24 @@ def main():
 
 	# 学習の準備
 	trainer = bhmm.trainer(dataset, model)
+	trainer.set_num_threads(args.num_threads)
+	trainer.set_num_chains(args.num_chains)			# レプリカ交換法の鎖の数
+	trainer.set_max_temperature(args.max_temperature)
+
+	if args.variational:
+		train_variational(trainer, model, dictionary)
+		return
 
 	# 学習ループ
 	decay = (args.start_temperature - args.min_temperature) / args.epochs 
 	for epoch in range(1, args.epochs + 1):
 		start = time.time()
-		trainer.gibbs()	# 新しい状態系列をギブスサンプリング
+		if args.blocked:
+			trainer.blocked_gibbs()	# 文単位で状態系列をまとめてサンプリング
+		else:
+			trainer.gibbs()	# 新しい状態系列をギブスサンプリング
+		if args.type_interval > 0 and epoch % args.type_interval == 0:
+			trainer.type_gibbs()	# 単語ごとに同じ品詞の出現をまとめて別の品詞に移す
 		trainer.anneal_temperature(decay)	# 温度を下げる
 
 		# ログ
@@ -167,7 +216,16 @@ def main():
 			trainer.update_hyperparameters()	# ハイパーパラメータをサンプリング
 			printr("")
 			print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
-			model.save(os.path.join(args.working_directory, "bhmm.model"))
+			if args.num_chains > 1:
+				print("exchange: {}".format(" ".join(["{:.3f}".format(rate) for rate in trainer.get_exchange_acceptance_rates()])))
+			print("changed {:.4f} - log_p_joint {} - split_r_hat {:.3f}".format(trainer.get_changed_fraction(), trainer.get_log_p_joint(), trainer.get_split_r_hat()))
+			trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))	# 書き出しは裏で行う
+		if args.early_stopping and trainer.converged():	# 品詞の変化と同時確率が横ばいになったら打ち切る
+			printr("")
+			print("converged at epoch {}".format(epoch))
+			trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))
+			break
+	trainer.wait_for_save()
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -183,5 +241,14 @@ if __name__ == "__main__":
 	parser.add_argument("--min-temperature", type=float, default=0.08, help="最小温度.")
 	parser.add_argument("--initial-alpha", "-alpha", type=float, default=0.003, help="alphaの初期値.")
 	parser.add_argument("--initial-beta", "-beta", type=float, default=1.0, help="betaの初期値.")
+	parser.add_argument("-thread", "--num-threads", type=int, default=1, help="ギブスサンプリングと尤度の計算に使うスレッド数.")
+	parser.add_argument("-chains", "--num-chains", type=int, default=1, help="レプリカ交換法で温度を変えて並列に動かす鎖の数. 鎖ごとに1スレッドを使う.")
+	parser.add_argument("--max-temperature", type=float, default=10.0, help="レプリカ交換法で最も高温の鎖の温度.")
+	parser.add_argument("--early-stopping", dest="early_stopping", default=False, action="store_true", help="収束したら指定したepochより前に打ち切るかどうか.")
+	parser.add_argument("--blocked", dest="blocked", default=False, action="store_true", help="文単位のブロック化サンプリングを使うかどうか.")
+	parser.add_argument("--type-interval", type=int, default=0, help="何エポックごとに単語の種類ごとのブロック化サンプリングを挟むか. 0なら使わない.")
+	parser.add_argument("--variational", dest="variational", default=False, action="store_true", help="Gibbsサンプリングの代わりに変分ベイズEMを使うかどうか. E-stepは-threadのスレッド数で並列に行う.")
+	parser.add_argument("--vb-iterations", type=int, default=100, help="変分ベイズEMの最大反復回数.")
+	parser.add_argument("--vb-tolerance", type=float, default=1e-4, help="変分下界の相対的な増加がこれ以下になったら変分ベイズEMを止める.")
 	args = parser.parse_args()
 	main()
\ No newline at end of file
@@ -72,6 +72,23 @@ def build_corpus(filename):
 
 	return corpus, Wt
 
+# 変分ベイズEM. 変分下界の相対的な増加がvb_tolerance以下になったら止める
+def train_variational(trainer, model, dictionary):
+	previous = None
+	for iteration in range(1, args.vb_iterations + 1):
+		start = time.time()
+		lower_bound = trainer.variational_em()
+		elapsed_time = time.time() - start
+		print("Iteration {} / {} - lower_bound {} - {:.3f} sec".format(iteration, args.vb_iterations, lower_bound, elapsed_time))
+		if previous is not None and abs(lower_bound - previous) <= args.vb_tolerance * abs(previous):
+			print("converged at iteration {}".format(iteration))
+			break
+		previous = lower_bound
+	model.print_typical_words_assigned_to_each_tag(20, dictionary)
+	print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
+	trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))
+	trainer.wait_for_save()
+
 def main():
 	assert args.train_filename is not None
 	try:
@@ -99,12 +116,22 @@ def main():
 
 	# 学習の準備
 	trainer = bhmm.trainer(dataset, model)
+	trainer.set_num_threads(args.num_threads)
+
+	if args.variational:
+		train_variational(trainer, model, dictionary)
+		return
 
 	# 学習ループ
 	decay = (args.start_temperature - args.min_temperature) / args.epochs 
 	for epoch in range(1, args.epochs + 1):
 		start = time.time()
-		trainer.gibbs()	# 新しい状態系列をギブスサンプリング
+		if args.blocked:
+			trainer.blocked_gibbs()	# 文単位で状態系列をまとめてサンプリング
+		else:
+			trainer.gibbs()	# 新しい状態系列をギブスサンプリング
+		if args.type_interval > 0 and epoch % args.type_interval == 0:
+			trainer.type_gibbs()	# 単語ごとに同じ品詞の出現をまとめて別の品詞に移す
 		trainer.anneal_temperature(decay)	# 温度を下げる
 
 		# ログ
@@ -118,7 +145,14 @@ def main():
 			trainer.update_hyperparameters()	# ハイパーパラメータをサンプリング
 			printr("")
 			print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
-			model.save(os.path.join(args.working_directory, "bhmm.model"))
+			print("changed {:.4f} - log_p_joint {} - split_r_hat {:.3f}".format(trainer.get_changed_fraction(), trainer.get_log_p_joint(), trainer.get_split_r_hat()))
+			trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))	# 書き出しは裏で行う
+		if args.early_stopping and trainer.converged():	# 品詞の変化と同時確率が横ばいになったら打ち切る
+			printr("")
+			print("converged at epoch {}".format(epoch))
+			trainer.save_async(os.path.join(args.working_directory, "bhmm.model"))
+			break
+	trainer.wait_for_save()
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -134,5 +168,12 @@ if __name__ == "__main__":
 	parser.add_argument("--min-temperature", type=float, default=0.08, help="最小温度.")
 	parser.add_argument("--initial-alpha", "-alpha", type=float, default=0.003, help="alphaの初期値.")
 	parser.add_argument("--initial-beta", "-beta", type=float, default=1.0, help="betaの初期値.")
+	parser.add_argument("-thread", "--num-threads", type=int, default=1, help="ギブスサンプリングと尤度の計算に使うスレッド数.")
+	parser.add_argument("--early-stopping", dest="early_stopping", default=False, action="store_true", help="収束したら指定したepochより前に打ち切るかどうか.")
+	parser.add_argument("--blocked", dest="blocked", default=False, action="store_true", help="文単位のブロック化サンプリングを使うかどうか.")
+	parser.add_argument("--type-interval", type=int, default=0, help="何エポックごとに単語の種類ごとのブロック化サンプリングを挟むか. 0なら使わない.")
+	parser.add_argument("--variational", dest="variational", default=False, action="store_true", help="Gibbsサンプリングの代わりに変分ベイズEMを使うかどうか. E-stepは-threadのスレッド数で並列に行う.")
+	parser.add_argument("--vb-iterations", type=int, default=100, help="変分ベイズEMの最大反復回数.")
+	parser.add_argument("--vb-tolerance", type=float, default=1e-4, help="変分下界の相対的な増加がこれ以下になったら変分ベイズEMを止める.")
 	args = parser.parse_args()
 	main()
\ No newline at end of file
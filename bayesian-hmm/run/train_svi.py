@@ -0,0 +1,78 @@
+import argparse, sys, os, time
+import bhmm
+
+class stdout:
+	BOLD = "\033[1m"
+	END = "\033[0m"
+	CLEAR = "\033[2K"
+
+def printb(string):
+	print(stdout.BOLD + string + stdout.END)
+
+def printr(string):
+	sys.stdout.write("\r" + stdout.CLEAR)
+	sys.stdout.write(string)
+	sys.stdout.flush()
+
+# 確率的変分推論
+# コーパス全体をメモリに載せずにミニバッチ単位で読みながら学習する
+# 訓練データは単語分割済みのテキストファイル(1行1文、空白区切り)かbuild_corpusで作ったバイナリ形式
+def main():
+	assert args.train_filename is not None
+	try:
+		os.mkdir(args.working_directory)
+	except:
+		pass
+
+	corpus = bhmm.streaming_corpus(args.train_filename, args.unknown_threshold)	# 低頻度語を全て<unk>に置き換える
+	print("sentences: {} - tokens: {} - words: {}".format(corpus.get_num_sentences(), corpus.get_num_tokens(), corpus.get_num_words()))
+
+	# 単語辞書を保存
+	dictionary = corpus.get_dict()
+	dictionary.save(os.path.join(args.working_directory, "bhmm.dict"))
+
+	# モデル
+	Wt = [int(corpus.get_num_words() / args.num_tags)] * args.num_tags
+	model = bhmm.model(args.num_tags, corpus, Wt)
+	model.set_initial_alpha(args.initial_alpha)
+	model.set_initial_beta(args.initial_beta)
+
+	# 学習の準備
+	trainer = bhmm.svi_trainer(corpus, model)
+	trainer.set_batch_size(args.batch_size)
+	trainer.set_learning_rate(args.tau, args.kappa)	# 学習率は(tau + 更新回数)^-kappa
+	trainer.set_num_threads(args.num_threads)
+
+	# 学習ループ
+	num_updates_per_pass = max(1, (corpus.get_num_sentences() + args.batch_size - 1) // args.batch_size)
+	start = time.time()
+	while trainer.get_num_passes() < args.passes:
+		learning_rate = trainer.get_learning_rate()
+		log_p = trainer.update()
+		num_updates = trainer.get_num_updates()
+		printr("Pass {} / {} - update {} - rate {:.4f} - log_p {:.4f} - {:.3f} sec".format(trainer.get_num_passes() + 1, args.passes, num_updates, learning_rate, log_p, time.time() - start))
+		if num_updates % num_updates_per_pass == 0:
+			printr("")
+			trainer.update_model()
+			model.print_typical_words_assigned_to_each_tag(20, dictionary)
+			model.save(os.path.join(args.working_directory, "bhmm.model"))
+	printr("")
+	trainer.update_model()	# 期待カウントをモデルに書き込む
+	model.print_typical_words_assigned_to_each_tag(20, dictionary)
+	model.save(os.path.join(args.working_directory, "bhmm.model"))
+
+if __name__ == "__main__":
+	parser = argparse.ArgumentParser()
+	parser.add_argument("-file", "--train-filename", type=str, default=None, help="訓練用のテキストファイルかバイナリ形式のコーパスのパス.")
+	parser.add_argument("-cwd", "--working-directory", type=str, default="out", help="ワーキングディレクトリ.")
+	parser.add_argument("-tags", "--num-tags", type=int, default=20, help="タグの種類.")
+	parser.add_argument("-unk", "--unknown-threshold", type=int, default=1, help="出現回数がこの値以下の単語は<unk>に置き換える.")
+	parser.add_argument("--initial-alpha", "-alpha", type=float, default=0.003, help="alphaの初期値.")
+	parser.add_argument("--initial-beta", "-beta", type=float, default=1.0, help="betaの初期値.")
+	parser.add_argument("-batch", "--batch-size", type=int, default=256, help="ミニバッチの文の数.")
+	parser.add_argument("--tau", type=float, default=1.0, help="学習率(tau + t)^-kappaのtau. 大きくすると序盤の更新が小さくなる.")
+	parser.add_argument("--kappa", type=float, default=0.7, help="学習率(tau + t)^-kappaのkappa. (0.5, 1]でなければならない.")
+	parser.add_argument("-passes", "--passes", type=int, default=10, help="コーパスを読み通す回数.")
+	parser.add_argument("-thread", "--num-threads", type=int, default=1, help="E-stepに使うスレッド数.")
+	args = parser.parse_args()
+	main()
@@ -0,0 +1,174 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "binary.h"
+
+namespace bhmm {
+	namespace binary {
+		static size_t _align(size_t offset){
+			return (offset + BHMM_BINARY_ALIGNMENT - 1) / BHMM_BINARY_ALIGNMENT * BHMM_BINARY_ALIGNMENT;
+		}
+		size_t get_dtype_size(DataType dtype){
+			switch(dtype){
+				case DTYPE_INT32:
+					return 4;
+				case DTYPE_UINT64:
+					return 8;
+				case DTYPE_FLOAT64:
+					return 8;
+			}
+			return 0;
+		}
+		bool is_binary_file(const std::string &filename){
+			std::ifstream ifs(filename, std::ios::binary);
+			if(ifs.good() == false){
+				return false;
+			}
+			char magic[sizeof(BHMM_BINARY_MAGIC)] = {0};
+			ifs.read(magic, sizeof(magic));
+			if(ifs.gcount() != sizeof(magic)){
+				return false;
+			}
+			return std::memcmp(magic, BHMM_BINARY_MAGIC, sizeof(magic)) == 0;
+		}
+		Writer::Writer(){
+			static_assert(sizeof(int) == 4, "counts are stored as int32");
+			static_assert(sizeof(BHMM_BINARY_MAGIC) == sizeof(_header.magic), "magic must be 8 bytes");
+			std::memset(&_header, 0, sizeof(Header));
+			std::memcpy(_header.magic, BHMM_BINARY_MAGIC, sizeof(_header.magic));
+			_header.version = BHMM_BINARY_VERSION;
+			_header.byte_order = BHMM_BINARY_BYTE_ORDER;
+			_header.header_size = sizeof(Header);
+			_buffers.resize(NUM_SECTIONS, NULL);
+		}
+		void Writer::add_section(SectionId section_id, DataType dtype, const void* data, size_t num_elements){
+			assert(0 <= section_id && section_id < NUM_SECTIONS);
+			assert(data != NULL || num_elements == 0);
+			Section &section = _header.sections[section_id];
+			section.num_elements = num_elements;
+			section.dtype = dtype;
+			_buffers[section_id] = data;
+		}
+		bool Writer::write(const std::string &filename){
+			// 登録順によらず表の番号順に並べる
+			size_t offset = _align(sizeof(Header));
+			for(int section_id = 0;section_id < NUM_SECTIONS;section_id++){
+				Section &section = _header.sections[section_id];
+				if(section.dtype == 0){
+					continue;
+				}
+				section.offset = offset;
+				offset = _align(offset + section.num_elements * get_dtype_size((DataType)section.dtype));
+			}
+			std::string tmp_filename = filename + ".tmp";
+			std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+			if(ofs.good() == false){
+				return false;
+			}
+			char padding[BHMM_BINARY_ALIGNMENT] = {0};
+			size_t position = 0;
+			ofs.write(reinterpret_cast<const char*>(&_header), sizeof(Header));
+			position += sizeof(Header);
+			for(int section_id = 0;section_id < NUM_SECTIONS;section_id++){
+				const Section &section = _header.sections[section_id];
+				if(section.dtype == 0){
+					continue;
+				}
+				ofs.write(padding, section.offset - position);
+				size_t num_bytes = section.num_elements * get_dtype_size((DataType)section.dtype);
+				ofs.write(reinterpret_cast<const char*>(_buffers[section_id]), num_bytes);
+				position = section.offset + num_bytes;
+			}
+			ofs.close();
+			if(ofs.fail()){
+				std::remove(tmp_filename.c_str());
+				return false;
+			}
+			return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+		}
+		MappedFile::MappedFile(){
+			_address = NULL;
+			_num_bytes = 0;
+			_header = NULL;
+		}
+		MappedFile::~MappedFile(){
+			close();
+		}
+		bool MappedFile::open(const std::string &filename){
+			close();
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if(fd < 0){
+				return false;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)){
+				::close(fd);
+				return false;
+			}
+			void* address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);	// 対応付けはファイルを閉じても残る
+			if(address == MAP_FAILED){
+				return false;
+			}
+			_address = address;
+			_num_bytes = st.st_size;
+			_header = reinterpret_cast<const Header*>(address);
+			if(_validate() == false){
+				close();
+				return false;
+			}
+			return true;
+		}
+		void MappedFile::close(){
+			if(_address != NULL){
+				munmap(_address, _num_bytes);
+			}
+			_address = NULL;
+			_num_bytes = 0;
+			_header = NULL;
+		}
+		bool MappedFile::_validate(){
+			if(std::memcmp(_header->magic, BHMM_BINARY_MAGIC, sizeof(_header->magic)) != 0){
+				return false;
+			}
+			if(_header->byte_order != BHMM_BINARY_BYTE_ORDER || _header->version > BHMM_BINARY_VERSION || _header->header_size != sizeof(Header)){
+				return false;
+			}
+			if(_header->num_tags <= 0 || _header->num_words <= 0){
+				return false;
+			}
+			for(int section_id = 0;section_id < NUM_SECTIONS;section_id++){
+				const Section &section = _header->sections[section_id];
+				if(section.dtype == 0){
+					continue;
+				}
+				size_t dtype_size = get_dtype_size((DataType)section.dtype);
+				if(dtype_size == 0 || section.offset % BHMM_BINARY_ALIGNMENT != 0 || section.offset > _num_bytes){
+					return false;
+				}
+				// 途中で切れたファイル
+				if(section.num_elements > (_num_bytes - section.offset) / dtype_size){
+					return false;
+				}
+			}
+			return true;
+		}
+		bool MappedFile::has_section(SectionId section_id) const {
+			assert(_header != NULL);
+			return _header->sections[section_id].dtype != 0;
+		}
+		const void* MappedFile::get_section(SectionId section_id, DataType dtype, size_t num_elements) const {
+			assert(_header != NULL);
+			const Section &section = _header->sections[section_id];
+			if(section.dtype != dtype || section.num_elements != num_elements){
+				return NULL;
+			}
+			return static_cast<const char*>(_address) + section.offset;
+		}
+	}
+}
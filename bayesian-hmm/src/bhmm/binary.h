@@ -0,0 +1,92 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define BHMM_BINARY_MAGIC "BHMMBIN"		// 終端の0を含めて8バイト
+#define BHMM_BINARY_VERSION 1
+#define BHMM_BINARY_BYTE_ORDER 0x01020304
+#define BHMM_BINARY_ALIGNMENT 64		// 各表の先頭はこの倍数の位置に置く
+#define BHMM_BINARY_FLAG_HASHED_TRIGRAM 1
+#define BHMM_BINARY_FLAG_TAG_DICTIONARY 2
+
+namespace bhmm {
+	// モデルの独自バイナリ形式
+	// 固定長のヘッダの後にカウントの表をメモリ上の並びのまま置く
+	// 書き出しは表ごとに1回のwriteで済み、読み込みはmmapした領域から要素ごとの解析なしにコピーできる
+	namespace binary {
+		enum DataType {
+			DTYPE_INT32 = 1,
+			DTYPE_UINT64 = 2,
+			DTYPE_FLOAT64 = 3,
+		};
+		enum SectionId {
+			SECTION_WT = 0,
+			SECTION_BETA,
+			SECTION_TRIGRAM_COUNTS,		// 密なら(T+1)^3、ハッシュ表なら番地ごとの値
+			SECTION_TRIGRAM_KEYS,		// ハッシュ表の番地ごとの鍵
+			SECTION_BIGRAM_COUNTS,
+			SECTION_UNIGRAM_COUNTS,
+			SECTION_EMISSION_OFFSETS,	// 単語ごとの非ゼロ要素の開始位置. 長さ単語数 + 1
+			SECTION_EMISSION_TAGS,
+			SECTION_EMISSION_COUNTS,
+			SECTION_TAG_DICTIONARY_OFFSETS,
+			SECTION_TAG_DICTIONARY_TAGS,
+			NUM_SECTIONS,
+		};
+		struct Section {
+			uint64_t offset;		// ファイルの先頭から. 0なら表がない
+			uint64_t num_elements;
+			uint32_t dtype;
+			uint32_t reserved;
+		};
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t byte_order;	// 書き出したマシンと読み込むマシンのエンディアンが同じか確かめる
+			uint32_t header_size;
+			uint32_t flags;
+			int32_t num_tags;
+			int32_t num_words;
+			uint64_t trigram_capacity;	// 品詞3-gramのハッシュ表の番地数. 密なら0
+			double alpha;
+			double temperature;
+			double minimum_temperature;
+			Section sections[NUM_SECTIONS];
+		};
+		size_t get_dtype_size(DataType dtype);
+		// 先頭がBHMM_BINARY_MAGICならtrue. 旧形式のファイルはfalse
+		bool is_binary_file(const std::string &filename);
+		// 表を登録してからまとめて書き出す
+		// 登録したバッファはwriteを呼ぶまで保持しておくこと
+		class Writer {
+		private:
+			std::vector<const void*> _buffers;
+		public:
+			Header _header;
+			Writer();
+			void add_section(SectionId section_id, DataType dtype, const void* data, size_t num_elements);
+			// 一時ファイルに書いてから置き換えるので、途中で落ちても元のファイルは壊れない
+			bool write(const std::string &filename);
+		};
+		// 読み取り専用でmmapしたファイル
+		class MappedFile {
+		private:
+			MappedFile(const MappedFile &);
+			MappedFile &operator=(const MappedFile &);
+			bool _validate();
+		public:
+			void* _address;
+			size_t _num_bytes;
+			const Header* _header;
+			MappedFile();
+			~MappedFile();
+			bool open(const std::string &filename);
+			void close();
+			bool has_section(SectionId section_id) const;
+			// 型か要素数が合わなければNULL
+			const void* get_section(SectionId section_id, DataType dtype, size_t num_elements) const;
+		};
+	}
+}
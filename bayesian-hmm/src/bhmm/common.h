@@ -1,10 +1,3 @@
 #pragma once
 
 using id = int;
-
-namespace bhmm {
-	typedef struct Word {
-		id _id;
-		int _state;
-	} Word;
-}
\ No newline at end of file
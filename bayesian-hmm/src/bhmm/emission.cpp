@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <cstring>
+#include "emission.h"
+
+namespace bhmm {
+	EmissionCounts::EmissionCounts(int num_tags, id num_words){
+		assert(num_tags > 0);
+		assert(num_words > 0);
+		_num_tags = num_tags;
+		_num_words = num_words;
+		// (品詞, 頻度)のペアは8バイト、密な配列は(品詞数+1)*4バイトなので
+		// 非ゼロ要素が半分を超えたら密な方が小さい
+		_dense_threshold = (num_tags + 1) / 2;
+		_sparse_counts = new SparseCounts[num_words];
+		_dense_counts = new int*[num_words];
+		for(id word_id = 0;word_id < num_words;word_id++){
+			_dense_counts[word_id] = NULL;
+		}
+	}
+	EmissionCounts::~EmissionCounts(){
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			delete[] _dense_counts[word_id];
+		}
+		delete[] _dense_counts;
+		delete[] _sparse_counts;
+	}
+	void EmissionCounts::_promote_to_dense(id word_id){
+		assert(_dense_counts[word_id] == NULL);
+		int* counts = new int[_num_tags + 1];
+		get_counts_of_word(word_id, counts);
+		_dense_counts[word_id] = counts;
+		SparseCounts().swap(_sparse_counts[word_id]);	// メモリも解放
+	}
+	void EmissionCounts::set(int tag, id word_id, int count){
+		assert(1 <= tag && tag <= _num_tags);
+		assert(0 <= word_id && word_id < _num_words);
+		assert(count >= 0);
+		if(_dense_counts[word_id] != NULL){
+			_dense_counts[word_id][tag] = count;
+			return;
+		}
+		SparseCounts &sparse = _sparse_counts[word_id];
+		auto itr = std::lower_bound(sparse.begin(), sparse.end(), std::make_pair(tag, 0));
+		if(itr != sparse.end() && itr->first == tag){
+			if(count == 0){
+				sparse.erase(itr);
+				return;
+			}
+			itr->second = count;
+			return;
+		}
+		if(count == 0){
+			return;
+		}
+		sparse.insert(itr, std::make_pair(tag, count));
+		if((int)sparse.size() > _dense_threshold){
+			_promote_to_dense(word_id);
+		}
+	}
+	void EmissionCounts::increment(int tag, id word_id){
+		assert(1 <= tag && tag <= _num_tags);
+		assert(0 <= word_id && word_id < _num_words);
+		if(_dense_counts[word_id] != NULL){
+			_dense_counts[word_id][tag] += 1;
+			return;
+		}
+		set(tag, word_id, get(tag, word_id) + 1);
+	}
+	void EmissionCounts::decrement(int tag, id word_id){
+		assert(1 <= tag && tag <= _num_tags);
+		assert(0 <= word_id && word_id < _num_words);
+		if(_dense_counts[word_id] != NULL){
+			_dense_counts[word_id][tag] -= 1;
+			assert(_dense_counts[word_id][tag] >= 0);
+			return;
+		}
+		int count = get(tag, word_id);
+		assert(count > 0);
+		set(tag, word_id, count - 1);
+	}
+	void EmissionCounts::copy_from(const EmissionCounts* counts){
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			copy_word_from(counts, word_id);
+		}
+	}
+	void EmissionCounts::copy_word_from(const EmissionCounts* counts, id word_id){
+		assert(counts->_num_tags == _num_tags);
+		assert(counts->_num_words == _num_words);
+		assert(0 <= word_id && word_id < _num_words);
+		if(counts->_dense_counts[word_id] != NULL){
+			if(_dense_counts[word_id] == NULL){
+				_dense_counts[word_id] = new int[_num_tags + 1];
+				SparseCounts().swap(_sparse_counts[word_id]);
+			}
+			memcpy(_dense_counts[word_id], counts->_dense_counts[word_id], sizeof(int) * (_num_tags + 1));
+			return;
+		}
+		delete[] _dense_counts[word_id];
+		_dense_counts[word_id] = NULL;
+		_sparse_counts[word_id] = counts->_sparse_counts[word_id];
+	}
+	bool EmissionCounts::is_dense(id word_id) const {
+		assert(0 <= word_id && word_id < _num_words);
+		return _dense_counts[word_id] != NULL;
+	}
+	int EmissionCounts::get_num_nonzero_tags(id word_id) const {
+		assert(0 <= word_id && word_id < _num_words);
+		if(_dense_counts[word_id] == NULL){
+			return _sparse_counts[word_id].size();
+		}
+		int num_nonzero = 0;
+		for(int tag = 1;tag <= _num_tags;tag++){
+			if(_dense_counts[word_id][tag] > 0){
+				num_nonzero++;
+			}
+		}
+		return num_nonzero;
+	}
+	void EmissionCounts::get_counts_of_word(id word_id, int* counts) const {
+		assert(0 <= word_id && word_id < _num_words);
+		if(_dense_counts[word_id] != NULL){
+			memcpy(counts, _dense_counts[word_id], sizeof(int) * (_num_tags + 1));
+			return;
+		}
+		memset(counts, 0, sizeof(int) * (_num_tags + 1));
+		for(const auto &pair: _sparse_counts[word_id]){
+			counts[pair.first] = pair.second;
+		}
+	}
+	void EmissionCounts::assign_word(id word_id, const int* tags, const int* counts, int num_nonzero){
+		assert(0 <= word_id && word_id < _num_words);
+		assert(num_nonzero >= 0);
+		delete[] _dense_counts[word_id];
+		_dense_counts[word_id] = NULL;
+		SparseCounts &sparse = _sparse_counts[word_id];
+		if(num_nonzero > _dense_threshold){
+			SparseCounts().swap(sparse);
+			int* dense = new int[_num_tags + 1];
+			memset(dense, 0, sizeof(int) * (_num_tags + 1));
+			for(int k = 0;k < num_nonzero;k++){
+				assert(1 <= tags[k] && tags[k] <= _num_tags);
+				dense[tags[k]] = counts[k];
+			}
+			_dense_counts[word_id] = dense;
+			return;
+		}
+		sparse.resize(num_nonzero);
+		for(int k = 0;k < num_nonzero;k++){
+			assert(1 <= tags[k] && tags[k] <= _num_tags);
+			assert(k == 0 || tags[k - 1] < tags[k]);
+			sparse[k] = std::make_pair(tags[k], counts[k]);
+		}
+	}
+	void EmissionCounts::export_csr(std::vector<uint64_t> &offsets, std::vector<int> &tags, std::vector<int> &counts) const {
+		offsets.resize(_num_words + 1);
+		tags.clear();
+		counts.clear();
+		offsets[0] = 0;
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			if(_dense_counts[word_id] != NULL){
+				for(int tag = 1;tag <= _num_tags;tag++){
+					int count = _dense_counts[word_id][tag];
+					if(count > 0){
+						tags.push_back(tag);
+						counts.push_back(count);
+					}
+				}
+			}else{
+				for(const auto &pair: _sparse_counts[word_id]){
+					tags.push_back(pair.first);
+					counts.push_back(pair.second);
+				}
+			}
+			offsets[word_id + 1] = tags.size();
+		}
+	}
+	void EmissionCounts::enumerate_words_of_each_tag(std::vector<SparseCounts> &words_of_tag) const {
+		words_of_tag.clear();
+		words_of_tag.resize(_num_tags + 1);
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			if(_dense_counts[word_id] != NULL){
+				for(int tag = 1;tag <= _num_tags;tag++){
+					int count = _dense_counts[word_id][tag];
+					if(count > 0){
+						words_of_tag[tag].push_back(std::make_pair(word_id, count));
+					}
+				}
+				continue;
+			}
+			for(const auto &pair: _sparse_counts[word_id]){
+				words_of_tag[pair.first].push_back(std::make_pair(word_id, pair.second));
+			}
+		}
+	}
+	size_t EmissionCounts::get_num_bytes() const {
+		size_t bytes = _num_words * (sizeof(SparseCounts) + sizeof(int*));
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			if(_dense_counts[word_id] != NULL){
+				bytes += sizeof(int) * (_num_tags + 1);
+				continue;
+			}
+			bytes += _sparse_counts[word_id].capacity() * sizeof(std::pair<int, int>);
+		}
+		return bytes;
+	}
+}
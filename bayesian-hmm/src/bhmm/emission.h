@@ -0,0 +1,97 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "common.h"
+
+namespace bhmm {
+	// 品詞と単語のペアの出現頻度
+	// 単語ごとに(品詞, 頻度)の疎なリストを品詞の昇順で持つ
+	// 多くの品詞と共起する高頻度語だけは密な配列に切り替える
+	class EmissionCounts {
+	private:
+		EmissionCounts(const EmissionCounts &);
+		EmissionCounts &operator=(const EmissionCounts &);
+		void _promote_to_dense(id word_id);
+	public:
+		typedef std::vector<std::pair<int, int>> SparseCounts;
+		int _num_tags;
+		id _num_words;
+		int _dense_threshold;			// 非ゼロの品詞数がこれを超えたら密な配列にする
+		SparseCounts* _sparse_counts;	// [word_id] -> (品詞, 頻度)のリスト
+		int** _dense_counts;			// [word_id] -> 長さ_num_tags + 1の配列. 疎な単語はNULL
+		EmissionCounts(int num_tags, id num_words);
+		~EmissionCounts();
+		void set(int tag, id word_id, int count);
+		void increment(int tag, id word_id);
+		void decrement(int tag, id word_id);
+		// 品詞数と単語数が同じものからコピーする
+		void copy_from(const EmissionCounts* counts);
+		void copy_word_from(const EmissionCounts* counts, id word_id);
+		bool is_dense(id word_id) const;
+		int get_num_nonzero_tags(id word_id) const;
+		size_t get_num_bytes() const;
+		// counts[1..num_tags]に単語word_idの各品詞の頻度を書き込む
+		void get_counts_of_word(id word_id, int* counts) const;
+		// 単語word_idの頻度をまとめて設定する. tagsは昇順
+		void assign_word(id word_id, const int* tags, const int* counts, int num_nonzero);
+		// 全単語の非ゼロ要素を単語IDの順に連結する
+		// 単語word_idの要素はtags[offsets[word_id]]からtags[offsets[word_id + 1] - 1]まで
+		void export_csr(std::vector<uint64_t> &offsets, std::vector<int> &tags, std::vector<int> &counts) const;
+		// words_of_tag[tag]に(単語ID, 頻度)のリストを作る
+		void enumerate_words_of_each_tag(std::vector<SparseCounts> &words_of_tag) const;
+		inline int get(int tag, id word_id) const {
+			assert(1 <= tag && tag <= _num_tags);
+			assert(0 <= word_id && word_id < _num_words);
+			if(_dense_counts[word_id] != NULL){
+				return _dense_counts[word_id][tag];
+			}
+			for(const auto &pair: _sparse_counts[word_id]){
+				if(pair.first == tag){
+					return pair.second;
+				}
+				if(pair.first > tag){
+					break;
+				}
+			}
+			return 0;
+		}
+		// 非ゼロの要素だけを書き出す
+		template <class Archive>
+		void save(Archive &ar) const {
+			for(id word_id = 0;word_id < _num_words;word_id++){
+				int num_nonzero = get_num_nonzero_tags(word_id);
+				ar & num_nonzero;
+				if(_dense_counts[word_id] != NULL){
+					for(int tag = 1;tag <= _num_tags;tag++){
+						int count = _dense_counts[word_id][tag];
+						if(count > 0){
+							ar & tag;
+							ar & count;
+						}
+					}
+					continue;
+				}
+				for(const auto &pair: _sparse_counts[word_id]){
+					ar & pair.first;
+					ar & pair.second;
+				}
+			}
+		}
+		template <class Archive>
+		void load(Archive &ar){
+			for(id word_id = 0;word_id < _num_words;word_id++){
+				int num_nonzero = 0;
+				ar & num_nonzero;
+				for(int n = 0;n < num_nonzero;n++){
+					int tag = 0;
+					int count = 0;
+					ar & tag;
+					ar & count;
+					set(tag, word_id, count);
+				}
+			}
+		}
+	};
+}
@@ -3,64 +3,145 @@
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/unordered_map.hpp>
 #include <boost/serialization/split_free.hpp>
+#include <boost/serialization/array.hpp>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include "binary.h"
 #include "hmm.h"
 #include "sampler.h"
+#include "kernel.h"
 #include "utils.h"
 
 namespace bhmm {
 	HMM::HMM(){
-
-	}
-	HMM::HMM(int num_tags, int num_words){
-		assert(num_tags > 0);
-		assert(num_words > 0);
 		_trigram_counts = NULL;
 		_bigram_counts = NULL;
 		_unigram_counts = NULL;
+		_tag_word_counts = NULL;
 		_sampling_table = NULL;
+		_tag_counts_of_word = NULL;
+		_trigram_row = NULL;
+		_score_factors = NULL;
+		_emission_denominators = NULL;
+		_emission_denominators_inv = NULL;
+		_transition_denominators = NULL;
+		_transition_denominators_inv = NULL;
+		_denominator_caches_valid = false;
+		_blocked_transitions = NULL;
+		_blocked_transition_row = NULL;
+		_blocked_emissions = NULL;
+		_blocked_forward_table = NULL;
+		_blocked_forward_table_length = 0;
 		_Wt = NULL;
-		_num_tags = num_tags;
-		_num_words = num_words;
-		_alpha = 0.003;
+		_all_tags = NULL;
+		_tag_dictionary = NULL;
 		_beta = NULL;
+		_num_tags = -1;
+		_num_words = -1;
+		_alpha = 0.003;
 		_temperature = 1;
 		_minimum_temperature = 1;
+		_log_p_joint_delta = 0;
+		_track_log_p_joint = false;
+	}
+	HMM::HMM(int num_tags, int num_words): HMM(){
+		assert(num_tags > 0);
+		assert(num_words > 0);
+		_num_tags = num_tags;
+		_num_words = num_words;
 		_alloc_count_tables(_num_tags, _num_words);
 	}
 	HMM::~HMM(){
-		for(int tag_2 = 0;tag_2 <= _num_tags;tag_2++){
-			for(int tag_1 = 0;tag_1 <= _num_tags;tag_1++){
-				delete[] _trigram_counts[tag_2][tag_1];
-			}
-			delete[] _trigram_counts[tag_2];
-		}
-		delete[] _trigram_counts;
-		for(int tag_1 = 0;tag_1 <= _num_tags;tag_1++){
-			delete[] _bigram_counts[tag_1];
-		}
-		for(int tag = 0;tag <= _num_tags;tag++){
-			delete[] _tag_word_counts[tag];
-		}
-		delete[] _tag_word_counts;
-		delete[] _bigram_counts;
-		delete[] _unigram_counts;
-		delete[] _sampling_table;
+		delete _trigram_counts;
+		delete _bigram_counts;
+		delete _unigram_counts;
+		delete _tag_word_counts;
+		free_sampling_tables();
 		delete[] _beta;
 		delete[] _Wt;
+		delete[] _all_tags;
+		delete _tag_dictionary;
 	}
 	void HMM::anneal_temperature(double decay){
 		_temperature -= decay;
 		_temperature = std::max(_temperature, _minimum_temperature);
 	}
-	void HMM::initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset, std::vector<int> &Wt){
+	void HMM::initialize_with_training_dataset(WordSequences &dataset, std::vector<int> &Wt){
 		int length = Wt.size();
 		assert(length == _num_tags);
 		_init_ngram_counts_with_corpus(dataset);
 		for(int tag = 1;tag <= length;tag++){
 			set_Wt_for_tag(tag, Wt[tag - 1]);
 		}
+		invalidate_denominator_caches();
+	}
+	// カウントとハイパーパラメータを全てコピーする
+	// 並列サンプリング用のスレッドごとの複製に使う
+	void HMM::copy_from(const HMM* hmm){
+		assert(hmm->_num_tags > 0);
+		assert(hmm->_num_words > 0);
+		if(_num_tags != hmm->_num_tags || _num_words != hmm->_num_words || _tag_word_counts == NULL){
+			free_sampling_tables();
+			_free_count_tables();
+			_num_tags = hmm->_num_tags;
+			_num_words = hmm->_num_words;
+			_Wt = new int[_num_tags + 1];
+			_all_tags = new int[_num_tags];
+			for(int k = 0;k < _num_tags;k++){
+				_all_tags[k] = k + 1;
+			}
+			_beta = new double[_num_tags + 1];
+			_trigram_counts = new TrigramCounts();
+			_bigram_counts = new Tensor();
+			_unigram_counts = new Tensor();
+			_tag_word_counts = new EmissionCounts(_num_tags, _num_words);
+		}
+		for(int tag = 0;tag <= _num_tags;tag++){
+			_Wt[tag] = hmm->_Wt[tag];
+			_beta[tag] = hmm->_beta[tag];
+		}
+		_alpha = hmm->_alpha;
+		_temperature = hmm->_temperature;
+		_minimum_temperature = hmm->_minimum_temperature;
+		_trigram_counts->copy_from(hmm->_trigram_counts);
+		_bigram_counts->copy_from(hmm->_bigram_counts);
+		_unigram_counts->copy_from(hmm->_unigram_counts);
+		_tag_word_counts->copy_from(hmm->_tag_word_counts);
+		_num_words_of_tag = hmm->_num_words_of_tag;
+		if(hmm->_tag_dictionary == NULL){
+			delete _tag_dictionary;
+			_tag_dictionary = NULL;
+		}else{
+			if(_tag_dictionary == NULL){
+				_tag_dictionary = new TagDictionary();
+			}
+			_tag_dictionary->copy_from(hmm->_tag_dictionary);
+		}
+		invalidate_denominator_caches();
+	}
+	// データセットの品詞の割り当てからカウントを数え直す
+	// 変分ベイズEMで書き込んだ期待カウントからGibbsサンプリングに戻る時に使う
+	void HMM::count_assignments(WordSequences &dataset){
+		delete _trigram_counts;
+		_trigram_counts = new TrigramCounts(_num_tags);
+		_bigram_counts->fill(0);
+		_unigram_counts->fill(0);
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			_tag_word_counts->assign_word(word_id, NULL, NULL, 0);
+		}
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			for(int i = 2;i < sentence.size();i++){
+				_increment_tag_trigram_count(sentence.get_state(i - 2), sentence.get_state(i - 1), sentence.get_state(i));
+				if(i < sentence.size() - 2){
+					_increment_tag_word_count(sentence.get_state(i), sentence.get_word_id(i));
+				}
+			}
+		}
+		_num_words_of_tag.clear();
+		invalidate_denominator_caches();
 	}
 	void HMM::_alloc_count_tables(int num_tags, int num_words){
 		assert(num_tags > 0);
@@ -70,69 +151,85 @@ namespace bhmm {
 		for(int tag = 0;tag <= num_tags;tag++){
 			_Wt[tag] = 0;
 		}
+		_all_tags = new int[num_tags];
+		for(int k = 0;k < num_tags;k++){
+			_all_tags[k] = k + 1;
+		}
 		// Betaの初期化
 		// 初期値は1
 		_beta = new double[num_tags + 1];
 		for(int tag = 0;tag <= num_tags;tag++){
 			_beta[tag] = 1;
 		}
-		// 3-gram		
-		_trigram_counts = new int**[num_tags + 1];
-		for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
-			_trigram_counts[tag_2] = new int*[num_tags + 1];
-			for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-				_trigram_counts[tag_2][tag_1] = new int[num_tags + 1];
-				for(int tag = 0;tag <= num_tags;tag++){
-					_trigram_counts[tag_2][tag_1][tag] = 0;
-				}
-			}
-		}
+		// 各テーブルは0で初期化される
+		// 3-gram
+		_trigram_counts = new TrigramCounts(num_tags);
 		// 2-gram
-		_bigram_counts = new int*[num_tags + 1];
-		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-			_bigram_counts[tag_1] = new int[num_tags + 1];
-			for(int tag = 0;tag <= num_tags;tag++){
-				_bigram_counts[tag_1][tag] = 0;
-			}
-		}
+		_bigram_counts = new Tensor(num_tags + 1, num_tags + 1);
 		// 1-gram
-		_unigram_counts = new int[num_tags + 1];
-		for(int tag = 0;tag <= num_tags;tag++){
-			_unigram_counts[tag] = 0;
-		}
+		_unigram_counts = new Tensor(num_tags + 1);
 		// 単語-品詞ペアのカウント
-		_tag_word_counts = new int*[num_tags + 1];
-		for(int tag = 0;tag <= num_tags;tag++){
-			_tag_word_counts[tag] = new int[num_words];
-			for(id word = 0;word < num_words;word++){
-				_tag_word_counts[tag][word] = 0;
-			}
-		}
-
+		_tag_word_counts = new EmissionCounts(num_tags, num_words);
 	}
-	void HMM::_init_ngram_counts_with_corpus(std::vector<std::vector<Word*>> &dataset){
+	void HMM::_free_count_tables(){
+		delete[] _Wt;
+		delete[] _all_tags;
+		delete[] _beta;
+		delete _trigram_counts;
+		delete _bigram_counts;
+		delete _unigram_counts;
+		delete _tag_word_counts;
+		_Wt = NULL;
+		_all_tags = NULL;
+		_beta = NULL;
+		_trigram_counts = NULL;
+		_bigram_counts = NULL;
+		_unigram_counts = NULL;
+		_tag_word_counts = NULL;
+	}
+	void HMM::_init_ngram_counts_with_corpus(WordSequences &dataset){
 		// 最初は品詞をランダムに割り当てる
 		assert(_num_tags != -1);
 		// std::unordered_map<int, int> tag_for_word;
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			std::vector<Word*> &word_vec = dataset[data_index];
-			for(int i = 2;i < word_vec.size();i++){	// 3-gramなので3番目から.
-				Word* word = word_vec[i];
-				int state = sampler::uniform_int(1, _num_tags);
+			Sentence sentence = dataset.get_sentence(data_index);
+			id* word_ids = sentence._word_ids;
+			int* states = sentence._states;
+			for(int i = 2;i < sentence.size();i++){	// 3-gramなので3番目から.
+				int state = 0;
+				if(i < sentence.size() - 2){
+					// 取りうる品詞の中から選ぶ
+					const int* tags = NULL;
+					int num_tags_of_word = get_allowed_tags(word_ids[i], tags);
+					state = tags[(int)sampler::uniform_int(0, num_tags_of_word - 1)];
+				}else{
+					state = sampler::uniform_int(1, _num_tags);
+				}
 				assert(1 <= state && state <= _num_tags);
-				word->_state = state;
-				_increment_tag_trigram_count_by_words(word_vec[i - 2], word_vec[i - 1], word_vec[i]);
-				if(i < word_vec.size() - 2){
+				states[i] = state;
+				_increment_tag_trigram_count(states[i - 2], states[i - 1], states[i]);
+				if(i < sentence.size() - 2){
 					// 同じタグの単語集合をカウント
-					_increment_tag_word_count(word->_state, word->_id);
+					_increment_tag_word_count(states[i], word_ids[i]);
 				}
 			}
 		}
+		invalidate_denominator_caches();
 	}
 	void HMM::set_Wt_for_tag(int tag_id, int number){
 		assert(_Wt != NULL);
 		assert(1 <= tag_id && tag_id <= _num_tags);
 		_Wt[tag_id] = number;
+		invalidate_denominator_caches();
+	}
+	// 初期化の前に設定すると最初の品詞の割り当ても一覧の中から選ぶ
+	// 所有権はHMMに移る
+	void HMM::set_tag_dictionary(TagDictionary* dictionary){
+		assert(dictionary == NULL || dictionary->_num_tags == _num_tags);
+		if(dictionary != _tag_dictionary){
+			delete _tag_dictionary;
+		}
+		_tag_dictionary = dictionary;
 	}
 	void HMM::set_num_tags(int n){
 		assert(n > 0);
@@ -140,56 +237,160 @@ namespace bhmm {
 	}
 	void HMM::set_alpha(double alpha){
 		_alpha = alpha;
+		invalidate_denominator_caches();
 	}
 	void HMM::set_beta(double beta){
 		for(int tag = 1;tag <= _num_tags;tag++){
 			_beta[tag] = beta;
 		}
+		invalidate_denominator_caches();
+	}
+	// alpha, beta, Wtを直接書き換えた場合は必ず呼ぶ
+	void HMM::invalidate_denominator_caches(){
+		_denominator_caches_valid = false;
+	}
+	void HMM::_update_denominator_caches(){
+		if(_emission_denominators == NULL){
+			_emission_denominators = new double[_num_tags + 1];
+			_emission_denominators_inv = new double[_num_tags + 1];
+			_transition_denominators = new double[(_num_tags + 1) * (_num_tags + 1)];
+			_transition_denominators_inv = new double[(_num_tags + 1) * (_num_tags + 1)];
+		}
+		for(int tag = 1;tag <= _num_tags;tag++){
+			_update_emission_denominator(tag);
+		}
+		for(int tag_1 = 0;tag_1 <= _num_tags;tag_1++){
+			for(int tag = 0;tag <= _num_tags;tag++){
+				_update_transition_denominator(tag_1, tag);
+			}
+		}
+		_denominator_caches_valid = true;
+	}
+	void HMM::_update_emission_denominator(int tag){
+		double n_ti = _unigram_counts->at(tag);
+		double W_ti = _Wt[tag];
+		double denominator = n_ti + W_ti * _beta[tag];
+		_emission_denominators[tag] = denominator;
+		_emission_denominators_inv[tag] = 1.0 / denominator;
 	}
-	void HMM::_increment_tag_trigram_count_by_words(Word* wi_2, Word* wi_1, Word* wi){
-		assert(wi != NULL);
-		assert(wi_1 != NULL);
-		assert(wi_2 != NULL);
-		_unigram_counts[wi->_state] += 1;
-		_bigram_counts[wi_1->_state][wi->_state] += 1;
-		_trigram_counts[wi_2->_state][wi_1->_state][wi->_state] += 1;
+	void HMM::_update_transition_denominator(int tag_1, int tag){
+		double n_ti_1_ti = _bigram_counts->at(tag_1, tag);
+		double denominator = n_ti_1_ti + _num_tags * _alpha;
+		int index = tag_1 * (_num_tags + 1) + tag;
+		_transition_denominators[index] = denominator;
+		_transition_denominators_inv[index] = 1.0 / denominator;
+	}
+	void HMM::_increment_tag_trigram_count(int ti_2, int ti_1, int ti){
+		_unigram_counts->at(ti) += 1;
+		_bigram_counts->at(ti_1, ti) += 1;
+		_trigram_counts->increment(ti_2, ti_1, ti);
 	}
 	void HMM::_increment_tag_word_count(int tag, id word_id){
 		assert(1 <= tag && tag <= _num_tags);
 		assert(0 <= word_id && word_id < _num_words);
-		_tag_word_counts[tag][word_id] += 1;
+		_tag_word_counts->increment(tag, word_id);
 	}
 	void HMM::_decrement_tag_word_count(int tag, int word_id){
 		assert(1 <= tag && tag <= _num_tags);
 		assert(0 <= word_id && word_id < _num_words);
-		_tag_word_counts[tag][word_id] -= 1;
-		assert(_tag_word_counts[tag][word_id] >= 0);
+		_tag_word_counts->decrement(tag, word_id);
 	}
 	int HMM::get_count_of_tag_word(int tag, id word_id){
 		assert(1 <= tag && tag <= _num_tags);
 		assert(0 <= word_id && word_id < _num_words);
-		return _tag_word_counts[tag][word_id];
+		return _tag_word_counts->get(tag, word_id);
 	}
-	double HMM::compute_log_p_t_given_alpha(std::vector<Word*> &word_vec, double alpha){
+	double HMM::compute_log_p_t_given_alpha(Sentence &sentence, double alpha){
+		int* states = sentence._states;
 		double log_Pt_alpha = 0;
-		for(int i = 2;i < word_vec.size() - 2;i++){	// <bos>と<eos>の内側だけ考える
-			int ti_2 = word_vec[i - 2]->_state;
-			int ti_1 = word_vec[i - 1]->_state;
-			int ti = word_vec[i]->_state;
-			double n_ti_2_ti_1_ti = _trigram_counts[ti_2][ti_1][ti];
-			double n_ti_2_ti_1 = _bigram_counts[ti_2][ti_1];
+		for(int i = 2;i < sentence.size() - 2;i++){	// <bos>と<eos>の内側だけ考える
+			int ti_2 = states[i - 2];
+			int ti_1 = states[i - 1];
+			int ti = states[i];
+			double n_ti_2_ti_1_ti = _trigram_counts->get(ti_2, ti_1, ti);
+			double n_ti_2_ti_1 = _bigram_counts->at(ti_2, ti_1);
 			double Pt_i_alpha = (n_ti_2_ti_1_ti + alpha) / (n_ti_2_ti_1 + _num_tags * alpha);
 			log_Pt_alpha += log(Pt_i_alpha);
 		}
 		return log_Pt_alpha;
 	}
+	// 品詞と単語の割り当て全体の同時確率log p(t, w)
+	// 遷移と出力のパラメータを積分消去したディリクレ-多項分布の積をカウントから計算する
+	// 非ゼロのカウントだけを見るので1回あたり非ゼロ要素数と単語数に比例する
+	double HMM::compute_log_p_joint(){
+		int size = _num_tags + 1;
+		std::vector<int> context_counts(size * size, 0);	// [t_2 * (T + 1) + t_1] Σ_t n_{t_2,t_1,t}
+		double log_p = 0;
+		double lgamma_alpha = lgamma(_alpha);
+		auto add_trigram = [&](int t_2, int t_1, int count){
+			context_counts[t_2 * size + t_1] += count;
+			log_p += lgamma(count + _alpha) - lgamma_alpha;
+		};
+		if(_trigram_counts->is_dense()){
+			for(int t_2 = 0;t_2 <= _num_tags;t_2++){
+				for(int t_1 = 0;t_1 <= _num_tags;t_1++){
+					for(int t = 0;t <= _num_tags;t++){
+						int count = _trigram_counts->_dense->at(t_2, t_1, t);
+						if(count > 0){
+							add_trigram(t_2, t_1, count);
+						}
+					}
+				}
+			}
+		}else{
+			for(size_t slot = 0;slot < _trigram_counts->_capacity;slot++){
+				uint64_t key = _trigram_counts->_keys[slot];
+				int count = _trigram_counts->_values[slot];
+				if(key == BHMM_TRIGRAM_EMPTY_KEY || count == 0){
+					continue;
+				}
+				int t_2, t_1, t;
+				_trigram_counts->unpack(key, t_2, t_1, t);
+				add_trigram(t_2, t_1, count);
+			}
+		}
+		double lgamma_sum_alpha = lgamma(_num_tags * _alpha);
+		for(int count: context_counts){
+			if(count > 0){
+				log_p += lgamma_sum_alpha - lgamma(count + _num_tags * _alpha);
+			}
+		}
+		std::vector<int> tag_counts(size, 0);
+		std::vector<double> lgamma_beta(size, 0);
+		for(int tag = 1;tag <= _num_tags;tag++){
+			lgamma_beta[tag] = lgamma(_beta[tag]);
+		}
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			int* dense_counts = _tag_word_counts->_dense_counts[word_id];
+			if(dense_counts != NULL){
+				for(int tag = 1;tag <= _num_tags;tag++){
+					if(dense_counts[tag] > 0){
+						tag_counts[tag] += dense_counts[tag];
+						log_p += lgamma(dense_counts[tag] + _beta[tag]) - lgamma_beta[tag];
+					}
+				}
+				continue;
+			}
+			for(const auto &pair: _tag_word_counts->_sparse_counts[word_id]){
+				if(pair.second > 0){
+					tag_counts[pair.first] += pair.second;
+					log_p += lgamma(pair.second + _beta[pair.first]) - lgamma_beta[pair.first];
+				}
+			}
+		}
+		for(int tag = 1;tag <= _num_tags;tag++){
+			log_p += lgamma(_Wt[tag] * _beta[tag]) - lgamma(tag_counts[tag] + _Wt[tag] * _beta[tag]);
+		}
+		_num_words_of_tag = tag_counts;		// ここからgibbsで差分を追えるようになる
+		return log_p;
+	}
 	double HMM::compute_p_wi_given_ti(id wi, int ti){
 		return compute_p_wi_given_ti_beta(wi, ti, _beta[ti]);
 	}
 	double HMM::compute_p_wi_given_ti_beta(id wi, int ti, double beta){
 		assert(1 <= ti && ti <= _num_tags);
 		double n_ti_wi = get_count_of_tag_word(ti, wi);
-		double n_ti = _unigram_counts[ti];
+		double n_ti = _unigram_counts->at(ti);
 		double W_ti = _Wt[ti];
 		return (n_ti_wi + beta) / (n_ti + W_ti * beta);
 	}
@@ -197,115 +398,650 @@ namespace bhmm {
 		return compute_p_ti_given_t_alpha(ti, ti_1, ti_2, _alpha);
 	}
 	double HMM::compute_p_ti_given_t_alpha(int ti, int ti_1, int ti_2, double alpha){
-		double n_ti_2_ti_1_ti = _trigram_counts[ti_2][ti_1][ti];
-		double n_ti_2_ti_1 = _bigram_counts[ti_2][ti_1];
+		double n_ti_2_ti_1_ti = _trigram_counts->get(ti_2, ti_1, ti);
+		double n_ti_2_ti_1 = _bigram_counts->at(ti_2, ti_1);
 		return (n_ti_2_ti_1_ti + alpha) / (n_ti_2_ti_1 + _num_tags * alpha);
 	}
 	// in:  t_{i-2},t_{i-1},ti,t_{i+1},t_{i+2},w_i
 	void HMM::_add_tag_trigram_to_model(int ti_2, int ti_1, int ti, int ti1, int ti2, int wi){
 		assert(1 <= ti && ti <= _num_tags);
 		// 1-gram
-		_unigram_counts[ti] += 1;
+		_unigram_counts->at(ti) += 1;
 		// 2-gram
-		_bigram_counts[ti_1][ti] += 1;
-		_bigram_counts[ti][ti1] += 1;
+		_bigram_counts->at(ti_1, ti) += 1;
+		_bigram_counts->at(ti, ti1) += 1;
 		// 3-gram
-		_trigram_counts[ti_2][ti_1][ti] += 1;
-		_trigram_counts[ti_1][ti][ti1] += 1;
-		_trigram_counts[ti][ti1][ti2] += 1;
+		_trigram_counts->increment(ti_2, ti_1, ti);
+		_trigram_counts->increment(ti_1, ti, ti1);
+		_trigram_counts->increment(ti, ti1, ti2);
 		// 品詞-単語ペア
 		_increment_tag_word_count(ti, wi);
+		// 分母のキャッシュ
+		if(_denominator_caches_valid){
+			_update_emission_denominator(ti);
+			_update_transition_denominator(ti_1, ti);
+			_update_transition_denominator(ti, ti1);
+		}
 	}
 	// in:  t_{i-2},t_{i-1},ti,t_{i+1},t_{i+2},w_i
 	void HMM::_remove_tag_trigram_from_model(int ti_2, int ti_1, int ti, int ti1, int ti2, int wi){
 		assert(1 <= ti && ti <= _num_tags);
 		// 1-gram
-		_unigram_counts[ti] -= 1;
-		assert(_unigram_counts[ti] >= 0);
+		_unigram_counts->at(ti) -= 1;
+		assert(_unigram_counts->at(ti) >= 0);
 		// 2-gram
-		_bigram_counts[ti_1][ti] -= 1;
-		assert(_bigram_counts[ti_1][ti] >= 0);
-		_bigram_counts[ti][ti1] -= 1;
-		assert(_bigram_counts[ti][ti1] >= 0);
+		_bigram_counts->at(ti_1, ti) -= 1;
+		assert(_bigram_counts->at(ti_1, ti) >= 0);
+		_bigram_counts->at(ti, ti1) -= 1;
+		assert(_bigram_counts->at(ti, ti1) >= 0);
 		// 3-gram
-		_trigram_counts[ti_2][ti_1][ti] -= 1;
-		assert(_trigram_counts[ti_2][ti_1][ti] >= 0);
-		_trigram_counts[ti_1][ti][ti1] -= 1;
-		assert(_trigram_counts[ti_1][ti][ti1] >= 0);
-		_trigram_counts[ti][ti1][ti2] -= 1;
-		assert(_trigram_counts[ti][ti1][ti2] >= 0);
+		_trigram_counts->decrement(ti_2, ti_1, ti);
+		_trigram_counts->decrement(ti_1, ti, ti1);
+		_trigram_counts->decrement(ti, ti1, ti2);
 		// 品詞-単語ペア
 		_decrement_tag_word_count(ti, wi);
+		// 分母のキャッシュ
+		if(_denominator_caches_valid){
+			_update_emission_denominator(ti);
+			_update_transition_denominator(ti_1, ti);
+			_update_transition_denominator(ti, ti1);
+		}
 	}
-	void HMM::gibbs(std::vector<Word*> &word_vec){
+	// サンプリング用のキャッシュを全て解放する
+	// 次に使う時に現在の品詞数で確保し直される
+	void HMM::free_sampling_tables(){
+		delete[] _sampling_table;
+		delete[] _tag_counts_of_word;
+		delete[] _trigram_row;
+		delete[] _score_factors;
+		delete[] _emission_denominators;
+		delete[] _emission_denominators_inv;
+		delete[] _transition_denominators;
+		delete[] _transition_denominators_inv;
+		delete[] _blocked_transitions;
+		delete[] _blocked_transition_row;
+		delete[] _blocked_emissions;
+		delete[] _blocked_forward_table;
+		_sampling_table = NULL;
+		_tag_counts_of_word = NULL;
+		_trigram_row = NULL;
+		_score_factors = NULL;
+		_emission_denominators = NULL;
+		_emission_denominators_inv = NULL;
+		_transition_denominators = NULL;
+		_transition_denominators_inv = NULL;
+		_blocked_transitions = NULL;
+		_blocked_transition_row = NULL;
+		_blocked_emissions = NULL;
+		_blocked_forward_table = NULL;
+		_blocked_forward_table_length = 0;
+		invalidate_denominator_caches();
+	}
+	void HMM::_alloc_sampling_tables(){
 		if(_sampling_table == NULL){
 			_sampling_table = new double[_num_tags + 1];
 		}
-		for(int i = 2;i < word_vec.size() - 2;i++){	// <s>と</s>の内側だけ考える
-			int ti_2 = word_vec[i - 2]->_state;
-			int ti_1 = word_vec[i - 1]->_state;
-			int ti = word_vec[i]->_state;
-			int wi = word_vec[i]->_id;
-			int ti1 = word_vec[i + 1]->_state;
-			int ti2 = word_vec[i + 2]->_state;
+		if(_tag_counts_of_word == NULL){
+			_tag_counts_of_word = new int[_num_tags + 1];
+		}
+		if(_trigram_row == NULL){
+			_trigram_row = new int[_num_tags + 1];
+		}
+		if(_score_factors == NULL){
+			_score_factors = new double[BHMM_NUM_SCORE_FACTORS * 2 * _num_tags];
+		}
+	}
+	// t_iを除いた状態で各品詞のスコアをscores[1..num_tags]に書き込む
+	void HMM::compute_tag_scores(int ti_2, int ti_1, int ti1, int ti2, id wi, double* scores){
+		_compute_tag_scores(ti_2, ti_1, ti1, ti2, wi, _all_tags, _num_tags, scores);
+	}
+	// tags[0..num_tags_of_word - 1]の品詞のスコアをscores[1..num_tags_of_word]に詰めて書き込む
+	// 比の分子と分母の逆数を品詞ごとに並べてカーネルでまとめて計算する
+	void HMM::_compute_tag_scores(int ti_2, int ti_1, int ti1, int ti2, id wi, const int* tags, int num_tags_of_word, double* scores){
+		_alloc_sampling_tables();
+		if(_denominator_caches_valid == false){
+			_update_denominator_caches();
+		}
+		// 走査する連続領域を先読み
+		_trigram_counts->prefetch(ti_2, ti_1);
+		_bigram_counts->prefetch(ti_1);
+		if(num_tags_of_word == _num_tags){
+			_tag_word_counts->get_counts_of_word(wi, _tag_counts_of_word);
+		}else{
+			for(int k = 0;k < num_tags_of_word;k++){
+				_tag_counts_of_word[tags[k]] = _tag_word_counts->get(tags[k], wi);
+			}
+		}
+		int stride = _num_tags;
+		double* numerator_w 	= _score_factors;
+		double* inverse_w 		= _score_factors + stride;
+		double* numerator_0 	= _score_factors + stride * 2;
+		double* inverse_0 		= _score_factors + stride * 3;
+		double* numerator_1 	= _score_factors + stride * 4;
+		double* inverse_1 		= _score_factors + stride * 5;
+		double* numerator_2 	= _score_factors + stride * 6;
+		double* inverse_2 		= _score_factors + stride * 7;
+		const int* trigram_ti_2_ti_1 = _trigram_counts->row(ti_2, ti_1, _trigram_row);
+		const double* transition_inv_ti_1 = _transition_denominators_inv + ti_1 * (_num_tags + 1);
+		double inv_ti_2_ti_1 = _transition_denominators_inv[ti_2 * (_num_tags + 1) + ti_1];
+		for(int k = 0;k < num_tags_of_word;k++){
+			int tag = tags[k];
+			double n_ti_wi = _tag_counts_of_word[tag];
+			// n.
+			double n_ti_2_ti_1_ti 	= trigram_ti_2_ti_1[tag];
+			double n_ti_1_ti_ti1 	= _trigram_counts->get(ti_1, tag, ti1);
+			double n_ti_ti1_ti2 	= _trigram_counts->get(tag, ti1, ti2);
+			// I(.)
+			double I_ti_2_ti_1_ti_ti1 			= (ti_2 == ti_1 == tag == ti1) ? 1 : 0;
+			double I_ti_2_ti_1_ti 				= (ti_2 == ti_1 == tag) ? 1 : 0;
+			double I_ti_2_ti_ti2_and_ti_1_ti1 	= (ti_2 == tag == ti2 && ti_1 == ti1) ? 1 : 0;
+			double I_ti_1_ti_ti1_ti2 			= (ti_1 == tag == ti1 == ti2) ? 1 : 0;
+			double I_ti_2_ti_and_ti_1_ti1 		= (ti_2 == tag && ti_1 == ti1) ? 1 : 0;
+			double I_ti_1_ti_ti1 				= (ti_1 == tag == ti1) ? 1 : 0;
+			// 比の分子と分母の逆数
+			// 分母に指示関数が足される場合のみ割り算する
+			numerator_w[k] 	= n_ti_wi + _beta[tag];
+			inverse_w[k] 	= _emission_denominators_inv[tag];
+			numerator_0[k] 	= n_ti_2_ti_1_ti + _alpha;
+			inverse_0[k] 	= inv_ti_2_ti_1;
+			numerator_1[k] 	= n_ti_1_ti_ti1 + I_ti_2_ti_1_ti_ti1 + _alpha;
+			if(I_ti_2_ti_1_ti == 0){
+				inverse_1[k] = transition_inv_ti_1[tag];
+			}else{
+				double n_ti_1_ti = _bigram_counts->at(ti_1, tag);
+				inverse_1[k] = 1.0 / (n_ti_1_ti + I_ti_2_ti_1_ti + _num_tags * _alpha);
+			}
+			numerator_2[k] 	= n_ti_ti1_ti2 + I_ti_2_ti_ti2_and_ti_1_ti1 + I_ti_1_ti_ti1_ti2 + _alpha;
+			if(I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 == 0){
+				inverse_2[k] = _transition_denominators_inv[tag * (_num_tags + 1) + ti1];
+			}else{
+				double n_ti_ti1 = _bigram_counts->at(tag, ti1);
+				inverse_2[k] = 1.0 / (n_ti_ti1 + I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 + _num_tags * _alpha);
+			}
+		}
+		kernel::compute_tag_scores(_score_factors, stride, num_tags_of_word, _temperature, scores + 1);
+	}
+	// 参照用のスカラー実装
+	void HMM::compute_tag_scores_scalar(int ti_2, int ti_1, int ti1, int ti2, id wi, double* scores){
+		for(int tag = 1;tag <= _num_tags;tag++){
+			scores[tag] = 1;
+			double n_ti_wi = get_count_of_tag_word(tag, wi);
+			double W_ti = _Wt[tag];
+			// n.
+			double n_ti_2_ti_1_ti 	= _trigram_counts->get(ti_2, ti_1, tag);
+			double n_ti_2_ti_1 		= _bigram_counts->at(ti_2, ti_1);
+			double n_ti_1_ti_ti1 	= _trigram_counts->get(ti_1, tag, ti1);
+			double n_ti_1_ti 		= _bigram_counts->at(ti_1, tag);
+			double n_ti 			= _unigram_counts->at(tag);
+			double n_ti_ti1_ti2 	= _trigram_counts->get(tag, ti1, ti2);
+			double n_ti_ti1 		= _bigram_counts->at(tag, ti1);
+			// I(.)
+			double I_ti_2_ti_1_ti_ti1 			= (ti_2 == ti_1 == tag == ti1) ? 1 : 0;
+			double I_ti_2_ti_1_ti 				= (ti_2 == ti_1 == tag) ? 1 : 0;
+			double I_ti_2_ti_ti2_and_ti_1_ti1 	= (ti_2 == tag == ti2 && ti_1 == ti1) ? 1 : 0;
+			double I_ti_1_ti_ti1_ti2 			= (ti_1 == tag == ti1 == ti2) ? 1 : 0;
+			double I_ti_2_ti_and_ti_1_ti1 		= (ti_2 == tag && ti_1 == ti1) ? 1 : 0;
+			double I_ti_1_ti_ti1 				= (ti_1 == tag == ti1) ? 1 : 0;
+			// 確率を計算
+			scores[tag] *= (n_ti_wi + _beta[tag]) / (n_ti + W_ti * _beta[tag]);
+			scores[tag] *= (n_ti_2_ti_1_ti + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha);
+			scores[tag] *= (n_ti_1_ti_ti1 + I_ti_2_ti_1_ti_ti1 + _alpha) / (n_ti_1_ti + I_ti_2_ti_1_ti + _num_tags * _alpha);
+			scores[tag] *= (n_ti_ti1_ti2 + I_ti_2_ti_ti2_and_ti_1_ti1 + I_ti_1_ti_ti1_ti2 + _alpha) / (n_ti_ti1 + I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 + _num_tags * _alpha);
+			// アニーリング
+			scores[tag] = pow(scores[tag], 1.0 / _temperature);
+		}
+	}
+	// 位置iの品詞をtagにした時のlog p(w_i, t_i | 他の全ての割り当て). 位置iをモデルから除いた状態で呼ぶ
+	// compute_log_p_jointと同じく文脈の頻度は3-gramの行の和、品詞の頻度は品詞-単語ペアの和を使い、
+	// 3つの3-gramが同じカウントや文脈を共有する場合は先に足した分を数えに入れるので同時確率の比に正確に一致する
+	double HMM::_compute_log_p_position(int ti_2, int ti_1, int tag, int ti1, int ti2, id wi){
+		double log_p = log((_tag_word_counts->get(tag, wi) + _beta[tag]) / (_num_words_of_tag[tag] + _Wt[tag] * _beta[tag]));
+		int trigrams[3][3] = {{ti_2, ti_1, tag}, {ti_1, tag, ti1}, {tag, ti1, ti2}};
+		for(int k = 0;k < 3;k++){
+			int* trigram = trigrams[k];
+			int num_same_contexts = 0;
+			int num_same_trigrams = 0;
+			for(int j = 0;j < k;j++){
+				if(trigrams[j][0] == trigram[0] && trigrams[j][1] == trigram[1]){
+					num_same_contexts += 1;
+					num_same_trigrams += (trigrams[j][2] == trigram[2]) ? 1 : 0;
+				}
+			}
+			double n_trigram = _trigram_counts->get(trigram[0], trigram[1], trigram[2]) + num_same_trigrams;
+			const int* row = _trigram_counts->row(trigram[0], trigram[1], _trigram_row);
+			double n_context = num_same_contexts;
+			for(int t = 0;t <= _num_tags;t++){
+				n_context += row[t];
+			}
+			log_p += log((n_trigram + _alpha) / (n_context + _num_tags * _alpha));
+		}
+		return log_p;
+	}
+	void HMM::gibbs(Sentence &sentence){
+		gibbs(sentence, sampler::rng);
+	}
+	// 乱数生成器を指定する
+	// 並列サンプリングではスレッドごとに別の系列を使う
+	void HMM::gibbs(Sentence &sentence, sampler::Xoshiro256 &rng){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		_alloc_sampling_tables();
+		// 文の全ての位置の一様乱数を先にまとめて作る
+		_uniforms.resize(sentence.size());
+		rng.uniform(_uniforms.data(), sentence.size());
+		for(int i = 2;i < sentence.size() - 2;i++){	// <s>と</s>の内側だけ考える
+			int ti_2 = states[i - 2];
+			int ti_1 = states[i - 1];
+			int ti = states[i];
+			int wi = word_ids[i];
+			int ti1 = states[i + 1];
+			int ti2 = states[i + 2];
+			// 一覧で品詞が1つに決まる単語は変わらない
+			const int* tags = NULL;
+			int num_tags_of_word = get_allowed_tags(wi, tags);
+			if(num_tags_of_word == 1 && _tag_dictionary != NULL){
+				assert(ti == tags[0]);
+				continue;
+			}
 			// t_iをモデルパラメータから除去
 			_remove_tag_trigram_from_model(ti_2, ti_1, ti, ti1, ti2, wi);
 			// t_iを再サンプリング
+			_compute_tag_scores(ti_2, ti_1, ti1, ti2, wi, tags, num_tags_of_word, _sampling_table);
 			double sum_prob = 0;
 			int new_ti = 0;
-			for(int tag = 1;tag <= _num_tags;tag++){
-				_sampling_table[tag] = 1;
-				double n_ti_wi = get_count_of_tag_word(tag, wi);
-				double W_ti = _Wt[tag];
-				// n.
-				double n_ti_2_ti_1_ti 	= _trigram_counts[ti_2][ti_1][tag];
-				double n_ti_2_ti_1 		= _bigram_counts[ti_2][ti_1];
-				double n_ti_1_ti_ti1 	= _trigram_counts[ti_1][tag][ti1];
-				double n_ti_1_ti 		= _bigram_counts[ti_1][tag];
-				double n_ti 			= _unigram_counts[tag];
-				double n_ti_ti1_ti2 	= _trigram_counts[tag][ti1][ti2];
-				double n_ti_ti1 		= _bigram_counts[tag][ti1];
-				// I(.)
-				double I_ti_2_ti_1_ti_ti1 			= (ti_2 == ti_1 == tag == ti1) ? 1 : 0;
-				double I_ti_2_ti_1_ti 				= (ti_2 == ti_1 == tag) ? 1 : 0;
-				double I_ti_2_ti_ti2_and_ti_1_ti1 	= (ti_2 == tag == ti2 && ti_1 == ti1) ? 1 : 0;
-				double I_ti_1_ti_ti1_ti2 			= (ti_1 == tag == ti1 == ti2) ? 1 : 0;
-				double I_ti_2_ti_and_ti_1_ti1 		= (ti_2 == tag && ti_1 == ti1) ? 1 : 0;
-				double I_ti_1_ti_ti1 				= (ti_1 == tag == ti1) ? 1 : 0;
-				// 確率を計算
-				_sampling_table[tag] *= (n_ti_wi + _beta[tag]) / (n_ti + W_ti * _beta[tag]);
-				_sampling_table[tag] *= (n_ti_2_ti_1_ti + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha);
-				_sampling_table[tag] *= (n_ti_1_ti_ti1 + I_ti_2_ti_1_ti_ti1 + _alpha) / (n_ti_1_ti + I_ti_2_ti_1_ti + _num_tags * _alpha);
-				_sampling_table[tag] *= (n_ti_ti1_ti2 + I_ti_2_ti_ti2_and_ti_1_ti1 + I_ti_1_ti_ti1_ti2 + _alpha) / (n_ti_ti1 + I_ti_2_ti_and_ti_1_ti1 + I_ti_1_ti_ti1 + _num_tags * _alpha);
-				// アニーリング
-				_sampling_table[tag] = pow(_sampling_table[tag], 1.0 / _temperature);
-				sum_prob += _sampling_table[tag];
+			for(int k = 1;k <= num_tags_of_word;k++){
+				sum_prob += _sampling_table[k];
 			}
 			assert(sum_prob > 0);
 			double normalizer = 1.0 / sum_prob;
-			double bernoulli = sampler::uniform(0, 1);
+			double bernoulli = _uniforms[i];
 			double stack = 0;
-			for(int tag = 1;tag <= _num_tags;tag++){
-				stack += _sampling_table[tag] * normalizer;
+			for(int k = 1;k <= num_tags_of_word;k++){
+				stack += _sampling_table[k] * normalizer;
 				if(stack >= bernoulli){
-					new_ti = tag;
+					new_ti = tags[k - 1];
 					break;
 				}
 			}
 			assert(1 <= new_ti && new_ti <= _num_tags);
+			// 条件付き確率の比は同時確率の比なので、変わった位置だけ足せばlog p(t, w)を追える
+			if(new_ti != ti && _track_log_p_joint){
+				assert(_num_words_of_tag.size() == _num_tags + 1);
+				_num_words_of_tag[ti] -= 1;
+				_log_p_joint_delta += _compute_log_p_position(ti_2, ti_1, new_ti, ti1, ti2, wi) - _compute_log_p_position(ti_2, ti_1, ti, ti1, ti2, wi);
+				_num_words_of_tag[new_ti] += 1;
+			}
 			// 新しいt_iをモデルパラメータに追加
 			_add_tag_trigram_to_model(ti_2, ti_1, new_ti, ti1, ti2, wi);
-			word_vec[i]->_state = new_ti;
+			states[i] = new_ti;
+		}
+	}
+	// 位置iの品詞が関わる1-gram, 2-gram, 3-gramと品詞-単語ペアを足す
+	// 文の全ての位置を足すと_init_ngram_counts_with_corpusと同じ数え方になる
+	void HMM::_add_position_to_model(Sentence &sentence, int i){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		int ti_2 = states[i - 2];
+		int ti_1 = states[i - 1];
+		int ti = states[i];
+		_unigram_counts->at(ti) += 1;
+		_bigram_counts->at(ti_1, ti) += 1;
+		_trigram_counts->increment(ti_2, ti_1, ti);
+		if(i < sentence.size() - 2){
+			_increment_tag_word_count(ti, word_ids[i]);
+		}
+		if(_denominator_caches_valid){
+			if(ti > 0){
+				_update_emission_denominator(ti);
+			}
+			_update_transition_denominator(ti_1, ti);
+		}
+	}
+	void HMM::_remove_position_from_model(Sentence &sentence, int i){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		int ti_2 = states[i - 2];
+		int ti_1 = states[i - 1];
+		int ti = states[i];
+		_unigram_counts->at(ti) -= 1;
+		assert(_unigram_counts->at(ti) >= 0);
+		_bigram_counts->at(ti_1, ti) -= 1;
+		assert(_bigram_counts->at(ti_1, ti) >= 0);
+		_trigram_counts->decrement(ti_2, ti_1, ti);
+		if(i < sentence.size() - 2){
+			_decrement_tag_word_count(ti, word_ids[i]);
+		}
+		if(_denominator_caches_valid){
+			if(ti > 0){
+				_update_emission_denominator(ti);
+			}
+			_update_transition_denominator(ti_1, ti);
 		}
 	}
+	// 文を先頭から1つずつ足しながら周辺化した同時確率の対数を返す
+	// 文末の2つの位置の品詞は固定なので、その1-gramと2-gramはGibbsサンプリングと同じく先に数えておく
+	double HMM::_add_sentence_to_model(Sentence &sentence){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		int t_eos_1 = states[sentence.size() - 2];
+		int t_eos_2 = states[sentence.size() - 1];
+		_unigram_counts->at(t_eos_1) += 1;
+		_unigram_counts->at(t_eos_2) += 1;
+		_bigram_counts->at(t_eos_1, t_eos_2) += 1;
+		double log_p = 0;
+		for(int i = 2;i < sentence.size();i++){
+			int ti_2 = states[i - 2];
+			int ti_1 = states[i - 1];
+			int ti = states[i];
+			double n_ti_2_ti_1_ti = _trigram_counts->get(ti_2, ti_1, ti);
+			double n_ti_2_ti_1 = _bigram_counts->at(ti_2, ti_1);
+			if(i > 2){
+				n_ti_2_ti_1 -= 1;	// 位置i-1で足した2-gramは位置iの3-gramの文脈としてはまだ数えない
+			}
+			log_p += log((n_ti_2_ti_1_ti + _alpha) / (n_ti_2_ti_1 + _num_tags * _alpha));
+			if(i < sentence.size() - 2){
+				log_p += log(compute_p_wi_given_ti(word_ids[i], ti));
+			}
+			_add_position_to_model(sentence, i);
+		}
+		_unigram_counts->at(t_eos_1) -= 1;
+		_unigram_counts->at(t_eos_2) -= 1;
+		_bigram_counts->at(t_eos_1, t_eos_2) -= 1;
+		if(_denominator_caches_valid){
+			if(t_eos_1 > 0){
+				_update_emission_denominator(t_eos_1);
+			}
+			if(t_eos_2 > 0){
+				_update_emission_denominator(t_eos_2);
+			}
+			_update_transition_denominator(t_eos_1, t_eos_2);
+		}
+		return log_p;
+	}
+	void HMM::_remove_sentence_from_model(Sentence &sentence){
+		for(int i = 2;i < sentence.size();i++){
+			_remove_position_from_model(sentence, i);
+		}
+	}
+	// 現在のカウントを固定した時の品詞列の確率の対数
+	// 前向きアルゴリズムで使う提案分布と同じもの
+	double HMM::_compute_log_q_sentence(Sentence &sentence){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		double log_q = 0;
+		for(int i = 2;i < sentence.size();i++){
+			int ti_2 = states[i - 2];
+			int ti_1 = states[i - 1];
+			int ti = states[i];
+			log_q += log(compute_p_ti_given_t(ti, ti_1, ti_2));
+			if(i < sentence.size() - 2){
+				log_q += log(compute_p_wi_given_ti(word_ids[i], ti));
+			}
+		}
+		return log_q;
+	}
+	void HMM::_alloc_blocked_tables(int sentence_length){
+		_alloc_sampling_tables();
+		int size = _num_tags + 1;
+		// 遷移の表は3-gramが密な時だけ持つ. ハッシュ表の時は使う行をその都度計算する
+		if(_trigram_counts->is_dense()){
+			if(_blocked_transitions == NULL){
+				_blocked_transitions = new double[size * size * size];
+			}
+		}else if(_blocked_transition_row == NULL){
+			_blocked_transition_row = new double[size];
+		}
+		if(_blocked_emissions == NULL){
+			_blocked_emissions = new double[size];
+		}
+		if(sentence_length > _blocked_forward_table_length){
+			delete[] _blocked_forward_table;
+			_blocked_forward_table = new double[sentence_length * size * size];
+			_blocked_forward_table_length = sentence_length;
+		}
+	}
+	// [t_2][t_1][t] = P(t | t_2, t_1)^(1 / temperature)
+	void HMM::_update_blocked_transitions(){
+		int size = _num_tags + 1;
+		for(int tag_2 = 0;tag_2 <= _num_tags;tag_2++){
+			for(int tag_1 = 0;tag_1 <= _num_tags;tag_1++){
+				_compute_blocked_transition_row(tag_2, tag_1, _blocked_transitions + (tag_2 * size + tag_1) * size);
+			}
+		}
+	}
+	// [t] = P(t | t_2, t_1)^(1 / temperature)
+	// カウントが0の品詞は全て同じ値になるので累乗は1度だけ計算する
+	void HMM::_compute_blocked_transition_row(int tag_2, int tag_1, double* transitions){
+		int size = _num_tags + 1;
+		const int* n_tag_2_tag_1 = _trigram_counts->row(tag_2, tag_1, _trigram_row);
+		double inverse = _transition_denominators_inv[tag_2 * size + tag_1];
+		if(_temperature == 1){
+			for(int tag = 0;tag <= _num_tags;tag++){
+				transitions[tag] = (n_tag_2_tag_1[tag] + _alpha) * inverse;
+			}
+			return;
+		}
+		double exponent = 1.0 / _temperature;
+		double unseen = pow(_alpha * inverse, exponent);
+		for(int tag = 0;tag <= _num_tags;tag++){
+			transitions[tag] = (n_tag_2_tag_1[tag] == 0) ? unseen : pow((n_tag_2_tag_1[tag] + _alpha) * inverse, exponent);
+		}
+	}
+	// [t] = P(w_i | t)^(1 / temperature)
+	void HMM::_update_blocked_emissions(id wi){
+		double exponent = 1.0 / _temperature;
+		_tag_word_counts->get_counts_of_word(wi, _tag_counts_of_word);
+		_blocked_emissions[0] = 0;
+		for(int tag = 1;tag <= _num_tags;tag++){
+			double p_wi_given_ti = (_tag_counts_of_word[tag] + _beta[tag]) * _emission_denominators_inv[tag];
+			_blocked_emissions[tag] = (_temperature == 1) ? p_wi_given_ti : pow(p_wi_given_ti, exponent);
+		}
+	}
+	int HMM::_sample_from(double* weights, int begin, int end, sampler::Xoshiro256 &rng){
+		double sum = 0;
+		for(int k = begin;k < end;k++){
+			sum += weights[k];
+		}
+		assert(sum > 0);
+		double bernoulli = rng.uniform() * sum;
+		double stack = 0;
+		for(int k = begin;k < end;k++){
+			stack += weights[k];
+			if(stack >= bernoulli){
+				return k;
+			}
+		}
+		// 丸め誤差で届かなかった場合は最後の非ゼロ要素
+		for(int k = end - 1;k >= begin;k--){
+			if(weights[k] > 0){
+				return k;
+			}
+		}
+		return begin;
+	}
+	bool HMM::blocked_gibbs(Sentence &sentence){
+		return blocked_gibbs(sentence, sampler::rng);
+	}
+	// 文単位のブロック化Gibbsサンプリング
+	// 文をカウントから取り除き、残りのカウントを固定した2次のHMMで
+	// (t_{i-1}, t_i)の前向き確率を計算して品詞列全体を後ろから一度にサンプリングする
+	// 文の中でのカウントの変化は無視しているので、Metropolis-Hastings法で補正して採択するかを決める
+	// 採択した場合はtrueを返す
+	bool HMM::blocked_gibbs(Sentence &sentence, sampler::Xoshiro256 &rng){
+		id* word_ids = sentence._word_ids;
+		int* states = sentence._states;
+		int length = sentence.size();
+		assert(length > 4);		// <s>と</s>それぞれ2つづつ
+		_alloc_blocked_tables(length);
+		if(_denominator_caches_valid == false){
+			_update_denominator_caches();
+		}
+		int size = _num_tags + 1;
+		int table_size = size * size;
+		int last = length - 3;	// 最後の単語の位置
+		// 文頭と文末の2つの位置の品詞は固定
+		int t_bos_2 = states[0];
+		int t_bos_1 = states[1];
+		int t_eos_1 = states[last + 1];
+		int t_eos_2 = states[last + 2];
+		std::vector<int> old_states(length);
+		for(int i = 0;i < length;i++){
+			old_states[i] = states[i];
+		}
+		_remove_sentence_from_model(sentence);
+		if(_trigram_counts->is_dense()){
+			_update_blocked_transitions();
+		}
+		// 前向き確率
+		// forward_table[i][t_{i-1}][t_i]を位置ごとに正規化して持つ
+		double* forward_table = _blocked_forward_table;
+		double* table = forward_table + 2 * table_size;
+		std::fill(table, table + table_size, 0);
+		_update_blocked_emissions(word_ids[2]);
+		// 各位置では単語が取りうる品詞だけを見る. それ以外の前向き確率は0のまま
+		double* cell_bos = table + t_bos_1 * size;
+		const double* transitions_bos = _get_blocked_transition_row(t_bos_2, t_bos_1);
+		const int* tags = NULL;
+		int num_tags_of_word = get_allowed_tags(word_ids[2], tags);
+		double sum = 0;
+		for(int k = 0;k < num_tags_of_word;k++){
+			int tag = tags[k];
+			cell_bos[tag] = transitions_bos[tag] * _blocked_emissions[tag];
+			sum += cell_bos[tag];
+		}
+		assert(sum > 0);
+		for(int k = 0;k < num_tags_of_word;k++){
+			cell_bos[tags[k]] /= sum;
+		}
+		for(int i = 3;i <= last;i++){
+			double* prev_table = forward_table + (i - 1) * table_size;
+			table = forward_table + i * table_size;
+			std::fill(table, table + table_size, 0);
+			_update_blocked_emissions(word_ids[i]);
+			const int* tags_2 = &t_bos_1;	// t_{i-2}が<s>かどうか
+			int num_tags_2 = 1;
+			if(i > 3){
+				num_tags_2 = get_allowed_tags(word_ids[i - 2], tags_2);
+			}
+			const int* tags_1 = NULL;
+			int num_tags_1 = get_allowed_tags(word_ids[i - 1], tags_1);
+			num_tags_of_word = get_allowed_tags(word_ids[i], tags);
+			sum = 0;
+			for(int a = 0;a < num_tags_1;a++){
+				int tag_1 = tags_1[a];
+				double* cell = table + tag_1 * size;
+				for(int b = 0;b < num_tags_2;b++){
+					int tag_2 = tags_2[b];
+					double alpha = prev_table[tag_2 * size + tag_1];
+					if(alpha == 0){
+						continue;
+					}
+					const double* transitions = _get_blocked_transition_row(tag_2, tag_1);
+					if(num_tags_of_word == _num_tags){
+						for(int tag = 1;tag <= _num_tags;tag++){
+							cell[tag] += alpha * transitions[tag];
+						}
+					}else{
+						for(int k = 0;k < num_tags_of_word;k++){
+							cell[tags[k]] += alpha * transitions[tags[k]];
+						}
+					}
+				}
+				for(int k = 0;k < num_tags_of_word;k++){
+					int tag = tags[k];
+					cell[tag] *= _blocked_emissions[tag];
+					sum += cell[tag];
+				}
+			}
+			assert(sum > 0);
+			double normalizer = 1.0 / sum;
+			for(int k = 0;k < table_size;k++){
+				table[k] *= normalizer;
+			}
+		}
+		// 文末の</s></s>への遷移を掛けて最後の2つの品詞をサンプリング
+		table = forward_table + last * table_size;
+		for(int tag_1 = 0;tag_1 <= _num_tags;tag_1++){
+			for(int tag = 1;tag <= _num_tags;tag++){
+				double p_eos = _get_blocked_transition(tag_1, tag, t_eos_1) * _get_blocked_transition(tag, t_eos_1, t_eos_2);
+				table[tag_1 * size + tag] *= p_eos;
+			}
+		}
+		int index = _sample_from(table, 0, table_size, rng);
+		states[last] = index % size;
+		if(last > 2){
+			states[last - 1] = index / size;
+		}
+		// 後ろ向きに1つずつサンプリング
+		for(int i = last - 2;i >= 2;i--){
+			int ti1 = states[i + 1];
+			int ti2 = states[i + 2];
+			double* next_table = forward_table + (i + 1) * table_size;
+			for(int tag = 1;tag <= _num_tags;tag++){
+				_sampling_table[tag] = next_table[tag * size + ti1] * _get_blocked_transition(tag, ti1, ti2);
+			}
+			states[i] = _sample_from(_sampling_table, 1, size, rng);
+		}
+		bool changed = false;
+		for(int i = 2;i <= last;i++){
+			assert(1 <= states[i] && states[i] <= _num_tags);
+			if(states[i] != old_states[i]){
+				changed = true;
+			}
+		}
+		if(changed == false){
+			_add_sentence_to_model(sentence);
+			return true;
+		}
+		// Metropolis-Hastings法
+		// 目標分布は文を1つずつ足した時の同時確率、提案分布はカウントを固定した時の確率
+		std::vector<int> new_states(length);
+		for(int i = 0;i < length;i++){
+			new_states[i] = states[i];
+		}
+		double log_q_new = _compute_log_q_sentence(sentence);
+		for(int i = 0;i < length;i++){
+			states[i] = old_states[i];
+		}
+		double log_q_old = _compute_log_q_sentence(sentence);
+		double log_p_old = _add_sentence_to_model(sentence);
+		_remove_sentence_from_model(sentence);
+		for(int i = 0;i < length;i++){
+			states[i] = new_states[i];
+		}
+		double log_p_new = _add_sentence_to_model(sentence);
+		double log_acceptance_rate = ((log_p_new - log_q_new) - (log_p_old - log_q_old)) / _temperature;
+		if(log_acceptance_rate >= 0 || rng.uniform() < exp(log_acceptance_rate)){
+			_num_words_of_tag.clear();		// gibbsを通らずに品詞が変わったので差分は追えない
+			return true;
+		}
+		// 棄却したら元に戻す
+		_remove_sentence_from_model(sentence);
+		for(int i = 0;i < length;i++){
+			states[i] = old_states[i];
+		}
+		_add_sentence_to_model(sentence);
+		return false;
+	}
 	int HMM::get_most_co_occurring_tag(int word_id){
+		assert(0 <= word_id && word_id < _num_words);
 		int max_count = 0;
 		int most_co_occurring_tag_id = 0;
-		for(int tag = 1;tag <= _num_tags;tag++){
-			int count = get_count_of_tag_word(tag, word_id);
-			if(count > max_count){
-				max_count = count;
-				most_co_occurring_tag_id = tag;
+		if(_tag_word_counts->is_dense(word_id)){
+			for(int tag = 1;tag <= _num_tags;tag++){
+				int count = _tag_word_counts->_dense_counts[word_id][tag];
+				if(count > max_count){
+					max_count = count;
+					most_co_occurring_tag_id = tag;
+				}
+			}
+			return most_co_occurring_tag_id;
+		}
+		// 非ゼロの品詞だけを見る
+		for(const auto &pair: _tag_word_counts->_sparse_counts[word_id]){
+			if(pair.second > max_count){
+				max_count = pair.second;
+				most_co_occurring_tag_id = pair.first;
 			}
 		}
 		return most_co_occurring_tag_id;
@@ -314,7 +1050,7 @@ namespace bhmm {
 		for(int tag_2 = 1;tag_2 <= _num_tags;tag_2++){
 			for(int tag_1 = 1;tag_1 <= _num_tags;tag_1++){
 				for(int tag = 1;tag <= _num_tags;tag++){
-					std::cout << (boost::format("3-gram [%d][%d][%d] = %d") % tag_2 % tag_1 % tag % _trigram_counts[tag_2][tag_1][tag]).str() << std::endl;
+					std::cout << (boost::format("3-gram [%d][%d][%d] = %d") % tag_2 % tag_1 % tag % _trigram_counts->get(tag_2, tag_1, tag)).str() << std::endl;
 				}
 			}
 		}
@@ -322,13 +1058,13 @@ namespace bhmm {
 	void HMM::dump_bigram_counts(){
 		for(int tag_1 = 1;tag_1 <= _num_tags;tag_1++){
 			for(int tag = 1;tag <= _num_tags;tag++){
-				std::cout << (boost::format("2-gram [%d][%d] = %d") % tag_1 % tag % _bigram_counts[tag_1][tag]).str() << std::endl;
+				std::cout << (boost::format("2-gram [%d][%d] = %d") % tag_1 % tag % _bigram_counts->at(tag_1, tag)).str() << std::endl;
 			}
 		}
 	}
 	void HMM::dump_unigram_counts(){
 		for(int tag = 1;tag <= _num_tags;tag++){
-			std::cout << (boost::format("1-gram [%d] = %d") % tag % _unigram_counts[tag]).str() << std::endl;
+			std::cout << (boost::format("1-gram [%d] = %d") % tag % _unigram_counts->at(tag)).str() << std::endl;
 		}
 	}
 	template <class Archive>
@@ -336,6 +1072,15 @@ namespace bhmm {
 		boost::serialization::split_free(ar, *this, version);
 	}
 	bool HMM::save(std::string filename){
+		return _save_binary(filename);
+	}
+	bool HMM::load(std::string filename){
+		if(binary::is_binary_file(filename)){
+			return _load_binary(filename);
+		}
+		return load_archive(filename);
+	}
+	bool HMM::save_archive(std::string filename){
 		bool success = false;
 		std::ofstream ofs(filename);
 		if(ofs.good()){
@@ -346,17 +1091,208 @@ namespace bhmm {
 		ofs.close();
 		return success;
 	}
-	bool HMM::load(std::string filename){
+	bool HMM::load_archive(std::string filename){
 		bool success = false;
 		std::ifstream ifs(filename);
 		if(ifs.good()){
 			boost::archive::binary_iarchive iarchive(ifs);
 			iarchive >> *this;
+			_reset_after_load();
 			success = true;
 		}
 		ifs.close();
 		return success;
 	}
+	// 読み込む前のモデルで数えた値は使えないので捨てる. 差分はcompute_log_p_jointを呼ぶまで追わない
+	void HMM::_reset_after_load(){
+		_num_words_of_tag.clear();
+		_log_p_joint_delta = 0;
+		invalidate_denominator_caches();
+	}
+	// カウントの表はメモリ上の並びのまま書き出す
+	// 品詞-単語ペアだけは単語ごとの疎なリストを連結してから書く
+	bool HMM::_save_binary(std::string filename){
+		assert(_num_tags > 0);
+		assert(_num_words > 0);
+		binary::Writer writer;
+		binary::Header &header = writer._header;
+		header.num_tags = _num_tags;
+		header.num_words = _num_words;
+		header.alpha = _alpha;
+		header.temperature = _temperature;
+		header.minimum_temperature = _minimum_temperature;
+		writer.add_section(binary::SECTION_WT, binary::DTYPE_INT32, _Wt, _num_tags + 1);
+		writer.add_section(binary::SECTION_BETA, binary::DTYPE_FLOAT64, _beta, _num_tags + 1);
+		// 3-gram
+		if(_trigram_counts->is_dense()){
+			writer.add_section(binary::SECTION_TRIGRAM_COUNTS, binary::DTYPE_INT32, _trigram_counts->_dense->_data, _trigram_counts->_dense->_size);
+		}else{
+			header.flags |= BHMM_BINARY_FLAG_HASHED_TRIGRAM;
+			header.trigram_capacity = _trigram_counts->_capacity;
+			writer.add_section(binary::SECTION_TRIGRAM_KEYS, binary::DTYPE_UINT64, _trigram_counts->_keys, _trigram_counts->_capacity);
+			writer.add_section(binary::SECTION_TRIGRAM_COUNTS, binary::DTYPE_INT32, _trigram_counts->_values, _trigram_counts->_capacity);
+		}
+		// 2-gram
+		writer.add_section(binary::SECTION_BIGRAM_COUNTS, binary::DTYPE_INT32, _bigram_counts->_data, _bigram_counts->_size);
+		// 1-gram
+		writer.add_section(binary::SECTION_UNIGRAM_COUNTS, binary::DTYPE_INT32, _unigram_counts->_data, _unigram_counts->_size);
+		// 単語-品詞ペアのカウント
+		std::vector<uint64_t> emission_offsets;
+		std::vector<int> emission_tags;
+		std::vector<int> emission_counts;
+		_tag_word_counts->export_csr(emission_offsets, emission_tags, emission_counts);
+		writer.add_section(binary::SECTION_EMISSION_OFFSETS, binary::DTYPE_UINT64, emission_offsets.data(), emission_offsets.size());
+		writer.add_section(binary::SECTION_EMISSION_TAGS, binary::DTYPE_INT32, emission_tags.data(), emission_tags.size());
+		writer.add_section(binary::SECTION_EMISSION_COUNTS, binary::DTYPE_INT32, emission_counts.data(), emission_counts.size());
+		// 単語ごとに取りうる品詞
+		if(_tag_dictionary != NULL){
+			header.flags |= BHMM_BINARY_FLAG_TAG_DICTIONARY;
+			writer.add_section(binary::SECTION_TAG_DICTIONARY_OFFSETS, binary::DTYPE_INT32, _tag_dictionary->_offsets, _tag_dictionary->_num_words + 1);
+			writer.add_section(binary::SECTION_TAG_DICTIONARY_TAGS, binary::DTYPE_INT32, _tag_dictionary->_tags, _tag_dictionary->_num_entries);
+		}
+		return writer.write(filename);
+	}
+	// 全ての表の大きさと中身を確かめてから置き換えるので、壊れたファイルなら何も変えずにfalseを返す
+	bool HMM::_load_binary(std::string filename){
+		binary::MappedFile file;
+		if(file.open(filename) == false){
+			return false;
+		}
+		const binary::Header &header = *file._header;
+		if(header.num_tags <= 0 || header.num_words <= 0){
+			return false;
+		}
+		int num_tags = header.num_tags;
+		id num_words = header.num_words;
+		size_t tensor_size = (size_t)num_tags + 1;
+		bool hashed = (header.flags & BHMM_BINARY_FLAG_HASHED_TRIGRAM) != 0;
+		size_t trigram_capacity = header.trigram_capacity;
+		if(hashed && (trigram_capacity < 2 || (trigram_capacity & (trigram_capacity - 1)) != 0)){
+			return false;
+		}
+		// 密な3-gramの大きさが桁あふれする品詞数
+		if(hashed == false && tensor_size > ((size_t)1 << 21)){
+			return false;
+		}
+		const int* Wt = static_cast<const int*>(file.get_section(binary::SECTION_WT, binary::DTYPE_INT32, tensor_size));
+		const double* beta = static_cast<const double*>(file.get_section(binary::SECTION_BETA, binary::DTYPE_FLOAT64, tensor_size));
+		const int* trigram_counts = static_cast<const int*>(file.get_section(binary::SECTION_TRIGRAM_COUNTS, binary::DTYPE_INT32, hashed ? trigram_capacity : tensor_size * tensor_size * tensor_size));
+		const uint64_t* trigram_keys = hashed ? static_cast<const uint64_t*>(file.get_section(binary::SECTION_TRIGRAM_KEYS, binary::DTYPE_UINT64, trigram_capacity)) : NULL;
+		const int* bigram_counts = static_cast<const int*>(file.get_section(binary::SECTION_BIGRAM_COUNTS, binary::DTYPE_INT32, tensor_size * tensor_size));
+		const int* unigram_counts = static_cast<const int*>(file.get_section(binary::SECTION_UNIGRAM_COUNTS, binary::DTYPE_INT32, tensor_size));
+		const uint64_t* emission_offsets = static_cast<const uint64_t*>(file.get_section(binary::SECTION_EMISSION_OFFSETS, binary::DTYPE_UINT64, (size_t)num_words + 1));
+		if(Wt == NULL || beta == NULL || trigram_counts == NULL || (hashed && trigram_keys == NULL) || bigram_counts == NULL || unigram_counts == NULL || emission_offsets == NULL){
+			return false;
+		}
+		// ハッシュ表は空き番地がないと探索が止まらず、キーは品詞の範囲に収まっていなければならない
+		if(hashed){
+			bool has_empty_slot = false;
+			for(size_t slot = 0;slot < trigram_capacity;slot++){
+				uint64_t key = trigram_keys[slot];
+				if(key == BHMM_TRIGRAM_EMPTY_KEY){
+					has_empty_slot = true;
+				}else if(key / tensor_size / tensor_size >= tensor_size){
+					return false;
+				}
+			}
+			if(has_empty_slot == false){
+				return false;
+			}
+		}
+		size_t num_emissions = emission_offsets[num_words];
+		const int* emission_tags = static_cast<const int*>(file.get_section(binary::SECTION_EMISSION_TAGS, binary::DTYPE_INT32, num_emissions));
+		const int* emission_counts = static_cast<const int*>(file.get_section(binary::SECTION_EMISSION_COUNTS, binary::DTYPE_INT32, num_emissions));
+		if(emission_tags == NULL || emission_counts == NULL){
+			return false;
+		}
+		// 単語ごとの品詞は1からnum_tagsまでの昇順
+		if(emission_offsets[0] != 0){
+			return false;
+		}
+		for(id word_id = 0;word_id < num_words;word_id++){
+			uint64_t begin = emission_offsets[word_id];
+			uint64_t end = emission_offsets[word_id + 1];
+			if(begin > end || end > num_emissions){
+				return false;
+			}
+			for(uint64_t k = begin;k < end;k++){
+				int tag = emission_tags[k];
+				if(tag < 1 || tag > num_tags || (k > begin && emission_tags[k - 1] >= tag)){
+					return false;
+				}
+			}
+		}
+		const int* dictionary_offsets = NULL;
+		const int* dictionary_tags = NULL;
+		id dictionary_num_words = 0;
+		if(header.flags & BHMM_BINARY_FLAG_TAG_DICTIONARY){
+			uint64_t num_offsets = header.sections[binary::SECTION_TAG_DICTIONARY_OFFSETS].num_elements;
+			if(num_offsets == 0 || num_offsets - 1 > (uint64_t)std::numeric_limits<id>::max()){
+				return false;
+			}
+			dictionary_num_words = num_offsets - 1;
+			dictionary_offsets = static_cast<const int*>(file.get_section(binary::SECTION_TAG_DICTIONARY_OFFSETS, binary::DTYPE_INT32, num_offsets));
+			if(dictionary_offsets == NULL){
+				return false;
+			}
+			if(dictionary_offsets[0] != 0 || dictionary_offsets[dictionary_num_words] < 0){
+				return false;
+			}
+			dictionary_tags = static_cast<const int*>(file.get_section(binary::SECTION_TAG_DICTIONARY_TAGS, binary::DTYPE_INT32, dictionary_offsets[dictionary_num_words]));
+			if(dictionary_tags == NULL){
+				return false;
+			}
+			for(id word_id = 0;word_id < dictionary_num_words;word_id++){
+				int begin = dictionary_offsets[word_id];
+				int end = dictionary_offsets[word_id + 1];
+				if(begin > end || end > dictionary_offsets[dictionary_num_words]){
+					return false;
+				}
+				for(int k = begin;k < end;k++){
+					int tag = dictionary_tags[k];
+					if(tag < 1 || tag > num_tags || (k > begin && dictionary_tags[k - 1] >= tag)){
+						return false;
+					}
+				}
+			}
+		}
+		// ここまでで全て確かめたので以降は失敗しない
+		free_sampling_tables();
+		_free_count_tables();
+		_num_tags = num_tags;
+		_num_words = num_words;
+		_alpha = header.alpha;
+		_temperature = header.temperature;
+		_minimum_temperature = header.minimum_temperature;
+		_alloc_count_tables(num_tags, num_words);
+		std::copy(Wt, Wt + tensor_size, _Wt);
+		std::copy(beta, beta + tensor_size, _beta);
+		// 3-gramは保存した時の表現をそのまま使う
+		delete _trigram_counts;
+		if(hashed){
+			_trigram_counts = new TrigramCounts();
+			_trigram_counts->assign_table(num_tags, trigram_keys, trigram_counts, trigram_capacity);
+		}else{
+			_trigram_counts = new TrigramCounts(num_tags, true);
+			std::copy(trigram_counts, trigram_counts + _trigram_counts->_dense->_size, _trigram_counts->_dense->_data);
+		}
+		std::copy(bigram_counts, bigram_counts + _bigram_counts->_size, _bigram_counts->_data);
+		std::copy(unigram_counts, unigram_counts + _unigram_counts->_size, _unigram_counts->_data);
+		for(id word_id = 0;word_id < num_words;word_id++){
+			uint64_t begin = emission_offsets[word_id];
+			uint64_t end = emission_offsets[word_id + 1];
+			_tag_word_counts->assign_word(word_id, emission_tags + begin, emission_counts + begin, end - begin);
+		}
+		delete _tag_dictionary;
+		_tag_dictionary = NULL;
+		if(dictionary_offsets != NULL){
+			std::vector<int> offsets(dictionary_offsets, dictionary_offsets + dictionary_num_words + 1);
+			std::vector<int> tags(dictionary_tags, dictionary_tags + offsets.back());
+			_tag_dictionary = new TagDictionary(num_tags, offsets, tags);
+		}
+		_reset_after_load();
+		return true;
+	}
 }
 
 namespace boost { 
@@ -372,7 +1308,6 @@ namespace boost {
 			assert(hmm._num_tags > 0);
 			assert(hmm._num_words > 0);
 			int num_tags = hmm._num_tags;
-			int num_words = hmm._num_words;
 			// 各タグの可能な単語数
 			for(int tag = 0;tag <= num_tags;tag++){
 				ar & hmm._Wt[tag];
@@ -382,29 +1317,19 @@ namespace boost {
 			for(int tag = 0;tag <= num_tags;tag++){
 				ar & hmm._beta[tag];
 			}
-			// 3-gram		
-			for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
-				for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-					for(int tag = 0;tag <= num_tags;tag++){
-						ar & hmm._trigram_counts[tag_2][tag_1][tag];
-					}
-				}
-			}
+			// 3-gram
+			hmm._trigram_counts->save(ar);
 			// 2-gram
-			for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-				for(int tag = 0;tag <= num_tags;tag++){
-					ar & hmm._bigram_counts[tag_1][tag];
-				}
-			}
+			ar & boost::serialization::make_array(hmm._bigram_counts->_data, hmm._bigram_counts->_size);
 			// 1-gram
-			for(int tag = 0;tag <= num_tags;tag++){
-				ar & hmm._unigram_counts[tag];
-			}
+			ar & boost::serialization::make_array(hmm._unigram_counts->_data, hmm._unigram_counts->_size);
 			// 単語-品詞ペアのカウント
-			for(int tag = 0;tag <= num_tags;tag++){
-				for(id word = 0;word < num_words;word++){
-					ar & hmm._tag_word_counts[tag][word];
-				}
+			hmm._tag_word_counts->save(ar);
+			// 単語ごとに取りうる品詞
+			bool has_tag_dictionary = (hmm._tag_dictionary != NULL);
+			ar & has_tag_dictionary;
+			if(has_tag_dictionary){
+				hmm._tag_dictionary->save(ar);
 			}
 		}
 		template<class Archive>
@@ -420,48 +1345,70 @@ namespace boost {
 			int num_tags = hmm._num_tags;
 			int num_words = hmm._num_words;
 			// 各タグの可能な単語数
+			delete[] hmm._Wt;
 			hmm._Wt = new int[num_tags + 1];
 			for(int tag = 0;tag <= num_tags;tag++){
 				ar & hmm._Wt[tag];
 			}
+			delete[] hmm._all_tags;
+			hmm._all_tags = new int[num_tags];
+			for(int k = 0;k < num_tags;k++){
+				hmm._all_tags[k] = k + 1;
+			}
 			// Betaの初期化
 			// 初期値は1
+			delete[] hmm._beta;
 			hmm._beta = new double[num_tags + 1];
 			for(int tag = 0;tag <= num_tags;tag++){
 				ar & hmm._beta[tag];
 			}
-			// 3-gram		
-			hmm._trigram_counts = new int**[num_tags + 1];
-			for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
-				hmm._trigram_counts[tag_2] = new int*[num_tags + 1];
-				for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-					hmm._trigram_counts[tag_2][tag_1] = new int[num_tags + 1];
-					for(int tag = 0;tag <= num_tags;tag++){
-						ar & hmm._trigram_counts[tag_2][tag_1][tag];
-					}
-				}
+			// 3-gram
+			delete hmm._trigram_counts;
+			hmm._trigram_counts = new bhmm::TrigramCounts();
+			if(version < 3){
+				// 旧形式は(品詞数+1)^3の密な配列
+				hmm._trigram_counts->load_dense_array(ar, num_tags);
+			}else{
+				hmm._trigram_counts->load(ar, num_tags);
 			}
 			// 2-gram
-			hmm._bigram_counts = new int*[num_tags + 1];
-			for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
-				hmm._bigram_counts[tag_1] = new int[num_tags + 1];
+			delete hmm._bigram_counts;
+			hmm._bigram_counts = new bhmm::Tensor(num_tags + 1, num_tags + 1);
+			ar & boost::serialization::make_array(hmm._bigram_counts->_data, hmm._bigram_counts->_size);
+			// 1-gram
+			delete hmm._unigram_counts;
+			hmm._unigram_counts = new bhmm::Tensor(num_tags + 1);
+			ar & boost::serialization::make_array(hmm._unigram_counts->_data, hmm._unigram_counts->_size);
+			// 単語-品詞ペアのカウント
+			delete hmm._tag_word_counts;
+			hmm._tag_word_counts = new bhmm::EmissionCounts(num_tags, num_words);
+			if(version == 0){
+				// 旧形式は(品詞数+1)×単語数の密な配列
 				for(int tag = 0;tag <= num_tags;tag++){
-					ar & hmm._bigram_counts[tag_1][tag];
+					for(id word = 0;word < num_words;word++){
+						int count = 0;
+						ar & count;
+						if(tag > 0 && count > 0){
+							hmm._tag_word_counts->set(tag, word, count);
+						}
+					}
 				}
+			}else{
+				hmm._tag_word_counts->load(ar);
 			}
-			// 1-gram
-			hmm._unigram_counts = new int[num_tags + 1];
-			for(int tag = 0;tag <= num_tags;tag++){
-				ar & hmm._unigram_counts[tag];
+			// 単語ごとに取りうる品詞
+			delete hmm._tag_dictionary;
+			hmm._tag_dictionary = NULL;
+			bool has_tag_dictionary = false;
+			if(version >= 2){
+				ar & has_tag_dictionary;
 			}
-			// 単語-品詞ペアのカウント
-			hmm._tag_word_counts = new int*[num_tags + 1];
-			for(int tag = 0;tag <= num_tags;tag++){
-				hmm._tag_word_counts[tag] = new int[num_words];
-				for(id word = 0;word < num_words;word++){
-					ar & hmm._tag_word_counts[tag][word];
-				}
+			if(has_tag_dictionary){
+				hmm._tag_dictionary = new bhmm::TagDictionary();
+				hmm._tag_dictionary->load(ar);
 			}
+			// キャッシュは品詞数が変わりうるので作り直す
+			hmm.free_sampling_tables();
 		}
 	}
 }
\ No newline at end of file
@@ -1,62 +1,160 @@
 #pragma once
 #include <boost/serialization/serialization.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/format.hpp>
 #include <cassert>
 #include <cmath>
+#include <random>
 #include <unordered_map>
 #include <set>
 #include "common.h"
+#include "sampler.h"
+#include "sequences.h"
+#include "tensor.h"
+#include "trigram.h"
+#include "emission.h"
+#include "tagdict.h"
 
 namespace bhmm {
 	class HMM{
 	private:
 		void _alloc_count_tables(int num_tags, int num_words);
-		void _init_ngram_counts_with_corpus(std::vector<std::vector<Word*>> &dataset);
+		void _free_count_tables();
+		bool _save_binary(std::string filename);
+		bool _load_binary(std::string filename);
+		void _init_ngram_counts_with_corpus(WordSequences &dataset);
 		void _add_tag_trigram_to_model(int ti_2, int ti_1, int ti, int ti1, int ti2, id wi);
 		void _remove_tag_trigram_from_model(int ti_2, int ti_1, int ti, int ti1, int ti2, id wi);
-		void _increment_tag_trigram_count_by_words(Word* wi_2, Word* wi_1, Word* wi);
+		void _increment_tag_trigram_count(int ti_2, int ti_1, int ti);
 		void _increment_tag_word_count(int tag, id word_id);
 		void _decrement_tag_word_count(int tag, id word_id);
+		void _alloc_sampling_tables();
+		void _update_denominator_caches();
+		void _update_emission_denominator(int tag);
+		void _update_transition_denominator(int tag_1, int tag);
+		void _add_position_to_model(Sentence &sentence, int i);
+		void _remove_position_from_model(Sentence &sentence, int i);
+		double _add_sentence_to_model(Sentence &sentence);
+		void _remove_sentence_from_model(Sentence &sentence);
+		double _compute_log_q_sentence(Sentence &sentence);
+		void _alloc_blocked_tables(int sentence_length);
+		void _reset_after_load();
+		void _update_blocked_transitions();
+		void _compute_blocked_transition_row(int tag_2, int tag_1, double* transitions);
+		// P(・| t_2, t_1)^(1 / temperature)の行. ハッシュ表の時は次に呼ぶまでしか使えない
+		inline const double* _get_blocked_transition_row(int tag_2, int tag_1){
+			if(_trigram_counts->is_dense()){
+				int size = _num_tags + 1;
+				return _blocked_transitions + (tag_2 * size + tag_1) * size;
+			}
+			_compute_blocked_transition_row(tag_2, tag_1, _blocked_transition_row);
+			return _blocked_transition_row;
+		}
+		inline double _get_blocked_transition(int tag_2, int tag_1, int tag){
+			int size = _num_tags + 1;
+			if(_trigram_counts->is_dense()){
+				return _blocked_transitions[(tag_2 * size + tag_1) * size + tag];
+			}
+			double p = (_trigram_counts->get(tag_2, tag_1, tag) + _alpha) * _transition_denominators_inv[tag_2 * size + tag_1];
+			return (_temperature == 1) ? p : pow(p, 1.0 / _temperature);
+		}
+		void _update_blocked_emissions(id wi);
+		int _sample_from(double* weights, int begin, int end, sampler::Xoshiro256 &rng);
+		double _compute_log_p_position(int ti_2, int ti_1, int tag, int ti1, int ti2, id wi);
+		void _compute_tag_scores(int ti_2, int ti_1, int ti1, int ti2, id wi, const int* tags, int num_tags_of_word, double* scores);
 	public:
 		int _num_tags;			// 品詞数
 		id _num_words;			// 単語数
-		int*** _trigram_counts;	// 品詞3-gramのカウント
-		int** _bigram_counts;	// 品詞2-gramのカウント
-		int* _unigram_counts;	// 品詞1-gramのカウント
+		TrigramCounts* _trigram_counts;	// 品詞3-gramのカウント
+		Tensor* _bigram_counts;		// 品詞2-gramのカウント
+		Tensor* _unigram_counts;	// 品詞1-gramのカウント
 		int* _Wt;
-		int** _tag_word_counts;	// 品詞と単語のペアの出現頻度
+		int* _all_tags;						// [k] = k + 1. 品詞に制約のない単語に使う
+		TagDictionary* _tag_dictionary;		// 単語ごとに取りうる品詞. NULLなら制約なし
+		EmissionCounts* _tag_word_counts;	// 品詞と単語のペアの出現頻度
 		double* _sampling_table;	// キャッシュ
+		int* _tag_counts_of_word;	// キャッシュ
+		int* _trigram_row;			// キャッシュ
+		double* _score_factors;		// キャッシュ
+		std::vector<double> _uniforms;	// キャッシュ. 文の位置ごとの一様乱数
+		// Gibbsサンプリングの分母のキャッシュ
+		// カウントの増減に合わせて更新し、ハイパーパラメータが変わったら無効化する
+		double* _emission_denominators;			// [t] n_t + W_t * beta_t
+		double* _emission_denominators_inv;
+		double* _transition_denominators;		// [t_1 * (T + 1) + t] n_{t_1,t} + T * alpha
+		double* _transition_denominators_inv;
+		bool _denominator_caches_valid;
+		// 文単位のブロック化サンプリング用
+		double* _blocked_transitions;		// [t_2][t_1][t] 遷移確率の1/temperature乗. 3-gramが密な時だけ持つ
+		double* _blocked_transition_row;	// [t] 3-gramがハッシュ表の時にその都度計算する遷移確率の行
+		double* _blocked_emissions;			// [t] 出力確率の1/temperature乗
+		double* _blocked_forward_table;		// [i][t_1][t] 正規化した前向き確率
+		int _blocked_forward_table_length;
 		double _alpha;
 		double* _beta;
 		double _temperature;
 		double _minimum_temperature;
+		double _log_p_joint_delta;	// gibbsで品詞を書き換えるたびにlog p(t, w)の変化を足す
+		std::vector<int> _num_words_of_tag;	// 差分の計算用. compute_log_p_jointで数え、gibbs以外で品詞が変わったら空にする
+		bool _track_log_p_joint;			// trueの間だけgibbsで差分を追う. copy_fromでは複製しない
 		HMM();
 		HMM(int num_tags, int num_words);
 		~HMM();
 		void anneal_temperature(double decay);
-		void initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset, std::vector<int> &Wt);
+		void initialize_with_training_dataset(WordSequences &dataset, std::vector<int> &Wt);
+		void copy_from(const HMM* hmm);
+		void count_assignments(WordSequences &dataset);
 		int get_count_of_tag_word(int tag_id, int word_id);
 		int get_most_co_occurring_tag(int word_id);
 		void set_Wt_for_tag(int tag_id, int number);
+		void set_tag_dictionary(TagDictionary* dictionary);
+		// 単語word_idが取りうる品詞の一覧をtagsに入れて個数を返す
+		inline int get_allowed_tags(id word_id, const int* &tags) const {
+			if(_tag_dictionary != NULL){
+				int num_tags_of_word = _tag_dictionary->get_tags_of_word(word_id, tags);
+				if(num_tags_of_word > 0){
+					return num_tags_of_word;
+				}
+			}
+			tags = _all_tags;
+			return _num_tags;
+		}
 		void set_num_tags(int n);
 		void set_alpha(double alpha);
 		void set_beta(double beta);
-		double compute_log_p_t_given_alpha(std::vector<Word*> &word_vec, double alpha);
+		void invalidate_denominator_caches();
+		void free_sampling_tables();
+		double compute_log_p_t_given_alpha(Sentence &sentence, double alpha);
 		double compute_p_wi_given_ti_beta(id wi, int ti, double beta);
+		double compute_log_p_joint();
 		double compute_p_wi_given_ti(id wi, int ti);
 		double compute_p_ti_given_t_alpha(int ti, int ti_1, int ti_2, double alpha);
 		double compute_p_ti_given_t(int ti, int ti_1, int ti_2);
-		void gibbs(std::vector<Word*> &word_vec);
+		void compute_tag_scores(int ti_2, int ti_1, int ti1, int ti2, id wi, double* scores);
+		void compute_tag_scores_scalar(int ti_2, int ti_1, int ti1, int ti2, id wi, double* scores);
+		void gibbs(Sentence &sentence);
+		void gibbs(Sentence &sentence, sampler::Xoshiro256 &rng);
+		bool blocked_gibbs(Sentence &sentence);
+		bool blocked_gibbs(Sentence &sentence, sampler::Xoshiro256 &rng);
 		void dump_trigram_counts();
 		void dump_bigram_counts();
 		void dump_unigram_counts();
+		// 独自のバイナリ形式で保存する. 読み込みは形式を判別して旧形式も読める
 		bool save(std::string filename);
 		bool load(std::string filename);
+		// Boost.Serializationの旧形式
+		bool save_archive(std::string filename);
+		bool load_archive(std::string filename);
 		template <class Archive>
 		void serialize(Archive& archive, unsigned int version);
 	};
 }
 
+// 1: 品詞-単語ペアのカウントを疎な形式で保存
+// 2: 単語ごとに取りうる品詞の一覧を保存
+// 3: 品詞3-gramのカウントを密な配列かハッシュ表の非ゼロ要素で保存
+BOOST_CLASS_VERSION(bhmm::HMM, 3)
+
 namespace boost { 
 	namespace serialization {
 		template<class Archive>
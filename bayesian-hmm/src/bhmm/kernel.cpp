@@ -0,0 +1,297 @@
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+#include "kernel.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BHMM_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+#define BHMM_LN2_HI 6.93147180369123816490e-01
+#define BHMM_LN2_LO 1.90821492927058770002e-10
+#define BHMM_EXP_MIN -708.0			// これより小さいとexpは0にする
+#define BHMM_EXP_MAX 709.0
+#define BHMM_ROUNDING_MAGIC 6755399441055744.0	// 1.5 * 2^52
+#define BHMM_TWO_POW_52 4503599627370496.0
+
+namespace bhmm {
+	namespace kernel {
+		// log(m) = 2f(1 + s/3 + s^2/5 + ...), f = (m - 1) / (m + 1), s = f^2 の係数
+		static const int log_poly_degree = 11;
+		static const double log_poly_coefficients[log_poly_degree + 1] = {
+			1.0, 1.0 / 3.0, 1.0 / 5.0, 1.0 / 7.0, 1.0 / 9.0, 1.0 / 11.0,
+			1.0 / 13.0, 1.0 / 15.0, 1.0 / 17.0, 1.0 / 19.0, 1.0 / 21.0, 1.0 / 23.0,
+		};
+		// exp(r)のテイラー展開の係数 1/k!
+		static const int exp_poly_degree = 13;
+		static const double exp_poly_coefficients[exp_poly_degree + 1] = {
+			1.0, 1.0, 1.0 / 2.0, 1.0 / 6.0, 1.0 / 24.0, 1.0 / 120.0, 1.0 / 720.0,
+			1.0 / 5040.0, 1.0 / 40320.0, 1.0 / 362880.0, 1.0 / 3628800.0,
+			1.0 / 39916800.0, 1.0 / 479001600.0, 1.0 / 6227020800.0,
+		};
+
+		static double _score_scalar(const double* factors, int stride, int k){
+			double score = 1;
+			for(int f = 0;f < BHMM_NUM_SCORE_FACTORS;f++){
+				score *= factors[(2 * f) * stride + k] * factors[(2 * f + 1) * stride + k];
+			}
+			return score;
+		}
+		static void _compute_tag_scores_scalar(const double* factors, int stride, int begin, int length, double temperature, double* scores){
+			for(int k = begin;k < length;k++){
+				scores[k] = _score_scalar(factors, stride, k);
+			}
+			if(temperature == 1){
+				return;
+			}
+			double exponent = 1.0 / temperature;
+			for(int k = begin;k < length;k++){
+				scores[k] = pow(scores[k], exponent);
+			}
+		}
+		static void _update_max_plus_scalar(const double* log_transitions, double forward, int index, int begin, int length, double* max_values, int* argmax){
+			for(int k = begin;k < length;k++){
+				double value = log_transitions[k] + forward;
+				if(value > max_values[k]){
+					max_values[k] = value;
+					argmax[k] = index;
+				}
+			}
+		}
+
+#ifdef BHMM_KERNEL_X86
+		// AVX2
+		__attribute__((target("avx2")))
+		static inline __m256d _log_avx2(__m256d x){
+			const __m256d one = _mm256_set1_pd(1.0);
+			const __m256d two_pow_52 = _mm256_set1_pd(BHMM_TWO_POW_52);
+			__m256i bits = _mm256_castpd_si256(x);
+			// x = m * 2^e, 1 <= m < 2
+			__m256i exponent_bits = _mm256_srli_epi64(bits, 52);
+			__m256d e = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(exponent_bits, _mm256_castpd_si256(two_pow_52))), _mm256_set1_pd(BHMM_TWO_POW_52 + 1023.0));
+			__m256i mantissa_bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffLL)), _mm256_castpd_si256(one));
+			__m256d m = _mm256_castsi256_pd(mantissa_bits);
+			// sqrt(1/2) <= m < sqrt(2)に寄せる
+			__m256d is_large = _mm256_cmp_pd(m, _mm256_set1_pd(M_SQRT2), _CMP_GT_OQ);
+			m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), is_large);
+			e = _mm256_add_pd(e, _mm256_and_pd(is_large, one));
+			__m256d f = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+			__m256d s = _mm256_mul_pd(f, f);
+			__m256d p = _mm256_set1_pd(log_poly_coefficients[log_poly_degree]);
+			for(int k = log_poly_degree - 1;k >= 0;k--){
+				p = _mm256_add_pd(_mm256_mul_pd(p, s), _mm256_set1_pd(log_poly_coefficients[k]));
+			}
+			__m256d log_m = _mm256_mul_pd(_mm256_add_pd(f, f), p);
+			__m256d lo = _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(BHMM_LN2_LO)), log_m);
+			return _mm256_add_pd(_mm256_mul_pd(e, _mm256_set1_pd(BHMM_LN2_HI)), lo);
+		}
+		__attribute__((target("avx2")))
+		static inline __m256d _exp_avx2(__m256d x){
+			const __m256d magic = _mm256_set1_pd(BHMM_ROUNDING_MAGIC);
+			__m256d underflow = _mm256_cmp_pd(x, _mm256_set1_pd(BHMM_EXP_MIN), _CMP_LT_OQ);
+			x = _mm256_max_pd(x, _mm256_set1_pd(BHMM_EXP_MIN));
+			x = _mm256_min_pd(x, _mm256_set1_pd(BHMM_EXP_MAX));
+			// x = n * log(2) + r
+			__m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(M_LOG2E)), magic);
+			__m256d n = _mm256_sub_pd(t, magic);
+			__m256i n_int = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(magic));
+			__m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(BHMM_LN2_HI)));
+			r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(BHMM_LN2_LO)));
+			__m256d p = _mm256_set1_pd(exp_poly_coefficients[exp_poly_degree]);
+			for(int k = exp_poly_degree - 1;k >= 0;k--){
+				p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(exp_poly_coefficients[k]));
+			}
+			__m256i pow2n = _mm256_slli_epi64(_mm256_add_epi64(n_int, _mm256_set1_epi64x(1023)), 52);
+			__m256d y = _mm256_mul_pd(p, _mm256_castsi256_pd(pow2n));
+			return _mm256_andnot_pd(underflow, y);
+		}
+		__attribute__((target("avx2")))
+		static void _compute_tag_scores_avx2(const double* factors, int stride, int length, double temperature, double* scores){
+			int k = 0;
+			bool annealing = (temperature != 1);
+			__m256d exponent = _mm256_set1_pd(1.0 / temperature);
+			__m256d min_value = _mm256_set1_pd(DBL_MIN);
+			for(;k + 4 <= length;k += 4){
+				__m256d score = _mm256_set1_pd(1.0);
+				for(int f = 0;f < BHMM_NUM_SCORE_FACTORS;f++){
+					__m256d numerator = _mm256_loadu_pd(factors + (2 * f) * stride + k);
+					__m256d inverse = _mm256_loadu_pd(factors + (2 * f + 1) * stride + k);
+					score = _mm256_mul_pd(score, _mm256_mul_pd(numerator, inverse));
+				}
+				if(annealing){
+					__m256d is_zero = _mm256_cmp_pd(score, _mm256_setzero_pd(), _CMP_LE_OQ);
+					__m256d log_score = _log_avx2(_mm256_max_pd(score, min_value));
+					score = _mm256_andnot_pd(is_zero, _exp_avx2(_mm256_mul_pd(log_score, exponent)));
+				}
+				_mm256_storeu_pd(scores + k, score);
+			}
+			_compute_tag_scores_scalar(factors, stride, k, length, temperature, scores);
+		}
+		__attribute__((target("avx2")))
+		static void _update_max_plus_avx2(const double* log_transitions, double forward, int index, int length, double* max_values, int* argmax){
+			int k = 0;
+			__m256d forward_vec = _mm256_set1_pd(forward);
+			__m128i index_vec = _mm_set1_epi32(index);
+			// 64bitのマスクの下位32bitを集めて4つのintのマスクにする
+			const __m256i gather = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+			for(;k + 4 <= length;k += 4){
+				__m256d value = _mm256_add_pd(_mm256_loadu_pd(log_transitions + k), forward_vec);
+				__m256d max_value = _mm256_loadu_pd(max_values + k);
+				__m256d is_greater = _mm256_cmp_pd(value, max_value, _CMP_GT_OQ);
+				_mm256_storeu_pd(max_values + k, _mm256_blendv_pd(max_value, value, is_greater));
+				__m128i mask = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(is_greater), gather));
+				__m128i old_argmax = _mm_loadu_si128(reinterpret_cast<const __m128i*>(argmax + k));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(argmax + k), _mm_blendv_epi8(old_argmax, index_vec, mask));
+			}
+			_update_max_plus_scalar(log_transitions, forward, index, k, length, max_values, argmax);
+		}
+		// AVX-512
+		__attribute__((target("avx512f")))
+		static inline __m512d _log_avx512(__m512d x){
+			const __m512d one = _mm512_set1_pd(1.0);
+			const __m512d two_pow_52 = _mm512_set1_pd(BHMM_TWO_POW_52);
+			__m512i bits = _mm512_castpd_si512(x);
+			__m512i exponent_bits = _mm512_srli_epi64(bits, 52);
+			__m512d e = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(exponent_bits, _mm512_castpd_si512(two_pow_52))), _mm512_set1_pd(BHMM_TWO_POW_52 + 1023.0));
+			__m512i mantissa_bits = _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi64(0x000fffffffffffffLL)), _mm512_castpd_si512(one));
+			__m512d m = _mm512_castsi512_pd(mantissa_bits);
+			__mmask8 is_large = _mm512_cmp_pd_mask(m, _mm512_set1_pd(M_SQRT2), _CMP_GT_OQ);
+			m = _mm512_mask_mul_pd(m, is_large, m, _mm512_set1_pd(0.5));
+			e = _mm512_mask_add_pd(e, is_large, e, one);
+			__m512d f = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+			__m512d s = _mm512_mul_pd(f, f);
+			__m512d p = _mm512_set1_pd(log_poly_coefficients[log_poly_degree]);
+			for(int k = log_poly_degree - 1;k >= 0;k--){
+				p = _mm512_add_pd(_mm512_mul_pd(p, s), _mm512_set1_pd(log_poly_coefficients[k]));
+			}
+			__m512d log_m = _mm512_mul_pd(_mm512_add_pd(f, f), p);
+			__m512d lo = _mm512_add_pd(_mm512_mul_pd(e, _mm512_set1_pd(BHMM_LN2_LO)), log_m);
+			return _mm512_add_pd(_mm512_mul_pd(e, _mm512_set1_pd(BHMM_LN2_HI)), lo);
+		}
+		__attribute__((target("avx512f")))
+		static inline __m512d _exp_avx512(__m512d x){
+			const __m512d magic = _mm512_set1_pd(BHMM_ROUNDING_MAGIC);
+			__mmask8 underflow = _mm512_cmp_pd_mask(x, _mm512_set1_pd(BHMM_EXP_MIN), _CMP_LT_OQ);
+			x = _mm512_max_pd(x, _mm512_set1_pd(BHMM_EXP_MIN));
+			x = _mm512_min_pd(x, _mm512_set1_pd(BHMM_EXP_MAX));
+			__m512d t = _mm512_add_pd(_mm512_mul_pd(x, _mm512_set1_pd(M_LOG2E)), magic);
+			__m512d n = _mm512_sub_pd(t, magic);
+			__m512i n_int = _mm512_sub_epi64(_mm512_castpd_si512(t), _mm512_castpd_si512(magic));
+			__m512d r = _mm512_sub_pd(x, _mm512_mul_pd(n, _mm512_set1_pd(BHMM_LN2_HI)));
+			r = _mm512_sub_pd(r, _mm512_mul_pd(n, _mm512_set1_pd(BHMM_LN2_LO)));
+			__m512d p = _mm512_set1_pd(exp_poly_coefficients[exp_poly_degree]);
+			for(int k = exp_poly_degree - 1;k >= 0;k--){
+				p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(exp_poly_coefficients[k]));
+			}
+			__m512i pow2n = _mm512_slli_epi64(_mm512_add_epi64(n_int, _mm512_set1_epi64(1023)), 52);
+			__m512d y = _mm512_mul_pd(p, _mm512_castsi512_pd(pow2n));
+			return _mm512_mask_mov_pd(y, underflow, _mm512_setzero_pd());
+		}
+		__attribute__((target("avx512f")))
+		static void _compute_tag_scores_avx512(const double* factors, int stride, int length, double temperature, double* scores){
+			int k = 0;
+			bool annealing = (temperature != 1);
+			__m512d exponent = _mm512_set1_pd(1.0 / temperature);
+			__m512d min_value = _mm512_set1_pd(DBL_MIN);
+			for(;k + 8 <= length;k += 8){
+				__m512d score = _mm512_set1_pd(1.0);
+				for(int f = 0;f < BHMM_NUM_SCORE_FACTORS;f++){
+					__m512d numerator = _mm512_loadu_pd(factors + (2 * f) * stride + k);
+					__m512d inverse = _mm512_loadu_pd(factors + (2 * f + 1) * stride + k);
+					score = _mm512_mul_pd(score, _mm512_mul_pd(numerator, inverse));
+				}
+				if(annealing){
+					__mmask8 is_zero = _mm512_cmp_pd_mask(score, _mm512_setzero_pd(), _CMP_LE_OQ);
+					__m512d log_score = _log_avx512(_mm512_max_pd(score, min_value));
+					score = _exp_avx512(_mm512_mul_pd(log_score, exponent));
+					score = _mm512_mask_mov_pd(score, is_zero, _mm512_setzero_pd());
+				}
+				_mm512_storeu_pd(scores + k, score);
+			}
+			_compute_tag_scores_scalar(factors, stride, k, length, temperature, scores);
+		}
+		__attribute__((target("avx512f")))
+		static void _update_max_plus_avx512(const double* log_transitions, double forward, int index, int length, double* max_values, int* argmax){
+			int k = 0;
+			__m512d forward_vec = _mm512_set1_pd(forward);
+			__m512i index_vec = _mm512_set1_epi32(index);
+			for(;k + 8 <= length;k += 8){
+				__m512d value = _mm512_add_pd(_mm512_loadu_pd(log_transitions + k), forward_vec);
+				__mmask8 is_greater = _mm512_cmp_pd_mask(value, _mm512_loadu_pd(max_values + k), _CMP_GT_OQ);
+				_mm512_mask_storeu_pd(max_values + k, is_greater, value);
+				// 下位8個のintだけに書き込む
+				_mm512_mask_storeu_epi32(argmax + k, (__mmask16)is_greater, index_vec);
+			}
+			_update_max_plus_scalar(log_transitions, forward, index, k, length, max_values, argmax);
+		}
+#endif
+
+		bool is_isa_supported(int isa){
+			if(isa == ISA_SCALAR){
+				return true;
+			}
+#ifdef BHMM_KERNEL_X86
+			__builtin_cpu_init();
+			if(isa == ISA_AVX2){
+				return __builtin_cpu_supports("avx2");
+			}
+			if(isa == ISA_AVX512){
+				return __builtin_cpu_supports("avx512f");
+			}
+#endif
+			return false;
+		}
+		int get_best_supported_isa(){
+			if(is_isa_supported(ISA_AVX512)){
+				return ISA_AVX512;
+			}
+			if(is_isa_supported(ISA_AVX2)){
+				return ISA_AVX2;
+			}
+			return ISA_SCALAR;
+		}
+		static int current_isa = get_best_supported_isa();
+		int get_isa(){
+			return current_isa;
+		}
+		void set_isa(int isa){
+			assert(is_isa_supported(isa));
+			current_isa = isa;
+		}
+		const char* get_isa_name(int isa){
+			switch(isa){
+				case ISA_AVX2:
+					return "avx2";
+				case ISA_AVX512:
+					return "avx512";
+				default:
+					return "scalar";
+			}
+		}
+		void compute_tag_scores(const double* factors, int stride, int length, double temperature, double* scores){
+			assert(length <= stride);
+			assert(temperature > 0);
+#ifdef BHMM_KERNEL_X86
+			if(current_isa == ISA_AVX512){
+				return _compute_tag_scores_avx512(factors, stride, length, temperature, scores);
+			}
+			if(current_isa == ISA_AVX2){
+				return _compute_tag_scores_avx2(factors, stride, length, temperature, scores);
+			}
+#endif
+			_compute_tag_scores_scalar(factors, stride, 0, length, temperature, scores);
+		}
+		void update_max_plus(const double* log_transitions, double forward, int index, int length, double* max_values, int* argmax){
+#ifdef BHMM_KERNEL_X86
+			if(current_isa == ISA_AVX512){
+				return _update_max_plus_avx512(log_transitions, forward, index, length, max_values, argmax);
+			}
+			if(current_isa == ISA_AVX2){
+				return _update_max_plus_avx2(log_transitions, forward, index, length, max_values, argmax);
+			}
+#endif
+			_update_max_plus_scalar(log_transitions, forward, index, 0, length, max_values, argmax);
+		}
+	}
+}
\ No newline at end of file
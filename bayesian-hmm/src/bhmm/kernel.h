@@ -0,0 +1,26 @@
+#pragma once
+
+#define BHMM_NUM_SCORE_FACTORS 4	// Gibbsサンプリングの確率は4つの比の積
+
+namespace bhmm {
+	namespace kernel {
+		enum {
+			ISA_SCALAR = 0,
+			ISA_AVX2,
+			ISA_AVX512,
+		};
+		bool is_isa_supported(int isa);
+		int get_best_supported_isa();
+		int get_isa();
+		void set_isa(int isa);
+		const char* get_isa_name(int isa);
+		// 品詞ごとのスコアを一度に計算する
+		// factorsは[分子0, 分母の逆数0, 分子1, 分母の逆数1, ...]の順に長さstrideの行を並べたもの
+		// scores[k] = (Π_f 分子f[k] * 分母の逆数f[k]) ^ (1 / temperature)
+		// temperatureが1のときはべき乗を省略する
+		void compute_tag_scores(const double* factors, int stride, int length, double temperature, double* scores);
+		// ビタビアルゴリズムのmax-plus更新
+		// value = log_transitions[k] + forward がmax_values[k]より真に大きければmax_values[k]とargmax[k] = indexを更新する
+		void update_max_plus(const double* log_transitions, double forward, int index, int length, double* max_values, int* argmax);
+	}
+}
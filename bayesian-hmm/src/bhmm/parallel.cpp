@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <climits>
+#include <thread>
+#include "parallel.h"
+
+namespace bhmm {
+	ParallelGibbs::ParallelGibbs(HMM* hmm, int num_threads, uint64_t seed){
+		assert(hmm != NULL);
+		assert(num_threads > 0);
+		_hmm = hmm;
+		_num_threads = num_threads;
+		_sync_interval = 0;
+		_blocked = false;
+		_dataset = NULL;
+		// 同じseedなら毎回同じ系列になる. スレッドごとにjumpして重ならない系列を使う
+		sampler::Xoshiro256 rng(seed);
+		for(int thread_id = 0;thread_id < num_threads;thread_id++){
+			_replicas.push_back(new HMM());
+			_rngs.push_back(rng);
+			rng.jump();
+		}
+		_shards.resize(num_threads);
+		_shard_positions.resize(num_threads, 0);
+		_touched_words.resize(num_threads);
+		_is_touched.resize(num_threads);
+	}
+	ParallelGibbs::~ParallelGibbs(){
+		for(HMM* replica: _replicas){
+			delete replica;
+		}
+	}
+	void ParallelGibbs::set_sync_interval(int interval){
+		assert(interval >= 0);
+		_sync_interval = interval;
+	}
+	// 各スレッドは同期までの間は自分の複製を固定されたカウントとして文ごとにサンプリングする
+	void ParallelGibbs::set_blocked(bool blocked){
+		_blocked = blocked;
+	}
+	void ParallelGibbs::begin_epoch(WordSequences &dataset, std::vector<int> &indices){
+		// ハイパーパラメータや温度はエポックの間に変わるので全てコピーし直す
+		for(int thread_id = 0;thread_id < _num_threads;thread_id++){
+			_replicas[thread_id]->copy_from(_hmm);
+			_shards[thread_id].clear();
+			_shard_positions[thread_id] = 0;
+			_touched_words[thread_id].clear();
+			_is_touched[thread_id].assign(_hmm->_num_words, 0);
+		}
+		// シャッフル済みの順序を連続したブロックに分ける
+		_dataset = &dataset;
+		int num_sentences = indices.size();
+		for(int thread_id = 0;thread_id < _num_threads;thread_id++){
+			int begin = (long)num_sentences * thread_id / _num_threads;
+			int end = (long)num_sentences * (thread_id + 1) / _num_threads;
+			for(int n = begin;n < end;n++){
+				_shards[thread_id].push_back(indices[n]);
+			}
+		}
+	}
+	bool ParallelGibbs::gibbs_next_round(){
+		bool remaining = false;
+		for(int thread_id = 0;thread_id < _num_threads;thread_id++){
+			if(_shard_positions[thread_id] < _shards[thread_id].size()){
+				remaining = true;
+			}
+		}
+		if(remaining == false){
+			return false;
+		}
+		int num_sentences = (_sync_interval > 0) ? _sync_interval : INT_MAX;
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < _num_threads;thread_id++){
+			threads.push_back(std::thread(&ParallelGibbs::_sample_shard, this, thread_id, num_sentences));
+		}
+		_sample_shard(0, num_sentences);
+		for(auto &thread: threads){
+			thread.join();
+		}
+		_merge_replicas();
+		return true;
+	}
+	void ParallelGibbs::gibbs(WordSequences &dataset, std::vector<int> &indices){
+		begin_epoch(dataset, indices);
+		while(gibbs_next_round()){
+			// 全ての文をサンプリングし終えるまで同期を繰り返す
+		}
+	}
+	// 各文は1つのスレッドにしか割り当てられないので単語の状態を直接書き換えてよい
+	void ParallelGibbs::_sample_shard(int thread_id, int num_sentences){
+		HMM* replica = _replicas[thread_id];
+		std::vector<int> &shard = _shards[thread_id];
+		std::vector<id> &touched_words = _touched_words[thread_id];
+		std::vector<char> &is_touched = _is_touched[thread_id];
+		int &position = _shard_positions[thread_id];
+		int end = std::min((long)shard.size(), (long)position + num_sentences);
+		for(;position < end;position++){
+			Sentence sentence = _dataset->get_sentence(shard[position]);
+			if(_blocked){
+				replica->blocked_gibbs(sentence, _rngs[thread_id]);
+			}else{
+				replica->gibbs(sentence, _rngs[thread_id]);
+			}
+			for(int i = 2;i < sentence.size() - 2;i++){
+				id word_id = sentence._word_ids[i];
+				if(is_touched[word_id] == 0){
+					is_touched[word_id] = 1;
+					touched_words.push_back(word_id);
+				}
+			}
+		}
+	}
+	// 同期の間は全体のカウントが変わらないので
+	// 全体 += Σ(複製 - 全体)で各スレッドの増減をまとめて足し込める
+	void ParallelGibbs::_merge_tensor(Tensor* global, Tensor* HMM::*member){
+		int* global_data = global->_data;
+		for(size_t i = 0;i < global->_size;i++){
+			int count = global_data[i];
+			for(HMM* replica: _replicas){
+				count += (replica->*member)->_data[i] - global_data[i];
+			}
+			assert(count >= 0);
+			global_data[i] = count;
+		}
+	}
+	// ハッシュ表の場合は複製か同期前の全体のどちらかにある鍵だけを見る
+	void ParallelGibbs::_merge_trigram_counts(){
+		TrigramCounts* global = _hmm->_trigram_counts;
+		if(global->is_dense()){
+			Tensor* dense = global->_dense;
+			for(size_t i = 0;i < dense->_size;i++){
+				int count = dense->_data[i];
+				for(HMM* replica: _replicas){
+					count += replica->_trigram_counts->_dense->_data[i] - dense->_data[i];
+				}
+				assert(count >= 0);
+				dense->_data[i] = count;
+			}
+			return;
+		}
+		TrigramCounts old_counts;
+		old_counts.copy_from(global);
+		for(HMM* replica: _replicas){
+			TrigramCounts* counts = replica->_trigram_counts;
+			for(size_t slot = 0;slot < counts->_capacity;slot++){
+				uint64_t key = counts->_keys[slot];
+				if(key == BHMM_TRIGRAM_EMPTY_KEY){
+					continue;
+				}
+				int t_2, t_1, t;
+				counts->unpack(key, t_2, t_1, t);
+				int delta = counts->_values[slot] - old_counts.get(t_2, t_1, t);
+				if(delta != 0){
+					global->add(t_2, t_1, t, delta);
+				}
+			}
+			// 表を広げた時に0になって捨てられた要素
+			for(size_t slot = 0;slot < old_counts._capacity;slot++){
+				uint64_t key = old_counts._keys[slot];
+				if(key == BHMM_TRIGRAM_EMPTY_KEY || old_counts._values[slot] == 0 || counts->has_key(key)){
+					continue;
+				}
+				int t_2, t_1, t;
+				old_counts.unpack(key, t_2, t_1, t);
+				global->add(t_2, t_1, t, -old_counts._values[slot]);
+			}
+		}
+	}
+	void ParallelGibbs::_merge_replicas(){
+		_merge_trigram_counts();
+		_merge_tensor(_hmm->_bigram_counts, &HMM::_bigram_counts);
+		_merge_tensor(_hmm->_unigram_counts, &HMM::_unigram_counts);
+		// 品詞-単語ペアはどれかのスレッドが触れた単語だけを見る
+		int num_tags = _hmm->_num_tags;
+		EmissionCounts* global = _hmm->_tag_word_counts;
+		std::vector<int> old_counts(num_tags + 1);
+		std::vector<int> new_counts(num_tags + 1);
+		std::vector<int> replica_counts(num_tags + 1);
+		std::vector<char> is_merged(_hmm->_num_words, 0);
+		std::vector<id> merged_words;
+		for(int thread_id = 0;thread_id < _num_threads;thread_id++){
+			for(id word_id: _touched_words[thread_id]){
+				if(is_merged[word_id] == 1){
+					continue;
+				}
+				is_merged[word_id] = 1;
+				merged_words.push_back(word_id);
+				global->get_counts_of_word(word_id, old_counts.data());
+				new_counts = old_counts;
+				for(int k = 0;k < _num_threads;k++){
+					if(_is_touched[k][word_id] == 0){
+						continue;
+					}
+					_replicas[k]->_tag_word_counts->get_counts_of_word(word_id, replica_counts.data());
+					for(int tag = 1;tag <= num_tags;tag++){
+						new_counts[tag] += replica_counts[tag] - old_counts[tag];
+					}
+				}
+				for(int tag = 1;tag <= num_tags;tag++){
+					if(new_counts[tag] != old_counts[tag]){
+						global->set(tag, word_id, new_counts[tag]);
+					}
+				}
+			}
+		}
+		_hmm->invalidate_denominator_caches();
+		_hmm->_num_words_of_tag.clear();		// 複製での品詞の変化は数えていない
+		// 複製を最新の全体のカウントに戻す
+		for(int thread_id = 0;thread_id < _num_threads;thread_id++){
+			HMM* replica = _replicas[thread_id];
+			replica->_trigram_counts->copy_from(_hmm->_trigram_counts);
+			replica->_bigram_counts->copy_from(_hmm->_bigram_counts);
+			replica->_unigram_counts->copy_from(_hmm->_unigram_counts);
+			for(id word_id: merged_words){
+				replica->_tag_word_counts->copy_word_from(global, word_id);
+			}
+			replica->invalidate_denominator_caches();
+			for(id word_id: _touched_words[thread_id]){
+				_is_touched[thread_id][word_id] = 0;
+			}
+			_touched_words[thread_id].clear();
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "hmm.h"
+#include "sampler.h"
+
+namespace bhmm {
+	// AD-LDA方式の近似的な並列Gibbsサンプリング
+	// 文をスレッド数に分割し、各スレッドはカウントの複製に対して担当分の文をサンプリングする
+	// 一定数の文をサンプリングするごとに複製での増減を全体のカウントに足し込み、複製を最新の状態に戻す
+	class ParallelGibbs {
+	private:
+		ParallelGibbs(const ParallelGibbs &);
+		ParallelGibbs &operator=(const ParallelGibbs &);
+		void _sample_shard(int thread_id, int num_sentences);
+		void _merge_replicas();
+		void _merge_tensor(Tensor* global, Tensor* HMM::*member);
+		void _merge_trigram_counts();
+	public:
+		HMM* _hmm;
+		int _num_threads;
+		int _sync_interval;		// 同期までに各スレッドがサンプリングする文の数. 0なら1エポックに1回
+		bool _blocked;			// 文単位のブロック化サンプリングを使うかどうか
+		std::vector<HMM*> _replicas;
+		std::vector<sampler::Xoshiro256> _rngs;	// スレッドごとの乱数系列
+		WordSequences* _dataset;
+		std::vector<std::vector<int>> _shards;	// スレッドごとの担当の文番号
+		std::vector<int> _shard_positions;	// 次にサンプリングする文の位置
+		std::vector<std::vector<id>> _touched_words;	// 前回の同期以降に各スレッドが触れた単語
+		std::vector<std::vector<char>> _is_touched;
+		ParallelGibbs(HMM* hmm, int num_threads, uint64_t seed);
+		~ParallelGibbs();
+		void set_sync_interval(int interval);
+		void set_blocked(bool blocked);
+		// 1エポック分の文をシャッフル済みの順序で割り当てる
+		void begin_epoch(WordSequences &dataset, std::vector<int> &indices);
+		// 各スレッドがsync_interval個の文をサンプリングして同期する
+		// エポックの文を全てサンプリングし終えたらfalseを返す
+		bool gibbs_next_round();
+		void gibbs(WordSequences &dataset, std::vector<int> &indices);
+	};
+}
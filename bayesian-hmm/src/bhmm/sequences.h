@@ -0,0 +1,63 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "common.h"
+
+#define BHMM_NUM_SENTINELS 2	// 文頭と文末に置く<s>と</s>の数
+
+namespace bhmm {
+	// 1文分の単語IDと品詞への参照
+	// 添字は文頭の<s>2つと文末の</s>2つを含めた位置で数え、
+	// 単語は[BHMM_NUM_SENTINELS, size() - BHMM_NUM_SENTINELS)に並ぶ
+	class Sentence {
+	public:
+		id* _word_ids;
+		int* _states;
+		int _length;	// <s>と</s>を含む
+		Sentence(id* word_ids, int* states, int length){
+			_word_ids = word_ids;
+			_states = states;
+			_length = length;
+		}
+		inline int size() const {
+			return _length;
+		}
+		inline id get_word_id(int i) const {
+			assert(0 <= i && i < _length);
+			return _word_ids[i];
+		}
+		inline int get_state(int i) const {
+			assert(0 <= i && i < _length);
+			return _states[i];
+		}
+		inline void set_state(int i, int state){
+			assert(0 <= i && i < _length);
+			_states[i] = state;
+		}
+	};
+	// 全ての文の単語IDと品詞をそれぞれ1本の配列に並べる
+	// n番目の文は[_offsets[n], _offsets[n + 1])で、<s>と</s>の位置も含む
+	// 単語ごとにオブジェクトを持たないので1単語あたり8バイトで済み、サンプリングでは連続した領域を順に読む
+	class WordSequences {
+	public:
+		std::vector<id> _word_ids;
+		std::vector<int> _states;
+		std::vector<size_t> _offsets;
+		WordSequences();
+		// <s>と</s>で挟んで追加する. 品詞は<s>と</s>が0、単語が1
+		void add_sentence(const id* word_ids, int num_words);
+		void clear();
+		inline int size() const {
+			return _offsets.size() - 1;
+		}
+		inline size_t get_num_tokens() const {
+			return _word_ids.size();
+		}
+		inline Sentence get_sentence(int n){
+			assert(0 <= n && n < size());
+			size_t begin = _offsets[n];
+			return Sentence(_word_ids.data() + begin, _states.data() + begin, _offsets[n + 1] - begin);
+		}
+	};
+}
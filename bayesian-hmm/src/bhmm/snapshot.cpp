@@ -0,0 +1,31 @@
+#include <cmath>
+#include <cstdlib>
+#include <new>
+#include "snapshot.h"
+#include "tensor.h"
+
+namespace bhmm {
+	DecodingSnapshot::DecodingSnapshot(HMM* hmm){
+		assert(hmm != NULL);
+		assert(hmm->_trigram_counts->is_dense());
+		_num_tags = hmm->_num_tags;
+		size_t size = (size_t)(_num_tags + 1) * (_num_tags + 1) * (_num_tags + 1);
+		void* ptr = NULL;
+		if(posix_memalign(&ptr, BHMM_TENSOR_ALIGNMENT, size * sizeof(double)) != 0){
+			throw std::bad_alloc();
+		}
+		_log_transitions = static_cast<double*>(ptr);
+		for(int t_1 = 0;t_1 <= _num_tags;t_1++){
+			for(int t_2 = 0;t_2 <= _num_tags;t_2++){
+				double* row = _log_transitions + ((size_t)t_1 * (_num_tags + 1) + t_2) * (_num_tags + 1);
+				row[0] = 0;	// <s>には遷移しない
+				for(int t = 1;t <= _num_tags;t++){
+					row[t] = log(hmm->compute_p_ti_given_t(t, t_1, t_2));
+				}
+			}
+		}
+	}
+	DecodingSnapshot::~DecodingSnapshot(){
+		free(_log_transitions);
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include "hmm.h"
+
+namespace bhmm {
+	// 復号用に固めたモデル
+	// 学習中は変わるカウントとalphaから遷移確率の対数を一度だけ求めておく
+	// カウントが変わったら作り直す
+	// 大きさは(T+1)^3なので3-gramが密なモデルにだけ使う
+	class DecodingSnapshot {
+	private:
+		DecodingSnapshot(const DecodingSnapshot &);
+		DecodingSnapshot &operator=(const DecodingSnapshot &);
+	public:
+		int _num_tags;
+		double* _log_transitions;	// [t_{i-1}][t_{i-2}][t_i] = log P(t_i|t_{i-2}, t_{i-1})
+		DecodingSnapshot(HMM* hmm);
+		~DecodingSnapshot();
+		// log P(・|t_2, t_1)の連続領域の先頭
+		inline const double* log_transitions(int t_2, int t_1) const {
+			assert(0 <= t_2 && t_2 <= _num_tags && 0 <= t_1 && t_1 <= _num_tags);
+			return _log_transitions + ((size_t)t_1 * (_num_tags + 1) + t_2) * (_num_tags + 1);
+		}
+	};
+}
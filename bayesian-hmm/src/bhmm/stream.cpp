@@ -0,0 +1,213 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstring>
+#include "stream.h"
+
+namespace bhmm {
+	static inline bool _is_space(char ch){
+		return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+	}
+	SentenceStream::SentenceStream(){
+		_corpus = NULL;
+		_next_sentence = 0;
+		_address = NULL;
+		_num_bytes = 0;
+		_begin = NULL;
+		_end = NULL;
+		_cursor = NULL;
+		_released = NULL;
+		_num_sentences = 0;
+		_num_tokens = 0;
+		_max_num_words_in_line = 0;
+	}
+	SentenceStream::~SentenceStream(){
+		close();
+	}
+	bool SentenceStream::open(const std::string &filename){
+		close();
+		if(corpus_file::is_corpus_file(filename)){
+			_corpus = new corpus_file::MappedCorpus();
+			if(_corpus->open(filename) == false){
+				close();
+				return false;
+			}
+			_num_sentences = _corpus->get_num_sentences();
+			_num_tokens = _corpus->get_num_tokens();
+			for(size_t n = 0;n < _num_sentences;n++){
+				int length = _corpus->_sentence_offsets[n + 1] - _corpus->_sentence_offsets[n];
+				if(length > _max_num_words_in_line){
+					_max_num_words_in_line = length;
+				}
+			}
+			return true;
+		}
+		if(_open_textfile(filename) == false){
+			close();
+			return false;
+		}
+		return true;
+	}
+	// 1度読み通して単語の表を作り、文の数と単語数を数える
+	bool SentenceStream::_open_textfile(const std::string &filename){
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd < 0){
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0){
+			::close(fd);
+			return false;
+		}
+		_num_bytes = st.st_size;
+		if(_num_bytes > 0){
+			void* address = mmap(NULL, _num_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			if(address == MAP_FAILED){
+				::close(fd);
+				_num_bytes = 0;
+				return false;
+			}
+			_address = address;
+			madvise(_address, _num_bytes, MADV_SEQUENTIAL);
+		}
+		::close(fd);	// 対応付けはファイルを閉じても残る
+		_begin = static_cast<const char*>(_address);
+		_end = _begin + _num_bytes;
+		if(_num_bytes >= 3 && std::memcmp(_begin, "\xEF\xBB\xBF", 3) == 0){
+			_begin += 3;	// BOM
+		}
+		rewind();
+		std::vector<int> token_ids;
+		while(_next_line(token_ids, true)){
+			_num_sentences++;
+			_num_tokens += token_ids.size();
+			if((int)token_ids.size() > _max_num_words_in_line){
+				_max_num_words_in_line = token_ids.size();
+			}
+		}
+		rewind();
+		return true;
+	}
+	void SentenceStream::close(){
+		delete _corpus;
+		_corpus = NULL;
+		if(_address != NULL){
+			munmap(_address, _num_bytes);
+		}
+		_address = NULL;
+		_num_bytes = 0;
+		_begin = NULL;
+		_end = NULL;
+		_cursor = NULL;
+		_released = NULL;
+		_next_sentence = 0;
+		_type_ids.clear();
+		_type_strings.clear();
+		_type_counts.clear();
+		_num_sentences = 0;
+		_num_tokens = 0;
+		_max_num_words_in_line = 0;
+	}
+	int SentenceStream::get_num_types() const {
+		if(_corpus != NULL){
+			return _corpus->get_num_types();
+		}
+		return _type_counts.size();
+	}
+	int SentenceStream::get_type_count(int type_id) const {
+		assert(0 <= type_id && type_id < get_num_types());
+		if(_corpus != NULL){
+			return _corpus->get_type_count(type_id);
+		}
+		return _type_counts[type_id];
+	}
+	void SentenceStream::get_type_string(int type_id, std::string &str) const {
+		assert(0 <= type_id && type_id < get_num_types());
+		if(_corpus != NULL){
+			const char* begin;
+			const char* end;
+			_corpus->get_type_string(type_id, begin, end);
+			str.assign(begin, end);
+			return;
+		}
+		str = _type_strings[type_id];
+	}
+	void SentenceStream::rewind(){
+		_next_sentence = 0;
+		_cursor = _begin;
+		_released = static_cast<const char*>(_address);
+	}
+	bool SentenceStream::next_sentence(std::vector<int> &token_ids){
+		if(_corpus != NULL){
+			if(_next_sentence >= _num_sentences){
+				rewind();
+				return false;
+			}
+			int length;
+			const int* tokens = _corpus->get_sentence(_next_sentence, length);
+			token_ids.assign(tokens, tokens + length);
+			_next_sentence++;
+			return true;
+		}
+		if(_next_line(token_ids, false) == false){
+			rewind();
+			return false;
+		}
+		return true;
+	}
+	// 空行は読み飛ばす. count_typesなら単語の表に登録して頻度を数える
+	bool SentenceStream::_next_line(std::vector<int> &token_ids, bool count_types){
+		while(_cursor < _end){
+			const char* line = _cursor;
+			const char* line_end = static_cast<const char*>(std::memchr(line, '\n', _end - line));
+			if(line_end == NULL){
+				line_end = _end;
+			}
+			token_ids.clear();
+			const char* token = line;
+			while(token < line_end){
+				while(token < line_end && _is_space(*token)){
+					token++;
+				}
+				const char* token_end = token;
+				while(token_end < line_end && _is_space(*token_end) == false){
+					token_end++;
+				}
+				if(token < token_end){
+					token_ids.push_back(_intern_token(token, token_end, count_types));
+				}
+				token = token_end;
+			}
+			_cursor = line_end + 1;
+			// 読み終えたページを手放してメモリ使用量を抑える
+			if(_cursor - _released >= STREAM_RELEASE_INTERVAL){
+				size_t page_size = sysconf(_SC_PAGESIZE);
+				size_t length = (_cursor - _released) / page_size * page_size;
+				madvise(const_cast<char*>(_released), length, MADV_DONTNEED);
+				_released += length;
+			}
+			if(token_ids.size() > 0){
+				return true;
+			}
+		}
+		return false;
+	}
+	int SentenceStream::_intern_token(const char* begin, const char* end, bool count_types){
+		_token_buffer.assign(begin, end);
+		auto itr = _type_ids.find(_token_buffer);
+		if(itr != _type_ids.end()){
+			if(count_types){
+				_type_counts[itr->second] += 1;
+			}
+			return itr->second;
+		}
+		assert(count_types);	// 2回目以降に読む時は全ての単語が登録済み
+		int type_id = _type_strings.size();
+		_type_ids[_token_buffer] = type_id;
+		_type_strings.push_back(_token_buffer);
+		_type_counts.push_back(1);
+		return type_id;
+	}
+}
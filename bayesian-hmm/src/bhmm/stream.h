@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "corpus_file.h"
+
+#define STREAM_RELEASE_INTERVAL (64 << 20)	// 読み終えた領域をこの大きさごとに手放す
+
+namespace bhmm {
+	// 単語分割済みのコーパスを先頭から1文ずつ読む
+	// テキストファイル(1行1文、空白区切り、空行は読み飛ばす)とコーパスの独自バイナリ形式のどちらも扱える
+	// どちらもmmapして読むだけなので、コーパス全体の単語ID列はメモリに持たない
+	// テキストファイルは開く時に1度読み通して単語の種類と頻度を数え、単語の表だけを持つ
+	// 単語IDはコーパス内の通し番号で、モデルの辞書のIDとは別
+	class SentenceStream {
+	private:
+		SentenceStream(const SentenceStream &);
+		SentenceStream &operator=(const SentenceStream &);
+		bool _open_textfile(const std::string &filename);
+		bool _next_line(std::vector<int> &token_ids, bool count_types);
+		int _intern_token(const char* begin, const char* end, bool count_types);
+		corpus_file::MappedCorpus* _corpus;	// テキストファイルならNULL
+		size_t _next_sentence;				// バイナリ形式で次に読む文
+		// テキストファイル
+		void* _address;
+		size_t _num_bytes;
+		const char* _begin;
+		const char* _end;
+		const char* _cursor;
+		const char* _released;
+		std::unordered_map<std::string, int> _type_ids;
+		std::vector<std::string> _type_strings;
+		std::vector<int> _type_counts;
+		std::string _token_buffer;
+	public:
+		size_t _num_sentences;
+		size_t _num_tokens;
+		int _max_num_words_in_line;
+		SentenceStream();
+		~SentenceStream();
+		bool open(const std::string &filename);
+		void close();
+		int get_num_types() const;
+		int get_type_count(int type_id) const;
+		// UTF-8の文字列
+		void get_type_string(int type_id, std::string &str) const;
+		// 次の文の単語ID列をtoken_idsに入れる
+		// 最後まで読んだらfalseを返して先頭に戻る
+		bool next_sentence(std::vector<int> &token_ids);
+		void rewind();
+	};
+}
@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <cstring>
+#include "tagdict.h"
+
+namespace bhmm {
+	TagDictionary::TagDictionary(){
+		_num_tags = 0;
+		_num_words = 0;
+		_num_entries = 0;
+		_offsets = new int[1];
+		_offsets[0] = 0;
+		_tags = NULL;
+	}
+	// offsetsは長さ単語数 + 1, tagsは1からnum_tagsまでの品詞ID
+	TagDictionary::TagDictionary(int num_tags, const std::vector<int> &offsets, const std::vector<int> &tags): TagDictionary(){
+		assert(num_tags > 0);
+		assert(offsets.size() > 0);
+		assert(offsets[0] == 0 && offsets.back() == tags.size());
+		_alloc(num_tags, offsets.size() - 1, tags.size());
+		for(id word_id = 0;word_id <= _num_words;word_id++){
+			_offsets[word_id] = offsets[word_id];
+		}
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			int begin = offsets[word_id];
+			int end = offsets[word_id + 1];
+			assert(begin <= end);
+			for(int k = begin;k < end;k++){
+				assert(1 <= tags[k] && tags[k] <= num_tags);
+				_tags[k] = tags[k];
+			}
+			std::sort(_tags + begin, _tags + end);
+			assert(std::adjacent_find(_tags + begin, _tags + end) == _tags + end);
+		}
+	}
+	TagDictionary::~TagDictionary(){
+		delete[] _offsets;
+		delete[] _tags;
+	}
+	void TagDictionary::_alloc(int num_tags, id num_words, int num_entries){
+		delete[] _offsets;
+		delete[] _tags;
+		_num_tags = num_tags;
+		_num_words = num_words;
+		_num_entries = num_entries;
+		_offsets = new int[num_words + 1];
+		_tags = new int[std::max(num_entries, 1)];
+	}
+	void TagDictionary::copy_from(const TagDictionary* dictionary){
+		if(_num_words != dictionary->_num_words || _num_entries != dictionary->_num_entries){
+			_alloc(dictionary->_num_tags, dictionary->_num_words, dictionary->_num_entries);
+		}
+		_num_tags = dictionary->_num_tags;
+		std::memcpy(_offsets, dictionary->_offsets, sizeof(int) * (_num_words + 1));
+		std::memcpy(_tags, dictionary->_tags, sizeof(int) * _num_entries);
+	}
+	bool TagDictionary::is_allowed(id word_id, int tag) const {
+		const int* tags = NULL;
+		int num_tags_of_word = get_tags_of_word(word_id, tags);
+		if(num_tags_of_word == 0){
+			return true;
+		}
+		return std::binary_search(tags, tags + num_tags_of_word, tag);
+	}
+}
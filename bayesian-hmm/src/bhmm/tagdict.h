@@ -0,0 +1,64 @@
+#pragma once
+#include <cassert>
+#include <vector>
+#include "common.h"
+
+namespace bhmm {
+	// 単語ごとに取りうる品詞の一覧
+	// CSR形式で、単語wの品詞は_tags[_offsets[w]]から_tags[_offsets[w + 1] - 1]までに昇順で並ぶ
+	// 一覧が空の単語と辞書の範囲外の単語は全ての品詞を取りうる
+	class TagDictionary {
+	private:
+		TagDictionary(const TagDictionary &);
+		TagDictionary &operator=(const TagDictionary &);
+		void _alloc(int num_tags, id num_words, int num_entries);
+	public:
+		int _num_tags;
+		id _num_words;
+		int _num_entries;
+		int* _offsets;	// 長さ_num_words + 1
+		int* _tags;		// 長さ_num_entries
+		TagDictionary();
+		TagDictionary(int num_tags, const std::vector<int> &offsets, const std::vector<int> &tags);
+		~TagDictionary();
+		void copy_from(const TagDictionary* dictionary);
+		bool is_allowed(id word_id, int tag) const;
+		// 単語word_idの品詞の一覧をtagsに入れて個数を返す. 制約がなければ0
+		inline int get_tags_of_word(id word_id, const int* &tags) const {
+			assert(word_id >= 0);
+			if(word_id >= _num_words){
+				return 0;
+			}
+			tags = _tags + _offsets[word_id];
+			return _offsets[word_id + 1] - _offsets[word_id];
+		}
+		template <class Archive>
+		void save(Archive &ar) const {
+			ar & _num_tags;
+			ar & _num_words;
+			ar & _num_entries;
+			for(id word_id = 0;word_id <= _num_words;word_id++){
+				ar & _offsets[word_id];
+			}
+			for(int k = 0;k < _num_entries;k++){
+				ar & _tags[k];
+			}
+		}
+		template <class Archive>
+		void load(Archive &ar){
+			int num_tags = 0;
+			id num_words = 0;
+			int num_entries = 0;
+			ar & num_tags;
+			ar & num_words;
+			ar & num_entries;
+			_alloc(num_tags, num_words, num_entries);
+			for(id word_id = 0;word_id <= _num_words;word_id++){
+				ar & _offsets[word_id];
+			}
+			for(int k = 0;k < _num_entries;k++){
+				ar & _tags[k];
+			}
+		}
+	};
+}
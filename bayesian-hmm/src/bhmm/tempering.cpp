@@ -0,0 +1,137 @@
+#include <cmath>
+#include <thread>
+#include "tempering.h"
+
+namespace bhmm {
+	ParallelTempering::ParallelTempering(HMM* hmm, int num_chains, double max_temperature, uint64_t seed){
+		assert(hmm != NULL);
+		assert(num_chains > 0);
+		_hmm = hmm;
+		_num_chains = num_chains;
+		_max_temperature = max_temperature;
+		_blocked = false;
+		_epoch = 0;
+		// 同じseedなら毎回同じ系列になる. 鎖ごとにjumpして重ならない系列を使う
+		sampler::Xoshiro256 rng(seed);
+		_exchange_rng = rng;
+		_exchange_rng.jump();
+		for(int chain = 0;chain < num_chains;chain++){
+			_chains.push_back((chain == 0) ? hmm : new HMM());
+			rng.jump();
+			_rngs.push_back(rng);
+			rng.jump();
+		}
+		_states.resize(num_chains);
+		_temperatures.resize(num_chains, 1);
+		_log_p.resize(num_chains, 0);
+		_num_proposed.resize(num_chains, 0);
+		_num_accepted.resize(num_chains, 0);
+		_swap_buffer = new HMM();
+	}
+	ParallelTempering::~ParallelTempering(){
+		for(int chain = 1;chain < _num_chains;chain++){
+			delete _chains[chain];
+		}
+		delete _swap_buffer;
+	}
+	void ParallelTempering::set_blocked(bool blocked){
+		_blocked = blocked;
+	}
+	void ParallelTempering::set_max_temperature(double temperature){
+		_max_temperature = temperature;
+	}
+	void ParallelTempering::update_temperatures(){
+		double base = _hmm->_temperature;
+		double ratio = 1;
+		if(_num_chains > 1 && _max_temperature > base){
+			ratio = pow(_max_temperature / base, 1.0 / (_num_chains - 1));
+		}
+		for(int chain = 0;chain < _num_chains;chain++){
+			_temperatures[chain] = base * pow(ratio, chain);
+		}
+	}
+	// 高温の鎖はモデルと同じハイパーパラメータを使う
+	// データセットの大きさが変わっていれば最も低い鎖の状態から始め直す
+	void ParallelTempering::_begin_epoch(WordSequences &dataset){
+		update_temperatures();
+		for(int chain = 1;chain < _num_chains;chain++){
+			HMM* hmm = _chains[chain];
+			if(_states[chain].size() != dataset._states.size() || hmm->_num_tags != _hmm->_num_tags || hmm->_num_words != _hmm->_num_words){
+				hmm->copy_from(_hmm);
+				_states[chain] = dataset._states;
+			}
+			hmm->_alpha = _hmm->_alpha;
+			for(int tag = 1;tag <= _hmm->_num_tags;tag++){
+				hmm->_beta[tag] = _hmm->_beta[tag];
+			}
+			hmm->invalidate_denominator_caches();
+			hmm->_temperature = _temperatures[chain];
+			hmm->_minimum_temperature = _temperatures[chain];
+		}
+	}
+	void ParallelTempering::gibbs(WordSequences &dataset, std::vector<int> &indices){
+		_begin_epoch(dataset);
+		std::vector<std::thread> threads;
+		for(int chain = 1;chain < _num_chains;chain++){
+			threads.push_back(std::thread(&ParallelTempering::_sample_chain, this, chain, &dataset, &indices));
+		}
+		_sample_chain(0, &dataset, &indices);
+		for(auto &thread: threads){
+			thread.join();
+		}
+		// 偶数番目と奇数番目の組を交互に試す
+		for(int chain = _epoch % 2;chain + 1 < _num_chains;chain += 2){
+			_exchange(chain, dataset);
+		}
+		_epoch++;
+	}
+	// 単語IDは読むだけなので全ての鎖で共有する
+	void ParallelTempering::_sample_chain(int chain, WordSequences* dataset, std::vector<int>* indices){
+		HMM* hmm = _chains[chain];
+		int* states = (chain == 0) ? dataset->_states.data() : _states[chain].data();
+		sampler::Xoshiro256 &rng = _rngs[chain];
+		for(int data_index: *indices){
+			size_t begin = dataset->_offsets[data_index];
+			Sentence sentence(dataset->_word_ids.data() + begin, states + begin, dataset->_offsets[data_index + 1] - begin);
+			if(_blocked){
+				hmm->blocked_gibbs(sentence, rng);
+			}else{
+				hmm->gibbs(sentence, rng);
+			}
+		}
+		_log_p[chain] = hmm->compute_log_p_joint();
+	}
+	// 温度T_kの鎖は p(t, w)^(1/T_k) を目標にしているので
+	// 交換の採択率は min(1, exp((1/T_k - 1/T_{k+1}) * (log p_{k+1} - log p_k)))
+	void ParallelTempering::_exchange(int chain, WordSequences &dataset){
+		int next = chain + 1;
+		double log_ratio = (1.0 / _temperatures[chain] - 1.0 / _temperatures[next]) * (_log_p[next] - _log_p[chain]);
+		_num_proposed[chain] += 1;
+		if(log_ratio < 0 && log(_exchange_rng.uniform()) >= log_ratio){
+			return;
+		}
+		_num_accepted[chain] += 1;
+		std::swap(_log_p[chain], _log_p[next]);
+		if(chain > 0){
+			std::swap(_chains[chain], _chains[next]);
+			_states[chain].swap(_states[next]);
+			return;
+		}
+		// 最も低い鎖はモデルが持つHMMなので中身を入れ替える
+		double temperature = _hmm->_temperature;
+		double minimum_temperature = _hmm->_minimum_temperature;
+		_swap_buffer->copy_from(_hmm);
+		_hmm->copy_from(_chains[next]);
+		_chains[next]->copy_from(_swap_buffer);
+		_hmm->_temperature = temperature;
+		_hmm->_minimum_temperature = minimum_temperature;
+		dataset._states.swap(_states[next]);
+	}
+	double ParallelTempering::get_acceptance_rate(int chain){
+		assert(0 <= chain && chain + 1 < _num_chains);
+		if(_num_proposed[chain] == 0){
+			return 0;
+		}
+		return _num_accepted[chain] / (double)_num_proposed[chain];
+	}
+}
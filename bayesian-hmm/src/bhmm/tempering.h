@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "hmm.h"
+#include "sampler.h"
+
+namespace bhmm {
+	// レプリカ交換法
+	// 温度の異なる複数の鎖をそれぞれ別のスレッドでサンプリングし、エポックごとに隣り合う温度の鎖の状態を交換する
+	// 単語IDはデータセットのものを共有し、カウントと品詞の列は鎖ごとに持つ
+	// 最も温度の低い鎖はモデルのHMMとデータセットの品詞の列そのもので、高温の鎖から良い状態を受け取る
+	class ParallelTempering {
+	private:
+		ParallelTempering(const ParallelTempering &);
+		ParallelTempering &operator=(const ParallelTempering &);
+		void _begin_epoch(WordSequences &dataset);
+		void _sample_chain(int chain, WordSequences* dataset, std::vector<int>* indices);
+		void _exchange(int chain, WordSequences &dataset);
+	public:
+		HMM* _hmm;				// 温度の最も低い鎖
+		int _num_chains;
+		double _max_temperature;
+		bool _blocked;			// 文単位のブロック化サンプリングを使うかどうか
+		std::vector<HMM*> _chains;				// [0]は_hmm. 温度の低い順
+		std::vector<std::vector<int>> _states;	// 鎖ごとの品詞の列. [0]は使わずにデータセットの_statesを使う
+		std::vector<double> _temperatures;
+		std::vector<double> _log_p;				// エポックの終わりでの各鎖のlog p(t, w)
+		std::vector<sampler::Xoshiro256> _rngs;	// 鎖ごとの乱数系列
+		sampler::Xoshiro256 _exchange_rng;
+		std::vector<int> _num_proposed;			// [k] 鎖kとk+1の交換を試みた回数
+		std::vector<int> _num_accepted;
+		HMM* _swap_buffer;
+		int _epoch;
+		ParallelTempering(HMM* hmm, int num_chains, double max_temperature, uint64_t seed);
+		~ParallelTempering();
+		void set_blocked(bool blocked);
+		void set_max_temperature(double temperature);
+		// 温度は最も低い鎖の温度から_max_temperatureまでの等比数列
+		void update_temperatures();
+		// 全ての鎖を1エポックずつサンプリングしてから交換を試みる
+		void gibbs(WordSequences &dataset, std::vector<int> &indices);
+		double get_acceptance_rate(int chain);
+	};
+}
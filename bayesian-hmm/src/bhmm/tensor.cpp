@@ -0,0 +1,59 @@
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include "tensor.h"
+
+namespace bhmm {
+	Tensor::Tensor(){
+		_data = NULL;
+		_size = 0;
+		for(int n = 0;n < 3;n++){
+			_shape[n] = 0;
+			_stride[n] = 0;
+		}
+	}
+	Tensor::Tensor(size_t dim_0, size_t dim_1, size_t dim_2): Tensor(){
+		alloc(dim_0, dim_1, dim_2);
+	}
+	Tensor::~Tensor(){
+		free(_data);
+	}
+	void Tensor::alloc(size_t dim_0, size_t dim_1, size_t dim_2){
+		assert(dim_0 > 0 && dim_1 > 0 && dim_2 > 0);
+		free(_data);
+		_data = NULL;
+		_shape[0] = dim_0;
+		_shape[1] = dim_1;
+		_shape[2] = dim_2;
+		_stride[0] = dim_1 * dim_2;
+		_stride[1] = dim_2;
+		_stride[2] = 1;
+		_size = dim_0 * dim_1 * dim_2;
+		void* ptr = NULL;
+		if(posix_memalign(&ptr, BHMM_TENSOR_ALIGNMENT, get_num_bytes()) != 0){
+			throw std::bad_alloc();
+		}
+		_data = static_cast<int*>(ptr);
+		fill(0);
+	}
+	void Tensor::fill(int value){
+		if(value == 0){
+			memset(_data, 0, get_num_bytes());
+			return;
+		}
+		for(size_t i = 0;i < _size;i++){
+			_data[i] = value;
+		}
+	}
+	// 形が違う場合は確保し直す
+	void Tensor::copy_from(const Tensor* tensor){
+		assert(tensor != NULL && tensor->_data != NULL);
+		if(_data == NULL || _shape[0] != tensor->_shape[0] || _shape[1] != tensor->_shape[1] || _shape[2] != tensor->_shape[2]){
+			alloc(tensor->_shape[0], tensor->_shape[1], tensor->_shape[2]);
+		}
+		memcpy(_data, tensor->_data, get_num_bytes());
+	}
+	size_t Tensor::get_num_bytes() const {
+		return _size * sizeof(int);
+	}
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+
+#define BHMM_TENSOR_ALIGNMENT 64	// キャッシュラインの大きさ
+
+namespace bhmm {
+	// カウント用の密なテンソル
+	// 全要素を1本のアラインされたバッファに確保し、strideで添字を計算する
+	class Tensor {
+	private:
+		Tensor(const Tensor &);
+		Tensor &operator=(const Tensor &);
+	public:
+		int* _data;
+		size_t _size;			// 全要素数
+		size_t _shape[3];
+		size_t _stride[3];
+		Tensor();
+		Tensor(size_t dim_0, size_t dim_1 = 1, size_t dim_2 = 1);
+		~Tensor();
+		void alloc(size_t dim_0, size_t dim_1 = 1, size_t dim_2 = 1);
+		void fill(int value);
+		void copy_from(const Tensor* tensor);
+		size_t get_num_bytes() const;
+		inline int &at(size_t i){
+			assert(i < _shape[0]);
+			return _data[i];
+		}
+		inline int &at(size_t i, size_t j){
+			assert(i < _shape[0] && j < _shape[1]);
+			return _data[i * _stride[0] + j];
+		}
+		inline int &at(size_t i, size_t j, size_t k){
+			assert(i < _shape[0] && j < _shape[1] && k < _shape[2]);
+			return _data[i * _stride[0] + j * _stride[1] + k];
+		}
+		// 最後の次元に沿った連続領域の先頭
+		inline int* slice(size_t i){
+			assert(i < _shape[0]);
+			return _data + i * _stride[0];
+		}
+		inline int* slice(size_t i, size_t j){
+			assert(i < _shape[0] && j < _shape[1]);
+			return _data + i * _stride[0] + j * _stride[1];
+		}
+		// slice(i)やslice(i, j)の連続領域をキャッシュに載せておく
+		inline void prefetch(size_t i){
+			_prefetch(slice(i), _stride[0]);
+		}
+		inline void prefetch(size_t i, size_t j){
+			_prefetch(slice(i, j), _stride[1]);
+		}
+		inline void _prefetch(const int* begin, size_t length){
+#ifdef __GNUC__
+			const char* ptr = reinterpret_cast<const char*>(begin);
+			const char* end = reinterpret_cast<const char*>(begin + length);
+			for(;ptr < end;ptr += BHMM_TENSOR_ALIGNMENT){
+				__builtin_prefetch(ptr);
+			}
+#endif
+		}
+	};
+}
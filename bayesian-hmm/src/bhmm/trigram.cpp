@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cstring>
+#include "trigram.h"
+
+#define BHMM_TRIGRAM_MIN_CAPACITY 1024
+
+namespace bhmm {
+	TrigramCounts::TrigramCounts(){
+		_num_tags = 0;
+		_dense = NULL;
+		_keys = NULL;
+		_values = NULL;
+		_capacity = 0;
+		_capacity_bits = 0;
+		_num_entries = 0;
+	}
+	TrigramCounts::TrigramCounts(int num_tags): TrigramCounts(){
+		_init(num_tags, is_dense_preferred(num_tags));
+	}
+	TrigramCounts::TrigramCounts(int num_tags, bool dense): TrigramCounts(){
+		_init(num_tags, dense);
+	}
+	TrigramCounts::~TrigramCounts(){
+		_free();
+	}
+	bool TrigramCounts::is_dense_preferred(int num_tags){
+		return num_tags <= BHMM_DENSE_TRIGRAM_MAX_TAGS;
+	}
+	void TrigramCounts::_init(int num_tags, bool dense){
+		assert(num_tags > 0);
+		_free();
+		_num_tags = num_tags;
+		if(dense){
+			_dense = new Tensor(num_tags + 1, num_tags + 1, num_tags + 1);
+			return;
+		}
+		_alloc_table(BHMM_TRIGRAM_MIN_CAPACITY);
+	}
+	void TrigramCounts::_free(){
+		delete _dense;
+		delete[] _keys;
+		delete[] _values;
+		_dense = NULL;
+		_keys = NULL;
+		_values = NULL;
+		_capacity = 0;
+		_capacity_bits = 0;
+		_num_entries = 0;
+	}
+	void TrigramCounts::_alloc_table(size_t capacity){
+		assert(capacity > 0 && (capacity & (capacity - 1)) == 0);
+		_capacity = capacity;
+		_capacity_bits = 0;
+		while(((size_t)1 << _capacity_bits) < capacity){
+			_capacity_bits++;
+		}
+		_keys = new uint64_t[capacity];
+		_values = new int[capacity];
+		std::fill(_keys, _keys + capacity, BHMM_TRIGRAM_EMPTY_KEY);
+		std::fill(_values, _values + capacity, 0);
+		_num_entries = 0;
+	}
+	// 0の要素を捨てて入れ直す
+	void TrigramCounts::_rehash(size_t capacity){
+		uint64_t* keys = _keys;
+		int* values = _values;
+		size_t old_capacity = _capacity;
+		_alloc_table(capacity);
+		for(size_t slot = 0;slot < old_capacity;slot++){
+			if(keys[slot] != BHMM_TRIGRAM_EMPTY_KEY && values[slot] != 0){
+				size_t new_slot = _insert(keys[slot]);
+				_values[new_slot] = values[slot];
+			}
+		}
+		delete[] keys;
+		delete[] values;
+	}
+	// 鍵の番地を返す. なければ値0で追加する
+	size_t TrigramCounts::_insert(uint64_t key){
+		assert(_dense == NULL);
+		size_t slot = _find_slot(key);
+		if(_keys[slot] == key){
+			return slot;
+		}
+		// 使用率を1/2以下に保つ
+		if((_num_entries + 1) * 2 > _capacity){
+			size_t capacity = BHMM_TRIGRAM_MIN_CAPACITY;
+			while(capacity < (get_num_nonzero() + 1) * 4){
+				capacity *= 2;
+			}
+			_rehash(capacity);
+			slot = _find_slot(key);
+		}
+		_keys[slot] = key;
+		_values[slot] = 0;
+		_num_entries++;
+		return slot;
+	}
+	const int* TrigramCounts::row(int t_2, int t_1, int* buffer) const {
+		if(_dense != NULL){
+			return _dense->slice(t_2, t_1);
+		}
+		for(int t = 0;t <= _num_tags;t++){
+			buffer[t] = get(t_2, t_1, t);
+		}
+		return buffer;
+	}
+	void TrigramCounts::prefetch(int t_2, int t_1) const {
+		if(_dense != NULL){
+			_dense->prefetch(t_2, t_1);
+		}
+	}
+	void TrigramCounts::copy_from(const TrigramCounts* counts){
+		assert(counts != NULL && counts->_num_tags > 0);
+		if(counts->is_dense()){
+			if(_dense == NULL || _num_tags != counts->_num_tags){
+				_init(counts->_num_tags, true);
+			}
+			_dense->copy_from(counts->_dense);
+			return;
+		}
+		if(_dense != NULL || _capacity != counts->_capacity){
+			_free();
+			_alloc_table(counts->_capacity);
+		}
+		_num_tags = counts->_num_tags;
+		_num_entries = counts->_num_entries;
+		std::memcpy(_keys, counts->_keys, sizeof(uint64_t) * _capacity);
+		std::memcpy(_values, counts->_values, sizeof(int) * _capacity);
+	}
+	void TrigramCounts::assign_table(int num_tags, const uint64_t* keys, const int* values, size_t capacity){
+		assert(num_tags > 0);
+		_free();
+		_num_tags = num_tags;
+		_alloc_table(capacity);
+		std::memcpy(_keys, keys, sizeof(uint64_t) * capacity);
+		std::memcpy(_values, values, sizeof(int) * capacity);
+		for(size_t slot = 0;slot < capacity;slot++){
+			if(_keys[slot] != BHMM_TRIGRAM_EMPTY_KEY){
+				_num_entries++;
+			}
+		}
+	}
+	size_t TrigramCounts::get_num_nonzero() const {
+		size_t num_nonzero = 0;
+		if(_dense != NULL){
+			for(size_t i = 0;i < _dense->_size;i++){
+				if(_dense->_data[i] != 0){
+					num_nonzero++;
+				}
+			}
+			return num_nonzero;
+		}
+		for(size_t slot = 0;slot < _capacity;slot++){
+			if(_keys[slot] != BHMM_TRIGRAM_EMPTY_KEY && _values[slot] != 0){
+				num_nonzero++;
+			}
+		}
+		return num_nonzero;
+	}
+	size_t TrigramCounts::get_num_bytes() const {
+		if(_dense != NULL){
+			return _dense->get_num_bytes();
+		}
+		return _capacity * (sizeof(uint64_t) + sizeof(int));
+	}
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <boost/serialization/array.hpp>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include "tensor.h"
+
+#define BHMM_DENSE_TRIGRAM_MAX_TAGS 128	// 品詞数がこれ以下なら密なテンソルに持つ
+#define BHMM_TRIGRAM_EMPTY_KEY UINT64_MAX
+
+namespace bhmm {
+	// 品詞3-gramのカウント
+	// 品詞数が少なければ(T+1)^3の密なテンソルに持ち、
+	// 多ければ(t_2, t_1, t)を1つにまとめた鍵で開番地法のハッシュ表に持つ. どちらにするかは構築時に決める
+	// ハッシュ表では0になった要素も番地を使い続け、表を広げる時にまとめて捨てる
+	class TrigramCounts {
+	private:
+		TrigramCounts(const TrigramCounts &);
+		TrigramCounts &operator=(const TrigramCounts &);
+		void _init(int num_tags, bool dense);
+		void _free();
+		void _alloc_table(size_t capacity);
+		void _rehash(size_t capacity);
+		size_t _insert(uint64_t key);
+		inline size_t _find_slot(uint64_t key) const {
+			size_t mask = _capacity - 1;
+			size_t slot = (key * 0x9E3779B97F4A7C15ULL) >> (64 - _capacity_bits);
+			while(_keys[slot] != key && _keys[slot] != BHMM_TRIGRAM_EMPTY_KEY){
+				slot = (slot + 1) & mask;
+			}
+			return slot;
+		}
+	public:
+		int _num_tags;
+		Tensor* _dense;			// ハッシュ表を使う場合はNULL
+		uint64_t* _keys;		// 空き番地はBHMM_TRIGRAM_EMPTY_KEY
+		int* _values;
+		size_t _capacity;		// 2のべき乗
+		int _capacity_bits;
+		size_t _num_entries;	// 使用中の番地の数
+		TrigramCounts();
+		TrigramCounts(int num_tags);
+		TrigramCounts(int num_tags, bool dense);
+		~TrigramCounts();
+		static bool is_dense_preferred(int num_tags);
+		inline bool is_dense() const {
+			return _dense != NULL;
+		}
+		inline uint64_t pack(int t_2, int t_1, int t) const {
+			assert(0 <= t_2 && t_2 <= _num_tags && 0 <= t_1 && t_1 <= _num_tags && 0 <= t && t <= _num_tags);
+			uint64_t size = _num_tags + 1;
+			return ((uint64_t)t_2 * size + t_1) * size + t;
+		}
+		inline void unpack(uint64_t key, int &t_2, int &t_1, int &t) const {
+			uint64_t size = _num_tags + 1;
+			t = key % size;
+			t_1 = (key / size) % size;
+			t_2 = key / size / size;
+		}
+		inline bool has_key(uint64_t key) const {
+			assert(_dense == NULL);
+			return _keys[_find_slot(key)] == key;
+		}
+		inline int get(int t_2, int t_1, int t) const {
+			if(_dense != NULL){
+				return _dense->at(t_2, t_1, t);
+			}
+			size_t slot = _find_slot(pack(t_2, t_1, t));
+			return (_keys[slot] == BHMM_TRIGRAM_EMPTY_KEY) ? 0 : _values[slot];
+		}
+		inline void add(int t_2, int t_1, int t, int delta){
+			if(_dense != NULL){
+				_dense->at(t_2, t_1, t) += delta;
+				assert(_dense->at(t_2, t_1, t) >= 0);
+				return;
+			}
+			size_t slot = _insert(pack(t_2, t_1, t));
+			_values[slot] += delta;
+			assert(_values[slot] >= 0);
+		}
+		inline void increment(int t_2, int t_1, int t){
+			add(t_2, t_1, t, 1);
+		}
+		inline void decrement(int t_2, int t_1, int t){
+			add(t_2, t_1, t, -1);
+		}
+		// (t_2, t_1)に続く各品詞のカウント[0..num_tags]
+		// 密な場合はテンソルの連続領域を、そうでなければbufferに書き出して返す
+		const int* row(int t_2, int t_1, int* buffer) const;
+		void prefetch(int t_2, int t_1) const;
+		void copy_from(const TrigramCounts* counts);
+		// ハッシュ表の番地を並びのまま読み込む. capacityは2のべき乗
+		void assign_table(int num_tags, const uint64_t* keys, const int* values, size_t capacity);
+		size_t get_num_nonzero() const;
+		size_t get_num_bytes() const;
+		template <class Archive>
+		void save(Archive &ar) const {
+			bool dense = is_dense();
+			ar & dense;
+			if(dense){
+				ar & boost::serialization::make_array(_dense->_data, _dense->_size);
+				return;
+			}
+			size_t num_nonzero = get_num_nonzero();
+			ar & num_nonzero;
+			for(size_t slot = 0;slot < _capacity;slot++){
+				if(_keys[slot] != BHMM_TRIGRAM_EMPTY_KEY && _values[slot] != 0){
+					uint64_t key = _keys[slot];
+					int value = _values[slot];
+					ar & key;
+					ar & value;
+				}
+			}
+		}
+		template <class Archive>
+		void load(Archive &ar, int num_tags){
+			bool dense = true;
+			ar & dense;
+			_init(num_tags, dense);
+			if(dense){
+				ar & boost::serialization::make_array(_dense->_data, _dense->_size);
+				return;
+			}
+			size_t num_nonzero = 0;
+			ar & num_nonzero;
+			for(size_t n = 0;n < num_nonzero;n++){
+				uint64_t key = 0;
+				int value = 0;
+				ar & key;
+				ar & value;
+				// _insertで表が作り直されることがあるので番地を先に求める
+				size_t slot = _insert(key);
+				_values[slot] = value;
+			}
+		}
+		// 旧形式の(T+1)^3の配列から読み込む. 表現は品詞数で選ぶ
+		template <class Archive>
+		void load_dense_array(Archive &ar, int num_tags){
+			_init(num_tags, is_dense_preferred(num_tags));
+			if(_dense != NULL){
+				ar & boost::serialization::make_array(_dense->_data, _dense->_size);
+				return;
+			}
+			Tensor tensor(num_tags + 1, num_tags + 1, num_tags + 1);
+			ar & boost::serialization::make_array(tensor._data, tensor._size);
+			for(size_t i = 0;i < tensor._size;i++){
+				if(tensor._data[i] != 0){
+					size_t slot = _insert(i);
+					_values[slot] = tensor._data[i];
+				}
+			}
+		}
+	};
+}
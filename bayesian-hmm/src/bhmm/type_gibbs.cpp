@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "type_gibbs.h"
+
+namespace bhmm {
+	TypeGibbs::TypeGibbs(HMM* hmm, WordSequences &dataset){
+		_hmm = hmm;
+		_dataset = &dataset;
+		// 転置索引. 単語ごとの出現数を数えてから位置を詰める
+		_word_offsets.assign(hmm->_num_words + 1, 0);
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			size_t begin = dataset._offsets[data_index];
+			size_t end = dataset._offsets[data_index + 1];
+			for(size_t position = begin + 2;position < end - 2;position++){	// <s>と</s>の内側だけ考える
+				_word_offsets[dataset._word_ids[position] + 1] += 1;
+			}
+		}
+		for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+			if(_word_offsets[word_id + 1] > 0){
+				_word_order.push_back(word_id);
+			}
+			_word_offsets[word_id + 1] += _word_offsets[word_id];
+		}
+		_positions.resize(_word_offsets[hmm->_num_words]);
+		std::vector<size_t> cursors(_word_offsets.begin(), _word_offsets.end() - 1);
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			size_t begin = dataset._offsets[data_index];
+			size_t end = dataset._offsets[data_index + 1];
+			for(size_t position = begin + 2;position < end - 2;position++){
+				_positions[cursors[dataset._word_ids[position]]++] = position;
+			}
+		}
+		_in_group.assign(dataset._states.size(), false);
+	}
+	void TypeGibbs::count_totals(){
+		HMM* hmm = _hmm;
+		int size = hmm->_num_tags + 1;
+		_context_counts.assign(size * size, 0);
+		for(int t_2 = 0;t_2 <= hmm->_num_tags;t_2++){
+			for(int t_1 = 0;t_1 <= hmm->_num_tags;t_1++){
+				if(t_2 == 0 && t_1 == 0){
+					continue;
+				}
+				_context_counts[t_2 * size + t_1] = hmm->_bigram_counts->at(t_2, t_1);
+			}
+		}
+		_tag_counts.assign(size, 0);
+		for(int tag = 1;tag <= hmm->_num_tags;tag++){
+			_tag_counts[tag] = hmm->_unigram_counts->at(tag);
+		}
+	}
+	double TypeGibbs::sweep(sampler::Xoshiro256 &rng){
+		count_totals();
+		std::shuffle(_word_order.begin(), _word_order.end(), rng);
+		int num_changed = 0;
+		for(id word_id: _word_order){
+			if(resample(word_id, rng)){
+				num_changed++;
+			}
+		}
+		return _word_order.empty() ? 0 : num_changed / (double)_word_order.size();
+	}
+	bool TypeGibbs::resample(id word_id, sampler::Xoshiro256 &rng){
+		HMM* hmm = _hmm;
+		int* states = _dataset->_states.data();
+		size_t begin = _word_offsets[word_id];
+		size_t end = _word_offsets[word_id + 1];
+		if(begin == end){
+			return false;
+		}
+		const int* tags = NULL;
+		int num_tags_of_word = hmm->get_allowed_tags(word_id, tags);
+		if(num_tags_of_word == 1){
+			return false;
+		}
+		if(_context_counts.empty()){
+			count_totals();
+		}
+		// 動かす品詞を単語が使っている品詞から一様に選ぶ
+		_num_occurrences_of_tag.assign(hmm->_num_tags + 1, 0);
+		int num_used_tags = 0;
+		for(size_t k = begin;k < end;k++){
+			int tag = states[_positions[k]];
+			if(_num_occurrences_of_tag[tag] == 0){
+				num_used_tags++;
+			}
+			_num_occurrences_of_tag[tag] += 1;
+		}
+		int index = rng.uniform() * num_used_tags;
+		int old_tag = 0;
+		for(int tag = 1;tag <= hmm->_num_tags;tag++){
+			if(_num_occurrences_of_tag[tag] > 0 && index-- == 0){
+				old_tag = tag;
+				break;
+			}
+		}
+		assert(old_tag > 0);
+		// 移す先の候補は元の品詞と、単語が取りうる品詞のうちまだ使っていないもの
+		_candidates.clear();
+		for(int k = 0;k < num_tags_of_word;k++){
+			if(tags[k] == old_tag || _num_occurrences_of_tag[tags[k]] == 0){
+				_candidates.push_back(tags[k]);
+			}
+		}
+		if(_candidates.size() == 1){
+			return false;
+		}
+		// 動かす出現の品詞が関わる3-gramは、出現の位置とその1つ後、2つ後で終わるもの
+		// 出現が隣り合う場合は重複するので1度だけ数える
+		_trigrams.clear();
+		for(size_t k = begin;k < end;k++){
+			size_t position = _positions[k];
+			if(states[position] != old_tag){
+				continue;
+			}
+			_in_group[position] = true;
+			for(size_t last = position;last <= position + 2;last++){
+				if(_trigrams.empty() || _trigrams.back() < last){
+					_trigrams.push_back(last);
+				}
+			}
+		}
+		int num_occurrences = _num_occurrences_of_tag[old_tag];
+		_remove_trigrams();
+		hmm->_tag_word_counts->set(old_tag, word_id, 0);
+		_tag_counts[old_tag] -= num_occurrences;
+		// 候補ごとに取り除いた後の状態から全ての出現を足した時の同時確率を求める
+		_log_p.resize(_candidates.size());
+		double max_log_p = -INFINITY;
+		for(size_t k = 0;k < _candidates.size();k++){
+			_log_p[k] = _compute_log_p_tag(_candidates[k], num_occurrences, word_id) / hmm->_temperature;
+			max_log_p = std::max(max_log_p, _log_p[k]);
+		}
+		double sum = 0;
+		for(size_t k = 0;k < _candidates.size();k++){
+			_log_p[k] = exp(_log_p[k] - max_log_p);
+			sum += _log_p[k];
+		}
+		double bernoulli = rng.uniform() * sum;
+		int new_tag = _candidates.back();
+		double stack = 0;
+		for(size_t k = 0;k < _candidates.size();k++){
+			stack += _log_p[k];
+			if(stack >= bernoulli){
+				new_tag = _candidates[k];
+				break;
+			}
+		}
+		// 選んだ品詞で足し直す
+		for(size_t k = begin;k < end;k++){
+			size_t position = _positions[k];
+			if(_in_group[position]){
+				states[position] = new_tag;
+				_in_group[position] = false;
+			}
+		}
+		_add_trigrams();
+		hmm->_tag_word_counts->set(new_tag, word_id, num_occurrences);
+		_tag_counts[new_tag] += num_occurrences;
+		if(new_tag == old_tag){
+			return false;
+		}
+		// 逐次のGibbsサンプリングで同時確率の差分を追うための品詞ごとの単語数
+		if(hmm->_num_words_of_tag.size() == hmm->_num_tags + 1){
+			hmm->_num_words_of_tag[old_tag] -= num_occurrences;
+			hmm->_num_words_of_tag[new_tag] += num_occurrences;
+		}
+		hmm->invalidate_denominator_caches();
+		return true;
+	}
+	// _trigramsの3-gramをHMMのカウントと文脈の頻度から引く
+	void TypeGibbs::_remove_trigrams(){
+		HMM* hmm = _hmm;
+		int size = hmm->_num_tags + 1;
+		int* states = _dataset->_states.data();
+		for(size_t last: _trigrams){
+			int t_2 = states[last - 2];
+			int t_1 = states[last - 1];
+			int t = states[last];
+			hmm->_unigram_counts->at(t) -= 1;
+			hmm->_bigram_counts->at(t_1, t) -= 1;
+			hmm->_trigram_counts->decrement(t_2, t_1, t);
+			if(t_2 != 0 || t_1 != 0){
+				_context_counts[t_2 * size + t_1] -= 1;
+			}
+		}
+	}
+	// _trigramsの3-gramを足す. 動かす出現の品詞は既にstatesに書き込んである
+	void TypeGibbs::_add_trigrams(){
+		HMM* hmm = _hmm;
+		int size = hmm->_num_tags + 1;
+		int* states = _dataset->_states.data();
+		for(size_t last: _trigrams){
+			int t_2 = states[last - 2];
+			int t_1 = states[last - 1];
+			int t = states[last];
+			hmm->_unigram_counts->at(t) += 1;
+			hmm->_bigram_counts->at(t_1, t) += 1;
+			hmm->_trigram_counts->increment(t_2, t_1, t);
+			if(t_2 != 0 || t_1 != 0){
+				_context_counts[t_2 * size + t_1] += 1;
+			}
+		}
+	}
+	// 動かす出現を全て品詞tagにした時の、取り除いた後の状態からのlog p(t, w)の増分
+	// 3-gramは1つ足すごとにカウントを増やしてから次を計算し、最後に元に戻す
+	// 出力は単語のカウントが0から始まるのでガンマ関数でまとめて計算できる
+	double TypeGibbs::_compute_log_p_tag(int tag, int num_occurrences, id word_id){
+		HMM* hmm = _hmm;
+		int size = hmm->_num_tags + 1;
+		double beta = hmm->_beta[tag];
+		double denominator = _tag_counts[tag] + hmm->_Wt[tag] * beta;
+		assert(hmm->_tag_word_counts->get(tag, word_id) == 0);
+		double log_p = lgamma(num_occurrences + beta) - lgamma(beta) - lgamma(denominator + num_occurrences) + lgamma(denominator);
+		double alpha = hmm->_alpha;
+		double sum_alpha = hmm->_num_tags * alpha;
+		for(size_t last: _trigrams){
+			int t_2 = _tag_at(last - 2, tag);
+			int t_1 = _tag_at(last - 1, tag);
+			int t = _tag_at(last, tag);
+			double n_trigram = hmm->_trigram_counts->get(t_2, t_1, t);
+			log_p += log((n_trigram + alpha) / (_context_counts[t_2 * size + t_1] + sum_alpha));
+			hmm->_trigram_counts->increment(t_2, t_1, t);
+			if(t_2 != 0 || t_1 != 0){
+				_context_counts[t_2 * size + t_1] += 1;
+			}
+		}
+		for(size_t last: _trigrams){
+			int t_2 = _tag_at(last - 2, tag);
+			int t_1 = _tag_at(last - 1, tag);
+			int t = _tag_at(last, tag);
+			hmm->_trigram_counts->decrement(t_2, t_1, t);
+			if(t_2 != 0 || t_1 != 0){
+				_context_counts[t_2 * size + t_1] -= 1;
+			}
+		}
+		return log_p;
+	}
+}
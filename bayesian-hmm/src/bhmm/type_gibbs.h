@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "hmm.h"
+#include "sampler.h"
+
+namespace bhmm {
+	// 単語の種類ごとのブロック化Gibbsサンプリング
+	// 単語の出現位置の転置索引を作っておき、ある単語のある品詞の出現を全てまとめて取り除いてから、
+	// その単語がまだ使っていない品詞と元の品詞のそれぞれに全ての出現を入れた時の同時確率を正確に計算して1つ選ぶ
+	// 出現どうしが隣り合って3-gramやカウントを共有する分も1つずつ足して数えるので、文単位のブロック化サンプリングと同じ分布に従う
+	// 動かす品詞は単語が使っている品詞から一様に選ぶ. 移す前と後で候補の集合が同じなので詳細釣り合いを満たす
+	// 全ての出現が同じ品詞の単語では、単語の品詞をまとめて引き直すことになる
+	// トークン単位のGibbsサンプリングで1つずつでは動かせない頻出語の品詞を一度に動かすために、その合間に使う
+	class TypeGibbs {
+	private:
+		TypeGibbs(const TypeGibbs &);
+		TypeGibbs &operator=(const TypeGibbs &);
+		inline int _tag_at(size_t position, int tag){
+			return _in_group[position] ? tag : _dataset->_states[position];
+		}
+		void _remove_trigrams();
+		void _add_trigrams();
+		double _compute_log_p_tag(int tag, int num_occurrences, id word_id);
+	public:
+		HMM* _hmm;
+		WordSequences* _dataset;
+		std::vector<size_t> _word_offsets;	// [word_id] _positionsでの単語の出現の開始. 大きさは単語数+1
+		std::vector<size_t> _positions;		// 単語ごとの出現位置. データセットの_statesでの位置で、<s>と</s>は含まない
+		std::vector<id> _word_order;		// 出現のある単語. sweepで並べ替える
+		// 3-gramの文脈と出力確率の分母の頻度. sweepの最初にHMMのカウントから作り、以降は移すたびに更新する
+		// Gibbsサンプリングと同じく文脈は2-gram、品詞は1-gramのカウントで、(<s>, <s>)は常に0
+		std::vector<int> _context_counts;	// [t_2 * (T + 1) + t_1]
+		std::vector<int> _tag_counts;		// [t]
+		// 作業領域
+		std::vector<int> _num_occurrences_of_tag;	// [t] 単語の出現のうち品詞がtのものの数
+		std::vector<size_t> _trigrams;				// 品詞が変わる3-gramの最後の位置
+		std::vector<char> _in_group;				// [位置] 動かす出現ならtrue
+		std::vector<int> _candidates;
+		std::vector<double> _log_p;
+		TypeGibbs(HMM* hmm, WordSequences &dataset);
+		// 文脈と品詞の頻度をHMMのカウントから作り直す
+		// resampleの前にカウントを他の方法で書き換えたら必ず呼ぶ
+		void count_totals();
+		// 出現のある全ての単語を1回ずつランダムな順に動かし、品詞が変わった単語の割合を返す
+		double sweep(sampler::Xoshiro256 &rng);
+		// 単語word_idの1つの品詞の出現をまとめて引き直す. 品詞が変わったらtrue
+		bool resample(id word_id, sampler::Xoshiro256 &rng);
+	};
+}
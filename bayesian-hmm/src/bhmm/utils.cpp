@@ -1,3 +1,4 @@
+#include <cstring>
 #include <iostream>
 #include "utils.h"
 
@@ -25,6 +26,52 @@ namespace bhmm {
 			return vec;
 		}
 		template std::vector<int> vector_from_list(boost::python::list &list);
+		std::vector<int> int_vector_from_object(boost::python::object &obj){
+			std::vector<int> vec;
+			PyObject* ptr = obj.ptr();
+			if(PyObject_CheckBuffer(ptr)){
+				Py_buffer view;
+				if(PyObject_GetBuffer(ptr, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) == 0){
+					const char* format = (view.format == NULL) ? "B" : view.format;
+					char type = format[strlen(format) - 1];
+					if(view.itemsize == sizeof(int) && (type == 'i' || type == 'l')){
+						const int* data = static_cast<const int*>(view.buf);
+						vec.assign(data, data + view.len / sizeof(int));
+						PyBuffer_Release(&view);
+						return vec;
+					}
+					PyBuffer_Release(&view);
+				}else{
+					PyErr_Clear();
+				}
+			}
+			int len = boost::python::len(obj);
+			vec.reserve(len);
+			for(int i = 0;i < len;i++){
+				vec.push_back(boost::python::extract<int>(obj[i]));
+			}
+			return vec;
+		}
+		boost::python::object int_array_from_vector(const std::vector<int> &vec){
+			boost::python::object array = boost::python::import("array").attr("array")("i");
+			PyObject* bytes = PyBytes_FromStringAndSize(reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(int));
+			if(bytes == NULL){
+				boost::python::throw_error_already_set();
+			}
+			array.attr("frombytes")(boost::python::object(boost::python::handle<>(bytes)));
+			return array;
+		}
+		double kahan_sum(const std::vector<double> &values){
+			double sum = 0;
+			double compensation = 0;
+			for(double value: values){
+				double y = value - compensation;
+				double t = sum + y;
+				compensation = (t - sum) - y;
+				sum = t;
+			}
+			return sum;
+		}
 		void split_word_by(const std::wstring &str, wchar_t delim, std::vector<std::wstring> &word_str_vec){
 			word_str_vec.clear();
 		    std::wstring word_str;
@@ -43,5 +90,67 @@ namespace bhmm {
 		        word_str_vec.push_back(word_str);
 		    }
 		}
+		void utf8_to_wstring(const char* begin, const char* end, std::wstring &str){
+			str.clear();
+			const unsigned char* ptr = reinterpret_cast<const unsigned char*>(begin);
+			const unsigned char* last = reinterpret_cast<const unsigned char*>(end);
+			while(ptr < last){
+				unsigned int ch = *ptr;
+				int length = 1;
+				if(ch >= 0xF0 && ch < 0xF8){
+					ch &= 0x07;
+					length = 4;
+				}else if(ch >= 0xE0){
+					ch &= 0x0F;
+					length = 3;
+				}else if(ch >= 0xC0){
+					ch &= 0x1F;
+					length = 2;
+				}else if(ch >= 0x80){
+					length = 0;		// 先頭バイトではない
+				}
+				if(length == 0 || ptr + length > last || (length == 4 && *ptr >= 0xF8)){
+					str.push_back(0xFFFD);
+					ptr++;
+					continue;
+				}
+				bool valid = true;
+				for(int k = 1;k < length;k++){
+					if((ptr[k] & 0xC0) != 0x80){
+						valid = false;
+						break;
+					}
+					ch = (ch << 6) | (ptr[k] & 0x3F);
+				}
+				if(valid == false){
+					str.push_back(0xFFFD);
+					ptr++;
+					continue;
+				}
+				str.push_back(ch);
+				ptr += length;
+			}
+		}
+		void wstring_to_utf8(const std::wstring &str, std::string &utf8){
+			utf8.clear();
+			for(wchar_t wch: str){
+				unsigned int ch = wch;
+				if(ch < 0x80){
+					utf8.push_back(ch);
+				}else if(ch < 0x800){
+					utf8.push_back(0xC0 | (ch >> 6));
+					utf8.push_back(0x80 | (ch & 0x3F));
+				}else if(ch < 0x10000){
+					utf8.push_back(0xE0 | (ch >> 12));
+					utf8.push_back(0x80 | ((ch >> 6) & 0x3F));
+					utf8.push_back(0x80 | (ch & 0x3F));
+				}else{
+					utf8.push_back(0xF0 | (ch >> 18));
+					utf8.push_back(0x80 | ((ch >> 12) & 0x3F));
+					utf8.push_back(0x80 | ((ch >> 6) & 0x3F));
+					utf8.push_back(0x80 | (ch & 0x3F));
+				}
+			}
+		}
 	}
 }
\ No newline at end of file
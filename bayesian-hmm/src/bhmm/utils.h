@@ -1,5 +1,6 @@
 #pragma once
 #include <boost/python.hpp>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
@@ -9,6 +10,16 @@ namespace bhmm {
 		boost::python::list list_from_vector(std::vector<T> &vec);
 		template<class T>
 		std::vector<T> vector_from_list(boost::python::list &list);
+		// int32のバッファ(array.array('i')やnumpyの配列)ならそのままコピーし、それ以外は要素を1つずつ取り出す
+		std::vector<int> int_vector_from_object(boost::python::object &obj);
+		// array.array('i')にまとめて返す
+		boost::python::object int_array_from_vector(const std::vector<int> &vec);
 		void split_word_by(const std::wstring &str, wchar_t delim, std::vector<std::wstring> &word_str_vec);
+		// 補償付きの総和
+		// 桁の大きく異なる値を足しても丸め誤差が溜まらない
+		double kahan_sum(const std::vector<double> &values);
+		// UTF-8のバイト列をワイド文字列に直す. 不正なバイトはU+FFFDにする
+		void utf8_to_wstring(const char* begin, const char* end, std::wstring &str);
+		void wstring_to_utf8(const std::wstring &str, std::string &utf8);
 	}
 }
\ No newline at end of file
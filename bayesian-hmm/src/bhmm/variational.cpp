@@ -0,0 +1,489 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <thread>
+#include "sampler.h"
+#include "variational.h"
+
+namespace bhmm {
+	namespace {
+		// ディガンマ関数
+		// 引数を6以上にずらしてから漸近展開を使う
+		double digamma(double x){
+			assert(x > 0);
+			double result = 0;
+			while(x < 6){
+				result -= 1.0 / x;
+				x += 1;
+			}
+			double f = 1.0 / (x * x);
+			return result + log(x) - 0.5 / x - f * (1.0 / 12 - f * (1.0 / 120 - f * (1.0 / 252 - f * (1.0 / 240 - f / 132))));
+		}
+	}
+	VariationalEM::VariationalEM(HMM* hmm, int num_threads){
+		assert(hmm != NULL);
+		assert(hmm->_num_tags <= BHMM_DENSE_TRIGRAM_MAX_TAGS);	// 呼び出し側で確かめる
+		_hmm = hmm;
+		_num_tags = hmm->_num_tags;
+		_num_words = hmm->_num_words;
+		_num_threads = 0;
+		_emission_scale = 1;
+		_kl_divergence = 0;
+		set_num_threads(num_threads);
+	}
+	void VariationalEM::set_num_threads(int num_threads){
+		assert(num_threads > 0);
+		_num_threads = num_threads;
+		_thread_trigram_counts.resize(num_threads);
+		_thread_emission_counts.resize(num_threads);
+		_row_of_word.resize(num_threads);
+		_touched_words.resize(num_threads);
+		_thread_log_z.resize(num_threads, 0);
+		_forward_tables.resize(num_threads);
+		_backward_tables.resize(num_threads);
+		_emission_tables.resize(num_threads);
+		_scales.resize(num_threads);
+	}
+	void VariationalEM::initialize_with_assignments(WordSequences &dataset){
+		int size = _num_tags + 1;
+		_trigram_counts.assign((size_t)size * size * size, 0);
+		_emission_counts.assign((size_t)_num_words * size, 0);
+		_tag_counts.assign(size, 0);
+		_emission_scale = 1;
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			for(int i = 2;i < sentence.size() - 2;i++){
+				int ti = sentence.get_state(i);
+				assert(1 <= ti && ti <= _num_tags);
+				_trigram_counts[((size_t)sentence.get_state(i - 2) * size + sentence.get_state(i - 1)) * size + ti] += 1;
+				_emission_counts[(size_t)sentence.get_word_id(i) * size + ti] += 1;
+				_tag_counts[ti] += 1;
+			}
+		}
+	}
+	// 全て0から始めると品詞が対称なままになるので、ランダムな割り当てで対称性を崩す
+	void VariationalEM::initialize_randomly(WordSequences &minibatch, double scale){
+		assert(scale > 0);
+		for(int data_index = 0;data_index < minibatch.size();data_index++){
+			Sentence sentence = minibatch.get_sentence(data_index);
+			for(int i = 2;i < sentence.size() - 2;i++){
+				const int* tags = NULL;
+				int num_tags_of_word = _hmm->get_allowed_tags(sentence.get_word_id(i), tags);
+				sentence.set_state(i, tags[(int)sampler::uniform_int(0, num_tags_of_word - 1)]);
+			}
+		}
+		initialize_with_assignments(minibatch);
+		for(double &count: _trigram_counts){
+			count *= scale;
+		}
+		for(double &count: _tag_counts){
+			count *= scale;
+		}
+		_emission_scale = scale;
+	}
+	double VariationalEM::iterate(WordSequences &dataset){
+		assert(_emission_counts.size() == (size_t)_num_words * (_num_tags + 1));
+		_update_weights();
+		int num_threads = 0;
+		double log_z = _run_e_step(dataset, num_threads);
+		_reduce(num_threads, 0, 1);
+		update_model();
+		return log_z - _kl_divergence;
+	}
+	// 重みはミニバッチに現れた単語の分だけ計算し直す
+	// 期待カウントは λ <- (1 - ρ) λ + ρ (D / |B|) λ_B で、ディリクレ分布の自然勾配の方向に進めることになる
+	double VariationalEM::stochastic_update(WordSequences &minibatch, double num_sentences, double learning_rate){
+		assert(_emission_counts.size() == (size_t)_num_words * (_num_tags + 1));
+		assert(0 < learning_rate && learning_rate <= 1);
+		assert(minibatch.size() > 0);
+		_update_transition_weights();
+		_update_emission_normalizers();
+		if(_emission_weights.size() != _emission_counts.size()){
+			_emission_weights.assign(_emission_counts.size(), 0);
+		}
+		_is_weight_updated.assign(_num_words, false);
+		size_t num_words = 0;
+		for(int data_index = 0;data_index < minibatch.size();data_index++){
+			Sentence sentence = minibatch.get_sentence(data_index);
+			for(int i = 2;i < sentence.size() - 2;i++){
+				id word_id = sentence.get_word_id(i);
+				if(_is_weight_updated[word_id] == false){
+					_update_emission_weights(word_id);
+					_is_weight_updated[word_id] = true;
+				}
+				num_words++;
+			}
+		}
+		int num_threads = 0;
+		double log_z = _run_e_step(minibatch, num_threads);
+		_reduce(num_threads, 1 - learning_rate, learning_rate * num_sentences / minibatch.size());
+		return (num_words > 0) ? log_z / num_words : 0;
+	}
+	// 期待カウントから近似事後分布での exp(E[log θ]) と、事前分布とのKLダイバージェンスを求める
+	void VariationalEM::_update_weights(){
+		int size = _num_tags + 1;
+		_update_transition_weights();
+		_update_emission_normalizers();
+		_emission_weights.assign((size_t)_num_words * size, 0);
+		std::vector<double> lgamma_beta(size, 0);
+		for(int tag = 1;tag <= _num_tags;tag++){
+			double sum_beta = _hmm->_Wt[tag] * _hmm->_beta[tag];
+			lgamma_beta[tag] = lgamma(_hmm->_beta[tag]);
+			_kl_divergence += lgamma(_tag_counts[tag] + sum_beta) - lgamma(sum_beta);
+		}
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			_update_emission_weights(word_id);
+			const double* counts = _emission_counts.data() + (size_t)word_id * size;
+			const double* weights = _emission_weights.data() + (size_t)word_id * size;
+			for(int tag = 1;tag <= _num_tags;tag++){
+				if(counts[tag] == 0){
+					continue;
+				}
+				double count = counts[tag] * _emission_scale;
+				_kl_divergence += lgamma_beta[tag] - lgamma(count + _hmm->_beta[tag]) + count * log(weights[tag]);
+			}
+		}
+	}
+	// 遷移の重みを計算し直し、_kl_divergenceを遷移の分だけにする
+	// 期待カウントが0の要素はディガンマ関数を計算し直さない
+	void VariationalEM::_update_transition_weights(){
+		int size = _num_tags + 1;
+		double alpha = _hmm->_alpha;
+		_transition_weights.resize((size_t)size * size * size);
+		_kl_divergence = 0;
+		double digamma_alpha = digamma(alpha);
+		double lgamma_alpha = lgamma(alpha);
+		for(int t_2 = 0;t_2 <= _num_tags;t_2++){
+			for(int t_1 = 0;t_1 <= _num_tags;t_1++){
+				size_t offset = ((size_t)t_2 * size + t_1) * size;
+				const double* counts = _trigram_counts.data() + offset;
+				double* weights = _transition_weights.data() + offset;
+				weights[0] = 0;
+				double sum_counts = 0;
+				for(int t = 1;t <= _num_tags;t++){
+					sum_counts += counts[t];
+				}
+				double normalizer = digamma(sum_counts + _num_tags * alpha);
+				if(sum_counts > 0){
+					_kl_divergence += lgamma(sum_counts + _num_tags * alpha) - lgamma(_num_tags * alpha);
+				}
+				for(int t = 1;t <= _num_tags;t++){
+					if(counts[t] == 0){
+						weights[t] = exp(digamma_alpha - normalizer);
+						continue;
+					}
+					double log_weight = digamma(counts[t] + alpha) - normalizer;
+					weights[t] = exp(log_weight);
+					_kl_divergence += lgamma_alpha - lgamma(counts[t] + alpha) + counts[t] * log_weight;
+				}
+			}
+		}
+	}
+	void VariationalEM::_update_emission_normalizers(){
+		int size = _num_tags + 1;
+		_emission_normalizers.assign(size, 0);
+		_default_emission_weights.assign(size, 0);
+		for(int tag = 1;tag <= _num_tags;tag++){
+			double beta = _hmm->_beta[tag];
+			_emission_normalizers[tag] = digamma(_tag_counts[tag] + _hmm->_Wt[tag] * beta);
+			_default_emission_weights[tag] = exp(digamma(beta) - _emission_normalizers[tag]);
+		}
+	}
+	void VariationalEM::_update_emission_weights(id word_id){
+		int size = _num_tags + 1;
+		const double* counts = _emission_counts.data() + (size_t)word_id * size;
+		double* weights = _emission_weights.data() + (size_t)word_id * size;
+		for(int tag = 1;tag <= _num_tags;tag++){
+			if(counts[tag] == 0){
+				weights[tag] = _default_emission_weights[tag];
+				continue;
+			}
+			weights[tag] = exp(digamma(counts[tag] * _emission_scale + _hmm->_beta[tag]) - _emission_normalizers[tag]);
+		}
+	}
+	// 各スレッドの対数周辺尤度の近似の和を返す
+	double VariationalEM::_run_e_step(WordSequences &dataset, int &num_threads){
+		num_threads = std::max(1, std::min(_num_threads, dataset.size()));
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < num_threads;thread_id++){
+			threads.push_back(std::thread(&VariationalEM::_e_step, this, thread_id, num_threads, &dataset));
+		}
+		_e_step(0, num_threads, &dataset);
+		for(auto &thread: threads){
+			thread.join();
+		}
+		double log_z = 0;
+		for(int thread_id = 0;thread_id < num_threads;thread_id++){
+			log_z += _thread_log_z[thread_id];
+		}
+		return log_z;
+	}
+	// 文の長さが偏らないように1つおきに割り当てる
+	void VariationalEM::_e_step(int thread_id, int num_threads, WordSequences* dataset){
+		int size = _num_tags + 1;
+		_thread_trigram_counts[thread_id].assign((size_t)size * size * size, 0);
+		_row_of_word[thread_id].resize(_num_words, -1);
+		for(id word_id: _touched_words[thread_id]){
+			_row_of_word[thread_id][word_id] = -1;
+		}
+		_touched_words[thread_id].clear();
+		_thread_emission_counts[thread_id].clear();
+		_thread_log_z[thread_id] = 0;
+		for(int data_index = thread_id;data_index < dataset->size();data_index += num_threads){
+			Sentence sentence = dataset->get_sentence(data_index);
+			_forward_backward(thread_id, sentence);
+		}
+	}
+	// 2次のHMMなので(t_{i-1}, t_i)の組を状態とみなした前向き後ろ向きアルゴリズム
+	// 前向き確率は位置ごとに正規化し、正規化定数の対数の和が文の対数周辺尤度の近似になる
+	// 各位置では単語が取りうる品詞だけを見る
+	void VariationalEM::_forward_backward(int thread_id, Sentence &sentence){
+		int length = sentence.size();
+		int last = length - 3;	// 最後の単語の位置
+		if(last < 2){
+			return;
+		}
+		int size = _num_tags + 1;
+		size_t stride = (size_t)size * size;
+		std::vector<double> &forward = _forward_tables[thread_id];
+		std::vector<double> &backward = _backward_tables[thread_id];
+		std::vector<double> &emissions = _emission_tables[thread_id];
+		std::vector<double> &scales = _scales[thread_id];
+		if(forward.size() < length * stride){
+			forward.resize(length * stride);
+			backward.resize(length * stride);
+		}
+		if(emissions.size() < length * size){
+			emissions.resize(length * size);
+			scales.resize(length);
+		}
+		const double* transitions = _transition_weights.data();
+		int tag_bos = 0;
+		const int* tags = NULL;
+		const int* tags_1 = NULL;
+		const int* tags_2 = NULL;
+		for(int i = 2;i <= last;i++){
+			id wi = sentence.get_word_id(i);
+			int num_tags_of_word = _hmm->get_allowed_tags(wi, tags);
+			const double* weights = _emission_weights.data() + (size_t)wi * size;
+			for(int k = 0;k < num_tags_of_word;k++){
+				emissions[i * size + tags[k]] = weights[tags[k]];
+			}
+		}
+		// 前向き
+		double log_z = 0;
+		for(int i = 2;i <= last;i++){
+			int num_tags_2 = 1;
+			tags_2 = &tag_bos;
+			if(i > 3){
+				num_tags_2 = _hmm->get_allowed_tags(sentence.get_word_id(i - 2), tags_2);
+			}
+			int num_tags_1 = 1;
+			tags_1 = &tag_bos;
+			if(i > 2){
+				num_tags_1 = _hmm->get_allowed_tags(sentence.get_word_id(i - 1), tags_1);
+			}
+			int num_tags_of_word = _hmm->get_allowed_tags(sentence.get_word_id(i), tags);
+			double* forward_i = forward.data() + i * stride;
+			double scale = 0;
+			for(int a = 0;a < num_tags_1;a++){
+				int ti_1 = tags_1[a];
+				for(int k = 0;k < num_tags_of_word;k++){
+					int ti = tags[k];
+					double sum = 0;
+					if(i == 2){
+						sum = transitions[ti];	// (<s>, <s>, t)
+					}else{
+						for(int b = 0;b < num_tags_2;b++){
+							int ti_2 = tags_2[b];
+							sum += forward[(i - 1) * stride + ti_2 * size + ti_1] * transitions[(ti_2 * stride) + ti_1 * size + ti];
+						}
+					}
+					double value = sum * emissions[i * size + ti];
+					forward_i[ti_1 * size + ti] = value;
+					scale += value;
+				}
+			}
+			assert(scale > 0);
+			for(int a = 0;a < num_tags_1;a++){
+				for(int k = 0;k < num_tags_of_word;k++){
+					forward_i[tags_1[a] * size + tags[k]] /= scale;
+				}
+			}
+			scales[i] = scale;
+			log_z += log(scale);
+		}
+		_thread_log_z[thread_id] += log_z;
+		// 後ろ向き
+		for(int i = last;i >= 2;i--){
+			int num_tags_1 = 1;
+			tags_1 = &tag_bos;
+			if(i > 2){
+				num_tags_1 = _hmm->get_allowed_tags(sentence.get_word_id(i - 1), tags_1);
+			}
+			int num_tags_of_word = _hmm->get_allowed_tags(sentence.get_word_id(i), tags);
+			double* backward_i = backward.data() + i * stride;
+			if(i == last){
+				for(int a = 0;a < num_tags_1;a++){
+					for(int k = 0;k < num_tags_of_word;k++){
+						backward_i[tags_1[a] * size + tags[k]] = 1;
+					}
+				}
+				continue;
+			}
+			const int* tags_next = NULL;
+			int num_tags_next = _hmm->get_allowed_tags(sentence.get_word_id(i + 1), tags_next);
+			const double* backward_next = backward.data() + (i + 1) * stride;
+			const double* emissions_next = emissions.data() + (i + 1) * size;
+			double inv_scale = 1.0 / scales[i + 1];
+			for(int a = 0;a < num_tags_1;a++){
+				int ti_1 = tags_1[a];
+				for(int k = 0;k < num_tags_of_word;k++){
+					int ti = tags[k];
+					const double* row = transitions + ti_1 * stride + ti * size;
+					double sum = 0;
+					for(int c = 0;c < num_tags_next;c++){
+						int ti1 = tags_next[c];
+						sum += row[ti1] * emissions_next[ti1] * backward_next[ti * size + ti1];
+					}
+					backward_i[ti_1 * size + ti] = sum * inv_scale;
+				}
+			}
+		}
+		// 期待カウント
+		// 正規化してあるので前向き確率と後ろ向き確率の積がそのまま事後確率になる
+		std::vector<double> &trigram_counts = _thread_trigram_counts[thread_id];
+		for(int i = 2;i <= last;i++){
+			id wi = sentence.get_word_id(i);
+			int num_tags_1 = 1;
+			tags_1 = &tag_bos;
+			if(i > 2){
+				num_tags_1 = _hmm->get_allowed_tags(sentence.get_word_id(i - 1), tags_1);
+			}
+			int num_tags_of_word = _hmm->get_allowed_tags(wi, tags);
+			const double* forward_i = forward.data() + i * stride;
+			const double* backward_i = backward.data() + i * stride;
+			if(i == 2){
+				for(int k = 0;k < num_tags_of_word;k++){
+					trigram_counts[tags[k]] += forward_i[tags[k]] * backward_i[tags[k]];
+				}
+			}else{
+				int num_tags_2 = 1;
+				tags_2 = &tag_bos;
+				if(i > 3){
+					num_tags_2 = _hmm->get_allowed_tags(sentence.get_word_id(i - 2), tags_2);
+				}
+				const double* forward_prev = forward.data() + (i - 1) * stride;
+				const double* emissions_i = emissions.data() + i * size;
+				double inv_scale = 1.0 / scales[i];
+				for(int b = 0;b < num_tags_2;b++){
+					int ti_2 = tags_2[b];
+					for(int a = 0;a < num_tags_1;a++){
+						int ti_1 = tags_1[a];
+						double f = forward_prev[ti_2 * size + ti_1] * inv_scale;
+						const double* row = transitions + ti_2 * stride + ti_1 * size;
+						double* counts = trigram_counts.data() + ti_2 * stride + ti_1 * size;
+						for(int k = 0;k < num_tags_of_word;k++){
+							int ti = tags[k];
+							counts[ti] += f * row[ti] * emissions_i[ti] * backward_i[ti_1 * size + ti];
+						}
+					}
+				}
+			}
+			int best_tag = tags[0];
+			double best_posterior = -1;
+			for(int k = 0;k < num_tags_of_word;k++){
+				int ti = tags[k];
+				double posterior = 0;
+				for(int a = 0;a < num_tags_1;a++){
+					posterior += forward_i[tags_1[a] * size + ti] * backward_i[tags_1[a] * size + ti];
+				}
+				_thread_emission_count(thread_id, wi, ti) += posterior;
+				if(posterior > best_posterior){
+					best_posterior = posterior;
+					best_tag = ti;
+				}
+			}
+			sentence.set_state(i, best_tag);
+		}
+	}
+	// 期待カウントを decay 倍してから各スレッドの期待カウントの scale 倍を足す
+	void VariationalEM::_reduce(int num_threads, double decay, double scale){
+		int size = _num_tags + 1;
+		for(double &count: _trigram_counts){
+			count *= decay;
+		}
+		for(double &count: _tag_counts){
+			count *= decay;
+		}
+		if(decay == 0){
+			std::fill(_emission_counts.begin(), _emission_counts.end(), 0);
+			_emission_scale = 1;
+		}else{
+			_emission_scale *= decay;
+			// 小さくなりすぎる前に全ての要素に掛けておく
+			if(_emission_scale < BHMM_VB_MIN_EMISSION_SCALE){
+				for(double &count: _emission_counts){
+					count *= _emission_scale;
+				}
+				_emission_scale = 1;
+			}
+		}
+		double emission_scale = scale / _emission_scale;
+		for(int thread_id = 0;thread_id < num_threads;thread_id++){
+			const std::vector<double> &trigram_counts = _thread_trigram_counts[thread_id];
+			for(size_t i = 0;i < trigram_counts.size();i++){
+				_trigram_counts[i] += scale * trigram_counts[i];
+			}
+			const std::vector<id> &touched_words = _touched_words[thread_id];
+			for(size_t row = 0;row < touched_words.size();row++){
+				double* counts = _emission_counts.data() + (size_t)touched_words[row] * size;
+				const double* thread_counts = _thread_emission_counts[thread_id].data() + row * size;
+				for(int tag = 1;tag <= _num_tags;tag++){
+					counts[tag] += emission_scale * thread_counts[tag];
+					_tag_counts[tag] += scale * thread_counts[tag];
+				}
+			}
+		}
+	}
+	// 復号で使う確率がそのまま近似事後分布の平均になるように、
+	// 2-gramは(t_2, t_1)に続く3-gramの和、1-gramはその品詞の単語の数にする
+	void VariationalEM::update_model(){
+		int size = _num_tags + 1;
+		HMM* hmm = _hmm;
+		delete hmm->_trigram_counts;
+		hmm->_trigram_counts = new TrigramCounts(_num_tags);
+		hmm->_bigram_counts->fill(0);
+		hmm->_unigram_counts->fill(0);
+		for(int t_2 = 0;t_2 <= _num_tags;t_2++){
+			for(int t_1 = 0;t_1 <= _num_tags;t_1++){
+				const double* counts = _trigram_counts.data() + ((size_t)t_2 * size + t_1) * size;
+				for(int t = 1;t <= _num_tags;t++){
+					int count = lround(counts[t]);
+					if(count > 0){
+						hmm->_trigram_counts->add(t_2, t_1, t, count);
+						hmm->_bigram_counts->at(t_2, t_1) += count;
+					}
+				}
+			}
+		}
+		std::vector<int> tags;
+		std::vector<int> counts;
+		for(id word_id = 0;word_id < _num_words;word_id++){
+			const double* expected_counts = _emission_counts.data() + (size_t)word_id * size;
+			tags.clear();
+			counts.clear();
+			for(int tag = 1;tag <= _num_tags;tag++){
+				int count = lround(expected_counts[tag] * _emission_scale);
+				if(count > 0){
+					tags.push_back(tag);
+					counts.push_back(count);
+					hmm->_unigram_counts->at(tag) += count;
+				}
+			}
+			hmm->_tag_word_counts->assign_word(word_id, tags.data(), counts.data(), tags.size());
+		}
+		hmm->_num_words_of_tag.clear();		// 割り当てと対応しないので差分は追えない
+		hmm->invalidate_denominator_caches();
+	}
+}
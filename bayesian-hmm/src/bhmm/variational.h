@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include "common.h"
+#include "hmm.h"
+
+#define BHMM_VB_MIN_EMISSION_SCALE 1e-100	// 出力の期待カウントの倍率がこれを下回ったら全ての要素に掛ける
+
+namespace bhmm {
+	// 平均場近似による変分ベイズEM
+	// 遷移と出力のパラメータの近似事後分布はディリクレ分布で、その母数は事前分布のalpha, betaに品詞の期待カウントを足したもの
+	// E-stepでは exp(E[log θ]) を重みにした前向き後ろ向きアルゴリズムを文ごとに別スレッドで行い、期待カウントをスレッドごとに足してから合計する
+	// M-stepでは期待カウントから重みを作り直し、丸めた期待カウントをHMMのカウントに書き込むのでビタビアルゴリズムなどはそのまま使える
+	// 品詞の割り当ては持たないので、データセットの品詞には各位置で事後確率が最大の品詞を書き込む
+	// 遷移は<s>から文の最後の単語までだけを考え、文末の</s>への遷移は数えない. Gibbsサンプリングは</s>の位置の品詞への遷移も数えるので、その分だけ同時確率が異なる
+	// 温度は使わない
+	// 期待カウントは非ゼロの要素が多いので遷移は密な配列に持ち、品詞数はBHMM_DENSE_TRIGRAM_MAX_TAGS以下でなければならない
+	class VariationalEM {
+	private:
+		VariationalEM(const VariationalEM &);
+		VariationalEM &operator=(const VariationalEM &);
+		void _update_weights();
+		void _update_transition_weights();
+		void _update_emission_normalizers();
+		void _update_emission_weights(id word_id);
+		double _run_e_step(WordSequences &dataset, int &num_threads);
+		void _e_step(int thread_id, int num_threads, WordSequences* dataset);
+		void _forward_backward(int thread_id, Sentence &sentence);
+		void _reduce(int num_threads, double decay, double scale);
+		inline double &_thread_emission_count(int thread_id, id word_id, int tag){
+			int row = _row_of_word[thread_id][word_id];
+			if(row == -1){
+				row = _touched_words[thread_id].size();
+				_row_of_word[thread_id][word_id] = row;
+				_touched_words[thread_id].push_back(word_id);
+				_thread_emission_counts[thread_id].resize((row + 1) * (_num_tags + 1), 0);
+			}
+			return _thread_emission_counts[thread_id][row * (_num_tags + 1) + tag];
+		}
+	public:
+		HMM* _hmm;
+		int _num_tags;
+		id _num_words;
+		int _num_threads;
+		std::vector<double> _trigram_counts;		// [(t_2 * (T + 1) + t_1) * (T + 1) + t] n_{t_2,t_1,t}の期待値
+		// 確率的な更新で全ての要素を毎回縮めなくて済むように、n_{t,w}の期待値を_emission_scaleで割って持つ
+		std::vector<double> _emission_counts;		// [word_id * (T + 1) + t]
+		double _emission_scale;
+		std::vector<double> _tag_counts;			// [t] n_tの期待値
+		std::vector<double> _transition_weights;	// exp(ψ(n_{t_2,t_1,t} + α) - ψ(n_{t_2,t_1} + Tα))
+		std::vector<double> _emission_weights;		// exp(ψ(n_{t,w} + β_t) - ψ(n_t + W_t β_t))
+		std::vector<double> _emission_normalizers;	// [t] ψ(n_t + W_t β_t)
+		std::vector<double> _default_emission_weights;	// [t] n_{t,w}が0の場合の重み
+		std::vector<char> _is_weight_updated;		// 確率的な更新でミニバッチの単語の重みを計算し直したか
+		double _kl_divergence;		// 近似事後分布と事前分布のKLダイバージェンス
+		// スレッドごとの期待カウント
+		// 出力の期待カウントは触れた単語の行だけを確保する
+		std::vector<std::vector<double>> _thread_trigram_counts;
+		std::vector<std::vector<double>> _thread_emission_counts;
+		std::vector<std::vector<int>> _row_of_word;		// 未使用なら-1
+		std::vector<std::vector<id>> _touched_words;
+		std::vector<double> _thread_log_z;				// 担当した文の対数周辺尤度の近似の和
+		// スレッドごとの作業領域
+		std::vector<std::vector<double>> _forward_tables;	// [i][t_1][t] 位置ごとに正規化した前向き確率
+		std::vector<std::vector<double>> _backward_tables;
+		std::vector<std::vector<double>> _emission_tables;	// [i][t] 出力の重み
+		std::vector<std::vector<double>> _scales;			// [i] 前向き確率の正規化定数
+		VariationalEM(HMM* hmm, int num_threads);
+		void set_num_threads(int num_threads);
+		// データセットの品詞の割り当てから期待カウントの初期値を数える
+		void initialize_with_assignments(WordSequences &dataset);
+		// ミニバッチの各単語に取りうる品詞をランダムに割り当てて数え、scale倍したものを期待カウントの初期値にする
+		void initialize_randomly(WordSequences &minibatch, double scale);
+		// M-stepとE-stepを1回ずつ行い、E-stepでの変分下界を返す
+		// 下界は反復ごとに単調に増える
+		double iterate(WordSequences &dataset);
+		// 確率的変分推論の1回分の更新
+		// ミニバッチの期待カウントをnum_sentences / ミニバッチの文数 倍し、期待カウントを学習率learning_rateでそこへ近づける
+		// HMMのカウントには書き込まない. ミニバッチの単語あたりの対数周辺尤度の近似を返す
+		double stochastic_update(WordSequences &minibatch, double num_sentences, double learning_rate);
+		// 丸めた期待カウントをHMMのカウントに書き込む
+		void update_model();
+	};
+}
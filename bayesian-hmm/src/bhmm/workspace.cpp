@@ -0,0 +1,50 @@
+#include "workspace.h"
+
+namespace bhmm {
+	DecodeWorkspace::DecodeWorkspace(){
+		_num_tags = 0;
+		_stride = 0;
+		_table_capacity = 0;
+		_max_sentence_length = 0;
+		_forward_table = NULL;
+		_decode_table = NULL;
+		_log_emissions = NULL;
+		_log_emissions_capacity = 0;
+		_word_ids = NULL;
+	}
+	DecodeWorkspace::~DecodeWorkspace(){
+		delete[] _forward_table;
+		delete[] _decode_table;
+		delete[] _log_emissions;
+		delete[] _word_ids;
+	}
+	void DecodeWorkspace::reserve(int num_tags, int sentence_length){
+		assert(num_tags > 0);
+		assert(sentence_length > 0);
+		_num_tags = num_tags;
+		_stride = (num_tags + 1) * (num_tags + 1);
+		size_t size = (size_t)sentence_length * _stride;
+		if(size > _table_capacity){
+			delete[] _forward_table;
+			delete[] _decode_table;
+			_forward_table = new double[size];
+			_decode_table = new int[size];
+			_table_capacity = size;
+		}
+		size_t log_emissions_size = (size_t)sentence_length * (num_tags + 1);
+		if(log_emissions_size > _log_emissions_capacity){
+			delete[] _log_emissions;
+			_log_emissions = new double[log_emissions_size];
+			_log_emissions_capacity = log_emissions_size;
+		}
+		if(sentence_length > _max_sentence_length){
+			delete[] _word_ids;
+			_word_ids = new id[sentence_length];
+			_max_sentence_length = sentence_length;
+		}
+	}
+	DecodeWorkspace* DecodeWorkspace::get_thread_local(){
+		static thread_local DecodeWorkspace workspace;
+		return &workspace;
+	}
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "common.h"
+
+namespace bhmm {
+	// ビタビアルゴリズムと前向きアルゴリズムの作業領域
+	// 文ごとに確保し直さないように、これまでで最も長い文に合わせて大きくするだけで縮めない
+	// テーブルは[i][t_1][t]の順に1本のバッファに並べる
+	class DecodeWorkspace {
+	private:
+		DecodeWorkspace(const DecodeWorkspace &);
+		DecodeWorkspace &operator=(const DecodeWorkspace &);
+	public:
+		int _num_tags;
+		int _stride;				// (num_tags + 1)^2
+		size_t _table_capacity;		// 確保済みの要素数
+		int _max_sentence_length;	// 確保済みの単語ID列の長さ
+		size_t _log_emissions_capacity;
+		double* _forward_table;
+		int* _decode_table;			// ひとつ前の品詞へのバックポインタ
+		double* _log_emissions;		// [i][t] = log P(w_i|t)
+		id* _word_ids;				// <s>と</s>を2つずつ含む単語ID列
+		std::vector<int> _state_sequence;	// 復号結果
+		// ビームサーチ用
+		std::vector<int> _beam_candidates;
+		std::vector<double> _beam_values;
+		std::vector<double> _beam_buffer;
+		std::vector<int> _beam;
+		std::vector<char> _is_reached;
+		std::vector<double> _log_transition_row;
+		DecodeWorkspace();
+		~DecodeWorkspace();
+		// <s>と</s>を含めた長さsentence_lengthの文を扱えるようにする
+		void reserve(int num_tags, int sentence_length);
+		// 呼び出したスレッド専用の作業領域
+		static DecodeWorkspace* get_thread_local();
+		inline double &forward(int i, int t_1, int t){
+			assert(0 <= t_1 && t_1 <= _num_tags && 0 <= t && t <= _num_tags);
+			return _forward_table[(size_t)i * _stride + t_1 * (_num_tags + 1) + t];
+		}
+		inline double* log_emissions(int i){
+			return _log_emissions + (size_t)i * (_num_tags + 1);
+		}
+		inline int &decode(int i, int t_1, int t){
+			assert(0 <= t_1 && t_1 <= _num_tags && 0 <= t && t <= _num_tags);
+			return _decode_table[(size_t)i * _stride + t_1 * (_num_tags + 1) + t];
+		}
+	};
+}
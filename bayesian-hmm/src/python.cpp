@@ -3,31 +3,80 @@
 #include "python/dataset.h"
 #include "python/dictionary.h"
 #include "python/trainer.h"
+#include "python/stream.h"
+#include "python/svi.h"
+#include "bhmm/sampler.h"
 
 using namespace bhmm;
 
 BOOST_PYTHON_MODULE(bhmm){
-	boost::python::class_<Dictionary>("dictionary")
+	// 乱数の系列を固定する. 学習の前に呼ぶ
+	boost::python::def("set_seed", &sampler::set_seed);
+
+	boost::python::class_<Dictionary, boost::noncopyable>("dictionary")
 	.def("string_to_word_id", &Dictionary::string_to_word_id)
+	.def("string_to_word_ids", &Dictionary::python_string_to_word_ids)
 	.def("is_unk", &Dictionary::is_unk)
 	.def("save", &Dictionary::save)
 	.def("load", &Dictionary::load);
 
 	boost::python::class_<Corpus>("corpus")
-	.def("add_words", &Corpus::python_add_words);
+	.def("add_words", &Corpus::python_add_words)
+	.def("add_textfile", &Corpus::add_textfile)
+	.def("save_binary", &Corpus::save_binary)
+	.def("set_blank_line_policy", &Corpus::python_set_blank_line_policy)
+	.def("get_num_words", &Corpus::get_num_words);
 
 	boost::python::class_<Dataset>("dataset", boost::python::init<Corpus*, double, int>())
+	.def(boost::python::init<std::string, double, int>())
 	.def("get_num_words", &Dataset::get_num_words)
 	.def("get_dict", &Dataset::get_dict_obj, boost::python::return_internal_reference<>());
 
-	boost::python::class_<Trainer>("trainer", boost::python::init<Dataset*, Model*>())
+	boost::python::class_<StreamingCorpus, boost::noncopyable>("streaming_corpus", boost::python::init<std::string, int>())
+	.def("get_num_words", &StreamingCorpus::get_num_words)
+	.def("get_num_sentences", &StreamingCorpus::get_num_sentences)
+	.def("get_num_tokens", &StreamingCorpus::get_num_tokens)
+	.def("get_num_passes", &StreamingCorpus::get_num_passes)
+	.def("get_dict", &StreamingCorpus::get_dict_obj, boost::python::return_internal_reference<>());
+
+	boost::python::class_<SVITrainer, boost::noncopyable>("svi_trainer", boost::python::init<StreamingCorpus*, Model*>())
+	.def("set_batch_size", &SVITrainer::set_batch_size)
+	.def("set_learning_rate", &SVITrainer::set_learning_rate)
+	.def("set_num_threads", &SVITrainer::set_num_threads)
+	.def("get_learning_rate", &SVITrainer::get_learning_rate)
+	.def("get_num_updates", &SVITrainer::get_num_updates)
+	.def("get_num_passes", &SVITrainer::get_num_passes)
+	.def("update", &SVITrainer::update)
+	.def("update_model", &SVITrainer::update_model);
+
+	boost::python::class_<Trainer, boost::noncopyable>("trainer", boost::python::init<Dataset*, Model*>())
 	.def("compute_log_p_dataset_train", &Trainer::compute_log_p_dataset_train)
 	.def("compute_log_p_dataset_dev", &Trainer::compute_log_p_dataset_dev)
 	.def("update_hyperparameters", &Trainer::update_hyperparameters)
 	.def("anneal_temperature", &Trainer::anneal_temperature)
-	.def("gibbs", &Trainer::gibbs);
+	.def("set_num_threads", &Trainer::set_num_threads)
+	.def("get_num_threads", &Trainer::get_num_threads)
+	.def("set_sync_interval", &Trainer::set_sync_interval)
+	.def("set_num_chains", &Trainer::set_num_chains)
+	.def("get_num_chains", &Trainer::get_num_chains)
+	.def("set_max_temperature", &Trainer::set_max_temperature)
+	.def("get_exchange_acceptance_rates", &Trainer::python_get_exchange_acceptance_rates)
+	.def("set_convergence_criteria", &Trainer::set_convergence_criteria)
+	.def("converged", &Trainer::converged)
+	.def("get_changed_fraction", &Trainer::get_changed_fraction)
+	.def("get_log_p_joint", &Trainer::get_log_p_joint)
+	.def("get_split_r_hat", &Trainer::get_split_r_hat)
+	.def("gibbs", &Trainer::gibbs)
+	.def("blocked_gibbs", &Trainer::blocked_gibbs)
+	.def("type_gibbs", &Trainer::type_gibbs)
+	.def("variational_em", &Trainer::variational_em)
+	.def("save_async", &Trainer::save_async)
+	.def("is_saving", &Trainer::is_saving)
+	.def("wait_for_save", &Trainer::wait_for_save);
 
 	boost::python::class_<Model>("model", boost::python::init<int, Dataset*, boost::python::list>())
+	.def(boost::python::init<int, Dataset*, boost::python::list, boost::python::object, boost::python::object>())
+	.def(boost::python::init<int, StreamingCorpus*, boost::python::list>())
 	.def(boost::python::init<std::string>())
 	.def("get_num_tags", &Model::get_num_tags)
 	.def("get_temperature", &Model::get_temperature)
@@ -37,6 +86,11 @@ BOOST_PYTHON_MODULE(bhmm){
 	.def("set_initial_beta", &Model::set_initial_beta)
 	.def("anneal_temperature", &Model::anneal_temperature)
 	.def("viterbi_decode", &Model::python_viterbi_decode)
+	.def("viterbi_decode_batch", &Model::python_viterbi_decode_batch)
+	.def("freeze_for_decoding", &Model::freeze_for_decoding)
+	.def("is_frozen_for_decoding", &Model::is_frozen_for_decoding)
+	.def("set_beam_width", &Model::set_beam_width)
+	.def("set_beam_threshold", &Model::set_beam_threshold)
 	.def("print_typical_words_assigned_to_each_tag", &Model::print_typical_words_assigned_to_each_tag)
 	.def("print_alpha_and_beta", &Model::print_alpha_and_beta)
 	.def("save", &Model::save)
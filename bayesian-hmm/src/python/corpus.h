@@ -1,22 +1,34 @@
 #pragma once
 #include <boost/python.hpp>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include "../bhmm/common.h"
 
+// 空行の扱い
+#define BLANK_LINE_SKIP 0	// 読み飛ばす
+#define BLANK_LINE_STOP 1	// そこで読み込みを終える
+
 namespace bhmm {
 	class Corpus{
 	private:
-		void _add_words_to_corpus(std::vector<std::wstring> &word_str_vec);
-		void _before_python_add_sentence_str(boost::python::list &py_word_str_list, std::vector<std::wstring> &word_str_vec);
+		void _add_token_ids_to_corpus(std::vector<int> &token_ids);
+		int _intern_token(const char* begin, const char* end);
+		std::string _token_buffer;	// 検索用. 単語ごとに確保し直さない
 	public:
-		std::unordered_map<std::wstring, int> _word_count;		// 事前に単語数がわからないのでmapを使う
-		std::vector<std::vector<std::wstring>> _word_sequences;
+		std::unordered_map<std::string, int> _token_ids;	// UTF-8の単語 -> コーパス内の単語ID
+		std::vector<std::wstring> _token_strings;			// コーパス内の単語ID -> 単語
+		std::vector<int> _token_counts;						// コーパス内の単語ID -> 頻度
+		std::vector<std::vector<int>> _word_sequences;		// 各文をコーパス内の単語IDの列で持つ
+		int _blank_line_policy;
 		int _max_num_words_in_line;
 		int _min_num_words_in_line;
 		Corpus();
-		void add_textfile(std::string filename);
-		void add_sentence_str(std::wstring sentence_str);
+		bool add_textfile(std::string filename);
+		// 単語分割済みのコーパスの独自バイナリ形式で書き出す
+		bool save_binary(std::string filename);
+		void set_blank_line_policy(int policy);
+		void python_set_blank_line_policy(std::string policy);
 		void python_add_words(boost::python::list py_word_str_list);
 		int get_num_words();
 		int get_count_of_word(std::wstring word_str);
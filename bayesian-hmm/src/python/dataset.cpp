@@ -2,6 +2,7 @@
 #include <fstream>
 #include <unordered_set>
 #include "dataset.h"
+#include "../bhmm/corpus_file.h"
 #include "../bhmm/utils.h"
 #include "../bhmm/sampler.h"
 
@@ -12,76 +13,110 @@ namespace bhmm {
 		_min_num_words_in_line = corpus->_min_num_words_in_line;
 
 		std::vector<int> rand_indices;
-		for(int i = 0;i < corpus->_word_sequences.size();i++){
-			rand_indices.push_back(i);
-		}
-		shuffle(rand_indices.begin(), rand_indices.end(), sampler::mt);	// データをシャッフル
-		train_split = std::min(1.0, std::max(0.0, train_split));
-		int num_train_data = corpus->_word_sequences.size() * train_split;
+		int num_train_data;
+		_split_indices(corpus->_word_sequences.size(), train_split, rand_indices, num_train_data);
+		std::vector<int> word_id_of_token(corpus->_token_strings.size(), -1);	// 辞書への登録は単語ごとに1回だけ
 		for(int i = 0;i < rand_indices.size();i++){
-			std::vector<std::wstring> &word_str_vec = corpus->_word_sequences[rand_indices[i]];
+			std::vector<int> &token_ids = corpus->_word_sequences[rand_indices[i]];
+			for(int token_id: token_ids){
+				if(word_id_of_token[token_id] == -1){
+					if(corpus->_token_counts[token_id] <= unknown_count){
+						word_id_of_token[token_id] = ID_UNK;
+					}else{
+						word_id_of_token[token_id] = _dict->add_word_string(corpus->_token_strings[token_id]);
+					}
+				}
+			}
 			if(i < num_train_data){
-				_add_words_to_dataset(word_str_vec, _word_sequences_train, corpus, unknown_count);
+				_add_words_to_dataset(token_ids.data(), token_ids.size(), _word_sequences_train, word_id_of_token);
 			}else{
-				_add_words_to_dataset(word_str_vec, _word_sequences_dev, corpus, unknown_count);
+				_add_words_to_dataset(token_ids.data(), token_ids.size(), _word_sequences_dev, word_id_of_token);
 			}
 		}
+		_dict->shrink_to_fit();
 	}
-	Dataset::~Dataset(){
-		for(int n = 0;n < _word_sequences_train.size();n++){
-			std::vector<Word*> &words = _word_sequences_train[n];
-			for(int m = 0;m < words.size();m++){
-				Word* word = words[m];
-				delete word;
-			}
+	// 単語の文字列はmmapした領域から辞書に登録する単語の分だけ作る
+	// 分割は文番号の並べ替えだけで、コーパス全体を複製しない
+	Dataset::Dataset(std::string filename, double train_split, int unknown_count){
+		corpus_file::MappedCorpus corpus;
+		if(corpus.open(filename) == false){
+			std::string message = filename + " is not a valid corpus file";
+			PyErr_SetString(PyExc_IOError, message.c_str());
+			boost::python::throw_error_already_set();
 		}
-		for(int n = 0;n < _word_sequences_dev.size();n++){
-			std::vector<Word*> &words = _word_sequences_dev[n];
-			for(int m = 0;m < words.size();m++){
-				Word* word = words[m];
-				delete word;
+		_dict = new Dictionary();
+		_max_num_words_in_line = -1;
+		_min_num_words_in_line = -1;
+		for(size_t n = 0;n < corpus.get_num_sentences();n++){
+			int num_tokens;
+			corpus.get_sentence(n, num_tokens);
+			if(num_tokens > _max_num_words_in_line){
+				_max_num_words_in_line = num_tokens;
+			}
+			if(num_tokens < _min_num_words_in_line || _min_num_words_in_line == -1){
+				_min_num_words_in_line = num_tokens;
 			}
 		}
-		delete _dict;
-	}
-	void Dataset::_add_words_to_dataset(std::vector<std::wstring> &word_str_vec, std::vector<std::vector<Word*>> &dataset, Corpus* corpus, int unknown_count){
-		assert(word_str_vec.size() > 0);
-		std::vector<Word*> words;
-		// <s>を2つセット
-		for(int i = 0;i < 2;i++){
-			Word* bos = new Word();
-			bos->_state = 0;
-			words.push_back(bos);
-		}
-		// 単語列
-		for(auto word_str: word_str_vec){
-			if(word_str.size() == 0){
-				continue;
+
+		std::vector<int> rand_indices;
+		int num_train_data;
+		_split_indices(corpus.get_num_sentences(), train_split, rand_indices, num_train_data);
+		std::vector<int> word_id_of_token(corpus.get_num_types(), -1);
+		std::wstring word_str;
+		for(int i = 0;i < rand_indices.size();i++){
+			int num_tokens;
+			const int* token_ids = corpus.get_sentence(rand_indices[i], num_tokens);
+			for(int k = 0;k < num_tokens;k++){
+				int token_id = token_ids[k];
+				if(word_id_of_token[token_id] == -1){
+					if(corpus.get_type_count(token_id) <= unknown_count){
+						word_id_of_token[token_id] = ID_UNK;
+					}else{
+						const char* begin;
+						const char* end;
+						corpus.get_type_string(token_id, begin, end);
+						utils::utf8_to_wstring(begin, end, word_str);
+						word_id_of_token[token_id] = _dict->add_word_string(word_str);
+					}
+				}
 			}
-			Word* word = new Word();
-			int count = corpus->get_count_of_word(word_str);
-			if(count <= unknown_count){
-				word->_id = ID_UNK;
+			if(i < num_train_data){
+				_add_words_to_dataset(token_ids, num_tokens, _word_sequences_train, word_id_of_token);
 			}else{
-				word->_id = _dict->add_word_string(word_str);
+				_add_words_to_dataset(token_ids, num_tokens, _word_sequences_dev, word_id_of_token);
 			}
-			word->_state = 1;
-			words.push_back(word);
 		}
-		// </s>を2つセット
-		for(int i = 0;i < 2;i++){
-			Word* eos = new Word();
-			eos->_state = 0;
-			words.push_back(eos);
+		_dict->shrink_to_fit();
+	}
+	Dataset::~Dataset(){
+		delete _dict;
+	}
+	// シャッフルした文番号の先頭num_train_data個を訓練データにする
+	void Dataset::_split_indices(int num_sentences, double train_split, std::vector<int> &rand_indices, int &num_train_data){
+		for(int i = 0;i < num_sentences;i++){
+			rand_indices.push_back(i);
+		}
+		shuffle(rand_indices.begin(), rand_indices.end(), sampler::rng);	// データをシャッフル
+		train_split = std::min(1.0, std::max(0.0, train_split));
+		num_train_data = num_sentences * train_split;
+	}
+	// word_id_of_token[コーパス内の単語ID]は辞書の単語ID. 文中の単語は全て登録済みであること
+	void Dataset::_add_words_to_dataset(const int* token_ids, int num_tokens, WordSequences &dataset, std::vector<int> &word_id_of_token){
+		assert(num_tokens > 0);
+		std::vector<id> word_ids(num_tokens);
+		for(int k = 0;k < num_tokens;k++){
+			word_ids[k] = word_id_of_token[token_ids[k]];
+			assert(word_ids[k] != -1);
 		}
-		// 追加
-		dataset.push_back(words);
+		// <s>と</s>を2つずつ付けて追加
+		dataset.add_sentence(word_ids.data(), num_tokens);
 
-		if((int)words.size() > _max_num_words_in_line){
-			_max_num_words_in_line = words.size();
+		int length = num_tokens + BHMM_NUM_SENTINELS * 2;
+		if(length > _max_num_words_in_line){
+			_max_num_words_in_line = length;
 		}
-		if((int)words.size() < _min_num_words_in_line || _min_num_words_in_line == -1){
-			_min_num_words_in_line = words.size();
+		if(length < _min_num_words_in_line || _min_num_words_in_line == -1){
+			_min_num_words_in_line = length;
 		}
 	}
 	int Dataset::get_num_words(){
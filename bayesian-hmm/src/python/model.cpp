@@ -1,21 +1,63 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <iostream>
+#include <thread>
+#include "../bhmm/kernel.h"
 #include "../bhmm/utils.h"
 #include "model.h"
 
 namespace bhmm {
 	Model::Model(int num_tags, Dataset* dataset, boost::python::list py_Wt){
 		_set_locale();
+		_snapshot = NULL;
+		_beam_width = 0;
+		_beam_threshold = 0;
 		_hmm = new HMM(num_tags, dataset->get_num_words());
 		std::vector<int> Wt = utils::vector_from_list<int>(py_Wt);
 		_hmm->initialize_with_training_dataset(dataset->_word_sequences_train, Wt);
 	}
 	Model::Model(int num_tags, Dataset* dataset, std::vector<int> &Wt){
 		_set_locale();
+		_snapshot = NULL;
+		_beam_width = 0;
+		_beam_threshold = 0;
 		_hmm = new HMM(num_tags, dataset->get_num_words());
 		_hmm->initialize_with_training_dataset(dataset->_word_sequences_train, Wt);
 	}
+	// 単語ごとに取りうる品詞の一覧をCSR形式で与える
+	// 単語word_idの品詞はtags[offsets[word_id]]からtags[offsets[word_id + 1] - 1]まで
+	// 一覧が空の単語は全ての品詞を取りうる
+	Model::Model(int num_tags, Dataset* dataset, boost::python::list py_Wt, boost::python::object py_offsets, boost::python::object py_tags){
+		_set_locale();
+		_snapshot = NULL;
+		_beam_width = 0;
+		_beam_threshold = 0;
+		_hmm = new HMM(num_tags, dataset->get_num_words());
+		std::vector<int> offsets = utils::int_vector_from_object(py_offsets);
+		std::vector<int> tags = utils::int_vector_from_object(py_tags);
+		_hmm->set_tag_dictionary(new TagDictionary(num_tags, offsets, tags));
+		std::vector<int> Wt = utils::vector_from_list<int>(py_Wt);
+		_hmm->initialize_with_training_dataset(dataset->_word_sequences_train, Wt);
+	}
+	// 確率的変分推論用. カウントは全て0から始める
+	Model::Model(int num_tags, StreamingCorpus* corpus, boost::python::list py_Wt){
+		_set_locale();
+		_snapshot = NULL;
+		_beam_width = 0;
+		_beam_threshold = 0;
+		_hmm = new HMM(num_tags, corpus->get_num_words());
+		std::vector<int> Wt = utils::vector_from_list<int>(py_Wt);
+		assert(Wt.size() == num_tags);
+		for(int tag = 1;tag <= num_tags;tag++){
+			_hmm->set_Wt_for_tag(tag, Wt[tag - 1]);
+		}
+	}
 	Model::Model(std::string filename){
 		_set_locale();
+		_snapshot = NULL;
+		_beam_width = 0;
+		_beam_threshold = 0;
 		_hmm = new HMM();
 		if(load(filename) == false){
 			std::cout << filename << " not found." << std::endl;
@@ -24,6 +66,7 @@ namespace bhmm {
 	}
 	Model::~Model(){
 		delete _hmm;
+		delete _snapshot;
 	}
 	// 日本語周り
 	void Model::_set_locale(){
@@ -36,17 +79,50 @@ namespace bhmm {
 		std::wcin.imbue(ctype_default);
 	}
 	bool Model::load(std::string filename){
+		invalidate_decoding_snapshot();
 		return _hmm->load(filename);
 	}
 	bool Model::save(std::string filename){
 		return _hmm->save(filename);
 	}
 	void Model::set_initial_alpha(double alpha){
+		invalidate_decoding_snapshot();
 		_hmm->set_alpha(alpha);
 	}
 	void Model::set_initial_beta(double beta){
+		invalidate_decoding_snapshot();
 		_hmm->set_beta(beta);
 	}
+	// 学習を終えたモデルで復号を繰り返す前に呼ぶ
+	// 遷移確率の対数を表にしておき、以降のビタビアルゴリズムではそれを使う
+	// 3-gramをハッシュ表に持つモデルでは表が(T+1)^3の大きさになるので作らず、これまで通りカウントから計算する
+	void Model::freeze_for_decoding(){
+		delete _snapshot;
+		_snapshot = NULL;
+		if(_hmm->_trigram_counts->is_dense()){
+			_snapshot = new DecodingSnapshot(_hmm);
+		}
+	}
+	// カウントやハイパーパラメータを変えたら呼ぶ
+	void Model::invalidate_decoding_snapshot(){
+		delete _snapshot;
+		_snapshot = NULL;
+	}
+	bool Model::is_frozen_for_decoding(){
+		return _snapshot != NULL;
+	}
+	// ビタビアルゴリズムで各位置に残す(t_{i-1}, t_i)の組の数
+	// 0なら枝刈りしない
+	void Model::set_beam_width(int width){
+		assert(width >= 0);
+		_beam_width = width;
+	}
+	// 最良の組から対数確率でthreshold以上離れた組を捨てる
+	// 0なら枝刈りしない
+	void Model::set_beam_threshold(double threshold){
+		assert(threshold >= 0);
+		_beam_threshold = threshold;
+	}
 	int Model::get_num_tags(){
 		return _hmm->_num_tags;
 	}
@@ -64,131 +140,200 @@ namespace bhmm {
 	}
 	// 文の確率
 	// 前向きアルゴリズムの拡張
-	double Model::compute_p_sentence(std::vector<Word*> &sentence, double*** forward_table){
-		assert(sentence.size() > 4);	// <s>と</s>それぞれ2つづつ
+	// 単語ID列は<s>と</s>を含めて並んでいるのでそのまま渡す
+	double Model::compute_p_sentence(Sentence &sentence, DecodeWorkspace* workspace){
+		return compute_p_sentence(sentence._word_ids, sentence.size(), workspace);
+	}
+	// word_idsは<s>と</s>を2つずつ含む
+	double Model::compute_p_sentence(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
+		assert(sentence_length > 4);	// <s>と</s>それぞれ2つづつ
+		workspace->reserve(_hmm->_num_tags, sentence_length);
 		int tag_bos = 0;	// <s>
-		for(int ti = 1;ti <= _hmm->_num_tags;ti++){
+		// 各位置では単語が取りうる品詞だけを見る
+		const int* tags = NULL;
+		int num_tags_of_word = _hmm->get_allowed_tags(word_ids[2], tags);
+		for(int k = 0;k < num_tags_of_word;k++){
+			int ti = tags[k];
 			int ti_2 = tag_bos;	// <s>
 			int ti_1 = tag_bos;	// <s>
-			id wi = sentence[2]->_id;
+			id wi = word_ids[2];
 			double p_s_given_prev = _hmm->compute_p_ti_given_t(ti, ti_1, ti_2);
 			double p_w_given_s = _hmm->compute_p_wi_given_ti(wi, ti);
 			assert(p_s_given_prev > 0);
 			assert(p_w_given_s > 0);
-			forward_table[2][tag_bos][ti] = p_w_given_s * p_s_given_prev;
-			for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
-				forward_table[2][ti_1][ti] = 0;
-			}
+			workspace->forward(2, tag_bos, ti) = p_w_given_s * p_s_given_prev;
 		}
-		for(int i = 3;i < sentence.size() - 2;i++){
-			for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
-				for(int ti = 1;ti <= _hmm->_num_tags;ti++){
-
-					id wi = sentence[i]->_id;
+		for(int i = 3;i < sentence_length - 2;i++){
+			const int* tags_2 = &tag_bos;
+			int num_tags_2 = 1;
+			if(i > 3){
+				num_tags_2 = _hmm->get_allowed_tags(word_ids[i - 2], tags_2);
+			}
+			const int* tags_1 = NULL;
+			int num_tags_1 = _hmm->get_allowed_tags(word_ids[i - 1], tags_1);
+			num_tags_of_word = _hmm->get_allowed_tags(word_ids[i], tags);
+			for(int a = 0;a < num_tags_1;a++){
+				int ti_1 = tags_1[a];
+				for(int k = 0;k < num_tags_of_word;k++){
+					int ti = tags[k];
+					id wi = word_ids[i];
 					double p_w_given_s = _hmm->compute_p_wi_given_ti(wi, ti);
 					assert(p_w_given_s > 0);
-					forward_table[i][ti_1][ti] = 0;
-					if(i == 3){
-						forward_table[i][ti_1][ti] += forward_table[i - 1][tag_bos][ti_1] * _hmm->compute_p_ti_given_t(ti, ti_1, tag_bos);
-					}else{
-						for(int ti_2 = 1;ti_2 <= _hmm->_num_tags;ti_2++){
-							forward_table[i][ti_1][ti] += forward_table[i - 1][ti_2][ti_1] * _hmm->compute_p_ti_given_t(ti, ti_1, ti_2);
-						}
+					double &forward = workspace->forward(i, ti_1, ti);
+					forward = 0;
+					for(int b = 0;b < num_tags_2;b++){
+						int ti_2 = tags_2[b];
+						forward += workspace->forward(i - 1, ti_2, ti_1) * _hmm->compute_p_ti_given_t(ti, ti_1, ti_2);
 					}
-					forward_table[i][ti_1][ti] *= p_w_given_s;
-
+					forward *= p_w_given_s;
 				}
 			}
 		}
-		int i = sentence.size() - 3;
+		int i = sentence_length - 3;
+		const int* tags_1 = &tag_bos;
+		int num_tags_1 = 1;
+		if(i > 2){
+			num_tags_1 = _hmm->get_allowed_tags(word_ids[i - 1], tags_1);
+		}
+		num_tags_of_word = _hmm->get_allowed_tags(word_ids[i], tags);
 		double p_x = 0;
-		for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
-			for(int ti = 1;ti <= _hmm->_num_tags;ti++){
-				p_x += forward_table[i][ti_1][ti];
+		for(int a = 0;a < num_tags_1;a++){
+			for(int k = 0;k < num_tags_of_word;k++){
+				p_x += workspace->forward(i, tags_1[a], tags[k]);
 			}
 		}
 		return p_x;
 	}
-	void Model::_alloc_viterbi_tables(int sentence_length, double*** &forward_table, double*** &decode_table){
-		forward_table = new double**[sentence_length];
-		decode_table = new double**[sentence_length];
-		for(int i = 0;i < sentence_length;i++){
-			forward_table[i] = new double*[_hmm->_num_tags + 1];
-			decode_table[i] = new double*[_hmm->_num_tags + 1];
-			for(int k = 0;k <= _hmm->_num_tags;k++){
-				forward_table[i][k] = new double[_hmm->_num_tags + 1];
-				decode_table[i][k] = new double[_hmm->_num_tags + 1];
-			}
-		}
-	}
-	void Model::_free_viterbi_tables(int sentence_length, double*** &forward_table, double*** &decode_table){
-		for(int i = 0;i < sentence_length;i++){
-			for(int k = 0;k <= _hmm->_num_tags;k++){
-				delete[] forward_table[i][k];
-				delete[] decode_table[i][k];
-			}
-			delete[] forward_table[i];
-			delete[] decode_table[i];
-		}
-		delete[] forward_table;
-		delete[] decode_table;
-	}
+	// 作業領域はスレッドごとに使い回すので呼び出しのたびに確保しない
 	boost::python::list Model::python_viterbi_decode(boost::python::list py_word_ids){
-		// デコード用のテーブルを確保
 		int num_words = boost::python::len(py_word_ids);
-		double*** forward_table = NULL;
-		double*** decode_table = NULL;
-		_alloc_viterbi_tables(num_words + 4, forward_table, decode_table);
-		// Python側から渡された単語IDリストを変換
-		std::vector<Word*> sentence;
-		// <s>を2つセット
-		for(int i = 0;i < 2;i++){
-			Word* bos = new Word();
-			bos->_state = 0;
-			sentence.push_back(bos);
-		}
+		DecodeWorkspace* workspace = DecodeWorkspace::get_thread_local();
+		workspace->reserve(_hmm->_num_tags, num_words + 4);
+		// Python側から渡された単語IDリストを<s>と</s>で挟む
+		id* word_ids = workspace->_word_ids;
+		word_ids[0] = 0;
+		word_ids[1] = 0;
 		for(int i = 0;i < num_words;i++){
-			Word* word = new Word();
-			word->_id = boost::python::extract<id>(py_word_ids[i]);
-			word->_state = 0;
-			sentence.push_back(word);
-		}
-		// </s>を2つセット
-		for(int i = 0;i < 2;i++){
-			Word* eos = new Word();
-			eos->_state = 0;
-			sentence.push_back(eos);
+			word_ids[i + 2] = boost::python::extract<id>(py_word_ids[i]);
 		}
+		word_ids[num_words + 2] = 0;
+		word_ids[num_words + 3] = 0;
 		// ビタビアルゴリズム
-		std::vector<int> sampled_state_sequence;
-		viterbi_decode(sentence, sampled_state_sequence, forward_table, decode_table);
+		std::vector<int> &sampled_state_sequence = workspace->_state_sequence;
+		viterbi_decode(word_ids, num_words + 4, sampled_state_sequence, workspace);
 		// 結果を返す
 		boost::python::list result;
 		for(int i = 0;i < sampled_state_sequence.size();i++){
 			result.append(sampled_state_sequence[i]);
 		}
-		_free_viterbi_tables(num_words + 4, forward_table, decode_table);
-		for(int i = 0;i < sentence.size();i++){
-			delete sentence[i];
-		}
 		return result;
 	}
+	// 複数の文をまとめて復号する
+	// word_idsは全ての文の単語IDを<s>と</s>なしで連結したもので、n番目の文は[offsets[n], offsets[n + 1])
+	// 結果はword_idsと同じ位置に品詞を書き込んだ配列で返す
+	boost::python::object Model::python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads){
+		std::vector<int> word_ids = utils::int_vector_from_object(py_word_ids);
+		std::vector<int> offsets = utils::int_vector_from_object(py_offsets);
+		// GILを解放した後の各スレッドは範囲を確かめずに読むので、ここで全て確かめておく
+		if(num_threads <= 0){
+			PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+			boost::python::throw_error_already_set();
+		}
+		if(offsets.size() == 0 || offsets.front() != 0 || (size_t)offsets.back() != word_ids.size()){
+			PyErr_SetString(PyExc_ValueError, "offsets must start at 0 and end at the number of word ids");
+			boost::python::throw_error_already_set();
+		}
+		for(size_t n = 0;n + 1 < offsets.size();n++){
+			if(offsets[n] > offsets[n + 1]){
+				PyErr_SetString(PyExc_ValueError, "offsets must be non-decreasing");
+				boost::python::throw_error_already_set();
+			}
+		}
+		for(id word_id: word_ids){
+			if(word_id < 0 || (word_id >= _hmm->_num_words && word_id != ID_UNK)){
+				std::string message = "word id " + std::to_string(word_id) + " is out of range";
+				PyErr_SetString(PyExc_ValueError, message.c_str());
+				boost::python::throw_error_already_set();
+			}
+		}
+		std::vector<int> tags(word_ids.size(), 0);
+		// 復号中はPythonのオブジェクトに触れないのでGILを解放する
+		PyThreadState* thread_state = PyEval_SaveThread();
+		viterbi_decode_batch(word_ids.data(), offsets.data(), offsets.size() - 1, tags.data(), num_threads);
+		PyEval_RestoreThread(thread_state);
+		return utils::int_array_from_vector(tags);
+	}
+	// 文の長さがばらつくので各スレッドは終わり次第次の文を取りに行く
+	void Model::viterbi_decode_batch(const id* word_ids, const int* offsets, int num_sentences, int* tags, int num_threads){
+		assert(num_threads > 0);
+		std::atomic<int> next_sentence(0);
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < num_threads;thread_id++){
+			threads.push_back(std::thread(&Model::_viterbi_decode_batch_worker, this, word_ids, offsets, num_sentences, tags, &next_sentence));
+		}
+		_viterbi_decode_batch_worker(word_ids, offsets, num_sentences, tags, &next_sentence);
+		for(auto &thread: threads){
+			thread.join();
+		}
+	}
+	void Model::_viterbi_decode_batch_worker(const id* word_ids, const int* offsets, int num_sentences, int* tags, std::atomic<int>* next_sentence){
+		DecodeWorkspace workspace;	// スレッドごとに持ち、バッチの間使い回す
+		std::vector<int> &sampled_state_sequence = workspace._state_sequence;
+		while(true){
+			int n = next_sentence->fetch_add(1);
+			if(n >= num_sentences){
+				return;
+			}
+			int begin = offsets[n];
+			int num_words = offsets[n + 1] - begin;
+			assert(num_words >= 0);
+			if(num_words == 0){
+				continue;
+			}
+			workspace.reserve(_hmm->_num_tags, num_words + 4);
+			id* sentence = workspace._word_ids;
+			sentence[0] = 0;
+			sentence[1] = 0;
+			for(int i = 0;i < num_words;i++){
+				sentence[i + 2] = word_ids[begin + i];
+			}
+			sentence[num_words + 2] = 0;
+			sentence[num_words + 3] = 0;
+			viterbi_decode(sentence, num_words + 4, sampled_state_sequence, &workspace);
+			for(int i = 0;i < num_words;i++){
+				tags[begin + i] = sampled_state_sequence[i];
+			}
+		}
+	}
 	// 状態系列の復号
 	// ビタビアルゴリズムの拡張
-	void Model::viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence){
-		double*** forward_table = NULL;
-		double*** decode_table = NULL;
-		_alloc_viterbi_tables(sentence.size(), forward_table, decode_table);
-		viterbi_decode(sentence, sampled_state_sequence, forward_table, decode_table);
-		_free_viterbi_tables(sentence.size(), forward_table, decode_table);
-	}
-	void Model::viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence, double*** forward_table, double*** decode_table){
-		assert(sentence.size() > 4);	// <s>と</s>それぞれ2つづつ
+	void Model::viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence){
+		viterbi_decode(sentence, sampled_state_sequence, DecodeWorkspace::get_thread_local());
+	}
+	void Model::viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace){
+		viterbi_decode(sentence._word_ids, sentence.size(), sampled_state_sequence, workspace);
+	}
+	// word_idsは<s>と</s>を2つずつ含む
+	void Model::viterbi_decode(const id* word_ids, int sentence_length, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace){
+		assert(sentence_length > 4);	// <s>と</s>それぞれ2つづつ
+		workspace->reserve(_hmm->_num_tags, sentence_length);
+		if(_hmm->_tag_dictionary != NULL){
+			_viterbi_forward_with_tag_dictionary(word_ids, sentence_length, workspace);
+		}else if(_beam_width > 0 || _beam_threshold > 0){
+			_viterbi_forward_with_beam(word_ids, sentence_length, workspace);
+		}else if(_snapshot != NULL){
+			_viterbi_forward_with_snapshot(word_ids, sentence_length, workspace);
+		}else{
+			_viterbi_forward(word_ids, sentence_length, workspace);
+		}
+		_viterbi_backward(sentence_length, sampled_state_sequence, workspace);
+	}
+	void Model::_viterbi_forward(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
 		int tag_bos = 0;	// <s>
 		for(int ti = 1;ti <= _hmm->_num_tags;ti++){
 			int ti_2 = tag_bos;	// <s>
 			int ti_1 = tag_bos;	// <s>
-			id wi = sentence[2]->_id;
+			id wi = word_ids[2];
 			double p_s_given_prev = _hmm->compute_p_ti_given_t(ti, ti_1, ti_2);
 			double p_w_given_s = _hmm->compute_p_wi_given_ti(wi, ti);
 			assert(p_s_given_prev > 0);
@@ -196,16 +341,16 @@ namespace bhmm {
 			if(p_w_given_s > 0){
 				log_p_w_given_s = log(p_w_given_s);
 			}
-			forward_table[2][tag_bos][ti] = log_p_w_given_s + log(p_s_given_prev);
+			workspace->forward(2, tag_bos, ti) = log_p_w_given_s + log(p_s_given_prev);
 			for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
-				forward_table[2][ti_1][ti] = -10000000;
+				workspace->forward(2, ti_1, ti) = -10000000;
 			}
 		}
-		for(int i = 3;i < sentence.size() - 2;i++){
+		for(int i = 3;i < sentence_length - 2;i++){
 			for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
 				for(int ti = 1;ti <= _hmm->_num_tags;ti++){
 
-					id wi = sentence[i]->_id;
+					id wi = word_ids[i];
 					double p_w_given_s = _hmm->compute_p_wi_given_ti(wi, ti);
 					double log_p_w_given_s = -1000000;
 					if(p_w_given_s > 0){
@@ -213,30 +358,298 @@ namespace bhmm {
 					}
 					if(i == 3){
 						double p_s_given_prev = _hmm->compute_p_ti_given_t(ti, ti_1, tag_bos);
-						forward_table[i][ti_1][ti] = forward_table[i - 1][tag_bos][ti_1] + log(p_s_given_prev) + log_p_w_given_s;
-						decode_table[i][ti_1][ti] = tag_bos;
+						workspace->forward(i, ti_1, ti) = workspace->forward(i - 1, tag_bos, ti_1) + log(p_s_given_prev) + log_p_w_given_s;
+						workspace->decode(i, ti_1, ti) = tag_bos;
 					}else{
 						double max_value = 0;
 						for(int ti_2 = 1;ti_2 <= _hmm->_num_tags;ti_2++){
 							double p_s_given_prev = _hmm->compute_p_ti_given_t(ti, ti_1, ti_2);
-							double value = log(p_s_given_prev) + forward_table[i - 1][ti_2][ti_1];
+							double value = log(p_s_given_prev) + workspace->forward(i - 1, ti_2, ti_1);
 							if(max_value == 0 || value > max_value){
 								max_value = value;
-								forward_table[i][ti_1][ti] = value + log_p_w_given_s;
-								decode_table[i][ti_1][ti] = ti_2;
+								workspace->forward(i, ti_1, ti) = value + log_p_w_given_s;
+								workspace->decode(i, ti_1, ti) = ti_2;
 							}
 						}
 					}
 				}
 			}
 		}
-		int i = sentence.size() - 3;
+	}
+	// 遷移確率の対数は固めたものを使い、出力確率の対数は文ごとに品詞の数だけ計算する
+	// 結果は_viterbi_forwardと完全に一致する
+	void Model::_viterbi_forward_with_snapshot(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
+		assert(_snapshot->_num_tags == _hmm->_num_tags);
+		int num_tags = _hmm->_num_tags;
+		int tag_bos = 0;	// <s>
+		_compute_log_emissions(word_ids, sentence_length, workspace);
+		const double* log_transitions = _snapshot->log_transitions(tag_bos, tag_bos);
+		const double* log_emissions = workspace->log_emissions(2);
+		for(int ti = 1;ti <= num_tags;ti++){
+			workspace->forward(2, tag_bos, ti) = log_emissions[ti] + log_transitions[ti];
+			for(int ti_1 = 1;ti_1 <= num_tags;ti_1++){
+				workspace->forward(2, ti_1, ti) = -10000000;
+			}
+		}
+		for(int i = 3;i < sentence_length - 2;i++){
+			const double* log_emissions = workspace->log_emissions(i);
+			for(int ti_1 = 1;ti_1 <= num_tags;ti_1++){
+				double* forward = &workspace->forward(i, ti_1, 0);
+				int* decode = &workspace->decode(i, ti_1, 0);
+				if(i == 3){
+					const double* log_transitions = _snapshot->log_transitions(tag_bos, ti_1);
+					double prev = workspace->forward(i - 1, tag_bos, ti_1);
+					for(int ti = 1;ti <= num_tags;ti++){
+						forward[ti] = prev + log_transitions[ti] + log_emissions[ti];
+						decode[ti] = tag_bos;
+					}
+					continue;
+				}
+				// t_{i-2}を順に見て真に大きい時だけ更新するので、同点の場合は元の実装と同じく最初のものが残る
+				for(int ti = 1;ti <= num_tags;ti++){
+					forward[ti] = -INFINITY;
+					decode[ti] = 0;
+				}
+				for(int ti_2 = 1;ti_2 <= num_tags;ti_2++){
+					const double* log_transitions = _snapshot->log_transitions(ti_2, ti_1);
+					kernel::update_max_plus(log_transitions + 1, workspace->forward(i - 1, ti_2, ti_1), ti_2, num_tags, forward + 1, decode + 1);
+				}
+				for(int ti = 1;ti <= num_tags;ti++){
+					forward[ti] += log_emissions[ti];
+				}
+			}
+		}
+	}
+	// 各位置で単語が取りうる品詞の組だけを見る
+	// 取りうる品詞がk個ずつなら計算量は位置ごとにO(k^3)になる. 遷移確率も取りうる品詞の分だけ計算する
+	// ビームを設定していれば、各位置で残す(t_{i-1}, t_i)の組を_viterbi_forward_with_beamと同じく取りうる組から選ぶ
+	// 後ろ向きの復号は最後の位置の全ての組から最大のものを選ぶので、最後の位置だけは他の組を-∞にしておく
+	void Model::_viterbi_forward_with_tag_dictionary(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
+		int num_tags = _hmm->_num_tags;
+		int tag_bos = 0;	// <s>
+		int last = sentence_length - 3;
+		std::vector<int> &candidates = workspace->_beam_candidates;	// t_{i-1} * (num_tags + 1) + t_i
+		std::vector<double> &values = workspace->_beam_values;
+		std::vector<int> &beam = workspace->_beam;	// 生き残った組
+		std::vector<char> &is_reached = workspace->_is_reached;
+		for(int ti_1 = 0;ti_1 <= num_tags;ti_1++){
+			for(int ti = 1;ti <= num_tags;ti++){
+				workspace->forward(last, ti_1, ti) = -INFINITY;
+			}
+		}
+		const int* tags = NULL;
+		int num_tags_of_word = _hmm->get_allowed_tags(word_ids[2], tags);
+		candidates.clear();
+		values.clear();
+		for(int k = 0;k < num_tags_of_word;k++){
+			int ti = tags[k];
+			double p_w_given_s = _hmm->compute_p_wi_given_ti(word_ids[2], ti);
+			double log_p_w_given_s = (p_w_given_s > 0) ? log(p_w_given_s) : -1000000;
+			double value = log_p_w_given_s + _log_transition(tag_bos, tag_bos, ti);
+			workspace->forward(2, tag_bos, ti) = value;
+			candidates.push_back(tag_bos * (num_tags + 1) + ti);
+			values.push_back(value);
+		}
+		_prune_beam(candidates, values, workspace->_beam_buffer, beam);
+		for(int i = 3;i < sentence_length - 2;i++){
+			double* log_emissions = workspace->log_emissions(i);
+			const int* tags_1 = NULL;
+			int num_tags_1 = _hmm->get_allowed_tags(word_ids[i - 1], tags_1);
+			num_tags_of_word = _hmm->get_allowed_tags(word_ids[i], tags);
+			for(int k = 0;k < num_tags_of_word;k++){
+				int ti = tags[k];
+				double p_w_given_s = _hmm->compute_p_wi_given_ti(word_ids[i], ti);
+				log_emissions[ti] = (p_w_given_s > 0) ? log(p_w_given_s) : -1000000;
+			}
+			is_reached.assign(num_tags + 1, 0);
+			for(int code: beam){
+				is_reached[code % (num_tags + 1)] = 1;
+			}
+			for(int a = 0;a < num_tags_1;a++){
+				int ti_1 = tags_1[a];
+				if(is_reached[ti_1] == 0){
+					continue;
+				}
+				double* forward = &workspace->forward(i, ti_1, 0);
+				int* decode = &workspace->decode(i, ti_1, 0);
+				for(int k = 0;k < num_tags_of_word;k++){
+					forward[tags[k]] = -INFINITY;
+					decode[tags[k]] = 0;
+				}
+			}
+			// beamはt_{i-2}の昇順に並んでいるので、t_{i-2}を昇順に見て真に大きい時だけ更新するのと同じになる
+			for(int code: beam){
+				int ti_2 = code / (num_tags + 1);
+				int ti_1 = code % (num_tags + 1);
+				double prev = workspace->forward(i - 1, ti_2, ti_1);
+				double* forward = &workspace->forward(i, ti_1, 0);
+				int* decode = &workspace->decode(i, ti_1, 0);
+				for(int k = 0;k < num_tags_of_word;k++){
+					int ti = tags[k];
+					double value = prev + _log_transition(ti_2, ti_1, ti);
+					if(value > forward[ti]){
+						forward[ti] = value;
+						decode[ti] = ti_2;
+					}
+				}
+			}
+			candidates.clear();
+			values.clear();
+			for(int a = 0;a < num_tags_1;a++){
+				int ti_1 = tags_1[a];
+				if(is_reached[ti_1] == 0){
+					continue;
+				}
+				double* forward = &workspace->forward(i, ti_1, 0);
+				for(int k = 0;k < num_tags_of_word;k++){
+					int ti = tags[k];
+					forward[ti] += log_emissions[ti];
+					candidates.push_back(ti_1 * (num_tags + 1) + ti);
+					values.push_back(forward[ti]);
+				}
+			}
+			_prune_beam(candidates, values, workspace->_beam_buffer, beam);
+		}
+	}
+	void Model::_compute_log_emissions(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
+		for(int i = 2;i < sentence_length - 2;i++){
+			double* log_emissions = workspace->log_emissions(i);
+			for(int ti = 1;ti <= _hmm->_num_tags;ti++){
+				double p_w_given_s = _hmm->compute_p_wi_given_ti(word_ids[i], ti);
+				log_emissions[ti] = -1000000;
+				if(p_w_given_s > 0){
+					log_emissions[ti] = log(p_w_given_s);
+				}
+			}
+		}
+	}
+	// 各位置で(t_{i-1}, t_i)の組を上位_beam_width個、または最良から_beam_threshold以内のものだけ残し、
+	// 次の位置では残った組からだけ遷移させる
+	// 計算量は位置ごとにO(K・T + T^2)になる
+	void Model::_viterbi_forward_with_beam(const id* word_ids, int sentence_length, DecodeWorkspace* workspace){
+		int num_tags = _hmm->_num_tags;
+		int tag_bos = 0;	// <s>
+		_compute_log_emissions(word_ids, sentence_length, workspace);
+		std::vector<double> &row = workspace->_log_transition_row;
+		row.resize(num_tags + 1);
+		std::vector<int> &candidates = workspace->_beam_candidates;	// t_{i-1} * (num_tags + 1) + t_i
+		std::vector<double> &values = workspace->_beam_values;
+		std::vector<int> &beam = workspace->_beam;	// 生き残った組
+		std::vector<char> &is_reached = workspace->_is_reached;
+		// 文頭
+		const double* log_emissions = workspace->log_emissions(2);
+		const double* log_transitions = _log_transition_row(tag_bos, tag_bos, row.data());
+		for(int ti_1 = 0;ti_1 <= num_tags;ti_1++){
+			for(int ti = 1;ti <= num_tags;ti++){
+				workspace->forward(2, ti_1, ti) = -INFINITY;
+			}
+		}
+		candidates.clear();
+		values.clear();
+		for(int ti = 1;ti <= num_tags;ti++){
+			double value = log_emissions[ti] + log_transitions[ti];
+			workspace->forward(2, tag_bos, ti) = value;
+			candidates.push_back(tag_bos * (num_tags + 1) + ti);
+			values.push_back(value);
+		}
+		_prune_beam(candidates, values, workspace->_beam_buffer, beam);
+		for(int i = 3;i < sentence_length - 2;i++){
+			const double* log_emissions = workspace->log_emissions(i);
+			// 残った組から届かない(t_{i-1}, t_i)は後ろ向きの復号で選ばれないように-∞のままにしておく
+			is_reached.assign(num_tags + 1, 0);
+			for(int code: beam){
+				is_reached[code % (num_tags + 1)] = 1;
+			}
+			for(int ti_1 = 1;ti_1 <= num_tags;ti_1++){
+				double* forward = &workspace->forward(i, ti_1, 0);
+				int* decode = &workspace->decode(i, ti_1, 0);
+				for(int ti = 1;ti <= num_tags;ti++){
+					forward[ti] = -INFINITY;
+					decode[ti] = 0;
+				}
+			}
+			// beamはt_{i-2}の昇順に並んでいるので同点の場合は厳密な実装と同じものが残る
+			for(int code: beam){
+				int ti_2 = code / (num_tags + 1);
+				int ti_1 = code % (num_tags + 1);
+				const double* log_transitions = _log_transition_row(ti_2, ti_1, row.data());
+				double* forward = &workspace->forward(i, ti_1, 0);
+				int* decode = &workspace->decode(i, ti_1, 0);
+				kernel::update_max_plus(log_transitions + 1, workspace->forward(i - 1, ti_2, ti_1), ti_2, num_tags, forward + 1, decode + 1);
+			}
+			candidates.clear();
+			values.clear();
+			for(int ti_1 = 1;ti_1 <= num_tags;ti_1++){
+				if(is_reached[ti_1] == 0){
+					continue;
+				}
+				double* forward = &workspace->forward(i, ti_1, 0);
+				for(int ti = 1;ti <= num_tags;ti++){
+					forward[ti] += log_emissions[ti];
+					candidates.push_back(ti_1 * (num_tags + 1) + ti);
+					values.push_back(forward[ti]);
+				}
+			}
+			_prune_beam(candidates, values, workspace->_beam_buffer, beam);
+		}
+	}
+	// 符号の昇順に並んだcandidatesから残す組を選んでbeamに入れる
+	// 境界と同点の組は全て残すので_beam_widthより多くなることがある
+	void Model::_prune_beam(std::vector<int> &candidates, std::vector<double> &values, std::vector<double> &buffer, std::vector<int> &beam){
+		assert(candidates.size() > 0 && candidates.size() == values.size());
+		double cutoff = -INFINITY;
+		if(_beam_threshold > 0){
+			cutoff = *std::max_element(values.begin(), values.end()) - _beam_threshold;
+		}
+		if(_beam_width > 0 && candidates.size() > _beam_width){
+			// 上位_beam_width番目の値を境界にする
+			buffer.assign(values.begin(), values.end());
+			std::nth_element(buffer.begin(), buffer.begin() + _beam_width - 1, buffer.end(), std::greater<double>());
+			cutoff = std::max(cutoff, buffer[_beam_width - 1]);
+		}
+		beam.clear();
+		for(int k = 0;k < candidates.size();k++){
+			if(values[k] >= cutoff){
+				beam.push_back(candidates[k]);
+			}
+		}
+	}
+	// log P(・|t_2, t_1). 固めたモデルがあればその表を返し、なければrowに計算する
+	const double* Model::_log_transition_row(int t_2, int t_1, double* row){
+		if(_snapshot != NULL){
+			return _snapshot->log_transitions(t_2, t_1);
+		}
+		row[0] = 0;
+		for(int t = 1;t <= _hmm->_num_tags;t++){
+			row[t] = log(_hmm->compute_p_ti_given_t(t, t_1, t_2));
+		}
+		return row;
+	}
+	void Model::_viterbi_backward(int sentence_length, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace){
+		int tag_bos = 0;	// <s>
+		// 1単語の文は文脈が(<s>, <s>)しかない
+		if(sentence_length == 5){
+			double max_p_x_s = 0;
+			int argmax_ti = 0;
+			for(int ti = 1;ti <= _hmm->_num_tags;ti++){
+				double log_p_x_s = workspace->forward(2, tag_bos, ti);
+				if(max_p_x_s == 0 || log_p_x_s > max_p_x_s){
+					max_p_x_s = log_p_x_s;
+					argmax_ti = ti;
+				}
+			}
+			assert(1 <= argmax_ti && argmax_ti <= _hmm->_num_tags);
+			sampled_state_sequence.clear();
+			sampled_state_sequence.push_back(argmax_ti);
+			return;
+		}
+		int i = sentence_length - 3;
 		double max_p_x_s = 0;
-		double argmax_ti_1 = 0;
-		double argmax_ti = 0;
+		int argmax_ti_1 = 0;
+		int argmax_ti = 0;
 		for(int ti_1 = 1;ti_1 <= _hmm->_num_tags;ti_1++){
 			for(int ti = 1;ti <= _hmm->_num_tags;ti++){
-				double log_p_x_s = forward_table[i][ti_1][ti];
+				double log_p_x_s = workspace->forward(i, ti_1, ti);
 				if(max_p_x_s == 0 || log_p_x_s > max_p_x_s){
 					max_p_x_s = log_p_x_s;
 					argmax_ti_1 = ti_1;
@@ -246,19 +659,20 @@ namespace bhmm {
 		}
 		assert(1 <= argmax_ti_1 && argmax_ti_1 <= _hmm->_num_tags);
 		assert(1 <= argmax_ti && argmax_ti <= _hmm->_num_tags);
+		// 後ろから積んで最後に反転する
 		sampled_state_sequence.clear();
-		sampled_state_sequence.push_back(argmax_ti_1);
 		sampled_state_sequence.push_back(argmax_ti);
+		sampled_state_sequence.push_back(argmax_ti_1);
 		int ti_1 = argmax_ti_1;
 		int ti = argmax_ti;
-		for(int i = sentence.size() - 3;i >= 4;i--){
-			int ti_2 = decode_table[i][ti_1][ti];
+		for(int i = sentence_length - 3;i >= 4;i--){
+			int ti_2 = workspace->decode(i, ti_1, ti);
 			sampled_state_sequence.push_back(ti_2);
 			ti = ti_1;
 			ti_1 = ti_2;
 		}
 		std::reverse(sampled_state_sequence.begin(), sampled_state_sequence.end());
-		assert(sampled_state_sequence.size() == sentence.size() - 4);
+		assert(sampled_state_sequence.size() == sentence_length - 4);
 	}
 	struct value_comparator {
 		bool operator()(const std::pair<int, int> &a, const std::pair<int, int> &b) {
@@ -268,16 +682,12 @@ namespace bhmm {
 	void Model::print_typical_words_assigned_to_each_tag(int number_to_show, Dictionary* dict){
 		using std::wcout;
 		using std::endl;
+		std::vector<EmissionCounts::SparseCounts> words_of_tag;
+		_hmm->_tag_word_counts->enumerate_words_of_each_tag(words_of_tag);
 		for(int tag = 1;tag <= _hmm->_num_tags;tag++){
 			int n = 0;
 			wcout << "\x1b[32;1m" << "[" << tag << "]" << "\x1b[0m" << std::endl;
-			std::multiset<std::pair<int, int>, value_comparator> ranking;
-			for(id word_id = 0;word_id < _hmm->_num_words;word_id++){
-				int count = _hmm->_tag_word_counts[tag][word_id];
-				if(count > 0){
-					ranking.insert(std::make_pair(word_id, count));
-				}
-			}
+			std::multiset<std::pair<int, int>, value_comparator> ranking(words_of_tag[tag].begin(), words_of_tag[tag].end());
 			for(auto elem: ranking){
 				std::wstring word = dict->word_id_to_string(elem.first);
 				wcout << "\x1b[1m" << word << "\x1b[0m" << L"(" << elem.second << L") ";
@@ -1,20 +1,43 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
 #include <string>
 #include "../bhmm/hmm.h"
+#include "../bhmm/snapshot.h"
+#include "../bhmm/workspace.h"
 #include "dataset.h"
 #include "dictionary.h"
+#include "stream.h"
 
 namespace bhmm {
 	class Model{
 	private:
-		void _alloc_viterbi_tables(int sentence_length, double*** &forward_table, double*** &decode_table);
-		void _free_viterbi_tables(int sentence_length, double*** &forward_table, double*** &decode_table);
 		void _set_locale();
+		void _viterbi_forward(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
+		void _viterbi_forward_with_snapshot(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
+		void _viterbi_forward_with_tag_dictionary(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
+		void _viterbi_forward_with_beam(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
+		void _compute_log_emissions(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
+		void _prune_beam(std::vector<int> &candidates, std::vector<double> &values, std::vector<double> &buffer, std::vector<int> &beam);
+		const double* _log_transition_row(int t_2, int t_1, double* row);
+		// log P(t|t_2, t_1). 固めたモデルがあればその表から引く
+		inline double _log_transition(int t_2, int t_1, int t){
+			if(_snapshot != NULL){
+				return _snapshot->log_transitions(t_2, t_1)[t];
+			}
+			return log(_hmm->compute_p_ti_given_t(t, t_1, t_2));
+		}
+		void _viterbi_backward(int sentence_length, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace);
+		void _viterbi_decode_batch_worker(const id* word_ids, const int* offsets, int num_sentences, int* tags, std::atomic<int>* next_sentence);
 	public:
 		HMM* _hmm;
+		DecodingSnapshot* _snapshot;	// freeze_for_decodingするまではNULL
+		int _beam_width;			// 0なら枝刈りしない
+		double _beam_threshold;	// 0なら枝刈りしない
 		Model(int num_tags, Dataset* dataset, boost::python::list py_Wt);
 		Model(int num_tags, Dataset* dataset, std::vector<int> &Wt);
+		Model(int num_tags, Dataset* dataset, boost::python::list py_Wt, boost::python::object py_offsets, boost::python::object py_tags);
+		Model(int num_tags, StreamingCorpus* corpus, boost::python::list py_Wt);
 		Model(std::string filename);
 		~Model();
 		bool load(std::string filename);
@@ -26,10 +49,19 @@ namespace bhmm {
 		void set_temperature(double temperature);
 		void set_minimum_temperature(double temperature);
 		void anneal_temperature(double decay);
-		void viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence);
-		void viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence, double*** forward_table, double*** decode_table);
+		void freeze_for_decoding();
+		void invalidate_decoding_snapshot();
+		bool is_frozen_for_decoding();
+		void set_beam_width(int width);
+		void set_beam_threshold(double threshold);
+		void viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence);
+		void viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace);
+		void viterbi_decode(const id* word_ids, int sentence_length, std::vector<int> &sampled_state_sequence, DecodeWorkspace* workspace);
 		boost::python::list python_viterbi_decode(boost::python::list py_word_ids);
-		double compute_p_sentence(std::vector<Word*> &sentence, double*** forward_table);
+		void viterbi_decode_batch(const id* word_ids, const int* offsets, int num_sentences, int* tags, int num_threads);
+		boost::python::object python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads);
+		double compute_p_sentence(Sentence &sentence, DecodeWorkspace* workspace);
+		double compute_p_sentence(const id* word_ids, int sentence_length, DecodeWorkspace* workspace);
 		void print_typical_words_assigned_to_each_tag(int number_to_show, Dictionary* dict);
 		void print_alpha_and_beta();
 	};
@@ -0,0 +1,69 @@
+#include <cassert>
+#include "stream.h"
+#include "../bhmm/utils.h"
+
+namespace bhmm {
+	StreamingCorpus::StreamingCorpus(std::string filename, int unknown_count){
+		if(_stream.open(filename) == false){
+			std::string message = filename + " could not be opened";
+			PyErr_SetString(PyExc_IOError, message.c_str());
+			boost::python::throw_error_already_set();
+		}
+		// 空のコーパスではnext_minibatchが文を取り出せずに止まらなくなる
+		if(_stream._num_sentences == 0){
+			std::string message = filename + " contains no sentences";
+			PyErr_SetString(PyExc_ValueError, message.c_str());
+			boost::python::throw_error_already_set();
+		}
+		_dict = new Dictionary();
+		_num_passes = 0;
+		_max_num_words_in_line = _stream._max_num_words_in_line + BHMM_NUM_SENTINELS * 2;
+		_word_id_of_type.resize(_stream.get_num_types(), ID_UNK);
+		std::string utf8;
+		std::wstring word_str;
+		for(int type_id = 0;type_id < _stream.get_num_types();type_id++){
+			if(_stream.get_type_count(type_id) <= unknown_count){
+				continue;
+			}
+			_stream.get_type_string(type_id, utf8);
+			utils::utf8_to_wstring(utf8.data(), utf8.data() + utf8.size(), word_str);
+			_word_id_of_type[type_id] = _dict->add_word_string(word_str);
+		}
+		_dict->shrink_to_fit();
+	}
+	StreamingCorpus::~StreamingCorpus(){
+		delete _dict;
+	}
+	void StreamingCorpus::next_minibatch(int batch_size, WordSequences &minibatch){
+		assert(batch_size > 0);
+		assert(_stream._num_sentences > 0);
+		minibatch.clear();
+		std::vector<id> word_ids;
+		while(minibatch.size() < batch_size){
+			if(_stream.next_sentence(_token_ids) == false){
+				_num_passes++;
+				continue;
+			}
+			word_ids.resize(_token_ids.size());
+			for(size_t k = 0;k < _token_ids.size();k++){
+				word_ids[k] = _word_id_of_type[_token_ids[k]];
+			}
+			minibatch.add_sentence(word_ids.data(), word_ids.size());
+		}
+	}
+	int StreamingCorpus::get_num_words(){
+		return _dict->get_vocabrary_size();
+	}
+	size_t StreamingCorpus::get_num_sentences(){
+		return _stream._num_sentences;
+	}
+	size_t StreamingCorpus::get_num_tokens(){
+		return _stream._num_tokens;
+	}
+	int StreamingCorpus::get_num_passes(){
+		return _num_passes;
+	}
+	Dictionary &StreamingCorpus::get_dict_obj(){
+		return *_dict;
+	}
+}
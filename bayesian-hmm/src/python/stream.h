@@ -0,0 +1,35 @@
+#pragma once
+#include <boost/python.hpp>
+#include <string>
+#include <vector>
+#include "../bhmm/common.h"
+#include "../bhmm/sequences.h"
+#include "../bhmm/stream.h"
+#include "dictionary.h"
+
+namespace bhmm {
+	// ファイルからミニバッチ単位で文を読むデータセット
+	// テキストファイルとコーパスの独自バイナリ形式のどちらでもよい
+	// 開く時に単語の頻度から辞書を作り、頻度がunknown_count以下の単語は<unk>にする
+	// 単語ID列は読んだミニバッチの分だけ持つ
+	class StreamingCorpus{
+	private:
+		std::vector<int> _token_ids;	// 読み込み用
+	public:
+		SentenceStream _stream;
+		Dictionary* _dict;
+		std::vector<id> _word_id_of_type;	// コーパス内の単語ID -> 辞書の単語ID
+		int _num_passes;					// コーパスを最後まで読んだ回数
+		int _max_num_words_in_line;			// <s>と</s>を含む
+		StreamingCorpus(std::string filename, int unknown_count);
+		~StreamingCorpus();
+		// 次のbatch_size文を<s>と</s>で挟んでminibatchに入れる
+		// 最後まで読んだら先頭に戻って続きを読む
+		void next_minibatch(int batch_size, WordSequences &minibatch);
+		int get_num_words();
+		size_t get_num_sentences();
+		size_t get_num_tokens();
+		int get_num_passes();
+		Dictionary &get_dict_obj();
+	};
+}
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include "svi.h"
+
+namespace bhmm {
+	SVITrainer::SVITrainer(StreamingCorpus* corpus, Model* model){
+		assert(model->_hmm->_num_words == corpus->get_num_words());
+		// 変分ベイズの期待カウントは密な配列に持つので品詞数が多すぎると扱えない
+		if(model->_hmm->_num_tags > BHMM_DENSE_TRIGRAM_MAX_TAGS){
+			std::string message = "variational Bayes supports at most " + std::to_string(BHMM_DENSE_TRIGRAM_MAX_TAGS) + " tags";
+			PyErr_SetString(PyExc_ValueError, message.c_str());
+			boost::python::throw_error_already_set();
+		}
+		_model = model;
+		_corpus = corpus;
+		_batch_size = 256;
+		_tau = 1;
+		_kappa = 0.7;
+		_num_updates = 0;
+		_num_threads = 1;
+		_variational = new VariationalEM(model->_hmm, _num_threads);
+	}
+	SVITrainer::~SVITrainer(){
+		delete _variational;
+	}
+	void SVITrainer::set_batch_size(int batch_size){
+		assert(batch_size > 0);
+		_batch_size = batch_size;
+	}
+	void SVITrainer::set_learning_rate(double tau, double kappa){
+		assert(tau >= 0);
+		assert(0.5 < kappa && kappa <= 1);
+		_tau = tau;
+		_kappa = kappa;
+	}
+	// E-stepをミニバッチの文を分けて並列に行う
+	void SVITrainer::set_num_threads(int num_threads){
+		assert(num_threads > 0);
+		_num_threads = num_threads;
+		_variational->set_num_threads(num_threads);
+	}
+	// 次の更新で使う学習率
+	// 最初の更新は1より大きくならないように1で抑える
+	double SVITrainer::get_learning_rate(){
+		return std::min(1.0, pow(_tau + _num_updates, -_kappa));
+	}
+	int SVITrainer::get_num_updates(){
+		return _num_updates;
+	}
+	int SVITrainer::get_num_passes(){
+		return _corpus->get_num_passes();
+	}
+	double SVITrainer::update(){
+		_model->invalidate_decoding_snapshot();
+		_corpus->next_minibatch(_batch_size, _minibatch);
+		double num_sentences = _corpus->get_num_sentences();
+		if(_num_updates == 0){
+			_variational->initialize_randomly(_minibatch, num_sentences / _minibatch.size());
+		}
+		double log_p = _variational->stochastic_update(_minibatch, num_sentences, get_learning_rate());
+		_num_updates++;
+		return log_p;
+	}
+	void SVITrainer::update_model(){
+		_model->invalidate_decoding_snapshot();
+		if(_num_updates > 0){
+			_variational->update_model();
+		}
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <boost/python.hpp>
+#include "../bhmm/sequences.h"
+#include "../bhmm/variational.h"
+#include "model.h"
+#include "stream.h"
+
+namespace bhmm {
+	// 確率的変分推論
+	// ファイルから読んだミニバッチごとに前向き後ろ向きアルゴリズムで期待カウントを求め、
+	// コーパス全体の大きさに引き伸ばしたものへ学習率 ρ_t = (τ + t)^(-κ) で近づける
+	// メモリに持つのは1ミニバッチ分の文と、品詞3-gramと品詞-単語ペアの期待カウントだけ
+	class SVITrainer{
+	private:
+		Model* _model;
+		StreamingCorpus* _corpus;
+		VariationalEM* _variational;
+		WordSequences _minibatch;
+		int _batch_size;
+		double _tau;		// 大きいほど最初の更新を小さくする
+		double _kappa;		// 学習率の減り方. (0.5, 1]なら収束する
+		int _num_updates;
+		int _num_threads;
+	public:
+		SVITrainer(StreamingCorpus* corpus, Model* model);
+		~SVITrainer();
+		void set_batch_size(int batch_size);
+		void set_learning_rate(double tau, double kappa);
+		void set_num_threads(int num_threads);
+		double get_learning_rate();
+		int get_num_updates();
+		int get_num_passes();
+		// 次のミニバッチで1回更新し、ミニバッチの単語あたりの対数周辺尤度の近似を返す
+		double update();
+		// 期待カウントをモデルのカウントに書き込む. 保存や復号の前に呼ぶ
+		void update_model();
+	};
+}
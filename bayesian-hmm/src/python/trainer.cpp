@@ -1,5 +1,7 @@
 #include <cassert>
+#include <functional>
 #include <iostream>
+#include <thread>
 #include "../bhmm/sampler.h"
 #include "../bhmm/utils.h"
 #include "trainer.h"
@@ -9,26 +11,283 @@ namespace bhmm {
 		_model = model;
 		_dict = dataset->_dict;
 		_dataset = dataset;
+		_num_threads = 1;
+		_sync_interval = 0;
+		_parallel_gibbs = NULL;
+		_num_chains = 1;
+		_max_temperature = 10;
+		_tempering = NULL;
+		_variational = NULL;
+		_type_gibbs = NULL;
+		_counts_from_variational = false;
+		_interrupted = false;
+		_log_p_joint = 0;
+		_log_p_joint_valid = false;
+		_num_incremental_epochs = 0;
+		_decode_workspace = new DecodeWorkspace();
+		_checkpoint = NULL;
+		_checkpoint_pending = false;
+		_checkpoint_succeeded = true;
+	}
+	Trainer::~Trainer(){
+		if(_checkpoint_thread.joinable()){
+			_checkpoint_thread.join();
+		}
+		delete _checkpoint;
+		delete _parallel_gibbs;
+		delete _tempering;
+		delete _variational;
+		delete _type_gibbs;
+		delete _decode_workspace;
+		for(DecodeWorkspace* workspace: _workspaces){
+			delete workspace;
+		}
+	}
+	void Trainer::set_num_threads(int num_threads){
+		assert(num_threads > 0);
+		if(num_threads == _num_threads){
+			return;
+		}
+		_num_threads = num_threads;
+		delete _parallel_gibbs;
+		_parallel_gibbs = NULL;
+	}
+	int Trainer::get_num_threads(){
+		return _num_threads;
+	}
+	// 各スレッドが何文サンプリングするごとにカウントを同期するか
+	// 0なら1エポックに1回
+	void Trainer::set_sync_interval(int interval){
+		assert(interval >= 0);
+		_sync_interval = interval;
+		if(_parallel_gibbs != NULL){
+			_parallel_gibbs->set_sync_interval(interval);
+		}
+	}
+	// レプリカ交換法で使う鎖の数. 1なら使わない
+	// 鎖ごとに1スレッドを使い、高温の鎖のカウントと品詞の列を複製して持つ
+	void Trainer::set_num_chains(int num_chains){
+		assert(num_chains > 0);
+		if(num_chains == _num_chains){
+			return;
+		}
+		_num_chains = num_chains;
+		delete _tempering;
+		_tempering = NULL;
+	}
+	int Trainer::get_num_chains(){
+		return _num_chains;
+	}
+	// 最も高温の鎖の温度
+	void Trainer::set_max_temperature(double temperature){
+		assert(temperature > 0);
+		_max_temperature = temperature;
+		if(_tempering != NULL){
+			_tempering->set_max_temperature(temperature);
+		}
+	}
+	// 隣り合う温度の鎖の交換の採択率
+	boost::python::list Trainer::python_get_exchange_acceptance_rates(){
+		boost::python::list rates;
+		if(_tempering == NULL){
+			return rates;
+		}
+		for(int chain = 0;chain + 1 < _num_chains;chain++){
+			rates.append(_tempering->get_acceptance_rate(chain));
+		}
+		return rates;
+	}
+	// 現在のカウントを複製してから別スレッドでファイルに書き出す
+	// 書き出している間もサンプリングを続けられる. 前の保存が終わっていなければ先に待つ
+	bool Trainer::save_async(std::string filename){
+		wait_for_save();
+		if(_checkpoint == NULL){
+			_checkpoint = new HMM();
+		}
+		_checkpoint->copy_from(_model->_hmm);	// 大きさが同じなら確保済みの表に上書きする
+		_checkpoint_pending = true;
+		_checkpoint_thread = std::thread(&Trainer::_write_checkpoint, this, filename);
+		return true;
+	}
+	void Trainer::_write_checkpoint(std::string filename){
+		// 一時ファイルに書いてから置き換えるので、書き出し中に読まれても古いモデルが見える
+		_checkpoint_succeeded = _checkpoint->save(filename);
+		_checkpoint_pending = false;
+	}
+	bool Trainer::is_saving(){
+		return _checkpoint_pending;
+	}
+	// 保存中なら終わるまで待ち、最後の保存が成功したかを返す
+	bool Trainer::wait_for_save(){
+		if(_checkpoint_thread.joinable() == false){
+			return _checkpoint_succeeded;
+		}
+		// 書き出しはPythonのオブジェクトに触れないので待つ間はGILを解放する
+		PyThreadState* thread_state = (Py_IsInitialized() && PyGILState_Check()) ? PyEval_SaveThread() : NULL;
+		_checkpoint_thread.join();
+		if(thread_state != NULL){
+			PyEval_RestoreThread(thread_state);
+		}
+		return _checkpoint_succeeded;
 	}
 	void Trainer::gibbs(){
-		std::vector<std::vector<Word*>> &dataset = _dataset->_word_sequences_train;
+		_gibbs(false);
+	}
+	// 文単位のブロック化サンプリング
+	// 1エポックあたりの計算量は増えるが少ないエポック数で収束する
+	void Trainer::blocked_gibbs(){
+		_gibbs(true);
+	}
+	// 単語の種類ごとのブロック化サンプリングを1回行い、品詞が変わった単語の割合を返す
+	// gibbsやblocked_gibbsの合間に呼ぶ. 1スレッドで行い、レプリカ交換法では温度の最も低い鎖だけを動かす
+	double Trainer::type_gibbs(){
+		_model->invalidate_decoding_snapshot();	// カウントが変わる
+		WordSequences &dataset = _dataset->_word_sequences_train;
+		if(_counts_from_variational){
+			_model->_hmm->count_assignments(dataset);
+			_counts_from_variational = false;
+		}
+		if(_type_gibbs == NULL){
+			_type_gibbs = new TypeGibbs(_model->_hmm, dataset);
+		}
+		_log_p_joint_valid = false;
+		return _type_gibbs->sweep(sampler::rng);
+	}
+	// 変分ベイズEMを1回行い、変分下界を返す
+	// E-stepはset_num_threadsのスレッド数で文を分けて並列に行う
+	// Gibbsサンプリングの後に呼ぶとその時点の品詞の割り当てから始める
+	double Trainer::variational_em(){
+		_model->invalidate_decoding_snapshot();	// カウントが変わる
+		WordSequences &dataset = _dataset->_word_sequences_train;
+		if(_variational == NULL){
+			if(_model->_hmm->_num_tags > BHMM_DENSE_TRIGRAM_MAX_TAGS){
+				std::string message = "variational Bayes supports at most " + std::to_string(BHMM_DENSE_TRIGRAM_MAX_TAGS) + " tags";
+				PyErr_SetString(PyExc_ValueError, message.c_str());
+				boost::python::throw_error_already_set();
+			}
+			_variational = new VariationalEM(_model->_hmm, _num_threads);
+		}
+		_variational->set_num_threads(_num_threads);
+		if(_counts_from_variational == false){
+			_variational->initialize_with_assignments(dataset);
+			_counts_from_variational = true;
+		}
+		_log_p_joint_valid = false;
+		return _variational->iterate(dataset);
+	}
+	void Trainer::_gibbs(bool blocked){
+		_model->invalidate_decoding_snapshot();	// カウントが変わる
+		WordSequences &dataset = _dataset->_word_sequences_train;
+		// 期待カウントのままでは割り当てと対応しないので、各位置で事後確率が最大の品詞から数え直す
+		if(_counts_from_variational){
+			_model->_hmm->count_assignments(dataset);
+			_counts_from_variational = false;
+		}
+		_previous_states.assign(dataset._states.begin(), dataset._states.end());
+		// 逐次のGibbsサンプリングだけが同時確率の差分を正しく追える
+		HMM* hmm = _model->_hmm;
+		bool incremental = _log_p_joint_valid && blocked == false && _num_chains == 1 && _num_threads == 1 && _num_incremental_epochs < BHMM_LOG_P_RESYNC_INTERVAL;
+		incremental = incremental && hmm->_num_words_of_tag.size() == hmm->_num_tags + 1;
+		hmm->_log_p_joint_delta = 0;
+		hmm->_track_log_p_joint = incremental;
+		bool finished = _sample_epoch(dataset, blocked);
+		hmm->_track_log_p_joint = false;
+		if(finished == false){
+			_log_p_joint_valid = false;		// 途中で止めたエポックは記録しない
+			return;
+		}
+		_update_convergence(dataset, incremental);
+	}
+	// ctrl+cで止めた場合はfalseを返す
+	bool Trainer::_sample_epoch(WordSequences &dataset, bool blocked){
 		if(_rand_indices.size() != dataset.size()){
 			_rand_indices.clear();
 			for(int data_index = 0;data_index < dataset.size();data_index++){
 				_rand_indices.push_back(data_index);
 			}
 		}
-		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::mt);	// データをシャッフル
+		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::rng);	// データをシャッフル
+		if(_num_chains > 1){
+			if(_tempering == NULL){
+				_tempering = new ParallelTempering(_model->_hmm, _num_chains, _max_temperature, sampler::rng());
+			}
+			_tempering->set_blocked(blocked);
+			_tempering->gibbs(dataset, _rand_indices);
+			return true;
+		}
+		if(_num_threads > 1){
+			if(_parallel_gibbs == NULL){
+				// スレッドごとの乱数系列のseedも共通の乱数から決める
+				_parallel_gibbs = new ParallelGibbs(_model->_hmm, _num_threads, sampler::rng());
+				_parallel_gibbs->set_sync_interval(_sync_interval);
+			}
+			_parallel_gibbs->set_blocked(blocked);
+			_parallel_gibbs->begin_epoch(dataset, _rand_indices);
+			while(_parallel_gibbs->gibbs_next_round()){
+				if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
+					return false;
+				}
+			}
+			return true;
+		}
 		for(int n = 0;n < dataset.size();n++){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+				return false;
 			}
 			int data_index = _rand_indices[n];
-			std::vector<Word*> &word_vec = dataset[data_index];
-			_model->_hmm->gibbs(word_vec);
+			Sentence sentence = dataset.get_sentence(data_index);
+			if(blocked){
+				_model->_hmm->blocked_gibbs(sentence);
+			}else{
+				_model->_hmm->gibbs(sentence);
+			}
 		}
+		return true;
+	}
+	// 品詞が変わった割合はエポック開始時の品詞と比べる
+	// 同時確率は逐次のGibbsサンプリングなら差分を足し、それ以外はカウントから計算し直す
+	void Trainer::_update_convergence(WordSequences &dataset, bool incremental){
+		assert(_previous_states.size() == dataset._states.size());
+		size_t num_changed = 0;
+		for(size_t i = 0;i < _previous_states.size();i++){
+			num_changed += (_previous_states[i] != dataset._states[i]);
+		}
+		size_t num_words = dataset.get_num_tokens() - (size_t)dataset.size() * BHMM_NUM_SENTINELS * 2;
+		if(incremental){
+			_log_p_joint += _model->_hmm->_log_p_joint_delta;
+			_num_incremental_epochs++;
+		}else{
+			// レプリカ交換法では最も低い鎖の値を計算済み
+			_log_p_joint = (_tempering != NULL && _num_chains > 1) ? _tempering->_log_p[0] : _model->_hmm->compute_log_p_joint();
+			_log_p_joint_valid = true;
+			_num_incremental_epochs = 0;
+		}
+		HMM* hmm = _model->_hmm;
+		bool annealed = hmm->_temperature <= hmm->_minimum_temperature;	// 温度を下げている間は収束とみなさない
+		_convergence.add_epoch((num_words > 0) ? num_changed / (double)num_words : 0, _log_p_joint, annealed);
+	}
+	// 直近window個のエポックで品詞が変わった割合の前半と後半の平均の差がtolerance以下で、
+	// 同時確率のsplit-R̂がmax_r_hat以下なら収束とみなす
+	void Trainer::set_convergence_criteria(int window, double tolerance, double max_r_hat){
+		_convergence.set_criteria(window, tolerance, max_r_hat);
+	}
+	bool Trainer::converged(){
+		return _convergence.converged();
+	}
+	// 直前のエポックで品詞が変わった単語の割合
+	double Trainer::get_changed_fraction(){
+		return _convergence.get_changed_fraction();
+	}
+	double Trainer::get_log_p_joint(){
+		return _convergence.get_log_p();
+	}
+	// エポックが足りなければ-1
+	double Trainer::get_split_r_hat(){
+		return _convergence.compute_split_r_hat();
 	}
 	void Trainer::update_hyperparameters(){
+		_model->invalidate_decoding_snapshot();
+		_log_p_joint_valid = false;		// 同時確率はハイパーパラメータに依存する
 		double old_log_p_x = _sample_new_alpha();
 		_sample_new_beta(old_log_p_x);
 	}
@@ -39,7 +298,7 @@ namespace bhmm {
 		double old_log_p_x = compute_log_p_dataset_train();
 
 		double new_alpha = sampler::normal(old_alpha, std::min(0.1, 0.1 * old_alpha));
-		hmm->_alpha = new_alpha;
+		hmm->set_alpha(new_alpha);
 		double new_log_p_x = compute_log_p_dataset_train();
 
 		double sigma_old_alpha = std::min(0.1, 0.1 * old_alpha);
@@ -57,10 +316,10 @@ namespace bhmm {
 		double bernoulli = sampler::uniform(0, 1);
 		double ret = 0;
 		if(bernoulli <= adoption_rate){
-			hmm->_alpha = new_alpha;
+			hmm->set_alpha(new_alpha);
 			ret = new_log_p_x;
 		}else{
-			hmm->_alpha = old_alpha;
+			hmm->set_alpha(old_alpha);
 			ret = old_log_p_x;
 		}
 		return ret;
@@ -85,6 +344,7 @@ namespace bhmm {
 				+ 0.5 * (old_beta_value - new_beta_value) * (old_beta_value - new_beta_value) / var_new_beta
 			);
 		}
+		hmm->invalidate_denominator_caches();
 		double new_log_p_x = compute_log_p_dataset_train();
 
 		// 採択率
@@ -94,6 +354,7 @@ namespace bhmm {
 			for(int tag = 1;tag <= hmm->_num_tags;tag++){
 				hmm->_beta[tag] = old_beta[tag];	// 元に戻す
 			}
+			hmm->invalidate_denominator_caches();
 		}
 		delete[] old_beta;
 	}
@@ -105,15 +366,11 @@ namespace bhmm {
 	boost::python::list Trainer::python_get_all_words_of_each_tag(int threshold){
 		std::vector<boost::python::list> result;
 		HMM* hmm = _model->_hmm;
+		std::vector<EmissionCounts::SparseCounts> words_of_tag;
+		hmm->_tag_word_counts->enumerate_words_of_each_tag(words_of_tag);
 		for(int tag = 1;tag <= hmm->_num_tags;tag++){
 			std::vector<boost::python::tuple> words;
-			std::multiset<std::pair<int, int>, value_comparator> ranking;
-			for(id word_id = 0;word_id < hmm->_num_words;word_id++){
-				int count = hmm->_tag_word_counts[tag][word_id];
-				if(count > 0){
-					ranking.insert(std::make_pair(word_id, count));
-				}
-			}
+			std::multiset<std::pair<int, int>, value_comparator> ranking(words_of_tag[tag].begin(), words_of_tag[tag].end());
 			for(auto elem: ranking){
 				if(elem.second <= threshold){
 					continue;
@@ -127,45 +384,18 @@ namespace bhmm {
 	}
 	void Trainer::_before_viterbi_decode(){
 		assert(_dataset->_max_num_words_in_line > 0);
-		_decode_table = new double**[_dataset->_max_num_words_in_line];
-		for(int i = 0;i < _dataset->_max_num_words_in_line;i++){
-			_decode_table[i] = new double*[_model->_hmm->_num_tags + 1];
-			for(int k = 0;k <=_model->_hmm->_num_tags;k++){
-				_decode_table[i][k] = new double[_model->_hmm->_num_tags + 1];
-			}
-		}
+		_decode_workspace->reserve(_model->_hmm->_num_tags, _dataset->_max_num_words_in_line);
 	}
-	void Trainer::_after_viterbi_decode(){
+	// 計算用の作業領域をスレッドごとに用意する
+	// 一度確保したものは次の計算でも使い回す
+	void Trainer::_before_compute_log_p_dataset(int num_threads){
 		assert(_dataset->_max_num_words_in_line > 0);
-		for(int i = 0;i < _dataset->_max_num_words_in_line;i++){
-			for(int k = 0;k <= _model->_hmm->_num_tags;k++){
-				delete[] _decode_table[i][k];
-			}
-			delete[] _decode_table[i];
+		while(_workspaces.size() < num_threads){
+			_workspaces.push_back(new DecodeWorkspace());
 		}
-		delete[] _decode_table;
-	}
-	void Trainer::_before_compute_log_p_dataset(){
-		// 計算用のテーブルを確保
-		assert(_dataset->_max_num_words_in_line > 0);
-		_forward_table = new double**[_dataset->_max_num_words_in_line];
-		for(int i = 0;i < _dataset->_max_num_words_in_line;i++){
-			_forward_table[i] = new double*[_model->_hmm->_num_tags + 1];
-			for(int k = 0;k <= _model->_hmm->_num_tags;k++){
-				_forward_table[i][k] = new double[_model->_hmm->_num_tags + 1];
-			}
-		}
-	}
-	void Trainer::_after_compute_log_p_dataset(){
-		// 計算用のテーブルを解放
-		assert(_dataset->_max_num_words_in_line > 0);
-		for(int i = 0;i < _dataset->_max_num_words_in_line;i++){
-			for(int k = 0;k <= _model->_hmm->_num_tags;k++){
-				delete[] _forward_table[i][k];
-			}
-			delete[] _forward_table[i];
+		for(int thread_id = 0;thread_id < num_threads;thread_id++){
+			_workspaces[thread_id]->reserve(_model->_hmm->_num_tags, _dataset->_max_num_words_in_line);
 		}
-		delete[] _forward_table;
 	}
 	// データセット全体の対数尤度を計算
 	double Trainer::compute_log_p_dataset_train(){
@@ -174,22 +404,47 @@ namespace bhmm {
 	double Trainer::compute_log_p_dataset_dev(){
 		return _compute_log_p_dataset(_dataset->_word_sequences_dev);
 	}
-	double Trainer::_compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset){
-		_before_compute_log_p_dataset();
-		// データごとの対数尤度を足していく
-		double log_p_dataset = 0;
-		for(int data_index = 0;data_index < dataset.size();data_index++){
-			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return 0;
+	// 文ごとの対数尤度を各スレッドで計算し、文の順に補償付きで足し合わせる
+	// 足す順序が固定なのでスレッド数によらず同じ値になる
+	double Trainer::_compute_log_p_dataset(WordSequences &dataset){
+		if(dataset.size() == 0){
+			return 0;
+		}
+		int num_threads = std::min(_num_threads, (int)dataset.size());
+		_before_compute_log_p_dataset(num_threads);
+		std::vector<double> log_p_sentences(dataset.size(), 0);
+		_interrupted = false;
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < num_threads;thread_id++){
+			threads.push_back(std::thread(&Trainer::_compute_log_p_sentences, this, std::ref(dataset), thread_id, num_threads, std::ref(log_p_sentences)));
+		}
+		_compute_log_p_sentences(dataset, 0, num_threads, log_p_sentences);
+		for(auto &thread: threads){
+			thread.join();
+		}
+		if(_interrupted){
+			return 0;
+		}
+		return utils::kahan_sum(log_p_sentences);
+	}
+	// 文の長さが偏らないように1つおきに割り当てる
+	void Trainer::_compute_log_p_sentences(WordSequences &dataset, int thread_id, int num_threads, std::vector<double> &log_p_sentences){
+		DecodeWorkspace* workspace = _workspaces[thread_id];
+		for(int data_index = thread_id;data_index < dataset.size();data_index += num_threads){
+			if(thread_id == 0){
+				if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
+					_interrupted = true;
+				}
+			}
+			if(_interrupted){
+				return;
 			}
-			std::vector<Word*> &sentence = dataset[data_index];
-			double p_x = _model->compute_p_sentence(sentence, _forward_table);
+			Sentence sentence = dataset.get_sentence(data_index);
+			double p_x = _model->compute_p_sentence(sentence, workspace);
 			if(p_x > 0){
-				log_p_dataset += log(p_x);
+				log_p_sentences[data_index] = log(p_x);
 			}
 		}
-		_after_compute_log_p_dataset();
-		return log_p_dataset;
 	}
 	void Trainer::anneal_temperature(double temperature){
 		_model->_hmm->anneal_temperature(temperature);
@@ -1,34 +1,87 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "../bhmm/convergence.h"
+#include "../bhmm/parallel.h"
+#include "../bhmm/tempering.h"
+#include "../bhmm/type_gibbs.h"
+#include "../bhmm/variational.h"
 #include "model.h"
 #include "dataset.h"
 #include "dictionary.h"
 
+#define BHMM_LOG_P_RESYNC_INTERVAL 100	// 差分で追った同時確率を何エポックごとにカウントから計算し直すか
+
 namespace bhmm {
 	class Trainer{
 	private:
+		void _gibbs(bool blocked);
+		bool _sample_epoch(WordSequences &dataset, bool blocked);
+		void _update_convergence(WordSequences &dataset, bool incremental);
 		void _before_viterbi_decode();
-		void _after_viterbi_decode();
-		void _before_compute_log_p_dataset();
-		void _after_compute_log_p_dataset();
-		double _compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_log2_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_perplexity(std::vector<std::vector<Word*>> &dataset);
+		void _before_compute_log_p_dataset(int num_threads);
+		double _compute_log_p_dataset(WordSequences &dataset);
+		void _compute_log_p_sentences(WordSequences &dataset, int thread_id, int num_threads, std::vector<double> &log_p_sentences);
+		double _compute_log2_p_dataset(WordSequences &dataset);
+		double _compute_perplexity(WordSequences &dataset);
 		double _sample_new_alpha();
 		void _sample_new_beta(double old_log_p_x);
+		void _write_checkpoint(std::string filename);
 		Model* _model;
 		Dictionary* _dict;
 		Dataset* _dataset;
 		std::vector<int> _rand_indices;
-		double*** _forward_table;		// 前向き確率計算用
-		double*** _decode_table;			// viterbiデコーディング用
+		int _num_threads;
+		int _sync_interval;
+		ParallelGibbs* _parallel_gibbs;	// 2スレッド以上の場合のみ使う
+		int _num_chains;
+		double _max_temperature;
+		ParallelTempering* _tempering;	// 2本以上の鎖を使う場合のみ使う
+		VariationalEM* _variational;
+		TypeGibbs* _type_gibbs;
+		bool _counts_from_variational;	// カウントが変分ベイズEMの期待カウントならtrue
+		std::vector<DecodeWorkspace*> _workspaces;	// 前向き確率計算用. スレッドごとに持つ
+		std::atomic<bool> _interrupted;
+		// 収束判定用
+		ConvergenceMonitor _convergence;
+		std::vector<int> _previous_states;	// エポック開始時の品詞
+		double _log_p_joint;				// 現在の割り当てのlog p(t, w)
+		bool _log_p_joint_valid;
+		int _num_incremental_epochs;		// 最後にカウントから計算し直してからのエポック数
+		DecodeWorkspace* _decode_workspace;		// viterbiデコーディング用
+		// 非同期保存用
+		HMM* _checkpoint;					// 保存を始めた時点のカウントの複製
+		std::thread _checkpoint_thread;
+		std::atomic<bool> _checkpoint_pending;
+		bool _checkpoint_succeeded;
 	public:
 		Trainer(Dataset* dataset, Model* model);
+		~Trainer();
 		void gibbs();
+		void blocked_gibbs();
+		double type_gibbs();
+		double variational_em();
+		void set_num_threads(int num_threads);
+		int get_num_threads();
+		void set_sync_interval(int interval);
+		void set_num_chains(int num_chains);
+		int get_num_chains();
+		void set_max_temperature(double temperature);
+		boost::python::list python_get_exchange_acceptance_rates();
+		void set_convergence_criteria(int window, double tolerance, double max_r_hat);
+		bool converged();
+		double get_changed_fraction();
+		double get_log_p_joint();
+		double get_split_r_hat();
 		void update_hyperparameters();
 		boost::python::list python_get_all_words_of_each_tag(int threshold = 0);
 		double compute_log_p_dataset_train();
 		double compute_log_p_dataset_dev();
 		void anneal_temperature(double temperature);
+		bool save_async(std::string filename);
+		bool is_saving();
+		bool wait_for_save();
 	};
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include  <algorithm>
+#include  <chrono>
+#include  <fstream>
+#include  <iostream>
+#include  <vector>
+#include  <functional>
+#include  <cassert>
+#include  <cstdio>
+#include "../src/bhmm/binary.h"
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/bhmm/tagdict.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int max_length, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, max_length);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words, bool with_dictionary){
+	HMM* hmm = new HMM(num_tags, num_words);
+	if(with_dictionary){
+		std::vector<int> offsets;
+		std::vector<int> tags;
+		offsets.push_back(0);
+		for(id word_id = 0;word_id < num_words;word_id++){
+			if(word_id % 3 == 0){
+				tags.push_back(word_id % num_tags + 1);
+			}
+			offsets.push_back(tags.size());
+		}
+		hmm->set_tag_dictionary(new TagDictionary(num_tags, offsets, tags));
+	}
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.25);
+	for(int tag = 1;tag <= num_tags;tag++){
+		hmm->_beta[tag] = 1.0 / tag;
+	}
+	hmm->_temperature = 1.5;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		hmm->gibbs(sentence);
+	}
+	return hmm;
+}
+
+void compare(HMM* a, HMM* b){
+	int num_tags = a->_num_tags;
+	assert(a->_num_tags == b->_num_tags);
+	assert(a->_num_words == b->_num_words);
+	assert(a->_alpha == b->_alpha);
+	assert(a->_temperature == b->_temperature);
+	assert(a->_minimum_temperature == b->_minimum_temperature);
+	for(int tag = 0;tag <= num_tags;tag++){
+		assert(a->_Wt[tag] == b->_Wt[tag]);
+		assert(a->_beta[tag] == b->_beta[tag]);
+	}
+	assert(a->_trigram_counts->is_dense() == b->_trigram_counts->is_dense());
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(a->_trigram_counts->get(tag_2, tag_1, tag) == b->_trigram_counts->get(tag_2, tag_1, tag));
+			}
+		}
+	}
+	for(size_t i = 0;i < a->_bigram_counts->_size;i++){
+		assert(a->_bigram_counts->_data[i] == b->_bigram_counts->_data[i]);
+	}
+	for(size_t i = 0;i < a->_unigram_counts->_size;i++){
+		assert(a->_unigram_counts->_data[i] == b->_unigram_counts->_data[i]);
+	}
+	for(id word_id = 0;word_id < a->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(a->_tag_word_counts->get(tag, word_id) == b->_tag_word_counts->get(tag, word_id));
+		}
+	}
+	assert((a->_tag_dictionary == NULL) == (b->_tag_dictionary == NULL));
+	if(a->_tag_dictionary != NULL){
+		for(id word_id = 0;word_id < a->_num_words;word_id++){
+			for(int tag = 1;tag <= num_tags;tag++){
+				assert(a->_tag_dictionary->is_allowed(word_id, tag) == b->_tag_dictionary->is_allowed(word_id, tag));
+			}
+		}
+	}
+}
+
+// 独自形式と旧形式のどちらで保存しても同じモデルに戻り、旧形式からの変換もできるか
+void test_round_trip(int num_tags, bool with_dictionary){
+	int num_words = 200;
+	WordSequences dataset;
+	generate_dataset(dataset, 200, 20, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words, with_dictionary);
+	std::string filename = "binary_test.model";
+	std::string archive_filename = "binary_test.archive";
+	assert(hmm->save(filename));
+	assert(binary::is_binary_file(filename));
+	HMM* loaded = new HMM(3, 7);	// 大きさの違うモデルにも読み込める
+	assert(loaded->load(filename));
+	compare(hmm, loaded);
+	// 読み込んだモデルでサンプリングを続けられる
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		loaded->gibbs(sentence);
+	}
+	hmm->copy_from(loaded);
+	// 旧形式
+	assert(hmm->save_archive(archive_filename));
+	assert(binary::is_binary_file(archive_filename) == false);
+	HMM* converted = new HMM();
+	assert(converted->load(archive_filename));
+	compare(hmm, converted);
+	assert(converted->save(filename));
+	HMM* reloaded = new HMM();
+	assert(reloaded->load(filename));
+	compare(hmm, reloaded);
+	std::remove(filename.c_str());
+	std::remove(archive_filename.c_str());
+	cout << "num_tags=" << num_tags << " dense=" << hmm->_trigram_counts->is_dense() << " dictionary=" << with_dictionary << " OK" << endl;
+	delete hmm;
+	delete loaded;
+	delete converted;
+	delete reloaded;
+}
+
+// どちらの形式でも読み込む前のモデルで数えた品詞ごとの単語数は捨てる
+void test_reset_after_load(){
+	int num_tags = 5;
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 50, 10, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words, false);
+	std::string filename = "binary_test.model";
+	std::string archive_filename = "binary_test.archive";
+	assert(hmm->save(filename));
+	assert(hmm->save_archive(archive_filename));
+	WordSequences other_dataset;
+	generate_dataset(other_dataset, 30, 10, num_words);
+	HMM* loaded = build_hmm(other_dataset, num_tags, num_words, false);
+	for(const std::string &name: {filename, archive_filename}){
+		loaded->compute_log_p_joint();
+		assert(loaded->_num_words_of_tag.size() == num_tags + 1);
+		assert(loaded->load(name));
+		assert(loaded->_num_words_of_tag.empty());
+	}
+	std::remove(filename.c_str());
+	std::remove(archive_filename.c_str());
+	cout << "reset after load OK" << endl;
+	delete hmm;
+	delete loaded;
+}
+
+// 途中で切れたファイルは読み込まずにfalseを返し、モデルはそのまま残る
+void test_truncated(){
+	int num_tags = 5;
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 50, 10, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words, false);
+	std::string filename = "binary_test.model";
+	assert(hmm->save(filename));
+	std::ifstream ifs(filename, std::ios::binary);
+	std::vector<char> bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	HMM* loaded = new HMM();
+	loaded->copy_from(hmm);
+	for(size_t length: {bytes.size() - 1, bytes.size() / 2, sizeof(binary::Header), (size_t)16}){
+		std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+		ofs.write(bytes.data(), length);
+		ofs.close();
+		assert(loaded->load(filename) == false);
+		compare(hmm, loaded);
+	}
+	std::remove(filename.c_str());
+	cout << "truncated OK" << endl;
+	delete hmm;
+	delete loaded;
+}
+
+// 大きさは合っていても中身が壊れたファイルは、モデルを書き換える前にfalseを返す
+template <class T>
+T* section_data(std::vector<char> &bytes, binary::SectionId section_id){
+	binary::Header* header = reinterpret_cast<binary::Header*>(bytes.data());
+	return reinterpret_cast<T*>(bytes.data() + header->sections[section_id].offset);
+}
+void test_corrupted(int num_tags){
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 50, 10, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words, true);
+	std::string filename = "binary_test.model";
+	assert(hmm->save(filename));
+	std::ifstream ifs(filename, std::ios::binary);
+	std::vector<char> original((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	std::vector<std::function<void(std::vector<char> &)>> corruptions = {
+		[](std::vector<char> &bytes){ reinterpret_cast<binary::Header*>(bytes.data())->num_tags = -1; },
+		[](std::vector<char> &bytes){ reinterpret_cast<binary::Header*>(bytes.data())->num_words = 0; },
+		[](std::vector<char> &bytes){ section_data<uint64_t>(bytes, binary::SECTION_EMISSION_OFFSETS)[1] = UINT64_MAX / 2; },
+		[](std::vector<char> &bytes){ section_data<uint64_t>(bytes, binary::SECTION_EMISSION_OFFSETS)[0] = 1; },
+		[num_tags](std::vector<char> &bytes){ section_data<int>(bytes, binary::SECTION_EMISSION_TAGS)[0] = num_tags + 1; },
+		[](std::vector<char> &bytes){ section_data<int>(bytes, binary::SECTION_EMISSION_TAGS)[0] = 0; },
+		[](std::vector<char> &bytes){ section_data<int>(bytes, binary::SECTION_TAG_DICTIONARY_OFFSETS)[1] = 1000; },
+		[](std::vector<char> &bytes){ section_data<int>(bytes, binary::SECTION_TAG_DICTIONARY_OFFSETS)[0] = -1; },
+		[num_tags](std::vector<char> &bytes){ section_data<int>(bytes, binary::SECTION_TAG_DICTIONARY_TAGS)[0] = num_tags + 1; },
+	};
+	if(hmm->_trigram_counts->is_dense() == false){
+		// 空き番地のないハッシュ表と、品詞の範囲外の鍵
+		corruptions.push_back([](std::vector<char> &bytes){
+			binary::Header* header = reinterpret_cast<binary::Header*>(bytes.data());
+			uint64_t* keys = section_data<uint64_t>(bytes, binary::SECTION_TRIGRAM_KEYS);
+			std::fill(keys, keys + header->trigram_capacity, 0);
+		});
+		corruptions.push_back([](std::vector<char> &bytes){
+			binary::Header* header = reinterpret_cast<binary::Header*>(bytes.data());
+			uint64_t* keys = section_data<uint64_t>(bytes, binary::SECTION_TRIGRAM_KEYS);
+			for(size_t slot = 0;slot < header->trigram_capacity;slot++){
+				if(keys[slot] != BHMM_TRIGRAM_EMPTY_KEY){
+					keys[slot] = UINT64_MAX - 1;
+					break;
+				}
+			}
+		});
+		corruptions.push_back([](std::vector<char> &bytes){ reinterpret_cast<binary::Header*>(bytes.data())->trigram_capacity = 1; });
+	}
+	HMM* loaded = new HMM();
+	loaded->copy_from(hmm);
+	for(auto &corrupt: corruptions){
+		std::vector<char> bytes = original;
+		corrupt(bytes);
+		std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+		ofs.write(bytes.data(), bytes.size());
+		ofs.close();
+		assert(loaded->load(filename) == false);
+		compare(hmm, loaded);
+	}
+	// 壊さなければ読み込める
+	std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+	ofs.write(original.data(), original.size());
+	ofs.close();
+	assert(loaded->load(filename));
+	compare(hmm, loaded);
+	std::remove(filename.c_str());
+	cout << "corrupted num_tags=" << num_tags << " OK" << endl;
+	delete hmm;
+	delete loaded;
+}
+
+// 語彙の大きいモデルの保存と読み込みの時間
+void benchmark(int num_tags, int num_words){
+	WordSequences dataset;
+	generate_dataset(dataset, 20000, 30, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words, false);
+	std::string filename = "binary_test.model";
+	std::string archive_filename = "binary_test.archive";
+	HMM* loaded = new HMM();
+	auto measure = [](std::function<void()> func){
+		auto start = std::chrono::system_clock::now();
+		func();
+		auto end = std::chrono::system_clock::now();
+		return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+	};
+	double archive_save = measure([&]{ assert(hmm->save_archive(archive_filename)); });
+	double archive_load = measure([&]{ assert(loaded->load(archive_filename)); });
+	double binary_save = measure([&]{ assert(hmm->save(filename)); });
+	double binary_load = measure([&]{ assert(loaded->load(filename)); });
+	compare(hmm, loaded);
+	cout << "num_tags=" << num_tags << " num_words=" << num_words << endl;
+	cout << "archive: save " << archive_save << " ms, load " << archive_load << " ms" << endl;
+	cout << "binary:  save " << binary_save << " ms, load " << binary_load << " ms" << endl;
+	std::remove(filename.c_str());
+	std::remove(archive_filename.c_str());
+	delete hmm;
+	delete loaded;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_round_trip(10, false);
+	test_round_trip(10, true);
+	test_round_trip(BHMM_DENSE_TRIGRAM_MAX_TAGS + 2, false);
+	test_reset_after_load();
+	test_truncated();
+	test_corrupted(5);
+	test_corrupted(BHMM_DENSE_TRIGRAM_MAX_TAGS + 2);
+	benchmark(100, 50000);
+	cout << "OK" << endl;
+	return 0;
+}
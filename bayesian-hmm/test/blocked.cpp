@@ -0,0 +1,293 @@
+#include  <algorithm>
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include  <cmath>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/parallel.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int max_length, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, max_length);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt;
+	for(int tag = 1;tag <= num_tags;tag++){
+		Wt.push_back(num_words);
+	}
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	return hmm;
+}
+
+void count_assignments(WordSequences &dataset, Tensor &trigram_counts, Tensor &bigram_counts, Tensor &unigram_counts, EmissionCounts &tag_word_counts){
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size();i++){
+			int ti_2 = sentence.get_state(i - 2);
+			int ti_1 = sentence.get_state(i - 1);
+			int ti = sentence.get_state(i);
+			unigram_counts.at(ti) += 1;
+			bigram_counts.at(ti_1, ti) += 1;
+			trigram_counts.at(ti_2, ti_1, ti) += 1;
+			if(i < sentence.size() - 2){
+				tag_word_counts.increment(ti, sentence.get_word_id(i));
+			}
+		}
+	}
+}
+
+// カウントが現在の品詞の割り当てから数え直したものと一致するか
+void compare_with_assignments(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	Tensor trigram_counts(num_tags + 1, num_tags + 1, num_tags + 1);
+	Tensor bigram_counts(num_tags + 1, num_tags + 1);
+	Tensor unigram_counts(num_tags + 1);
+	EmissionCounts tag_word_counts(num_tags, hmm->_num_words);
+	count_assignments(dataset, trigram_counts, bigram_counts, unigram_counts, tag_word_counts);
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(hmm->_trigram_counts->get(tag_2, tag_1, tag) == trigram_counts.at(tag_2, tag_1, tag));
+			}
+		}
+	}
+	for(size_t i = 0;i < bigram_counts._size;i++){
+		assert(hmm->_bigram_counts->_data[i] == bigram_counts._data[i]);
+	}
+	for(size_t i = 0;i < unigram_counts._size;i++){
+		assert(hmm->_unigram_counts->_data[i] == unigram_counts._data[i]);
+	}
+	for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(hmm->_tag_word_counts->get(tag, word_id) == tag_word_counts.get(tag, word_id));
+		}
+	}
+}
+
+// 全ての割り当てをガンマ関数で周辺化した同時確率の対数
+// 3-gramの文脈の頻度には2-gramのカウントを使うので、文末の2つの位置の2-gramの分だけ
+// Σ_t n(t_2, t_1, t)より大きくなる. その差は品詞列によらない定数として扱う
+// 文頭の(<s>, <s>)の2-gramは数えないので分母は常にT * alphaになる
+// 出力確率の分母の1-gramも同様に文末の位置の分だけ大きい
+double compute_log_joint(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	Tensor trigram_counts(num_tags + 1, num_tags + 1, num_tags + 1);
+	Tensor bigram_counts(num_tags + 1, num_tags + 1);
+	Tensor unigram_counts(num_tags + 1);
+	EmissionCounts tag_word_counts(num_tags, hmm->_num_words);
+	count_assignments(dataset, trigram_counts, bigram_counts, unigram_counts, tag_word_counts);
+	double alpha = hmm->_alpha;
+	double log_p = 0;
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			double n_context = 0;
+			for(int tag = 0;tag <= num_tags;tag++){
+				double n = trigram_counts.at(tag_2, tag_1, tag);
+				log_p += lgamma(n + alpha) - lgamma(alpha);
+				n_context += n;
+			}
+			if(tag_2 == 0 && tag_1 == 0){
+				log_p -= n_context * log(num_tags * alpha);
+				continue;
+			}
+			double n_offset = bigram_counts.at(tag_2, tag_1) - n_context;
+			log_p += lgamma(n_offset + num_tags * alpha) - lgamma(n_offset + n_context + num_tags * alpha);
+		}
+	}
+	for(int tag = 1;tag <= num_tags;tag++){
+		double beta = hmm->_beta[tag];
+		double W = hmm->_Wt[tag];
+		double n_tag = 0;
+		for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+			double n = tag_word_counts.get(tag, word_id);
+			log_p += lgamma(n + beta) - lgamma(beta);
+			n_tag += n;
+		}
+		double n_offset = unigram_counts.at(tag) - n_tag;
+		log_p += lgamma(n_offset + W * beta) - lgamma(n_offset + n_tag + W * beta);
+	}
+	return log_p;
+}
+
+// 1つの文だけを繰り返しサンプリングした時の品詞列の分布が
+// 他の文を固定した時の真の条件付き分布の1/temperature乗と一致するか
+void test_stationary_distribution(int num_tags, double temperature){
+	int num_words = 4;
+	int sentence_length = 3;
+	WordSequences dataset;
+	generate_dataset(dataset, 20, 4, num_words);
+	std::vector<id> word_ids;
+	for(int i = 0;i < sentence_length;i++){
+		word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+	}
+	dataset.add_sentence(word_ids.data(), sentence_length);
+	Sentence target = dataset.get_sentence(dataset.size() - 1);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	hmm->set_alpha(0.5);
+	hmm->_temperature = temperature;
+	// 全ての品詞列を列挙して真の分布を求める
+	int num_sequences = 1;
+	for(int i = 0;i < sentence_length;i++){
+		num_sequences *= num_tags;
+	}
+	std::vector<int> original_states;
+	for(int i = 0;i < target.size();i++){
+		original_states.push_back(target.get_state(i));
+	}
+	std::vector<double> log_p(num_sequences);
+	double max_log_p = -1e100;
+	for(int index = 0;index < num_sequences;index++){
+		int code = index;
+		for(int i = 0;i < sentence_length;i++){
+			target.set_state(i + 2, code % num_tags + 1);
+			code /= num_tags;
+		}
+		log_p[index] = compute_log_joint(hmm, dataset) / temperature;
+		max_log_p = std::max(max_log_p, log_p[index]);
+	}
+	std::vector<double> expected(num_sequences);
+	double sum = 0;
+	for(int index = 0;index < num_sequences;index++){
+		expected[index] = exp(log_p[index] - max_log_p);
+		sum += expected[index];
+	}
+	for(int index = 0;index < num_sequences;index++){
+		expected[index] /= sum;
+	}
+	for(int i = 0;i < target.size();i++){
+		target.set_state(i, original_states[i]);
+	}
+	// 経験分布
+	int num_samples = 200000;
+	std::vector<double> actual(num_sequences, 0);
+	int num_accepted = 0;
+	for(int n = 0;n < num_samples;n++){
+		if(hmm->blocked_gibbs(target)){
+			num_accepted++;
+		}
+		int index = 0;
+		for(int i = sentence_length - 1;i >= 0;i--){
+			index = index * num_tags + target.get_state(i + 2) - 1;
+		}
+		actual[index] += 1.0 / num_samples;
+	}
+	compare_with_assignments(hmm, dataset);
+	double max_error = 0;
+	for(int index = 0;index < num_sequences;index++){
+		max_error = std::max(max_error, std::abs(actual[index] - expected[index]));
+	}
+	cout << "num_tags=" << num_tags << " temperature=" << temperature << " max_error=" << max_error << " acceptance_rate=" << (double)num_accepted / num_samples << endl;
+	assert(max_error < 0.01);
+	delete hmm;
+}
+
+void test_consistency(int num_threads){
+	int num_tags = 10;
+	int num_words = 100;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, 20, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	hmm->_temperature = 1.5;
+	if(num_threads == 1){
+		for(int epoch = 0;epoch < 5;epoch++){
+			for(int data_index = 0;data_index < dataset.size();data_index++){
+				Sentence sentence = dataset.get_sentence(data_index);
+				hmm->blocked_gibbs(sentence);
+			}
+			compare_with_assignments(hmm, dataset);
+		}
+	}else{
+		std::vector<int> indices;
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			indices.push_back(data_index);
+		}
+		ParallelGibbs* parallel = new ParallelGibbs(hmm, num_threads, 1);
+		parallel->set_blocked(true);
+		parallel->set_sync_interval(10);
+		for(int epoch = 0;epoch < 5;epoch++){
+			parallel->gibbs(dataset, indices);
+			compare_with_assignments(hmm, dataset);
+		}
+		delete parallel;
+	}
+	// ブロック化サンプリングの後でも逐次のサンプリングを続けられる
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		hmm->gibbs(sentence);
+	}
+	compare_with_assignments(hmm, dataset);
+	cout << "num_threads=" << num_threads << " OK" << endl;
+	delete hmm;
+}
+
+// 3-gramをハッシュ表に持つモデルでは遷移の表を作らずに行をその都度計算し、密な表を使った場合と同じ系列をサンプリングする
+void test_hashed(double temperature){
+	int num_tags = BHMM_DENSE_TRIGRAM_MAX_TAGS + 2;
+	int num_words = 100;
+	WordSequences hashed_dataset;
+	WordSequences dense_dataset;
+	sampler::set_seed(7);
+	generate_dataset(hashed_dataset, 100, 15, num_words);
+	HMM* hashed = build_hmm(hashed_dataset, num_tags, num_words);
+	sampler::set_seed(7);
+	generate_dataset(dense_dataset, 100, 15, num_words);
+	HMM* dense = build_hmm(dense_dataset, num_tags, num_words);
+	assert(hashed_dataset._states == dense_dataset._states);
+	assert(hashed->_trigram_counts->is_dense() == false);
+	TrigramCounts* dense_counts = new TrigramCounts(num_tags, true);
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				dense_counts->add(tag_2, tag_1, tag, hashed->_trigram_counts->get(tag_2, tag_1, tag));
+			}
+		}
+	}
+	delete dense->_trigram_counts;
+	dense->_trigram_counts = dense_counts;
+	hashed->_temperature = temperature;
+	dense->_temperature = temperature;
+	sampler::Xoshiro256 hashed_rng(11);
+	sampler::Xoshiro256 dense_rng(11);
+	for(int epoch = 0;epoch < 2;epoch++){
+		for(int data_index = 0;data_index < hashed_dataset.size();data_index++){
+			Sentence hashed_sentence = hashed_dataset.get_sentence(data_index);
+			Sentence dense_sentence = dense_dataset.get_sentence(data_index);
+			bool hashed_accepted = hashed->blocked_gibbs(hashed_sentence, hashed_rng);
+			bool dense_accepted = dense->blocked_gibbs(dense_sentence, dense_rng);
+			assert(hashed_accepted == dense_accepted);
+		}
+		assert(hashed_dataset._states == dense_dataset._states);
+		compare_with_assignments(hashed, hashed_dataset);
+	}
+	assert(hashed->_blocked_transitions == NULL);
+	assert(dense->_blocked_transitions != NULL);
+	cout << "hashed temperature=" << temperature << " OK" << endl;
+	delete hashed;
+	delete dense;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_stationary_distribution(2, 1.0);
+	test_stationary_distribution(3, 1.0);
+	test_stationary_distribution(2, 2.0);
+	test_consistency(1);
+	test_consistency(4);
+	test_hashed(1.0);
+	test_hashed(1.5);
+	cout << "OK" << endl;
+	return 0;
+}
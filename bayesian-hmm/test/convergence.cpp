@@ -0,0 +1,180 @@
+#include  <iostream>
+#include  <vector>
+#include  <cmath>
+#include  <cassert>
+#include "../src/bhmm/convergence.h"
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/parallel.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/bhmm/type_gibbs.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+// Gibbsサンプリングで足した差分がカウントから計算し直した同時確率と一致する
+void test_incremental_log_p(){
+	int num_tags = 8;
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.1);
+	double log_p = hmm->compute_log_p_joint();
+	hmm->_track_log_p_joint = true;
+	for(int epoch = 0;epoch < 10;epoch++){
+		hmm->_log_p_joint_delta = 0;
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			hmm->gibbs(sentence);
+		}
+		assert(hmm->_log_p_joint_delta != 0);
+		log_p += hmm->_log_p_joint_delta;
+		assert(std::abs(log_p - hmm->compute_log_p_joint()) < 1e-8 * std::abs(log_p));
+	}
+	delete hmm;
+	cout << "incremental log p OK" << endl;
+}
+
+// gibbs以外で品詞を変えた後は品詞ごとの単語数が空か数え直した値と一致する
+void assert_num_words_of_tag_in_sync(HMM* hmm){
+	if(hmm->_num_words_of_tag.empty()){
+		return;
+	}
+	std::vector<int> num_words_of_tag = hmm->_num_words_of_tag;
+	hmm->compute_log_p_joint();
+	assert(num_words_of_tag == hmm->_num_words_of_tag);
+}
+
+// 学習器と同じく、差分を追えるのは品詞ごとの単語数がある時の逐次のgibbsだけで、それ以外は計算し直す
+// どの順に動かしても追った同時確率はカウントから計算し直した値と一致する
+void test_mixed_schedule(){
+	int num_tags = 8;
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.1);
+	TypeGibbs* type_gibbs = new TypeGibbs(hmm, dataset);
+	ParallelGibbs* parallel = new ParallelGibbs(hmm, 4, 1);
+	parallel->set_sync_interval(10);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	double log_p = hmm->compute_log_p_joint();
+	const char* schedule = "gbgtgpgbtpgg";	// g: gibbs, b: blocked, t: type_gibbs, p: 並列
+	for(const char* move = schedule;*move != '\0';move++){
+		bool incremental = *move == 'g' && hmm->_num_words_of_tag.size() == hmm->_num_tags + 1;
+		hmm->_log_p_joint_delta = 0;
+		hmm->_track_log_p_joint = incremental;
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			if(*move == 'g'){
+				hmm->gibbs(sentence);
+			}else if(*move == 'b'){
+				hmm->blocked_gibbs(sentence);
+			}
+		}
+		if(*move == 't'){
+			type_gibbs->sweep(sampler::rng);
+		}else if(*move == 'p'){
+			parallel->gibbs(dataset, indices);
+			for(HMM* replica: parallel->_replicas){
+				assert(replica->_track_log_p_joint == false);
+				assert(replica->_log_p_joint_delta == 0);
+			}
+		}
+		hmm->_track_log_p_joint = false;
+		if(incremental){
+			log_p += hmm->_log_p_joint_delta;
+		}else{
+			assert(hmm->_log_p_joint_delta == 0);
+			assert_num_words_of_tag_in_sync(hmm);
+			log_p = hmm->compute_log_p_joint();
+		}
+		assert(std::abs(log_p - hmm->compute_log_p_joint()) < 1e-8 * std::abs(log_p));
+	}
+	delete parallel;
+	delete type_gibbs;
+	delete hmm;
+	cout << "mixed schedule OK" << endl;
+}
+
+// 独立な値の系列ならR̂はほぼ1で、増え続ける系列なら大きくなる
+void test_split_r_hat(){
+	ConvergenceMonitor monitor;
+	monitor.set_criteria(400, 0.01, 1.05);
+	for(int epoch = 0;epoch < 399;epoch++){
+		monitor.add_epoch(0.1, sampler::normal(-1000, 5));
+	}
+	assert(monitor.compute_split_r_hat() == -1);
+	assert(monitor.converged() == false);
+	monitor.add_epoch(0.1, sampler::normal(-1000, 5));
+	double r_hat = monitor.compute_split_r_hat();
+	assert(0.95 < r_hat && r_hat < 1.05);
+	assert(monitor.converged());
+	monitor.clear();
+	for(int epoch = 0;epoch < 400;epoch++){
+		monitor.add_epoch(0.1, -1000 + epoch + sampler::normal(0, 5));
+	}
+	assert(monitor.compute_split_r_hat() > 2);
+	assert(monitor.converged() == false);
+	cout << "split r hat OK" << endl;
+}
+
+// 品詞が変わった割合が下がり続けている間は収束とみなさない
+void test_changed_fraction(){
+	ConvergenceMonitor monitor;
+	monitor.set_criteria(100, 0.01, 1.1);
+	for(int epoch = 0;epoch < 100;epoch++){
+		monitor.add_epoch(0.5 - 0.004 * epoch, sampler::normal(-1000, 5));
+	}
+	assert(monitor.converged() == false);
+	for(int epoch = 0;epoch < 100;epoch++){
+		monitor.add_epoch(0.1 + sampler::uniform(-0.005, 0.005), sampler::normal(-1000, 5));
+	}
+	assert(monitor.converged());
+	assert(std::abs(monitor.get_changed_fraction() - 0.1) <= 0.005);
+	cout << "changed fraction OK" << endl;
+}
+
+// 温度が下限に達する前の記録だけでは収束とみなさない
+void test_annealing(){
+	ConvergenceMonitor monitor;
+	monitor.set_criteria(100, 0.01, 1.1);
+	for(int epoch = 0;epoch < 150;epoch++){
+		monitor.add_epoch(0.1 + sampler::uniform(-0.005, 0.005), sampler::normal(-1000, 5), epoch >= 100);
+	}
+	assert(monitor.converged() == false);
+	for(int epoch = 0;epoch < 50;epoch++){
+		monitor.add_epoch(0.1 + sampler::uniform(-0.005, 0.005), sampler::normal(-1000, 5), true);
+	}
+	assert(monitor.converged());
+	cout << "annealing OK" << endl;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_incremental_log_p();
+	test_mixed_schedule();
+	test_split_r_hat();
+	test_changed_fraction();
+	test_annealing();
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include  <iostream>
+#include  <fstream>
+#include  <string>
+#include  <vector>
+#include  <cassert>
+#include "../src/bhmm/corpus_file.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/python/corpus.h"
+#include "../src/python/dataset.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void compare_datasets(WordSequences &a, Dictionary* dict_a, WordSequences &b, Dictionary* dict_b){
+	assert(a._offsets == b._offsets);
+	assert(a._states == b._states);
+	for(int n = 0;n < a.size();n++){
+		Sentence sentence_a = a.get_sentence(n);
+		Sentence sentence_b = b.get_sentence(n);
+		for(int i = 2;i < sentence_a.size() - 2;i++){
+			assert(sentence_a.get_word_id(i) == sentence_b.get_word_id(i));
+			assert(dict_a->word_id_to_string(sentence_a.get_word_id(i)) == dict_b->word_id_to_string(sentence_b.get_word_id(i)));
+		}
+	}
+}
+
+// テキストから作ったデータセットとバイナリ形式から作ったデータセットが一致するか
+void test_round_trip(std::string filename, int unknown_count){
+	Corpus* corpus = new Corpus();
+	bool success = corpus->add_textfile(filename);
+	assert(success);
+	success = corpus->save_binary("corpus_file.bin");
+	assert(success);
+	corpus_file::MappedCorpus mapped;
+	success = mapped.open("corpus_file.bin");
+	assert(success);
+	assert(mapped.get_num_types() == corpus->get_num_words());
+	assert(mapped.get_num_sentences() == corpus->_word_sequences.size());
+	for(int token_id = 0;token_id < mapped.get_num_types();token_id++){
+		assert(mapped.get_type_count(token_id) == corpus->_token_counts[token_id]);
+	}
+	mapped.close();
+
+	sampler::set_seed(1);
+	Dataset* dataset = new Dataset(corpus, 0.9, unknown_count);
+	sampler::set_seed(1);
+	Dataset* loaded = new Dataset(std::string("corpus_file.bin"), 0.9, unknown_count);
+	assert(dataset->get_num_words() == loaded->get_num_words());
+	assert(dataset->_max_num_words_in_line == loaded->_max_num_words_in_line);
+	assert(dataset->_min_num_words_in_line == loaded->_min_num_words_in_line);
+	compare_datasets(dataset->_word_sequences_train, dataset->_dict, loaded->_word_sequences_train, loaded->_dict);
+	compare_datasets(dataset->_word_sequences_dev, dataset->_dict, loaded->_word_sequences_dev, loaded->_dict);
+	cout << filename << " unknown_count=" << unknown_count << " sentences=" << corpus->_word_sequences.size() << " vocabulary=" << loaded->get_num_words() << " OK" << endl;
+	delete corpus;
+	delete dataset;
+	delete loaded;
+}
+
+// 途中で切れたファイルや壊れたファイルは開けない
+void test_invalid_files(){
+	std::ifstream ifs("corpus_file.bin", std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	corpus_file::MappedCorpus mapped;
+	assert(mapped.open("corpus_file.bin"));
+	size_t tokens_offset = mapped._header->tokens_offset;
+	mapped.close();
+	{
+		std::ofstream ofs("corpus_file_truncated.bin", std::ios::binary);
+		ofs.write(bytes.data(), bytes.size() - 8);
+	}
+	assert(mapped.open("corpus_file_truncated.bin") == false);
+	{
+		std::string broken = bytes;
+		int out_of_range = 1 << 30;
+		std::memcpy(&broken[tokens_offset], &out_of_range, sizeof(int));
+		std::ofstream ofs("corpus_file_broken.bin", std::ios::binary);
+		ofs.write(broken.data(), broken.size());
+	}
+	assert(mapped.open("corpus_file_broken.bin") == false);
+	assert(mapped.open("corpus_file_not_found.bin") == false);
+	assert(corpus_file::is_corpus_file("corpus_file.bin"));
+	assert(corpus_file::is_corpus_file("corpus_file_truncated.bin"));
+	std::remove("corpus_file_truncated.bin");
+	std::remove("corpus_file_broken.bin");
+	cout << "invalid files OK" << endl;
+}
+
+int main(){
+	Py_Initialize();
+	test_round_trip("../text/alice.txt", 0);
+	test_round_trip("../text/alice.txt", 1);
+	test_invalid_files();
+	std::remove("corpus_file.bin");
+	Py_Finalize();
+	cout << "OK" << endl;
+	return 0;
+}
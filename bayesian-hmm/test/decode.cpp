@@ -0,0 +1,213 @@
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include  <cmath>
+#include  <cstdio>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/bhmm/tagdict.h"
+#include "../src/python/model.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int max_length, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, max_length);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+// tagsは先頭に<s>を2つ含む
+double compute_log_p(HMM* hmm, const std::vector<id> &word_ids, const std::vector<int> &tags){
+	double log_p = 0;
+	for(size_t i = 0;i < word_ids.size();i++){
+		log_p += log(hmm->compute_p_ti_given_t(tags[i + 2], tags[i + 1], tags[i]));
+		log_p += log(hmm->compute_p_wi_given_ti(word_ids[i], tags[i + 2]));
+	}
+	return log_p;
+}
+
+// 全ての品詞列を列挙して、ビタビアルゴリズムと同じく<s>から最後の単語までの確率が最大のものを求める
+// 品詞の一覧があれば単語が取りうる品詞の列だけを見る
+std::vector<int> brute_force(HMM* hmm, const std::vector<id> &word_ids){
+	int num_words = word_ids.size();
+	int num_sequences = 1;
+	for(int i = 0;i < num_words;i++){
+		num_sequences *= hmm->_num_tags;
+	}
+	std::vector<int> best;
+	double max_log_p = -INFINITY;
+	std::vector<int> tags(num_words + 2, 0);	// 先頭の2つは<s>
+	for(int index = 0;index < num_sequences;index++){
+		int code = index;
+		for(int i = 0;i < num_words;i++){
+			tags[i + 2] = code % hmm->_num_tags + 1;
+			code /= hmm->_num_tags;
+		}
+		bool allowed = true;
+		for(int i = 0;i < num_words;i++){
+			if(hmm->_tag_dictionary != NULL && hmm->_tag_dictionary->is_allowed(word_ids[i], tags[i + 2]) == false){
+				allowed = false;
+			}
+		}
+		if(allowed == false){
+			continue;
+		}
+		double log_p = compute_log_p(hmm, word_ids, tags);
+		if(log_p > max_log_p){
+			max_log_p = log_p;
+			best.assign(tags.begin() + 2, tags.end());
+		}
+	}
+	return best;
+}
+
+// ビタビアルゴリズムで復号した品詞列が全列挙で求めた最大の品詞列と同じ順に並ぶ
+// 最後の2つの品詞の順が入れ替わると2単語以上の文で一致しなくなる
+void test_viterbi(bool frozen){
+	int num_tags = 3;
+	int num_words = 6;
+	WordSequences dataset;
+	generate_dataset(dataset, 100, 8, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.1);
+	// 品詞が1つに偏らないように、単語ごとに2つの品詞のどちらかを割り当てて数え直す
+	for(size_t position = 0;position < dataset._word_ids.size();position++){
+		if(dataset._states[position] > 0){
+			dataset._states[position] = 1 + (dataset._word_ids[position] + (int)sampler::uniform_int(0, 1)) % num_tags;
+		}
+	}
+	hmm->count_assignments(dataset);
+	std::string filename = "decode_test.model";
+	assert(hmm->save(filename));
+	Model* model = new Model(filename);
+	std::remove(filename.c_str());
+	if(frozen){
+		model->freeze_for_decoding();
+	}
+	std::vector<int> sampled_state_sequence;
+	int num_mismatches = 0;
+	for(int length = 1;length <= 5;length++){
+		for(int n = 0;n < 20;n++){
+			std::vector<id> word_ids;
+			for(int i = 0;i < length;i++){
+				word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+			}
+			std::vector<id> sentence = {0, 0};	// <s>
+			sentence.insert(sentence.end(), word_ids.begin(), word_ids.end());
+			sentence.push_back(0);	// </s>
+			sentence.push_back(0);
+			model->viterbi_decode(sentence.data(), sentence.size(), sampled_state_sequence, DecodeWorkspace::get_thread_local());
+			if(sampled_state_sequence != brute_force(model->_hmm, word_ids)){
+				num_mismatches++;
+			}
+		}
+	}
+	assert(num_mismatches == 0);
+	cout << "frozen=" << frozen << " OK" << endl;
+	delete model;
+	delete hmm;
+}
+
+// 単語ごとに1から3個の品詞を選ぶ. 最後の単語は制約なし
+TagDictionary* generate_tag_dictionary(int num_tags, int num_words){
+	std::vector<int> offsets;
+	std::vector<int> tags;
+	offsets.push_back(0);
+	for(id word_id = 0;word_id < num_words - 1;word_id++){
+		for(int k = 0;k <= word_id % 3;k++){
+			tags.push_back(1 + (word_id + k) % num_tags);
+		}
+		offsets.push_back(tags.size());
+	}
+	offsets.push_back(tags.size());
+	return new TagDictionary(num_tags, offsets, tags);
+}
+
+// 品詞の一覧がある時も、ビームがなければ取りうる品詞の列から確率が最大のものを選ぶ
+// ビームを設定すれば枝刈りし、どちらでも一覧にない品詞は選ばない
+void test_viterbi_with_tag_dictionary(bool frozen){
+	int num_tags = 4;
+	int num_words = 8;
+	WordSequences dataset;
+	generate_dataset(dataset, 200, 8, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	hmm->set_tag_dictionary(generate_tag_dictionary(num_tags, num_words));
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(1);
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		hmm->gibbs(sentence);
+	}
+	std::string filename = "decode_test.model";
+	assert(hmm->save(filename));
+	Model* model = new Model(filename);
+	std::remove(filename.c_str());
+	assert(model->_hmm->_tag_dictionary != NULL);
+	if(frozen){
+		model->freeze_for_decoding();
+	}
+	std::vector<int> sampled_state_sequence;
+	int num_mismatches = 0;
+	int num_pruned = 0;
+	for(int length = 1;length <= 5;length++){
+		for(int n = 0;n < 20;n++){
+			std::vector<id> word_ids;
+			for(int i = 0;i < length;i++){
+				word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+			}
+			std::vector<id> sentence = {0, 0};	// <s>
+			sentence.insert(sentence.end(), word_ids.begin(), word_ids.end());
+			sentence.push_back(0);	// </s>
+			sentence.push_back(0);
+			std::vector<int> best = brute_force(model->_hmm, word_ids);
+			model->set_beam_width(0);
+			model->viterbi_decode(sentence.data(), sentence.size(), sampled_state_sequence, DecodeWorkspace::get_thread_local());
+			if(sampled_state_sequence != best){
+				num_mismatches++;
+			}
+			// 全ての組が残る幅なら枝刈りしない場合と同じ
+			model->set_beam_width((num_tags + 1) * (num_tags + 1));
+			model->viterbi_decode(sentence.data(), sentence.size(), sampled_state_sequence, DecodeWorkspace::get_thread_local());
+			if(sampled_state_sequence != best){
+				num_mismatches++;
+			}
+			model->set_beam_width(1);
+			model->viterbi_decode(sentence.data(), sentence.size(), sampled_state_sequence, DecodeWorkspace::get_thread_local());
+			assert(sampled_state_sequence.size() == word_ids.size());
+			std::vector<int> tags = {0, 0};
+			for(int i = 0;i < length;i++){
+				assert(model->_hmm->_tag_dictionary->is_allowed(word_ids[i], sampled_state_sequence[i]));
+				tags.push_back(sampled_state_sequence[i]);
+			}
+			best.insert(best.begin(), 2, 0);
+			if(compute_log_p(model->_hmm, word_ids, tags) < compute_log_p(model->_hmm, word_ids, best)){
+				num_pruned++;
+			}
+		}
+	}
+	assert(num_mismatches == 0);
+	assert(num_pruned > 0);
+	cout << "tag dictionary frozen=" << frozen << " OK" << endl;
+	delete model;
+	delete hmm;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_viterbi(false);
+	test_viterbi(true);
+	test_viterbi_with_tag_dictionary(false);
+	test_viterbi_with_tag_dictionary(true);
+	cout << "OK" << endl;
+	return 0;
+}
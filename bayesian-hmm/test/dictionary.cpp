@@ -0,0 +1,137 @@
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/serialization/unordered_map.hpp>
+#include  <iostream>
+#include  <fstream>
+#include  <string>
+#include  <vector>
+#include  <unordered_map>
+#include  <cassert>
+#include "../src/python/dictionary.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+std::wstring make_word(int n){
+	return L"単語" + std::to_wstring(n);
+}
+
+void check_words(Dictionary &dict, int num_words){
+	assert(dict.get_vocabrary_size() == num_words + 1);	// <unk>を含む
+	assert(dict.word_id_to_string(ID_UNK) == L"<unk>");
+	assert(dict.string_to_word_id(L"<unk>") == ID_UNK);
+	for(int n = 0;n < num_words;n++){
+		assert(dict.string_to_word_id(make_word(n)) == n + 1);
+		assert(dict.word_id_to_string(n + 1) == make_word(n));
+	}
+	assert(dict.string_to_word_id(make_word(num_words)) == ID_UNK);
+	assert(dict.is_unk(make_word(-1)));
+	assert(dict.string_to_word_id(L"") == ID_UNK);
+}
+
+// 登録順に単語IDが振られ、表を広げても引ける
+void test_add(){
+	Dictionary dict;
+	int num_words = 100000;
+	for(int n = 0;n < num_words;n++){
+		assert(dict.add_word_string(make_word(n)) == n + 1);
+	}
+	for(int n = 0;n < num_words;n++){
+		assert(dict.add_word_string(make_word(n)) == n + 1);	// 2回目は同じID
+	}
+	dict.shrink_to_fit();
+	check_words(dict, num_words);
+	cout << "add OK" << endl;
+}
+
+// 保存したファイルをmmapして読み、書き換えると自前の配列に移る
+void test_save_load(){
+	Dictionary dict;
+	int num_words = 5000;
+	for(int n = 0;n < num_words;n++){
+		dict.add_word_string(make_word(n));
+	}
+	assert(dict.save("dictionary.bin"));
+	Dictionary loaded;
+	assert(loaded.load("dictionary.bin"));
+	check_words(loaded, num_words);
+	assert(loaded.add_word_string(make_word(num_words)) == num_words + 1);
+	check_words(loaded, num_words + 1);
+	check_words(dict, num_words);
+	// 読み込み直した辞書からもう一度保存できる
+	assert(loaded.save("dictionary.bin"));
+	Dictionary reloaded;
+	assert(reloaded.load("dictionary.bin"));
+	check_words(reloaded, num_words + 1);
+	cout << "save and load OK" << endl;
+}
+
+// Boost.Serializationの旧形式
+void test_load_archive(){
+	int num_words = 1000;
+	std::unordered_map<id, std::wstring> id_to_str;
+	std::unordered_map<std::wstring, id> str_to_id;
+	id_to_str[ID_UNK] = L"<unk>";
+	str_to_id[L"<unk>"] = ID_UNK;
+	for(int n = 0;n < num_words;n++){
+		id_to_str[n + 1] = make_word(n);
+		str_to_id[make_word(n)] = n + 1;
+	}
+	id autoincrement = num_words + 1;
+	{
+		std::ofstream ofs("dictionary.bin");
+		boost::archive::binary_oarchive oarchive(ofs);
+		oarchive << id_to_str;
+		oarchive << str_to_id;
+		oarchive << autoincrement;
+	}
+	Dictionary dict;
+	assert(dict.load("dictionary.bin"));
+	check_words(dict, num_words);
+	cout << "load archive OK" << endl;
+}
+
+void test_remove_ids(){
+	Dictionary dict;
+	for(int n = 0;n < 10;n++){
+		dict.add_word_string(make_word(n));
+	}
+	std::unordered_set<id> word_ids = {3, 5};
+	dict.remove_ids(word_ids);
+	assert(dict.get_vocabrary_size() == 11);
+	assert(dict.string_to_word_id(make_word(2)) == ID_UNK);
+	assert(dict.string_to_word_id(make_word(4)) == ID_UNK);
+	assert(dict.word_id_to_string(3) == L"<unk>");
+	assert(dict.string_to_word_id(L"<unk>") == ID_UNK);
+	assert(dict.string_to_word_id(make_word(5)) == 6);
+	cout << "remove ids OK" << endl;
+}
+
+// 途中で切れたファイルは読み込まず、今の辞書はそのまま
+void test_truncated_file(){
+	Dictionary dict;
+	for(int n = 0;n < 100;n++){
+		dict.add_word_string(make_word(n));
+	}
+	assert(dict.save("dictionary.bin"));
+	std::ifstream ifs("dictionary.bin", std::ios::binary);
+	std::string bytes((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+	ifs.close();
+	std::ofstream ofs("dictionary.bin", std::ios::binary | std::ios::trunc);
+	ofs.write(bytes.data(), bytes.size() - 100);
+	ofs.close();
+	Dictionary other;
+	other.add_word_string(make_word(0));
+	assert(other.load("dictionary.bin") == false);
+	check_words(other, 1);
+	cout << "truncated file OK" << endl;
+}
+
+int main(){
+	test_add();
+	test_save_load();
+	test_load_archive();
+	test_remove_ids();
+	test_truncated_file();
+	std::remove("dictionary.bin");
+	return 0;
+}
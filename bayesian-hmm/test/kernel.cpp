@@ -0,0 +1,165 @@
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include  <cmath>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/kernel.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+// スカラー実装とカーネルの結果を比較する
+// カーネルは分母の逆数を掛けるので相対誤差で比較
+void compare_with_scalar(HMM* hmm, WordSequences &dataset, double temperature){
+	int num_tags = hmm->_num_tags;
+	double* expected = new double[num_tags + 1];
+	double* actual = new double[num_tags + 1];
+	hmm->_temperature = temperature;
+	for(int isa = kernel::ISA_SCALAR;isa <= kernel::ISA_AVX512;isa++){
+		if(kernel::is_isa_supported(isa) == false){
+			continue;
+		}
+		kernel::set_isa(isa);
+		double max_error = 0;
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			for(int i = 2;i < sentence.size() - 2;i++){
+				int ti_2 = sentence.get_state(i - 2);
+				int ti_1 = sentence.get_state(i - 1);
+				int wi = sentence.get_word_id(i);
+				int ti1 = sentence.get_state(i + 1);
+				int ti2 = sentence.get_state(i + 2);
+				hmm->compute_tag_scores_scalar(ti_2, ti_1, ti1, ti2, wi, expected);
+				hmm->compute_tag_scores(ti_2, ti_1, ti1, ti2, wi, actual);
+				for(int tag = 1;tag <= num_tags;tag++){
+					double error = std::abs(actual[tag] - expected[tag]);
+					if(expected[tag] > 1e-300){
+						error /= expected[tag];
+					}
+					assert(error < 1e-12);
+					max_error = std::max(max_error, error);
+				}
+			}
+		}
+		cout << "num_tags=" << num_tags << " temperature=" << temperature << " " << kernel::get_isa_name(isa) << " max_error=" << max_error << endl;
+	}
+	kernel::set_isa(kernel::get_best_supported_isa());
+	delete[] expected;
+	delete[] actual;
+}
+
+// 差分更新した分母のキャッシュが作り直したものと一致するか
+void compare_denominator_caches(HMM* hmm){
+	int num_tags = hmm->_num_tags;
+	assert(hmm->_denominator_caches_valid);
+	for(int tag = 1;tag <= num_tags;tag++){
+		double denominator = hmm->_unigram_counts->at(tag) + hmm->_Wt[tag] * hmm->_beta[tag];
+		assert(hmm->_emission_denominators[tag] == denominator);
+		assert(hmm->_emission_denominators_inv[tag] == 1.0 / denominator);
+	}
+	for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+		for(int tag = 0;tag <= num_tags;tag++){
+			double denominator = hmm->_bigram_counts->at(tag_1, tag) + num_tags * hmm->_alpha;
+			assert(hmm->_transition_denominators[tag_1 * (num_tags + 1) + tag] == denominator);
+			assert(hmm->_transition_denominators_inv[tag_1 * (num_tags + 1) + tag] == 1.0 / denominator);
+		}
+	}
+}
+
+void test_compute_tag_scores(int num_tags){
+	int num_words = 200;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt;
+	for(int tag = 1;tag <= num_tags;tag++){
+		Wt.push_back(sampler::uniform_int(1, num_words));
+	}
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	for(int epoch = 0;epoch < 5;epoch++){
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			hmm->gibbs(sentence);
+		}
+	}
+	compare_denominator_caches(hmm);
+	double temperatures[] = {1.0, 0.08, 0.5, 1.5, 3.0};
+	for(double temperature: temperatures){
+		compare_with_scalar(hmm, dataset, temperature);
+	}
+	delete hmm;
+}
+
+// max-plus更新が全てのISAで素朴な実装と一致するか
+// 同点の場合は先に見た添字が残る
+void test_update_max_plus(int length){
+	int num_rows = 20;
+	std::vector<double> log_transitions(num_rows * length);
+	std::vector<double> forward(num_rows);
+	for(int n = 0;n < num_rows * length;n++){
+		// 同点を作るために値を粗くする
+		log_transitions[n] = -(double)sampler::uniform_int(0, 8) / 4.0;
+	}
+	for(int n = 0;n < num_rows;n++){
+		forward[n] = -(double)sampler::uniform_int(0, 8) / 4.0;
+	}
+	std::vector<double> expected_max(length, -INFINITY);
+	std::vector<int> expected_argmax(length, 0);
+	for(int n = 0;n < num_rows;n++){
+		for(int k = 0;k < length;k++){
+			double value = log_transitions[n * length + k] + forward[n];
+			if(value > expected_max[k]){
+				expected_max[k] = value;
+				expected_argmax[k] = n + 1;
+			}
+		}
+	}
+	for(int isa = kernel::ISA_SCALAR;isa <= kernel::ISA_AVX512;isa++){
+		if(kernel::is_isa_supported(isa) == false){
+			continue;
+		}
+		kernel::set_isa(isa);
+		// 範囲外に書き込まないことも確認する
+		std::vector<double> max_values(length + 1, -INFINITY);
+		std::vector<int> argmax(length + 1, 0);
+		max_values[length] = 1;
+		argmax[length] = -1;
+		for(int n = 0;n < num_rows;n++){
+			kernel::update_max_plus(log_transitions.data() + n * length, forward[n], n + 1, length, max_values.data(), argmax.data());
+		}
+		for(int k = 0;k < length;k++){
+			assert(max_values[k] == expected_max[k]);
+			assert(argmax[k] == expected_argmax[k]);
+		}
+		assert(max_values[length] == 1);
+		assert(argmax[length] == -1);
+		cout << "length=" << length << " " << kernel::get_isa_name(isa) << " max-plus OK" << endl;
+	}
+	kernel::set_isa(kernel::get_best_supported_isa());
+}
+
+int main(){
+	test_update_max_plus(1);
+	test_update_max_plus(7);
+	test_update_max_plus(16);
+	test_update_max_plus(45);
+	test_compute_tag_scores(1);
+	test_compute_tag_scores(7);
+	test_compute_tag_scores(10);
+	test_compute_tag_scores(45);
+	cout << "OK" << endl;
+	return 0;
+}
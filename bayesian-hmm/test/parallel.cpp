@@ -0,0 +1,141 @@
+#include  <algorithm>
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/parallel.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt;
+	for(int tag = 1;tag <= num_tags;tag++){
+		Wt.push_back(num_words);
+	}
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	return hmm;
+}
+
+// 同期後のカウントが現在の品詞の割り当てから数え直したものと一致するか
+void compare_with_assignments(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	Tensor trigram_counts(num_tags + 1, num_tags + 1, num_tags + 1);
+	Tensor bigram_counts(num_tags + 1, num_tags + 1);
+	Tensor unigram_counts(num_tags + 1);
+	EmissionCounts tag_word_counts(num_tags, hmm->_num_words);
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size();i++){
+			int ti_2 = sentence.get_state(i - 2);
+			int ti_1 = sentence.get_state(i - 1);
+			int ti = sentence.get_state(i);
+			unigram_counts.at(ti) += 1;
+			bigram_counts.at(ti_1, ti) += 1;
+			trigram_counts.at(ti_2, ti_1, ti) += 1;
+			if(i < sentence.size() - 2){
+				tag_word_counts.increment(ti, sentence.get_word_id(i));
+			}
+		}
+	}
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(hmm->_trigram_counts->get(tag_2, tag_1, tag) == trigram_counts.at(tag_2, tag_1, tag));
+			}
+		}
+	}
+	for(size_t i = 0;i < bigram_counts._size;i++){
+		assert(hmm->_bigram_counts->_data[i] == bigram_counts._data[i]);
+	}
+	for(size_t i = 0;i < unigram_counts._size;i++){
+		assert(hmm->_unigram_counts->_data[i] == unigram_counts._data[i]);
+	}
+	for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(hmm->_tag_word_counts->get(tag, word_id) == tag_word_counts.get(tag, word_id));
+		}
+	}
+}
+
+void test_consistency(int num_threads, int sync_interval){
+	int num_tags = 10;
+	int num_words = 100;
+	WordSequences dataset;
+	generate_dataset(dataset, 500, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	ParallelGibbs* parallel = new ParallelGibbs(hmm, num_threads, 1);
+	parallel->set_sync_interval(sync_interval);
+	for(int epoch = 0;epoch < 5;epoch++){
+		shuffle(indices.begin(), indices.end(), sampler::rng);
+		parallel->gibbs(dataset, indices);
+		compare_with_assignments(hmm, dataset);
+	}
+	// 並列サンプリングの後でも逐次のサンプリングを続けられる
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		hmm->gibbs(sentence);
+	}
+	compare_with_assignments(hmm, dataset);
+	cout << "num_threads=" << num_threads << " sync_interval=" << sync_interval << " OK" << endl;
+	delete parallel;
+	delete hmm;
+}
+
+// 同じseedなら同じ割り当てになる
+std::vector<int> run_with_seed(int num_threads, int seed){
+	sampler::set_seed(seed);
+	int num_tags = 10;
+	int num_words = 100;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	ParallelGibbs* parallel = new ParallelGibbs(hmm, num_threads, seed);
+	parallel->set_sync_interval(3);
+	for(int epoch = 0;epoch < 3;epoch++){
+		parallel->gibbs(dataset, indices);
+	}
+	std::vector<int> states = dataset._states;
+	delete parallel;
+	delete hmm;
+	return states;
+}
+
+void test_determinism(int num_threads){
+	std::vector<int> a = run_with_seed(num_threads, 1);
+	std::vector<int> b = run_with_seed(num_threads, 1);
+	assert(a == b);
+	cout << "num_threads=" << num_threads << " deterministic OK" << endl;
+}
+
+int main(){
+	test_consistency(1, 0);
+	test_consistency(4, 0);
+	test_consistency(4, 7);
+	test_consistency(3, 1);
+	test_determinism(4);
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include  <iostream>
+#include  <vector>
+#include  <algorithm>
+#include  <cmath>
+#include  <cassert>
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+// 同じseedなら同じ系列、まとめて作っても1つずつ作っても同じ値
+void test_reproducible(){
+	sampler::set_seed(1);
+	std::vector<double> a;
+	for(int i = 0;i < 100;i++){
+		a.push_back(sampler::uniform(0, 1));
+	}
+	sampler::set_seed(1);
+	std::vector<double> b(100);
+	sampler::rng.uniform(b.data(), b.size());
+	assert(a == b);
+	sampler::set_seed(2);
+	assert(sampler::uniform(0, 1) != a[0]);
+	cout << "reproducible OK" << endl;
+}
+
+// jumpした系列は元の系列の先頭と重ならない
+void test_jump(){
+	sampler::Xoshiro256 rng(1);
+	sampler::Xoshiro256 jumped = rng;
+	jumped.jump();
+	std::vector<uint64_t> head;
+	for(int i = 0;i < 10000;i++){
+		head.push_back(rng());
+	}
+	std::sort(head.begin(), head.end());
+	for(int i = 0;i < 10000;i++){
+		assert(std::binary_search(head.begin(), head.end(), jumped()) == false);
+	}
+	cout << "jump OK" << endl;
+}
+
+// 範囲と平均
+void test_ranges(){
+	sampler::set_seed(3);
+	int n = 1000000;
+	double sum = 0;
+	for(int i = 0;i < n;i++){
+		double u = sampler::uniform(0, 1);
+		assert(0 <= u && u < 1);
+		sum += u;
+	}
+	assert(std::abs(sum / n - 0.5) < 0.01);
+	std::vector<int> counts(5, 0);
+	for(int i = 0;i < n;i++){
+		int k = sampler::uniform_int(-2, 2);
+		assert(-2 <= k && k <= 2);
+		counts[k + 2] += 1;
+	}
+	for(int count: counts){
+		assert(std::abs(count / (double)n - 0.2) < 0.01);
+	}
+	double sum_bernoulli = 0;
+	for(int i = 0;i < n;i++){
+		sum_bernoulli += sampler::bernoulli(0.3);
+	}
+	assert(std::abs(sum_bernoulli / n - 0.3) < 0.01);
+	double sum_gamma = 0;
+	for(int i = 0;i < n;i++){
+		sum_gamma += sampler::gamma(2.0, 4.0);
+	}
+	assert(std::abs(sum_gamma / n - 0.5) < 0.01);	// 平均はa/b
+	cout << "ranges OK" << endl;
+}
+
+int main(){
+	test_reproducible();
+	test_jump();
+	test_ranges();
+	return 0;
+}
@@ -0,0 +1,248 @@
+#include  <iostream>
+#include  <fstream>
+#include  <string>
+#include  <vector>
+#include  <cmath>
+#include  <cassert>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/variational.h"
+#include "../src/bhmm/stream.h"
+#include "../src/bhmm/corpus_file.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/python/stream.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+// 品詞ごとに決まった範囲の単語を出す系列からテキストファイルを作る
+void write_textfile(std::string filename, int num_sentences, int num_words){
+	std::ofstream ofs(filename);
+	int block = num_words / 4;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 15);
+		int tag = sampler::uniform_int(0, 3);
+		for(int i = 0;i < length;i++){
+			if(i > 0){
+				ofs << (i % 3 == 0 ? "\t" : " ");
+			}
+			ofs << "w" << (tag * block + sampler::uniform_int(0, block - 1));
+			tag = (tag + 1) % 4;
+		}
+		ofs << endl;
+		if(n % 17 == 0){
+			ofs << endl;	// 空行は読み飛ばされる
+		}
+	}
+}
+
+// 開いたストリームの内容をそのままバイナリ形式で書き出す
+void write_corpus_file(SentenceStream &stream, std::string filename){
+	std::vector<uint64_t> type_offsets;
+	std::string strings;
+	std::vector<int> type_counts;
+	std::vector<int> tokens;
+	std::vector<uint64_t> sentence_offsets;
+	std::string str;
+	type_offsets.push_back(0);
+	for(int type_id = 0;type_id < stream.get_num_types();type_id++){
+		stream.get_type_string(type_id, str);
+		strings += str;
+		type_offsets.push_back(strings.size());
+		type_counts.push_back(stream.get_type_count(type_id));
+	}
+	std::vector<int> token_ids;
+	sentence_offsets.push_back(0);
+	while(stream.next_sentence(token_ids)){
+		tokens.insert(tokens.end(), token_ids.begin(), token_ids.end());
+		sentence_offsets.push_back(tokens.size());
+	}
+	bool success = corpus_file::write(filename, type_offsets, strings, type_counts, tokens, sentence_offsets);
+	assert(success);
+}
+
+void read_all(SentenceStream &stream, std::vector<std::vector<std::string>> &sentences){
+	sentences.clear();
+	std::vector<int> token_ids;
+	std::string str;
+	while(stream.next_sentence(token_ids)){
+		std::vector<std::string> words;
+		for(int token_id: token_ids){
+			stream.get_type_string(token_id, str);
+			words.push_back(str);
+		}
+		sentences.push_back(words);
+	}
+}
+
+// テキストファイルとバイナリ形式で同じ文が同じ順に読め、最後まで読むと先頭に戻る
+void test_stream(){
+	write_textfile("svi.txt", 500, 40);
+	SentenceStream text;
+	bool success = text.open("svi.txt");
+	assert(success);
+	assert(text._num_sentences == 500);
+	write_corpus_file(text, "svi.bin");
+	SentenceStream binary;
+	success = binary.open("svi.bin");
+	assert(success);
+	assert(binary._num_sentences == text._num_sentences);
+	assert(binary._num_tokens == text._num_tokens);
+	assert(binary._max_num_words_in_line == text._max_num_words_in_line);
+	assert(binary.get_num_types() == text.get_num_types());
+	std::vector<std::vector<std::string>> text_sentences;
+	std::vector<std::vector<std::string>> binary_sentences;
+	read_all(text, text_sentences);
+	read_all(binary, binary_sentences);
+	assert(text_sentences.size() == 500);
+	assert(text_sentences == binary_sentences);
+	std::vector<std::vector<std::string>> second_pass;
+	read_all(text, second_pass);
+	assert(second_pass == text_sentences);
+	// ミニバッチは途中で先頭に戻っても文を飛ばさない
+	for(std::string filename: {"svi.txt", "svi.bin"}){
+		StreamingCorpus* corpus = new StreamingCorpus(filename, 0);
+		assert(corpus->get_num_words() == text.get_num_types() + 1);	// <unk>
+		WordSequences minibatch;
+		size_t num_tokens = 0;
+		for(int step = 0;step < 7;step++){
+			corpus->next_minibatch(100, minibatch);
+			assert(minibatch.size() == 100);
+			num_tokens += minibatch.get_num_tokens() - (size_t)minibatch.size() * BHMM_NUM_SENTINELS * 2;
+		}
+		assert(corpus->get_num_passes() == 1);
+		assert(num_tokens > corpus->get_num_tokens());
+		delete corpus;
+	}
+	cout << "stream OK" << endl;
+}
+
+HMM* build_hmm(int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	for(int tag = 1;tag <= num_tags;tag++){
+		hmm->set_Wt_for_tag(tag, num_words);
+	}
+	hmm->set_alpha(0.1);
+	return hmm;
+}
+
+// 全ての文を1つのミニバッチにして学習率を1にするとバッチの反復と一致する
+void test_full_batch(){
+	StreamingCorpus* corpus = new StreamingCorpus("svi.txt", 1);
+	int num_tags = 5;
+	int num_words = corpus->get_num_words();
+	WordSequences dataset;
+	corpus->next_minibatch(corpus->get_num_sentences(), dataset);
+	HMM* hmm = build_hmm(num_tags, num_words);
+	VariationalEM* batch = new VariationalEM(hmm, 2);
+	VariationalEM* stochastic = new VariationalEM(hmm, 3);
+	batch->initialize_randomly(dataset, 1);
+	stochastic->initialize_with_assignments(dataset);
+	for(int iteration = 0;iteration < 5;iteration++){
+		batch->iterate(dataset);
+		stochastic->stochastic_update(dataset, dataset.size(), 1);
+		for(size_t i = 0;i < batch->_trigram_counts.size();i++){
+			assert(std::abs(batch->_trigram_counts[i] - stochastic->_trigram_counts[i]) < 1e-8);
+		}
+		for(size_t i = 0;i < batch->_emission_counts.size();i++){
+			double expected = batch->_emission_counts[i] * batch->_emission_scale;
+			assert(std::abs(expected - stochastic->_emission_counts[i] * stochastic->_emission_scale) < 1e-8);
+		}
+	}
+	delete batch;
+	delete stochastic;
+	delete hmm;
+	delete corpus;
+	cout << "full batch OK" << endl;
+}
+
+// ミニバッチで読み進めると単語あたりの対数周辺尤度が上がる
+void test_log_likelihood(){
+	StreamingCorpus* corpus = new StreamingCorpus("svi.bin", 1);
+	int num_tags = 4;
+	HMM* hmm = build_hmm(num_tags, corpus->get_num_words());
+	VariationalEM* vb = new VariationalEM(hmm, 2);
+	WordSequences minibatch;
+	double num_sentences = corpus->get_num_sentences();
+	double first_pass = 0;
+	double last_pass = 0;
+	int num_updates = 0;
+	for(int pass = 0;pass < 10;pass++){
+		double sum = 0;
+		for(int step = 0;step < 10;step++){
+			corpus->next_minibatch(50, minibatch);
+			if(num_updates == 0){
+				vb->initialize_randomly(minibatch, num_sentences / minibatch.size());
+			}
+			double learning_rate = std::min(1.0, pow(1.0 + num_updates, -0.7));
+			double log_p = vb->stochastic_update(minibatch, num_sentences, learning_rate);
+			assert(log_p < 0);
+			sum += log_p;
+			num_updates++;
+		}
+		if(pass == 0){
+			first_pass = sum / 10;
+		}
+		last_pass = sum / 10;
+	}
+	assert(last_pass > first_pass);
+	// 書き込んだカウントから計算した出力確率は和が1になる
+	vb->update_model();
+	for(int tag = 1;tag <= num_tags;tag++){
+		double sum = 0;
+		for(id word_id = 0;word_id < corpus->get_num_words();word_id++){
+			sum += hmm->compute_p_wi_given_ti(word_id, tag);
+		}
+		assert(std::abs(sum - 1) < 1e-10);
+	}
+	delete vb;
+	delete hmm;
+	delete corpus;
+	cout << "log likelihood OK" << endl;
+}
+
+// 出力の期待カウントの倍率が下限を下回って掛け直されても、品詞ごとの合計は品詞の期待カウントと一致する
+void test_emission_scale(){
+	StreamingCorpus* corpus = new StreamingCorpus("svi.txt", 0);
+	int num_tags = 3;
+	HMM* hmm = build_hmm(num_tags, corpus->get_num_words());
+	VariationalEM* vb = new VariationalEM(hmm, 1);
+	WordSequences minibatch;
+	double num_sentences = corpus->get_num_sentences();
+	corpus->next_minibatch(20, minibatch);
+	vb->initialize_randomly(minibatch, num_sentences / minibatch.size());
+	bool rescaled = false;
+	double previous_scale = vb->_emission_scale;
+	for(int step = 0;step < 150;step++){
+		corpus->next_minibatch(20, minibatch);
+		vb->stochastic_update(minibatch, num_sentences, 0.9);
+		if(vb->_emission_scale > previous_scale){
+			rescaled = true;
+		}
+		previous_scale = vb->_emission_scale;
+		assert(vb->_emission_scale >= BHMM_VB_MIN_EMISSION_SCALE);
+		for(int tag = 1;tag <= num_tags;tag++){
+			double sum = 0;
+			for(id word_id = 0;word_id < corpus->get_num_words();word_id++){
+				sum += vb->_emission_counts[word_id * (num_tags + 1) + tag] * vb->_emission_scale;
+			}
+			assert(std::isfinite(sum));
+			assert(std::abs(sum - vb->_tag_counts[tag]) < 1e-8 * (1 + vb->_tag_counts[tag]));
+		}
+	}
+	assert(rescaled);
+	delete vb;
+	delete hmm;
+	delete corpus;
+	cout << "emission scale OK" << endl;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_stream();
+	test_full_batch();
+	test_log_likelihood();
+	test_emission_scale();
+	remove("svi.txt");
+	remove("svi.bin");
+	return 0;
+}
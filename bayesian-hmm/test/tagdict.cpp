@@ -0,0 +1,165 @@
+#include  <algorithm>
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include  <cstdio>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/parallel.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/bhmm/tagdict.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int max_length, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, max_length);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+// 単語ごとに0から3個の品詞をランダムに選ぶ. 0個の単語は制約なし
+TagDictionary* generate_tag_dictionary(int num_tags, int num_words){
+	std::vector<int> offsets;
+	std::vector<int> tags;
+	offsets.push_back(0);
+	for(id word_id = 0;word_id < num_words;word_id++){
+		std::vector<int> candidates;
+		for(int tag = 1;tag <= num_tags;tag++){
+			candidates.push_back(tag);
+		}
+		std::shuffle(candidates.begin(), candidates.end(), sampler::rng);
+		int num_tags_of_word = sampler::uniform_int(0, 3);
+		for(int k = 0;k < num_tags_of_word;k++){
+			tags.push_back(candidates[k]);
+		}
+		offsets.push_back(tags.size());
+	}
+	return new TagDictionary(num_tags, offsets, tags);
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	hmm->set_tag_dictionary(generate_tag_dictionary(num_tags, num_words));
+	std::vector<int> Wt;
+	for(int tag = 1;tag <= num_tags;tag++){
+		Wt.push_back(num_words);
+	}
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	return hmm;
+}
+
+// 全ての単語の品詞が一覧に含まれていて、カウントが割り当てと一致するか
+void check_assignments(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	Tensor trigram_counts(num_tags + 1, num_tags + 1, num_tags + 1);
+	Tensor unigram_counts(num_tags + 1);
+	EmissionCounts tag_word_counts(num_tags, hmm->_num_words);
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size();i++){
+			int ti = sentence.get_state(i);
+			trigram_counts.at(sentence.get_state(i - 2), sentence.get_state(i - 1), ti) += 1;
+			unigram_counts.at(ti) += 1;
+			if(i < sentence.size() - 2){
+				assert(hmm->_tag_dictionary->is_allowed(sentence.get_word_id(i), ti));
+				tag_word_counts.increment(ti, sentence.get_word_id(i));
+			}
+		}
+	}
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(hmm->_trigram_counts->get(tag_2, tag_1, tag) == trigram_counts.at(tag_2, tag_1, tag));
+			}
+		}
+	}
+	for(size_t i = 0;i < unigram_counts._size;i++){
+		assert(hmm->_unigram_counts->_data[i] == unigram_counts._data[i]);
+	}
+	for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(hmm->_tag_word_counts->get(tag, word_id) == tag_word_counts.get(tag, word_id));
+		}
+	}
+}
+
+void test_sampling(bool blocked, int num_threads){
+	int num_tags = 8;
+	int num_words = 60;
+	WordSequences dataset;
+	generate_dataset(dataset, 200, 15, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	check_assignments(hmm, dataset);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	ParallelGibbs* parallel = new ParallelGibbs(hmm, num_threads, 1);
+	parallel->set_blocked(blocked);
+	parallel->set_sync_interval(10);
+	for(int epoch = 0;epoch < 5;epoch++){
+		if(num_threads == 1){
+			for(int data_index = 0;data_index < dataset.size();data_index++){
+				Sentence sentence = dataset.get_sentence(data_index);
+				if(blocked){
+					hmm->blocked_gibbs(sentence);
+				}else{
+					hmm->gibbs(sentence);
+				}
+			}
+		}else{
+			parallel->gibbs(dataset, indices);
+		}
+		check_assignments(hmm, dataset);
+	}
+	cout << "blocked=" << blocked << " num_threads=" << num_threads << " OK" << endl;
+	delete parallel;
+	delete hmm;
+}
+
+void test_save_and_load(){
+	int num_tags = 5;
+	int num_words = 30;
+	WordSequences dataset;
+	generate_dataset(dataset, 50, 10, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	std::string filename = "tagdict_test.model";
+	assert(hmm->save(filename));
+	HMM* loaded = new HMM();
+	assert(loaded->load(filename));
+	std::remove(filename.c_str());
+	assert(loaded->_tag_dictionary != NULL);
+	for(id word_id = 0;word_id < num_words;word_id++){
+		const int* expected = NULL;
+		const int* actual = NULL;
+		int num_expected = hmm->get_allowed_tags(word_id, expected);
+		int num_actual = loaded->get_allowed_tags(word_id, actual);
+		assert(num_expected == num_actual);
+		for(int k = 0;k < num_actual;k++){
+			assert(expected[k] == actual[k]);
+		}
+	}
+	// 辞書の範囲外の単語は制約なし
+	const int* tags = NULL;
+	assert(loaded->get_allowed_tags(num_words + 10, tags) == num_tags);
+	cout << "save and load OK" << endl;
+	delete hmm;
+	delete loaded;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_sampling(false, 1);
+	test_sampling(true, 1);
+	test_sampling(false, 4);
+	test_sampling(true, 4);
+	test_save_and_load();
+	cout << "OK" << endl;
+	return 0;
+}
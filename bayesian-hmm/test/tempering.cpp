@@ -0,0 +1,183 @@
+#include  <algorithm>
+#include  <iostream>
+#include  <map>
+#include  <tuple>
+#include  <vector>
+#include  <cmath>
+#include  <cassert>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/tempering.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt;
+	for(int tag = 1;tag <= num_tags;tag++){
+		Wt.push_back(num_words);
+	}
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	return hmm;
+}
+
+// 品詞の列statesから数え直したカウントと一致するか
+void compare_with_assignments(HMM* hmm, WordSequences &dataset, std::vector<int> &states){
+	int num_tags = hmm->_num_tags;
+	Tensor trigram_counts(num_tags + 1, num_tags + 1, num_tags + 1);
+	EmissionCounts tag_word_counts(num_tags, hmm->_num_words);
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		size_t begin = dataset._offsets[data_index];
+		Sentence sentence(dataset._word_ids.data() + begin, states.data() + begin, dataset._offsets[data_index + 1] - begin);
+		for(int i = 2;i < sentence.size();i++){
+			trigram_counts.at(sentence.get_state(i - 2), sentence.get_state(i - 1), sentence.get_state(i)) += 1;
+			if(i < sentence.size() - 2){
+				tag_word_counts.increment(sentence.get_state(i), sentence.get_word_id(i));
+			}
+		}
+	}
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(hmm->_trigram_counts->get(tag_2, tag_1, tag) == trigram_counts.at(tag_2, tag_1, tag));
+			}
+		}
+	}
+	for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(hmm->_tag_word_counts->get(tag, word_id) == tag_word_counts.get(tag, word_id));
+		}
+	}
+}
+
+// 同時確率は1単語ずつ予測分布を掛けていったものと等しい
+void test_log_p_joint(){
+	int num_tags = 6;
+	int num_words = 30;
+	WordSequences dataset;
+	generate_dataset(dataset, 100, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	hmm->set_alpha(0.3);
+	for(int tag = 1;tag <= num_tags;tag++){
+		hmm->_beta[tag] = 0.1 * tag;
+	}
+	hmm->invalidate_denominator_caches();
+	std::map<std::tuple<int, int, int>, int> trigram_counts;
+	std::map<std::pair<int, int>, int> context_counts;
+	std::map<std::pair<int, id>, int> tag_word_counts;
+	std::map<int, int> tag_counts;
+	double log_p = 0;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size();i++){
+			int ti_2 = sentence.get_state(i - 2);
+			int ti_1 = sentence.get_state(i - 1);
+			int ti = sentence.get_state(i);
+			int &n_t = trigram_counts[std::make_tuple(ti_2, ti_1, ti)];
+			int &n_context = context_counts[std::make_pair(ti_2, ti_1)];
+			log_p += log((n_t + hmm->_alpha) / (n_context + num_tags * hmm->_alpha));
+			n_t += 1;
+			n_context += 1;
+			if(i < sentence.size() - 2){
+				id wi = sentence.get_word_id(i);
+				int &n_tw = tag_word_counts[std::make_pair(ti, wi)];
+				int &n_tag = tag_counts[ti];
+				log_p += log((n_tw + hmm->_beta[ti]) / (n_tag + hmm->_Wt[ti] * hmm->_beta[ti]));
+				n_tw += 1;
+				n_tag += 1;
+			}
+		}
+	}
+	assert(std::abs(hmm->compute_log_p_joint() - log_p) < 1e-6 * std::abs(log_p));
+	delete hmm;
+	cout << "log p joint OK" << endl;
+}
+
+// 交換した後も各鎖のカウントが自分の品詞の列と一致する
+void test_consistency(int num_chains, bool blocked){
+	int num_tags = 8;
+	int num_words = 50;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	// 交換が起きるように温度の差を小さくする
+	ParallelTempering* tempering = new ParallelTempering(hmm, num_chains, 1.01, 1);
+	tempering->set_blocked(blocked);
+	for(int epoch = 0;epoch < 20;epoch++){
+		shuffle(indices.begin(), indices.end(), sampler::rng);
+		tempering->gibbs(dataset, indices);
+		assert(tempering->_chains[0] == hmm);
+		assert(hmm->_temperature == 1);
+		compare_with_assignments(hmm, dataset, dataset._states);
+		for(int chain = 1;chain < num_chains;chain++){
+			compare_with_assignments(tempering->_chains[chain], dataset, tempering->_states[chain]);
+			assert(tempering->_log_p[chain] == tempering->_chains[chain]->compute_log_p_joint());
+		}
+	}
+	for(int chain = 0;chain + 1 < num_chains;chain++){
+		assert(tempering->get_acceptance_rate(chain) > 0);
+	}
+	// 交換の後でも逐次のサンプリングを続けられる
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		hmm->gibbs(sentence);
+	}
+	compare_with_assignments(hmm, dataset, dataset._states);
+	delete tempering;
+	delete hmm;
+	cout << "num_chains=" << num_chains << " blocked=" << blocked << " OK" << endl;
+}
+
+// 同じseedなら同じ割り当てになる
+std::vector<int> run_with_seed(int num_chains, int seed){
+	sampler::set_seed(seed);
+	WordSequences dataset;
+	generate_dataset(dataset, 200, 50);
+	HMM* hmm = build_hmm(dataset, 8, 50);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	ParallelTempering* tempering = new ParallelTempering(hmm, num_chains, 3, seed);
+	for(int epoch = 0;epoch < 5;epoch++){
+		tempering->gibbs(dataset, indices);
+	}
+	std::vector<int> states = dataset._states;
+	delete tempering;
+	delete hmm;
+	return states;
+}
+
+void test_determinism(int num_chains){
+	std::vector<int> a = run_with_seed(num_chains, 1);
+	std::vector<int> b = run_with_seed(num_chains, 1);
+	assert(a == b);
+	cout << "num_chains=" << num_chains << " deterministic OK" << endl;
+}
+
+int main(){
+	test_log_p_joint();
+	test_consistency(1, false);
+	test_consistency(4, false);
+	test_consistency(3, true);
+	test_determinism(4);
+	cout << "OK" << endl;
+	return 0;
+}
@@ -0,0 +1,172 @@
+#include  <boost/archive/binary_iarchive.hpp>
+#include  <boost/archive/binary_oarchive.hpp>
+#include  <iostream>
+#include  <sstream>
+#include  <vector>
+#include  <cassert>
+#include  <cstdio>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/parallel.h"
+#include "../src/bhmm/sampler.h"
+#include "../src/bhmm/trigram.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void compare(TrigramCounts &counts, Tensor &expected, int num_tags){
+	std::vector<int> buffer(num_tags + 1);
+	size_t num_nonzero = 0;
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			const int* row = counts.row(tag_2, tag_1, buffer.data());
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(counts.get(tag_2, tag_1, tag) == expected.at(tag_2, tag_1, tag));
+				assert(row[tag] == expected.at(tag_2, tag_1, tag));
+				if(expected.at(tag_2, tag_1, tag) != 0){
+					num_nonzero++;
+				}
+			}
+		}
+	}
+	assert(counts.get_num_nonzero() == num_nonzero);
+}
+
+// 増減を繰り返して表を何度も広げても密なテンソルと一致するか
+void test_updates(bool dense){
+	int num_tags = 40;
+	TrigramCounts counts(num_tags, dense);
+	assert(counts.is_dense() == dense);
+	Tensor expected(num_tags + 1, num_tags + 1, num_tags + 1);
+	std::vector<std::vector<int>> added;
+	for(int n = 0;n < 200000;n++){
+		if(added.size() > 0 && sampler::uniform_int(0, 2) == 0){
+			int index = sampler::uniform_int(0, added.size() - 1);
+			std::vector<int> triple = added[index];
+			added[index] = added.back();
+			added.pop_back();
+			counts.decrement(triple[0], triple[1], triple[2]);
+			expected.at(triple[0], triple[1], triple[2]) -= 1;
+			continue;
+		}
+		// 偏りを持たせて同じ3-gramを何度も足す
+		int range = (n % 2 == 0) ? 3 : num_tags;
+		std::vector<int> triple{(int)sampler::uniform_int(0, range), (int)sampler::uniform_int(0, range), (int)sampler::uniform_int(0, num_tags)};
+		counts.increment(triple[0], triple[1], triple[2]);
+		expected.at(triple[0], triple[1], triple[2]) += 1;
+		added.push_back(triple);
+	}
+	compare(counts, expected, num_tags);
+	TrigramCounts copied;
+	copied.copy_from(&counts);
+	compare(copied, expected, num_tags);
+	std::stringstream stream;
+	{
+		boost::archive::binary_oarchive oarchive(stream);
+		counts.save(oarchive);
+	}
+	TrigramCounts loaded;
+	{
+		boost::archive::binary_iarchive iarchive(stream);
+		loaded.load(iarchive, num_tags);
+	}
+	assert(loaded.is_dense() == dense);
+	compare(loaded, expected, num_tags);
+	cout << "dense=" << dense << " num_nonzero=" << counts.get_num_nonzero() << " num_bytes=" << counts.get_num_bytes() << " OK" << endl;
+}
+
+// 旧形式の密な配列を品詞数に応じた表現で読み込めるか
+void test_load_dense_array(int num_tags){
+	Tensor expected(num_tags + 1, num_tags + 1, num_tags + 1);
+	for(int n = 0;n < 1000;n++){
+		expected.at(sampler::uniform_int(0, num_tags), sampler::uniform_int(0, num_tags), sampler::uniform_int(0, num_tags)) += 1;
+	}
+	std::stringstream stream;
+	{
+		boost::archive::binary_oarchive oarchive(stream);
+		oarchive & boost::serialization::make_array(expected._data, expected._size);
+	}
+	TrigramCounts loaded;
+	{
+		boost::archive::binary_iarchive iarchive(stream);
+		loaded.load_dense_array(iarchive, num_tags);
+	}
+	assert(loaded.is_dense() == TrigramCounts::is_dense_preferred(num_tags));
+	compare(loaded, expected, num_tags);
+	cout << "num_tags=" << num_tags << " legacy OK" << endl;
+}
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+void compare_with_assignments(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	Tensor expected(num_tags + 1, num_tags + 1, num_tags + 1);
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size();i++){
+			expected.at(sentence.get_state(i - 2), sentence.get_state(i - 1), sentence.get_state(i)) += 1;
+		}
+	}
+	compare(*hmm->_trigram_counts, expected, num_tags);
+}
+
+// 品詞数が多い場合はハッシュ表で学習し、並列サンプリングの同期と保存ができるか
+void test_hmm(int num_threads){
+	int num_tags = BHMM_DENSE_TRIGRAM_MAX_TAGS + 22;
+	int num_words = 100;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	assert(hmm->_trigram_counts->is_dense() == false);
+	std::vector<int> indices;
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		indices.push_back(data_index);
+	}
+	ParallelGibbs* parallel = new ParallelGibbs(hmm, num_threads, 1);
+	parallel->set_sync_interval(7);
+	for(int epoch = 0;epoch < 3;epoch++){
+		if(num_threads == 1){
+			for(int data_index = 0;data_index < dataset.size();data_index++){
+				Sentence sentence = dataset.get_sentence(data_index);
+				hmm->gibbs(sentence);
+			}
+		}else{
+			parallel->gibbs(dataset, indices);
+		}
+		compare_with_assignments(hmm, dataset);
+	}
+	std::string filename = "trigram_test.model";
+	assert(hmm->save(filename));
+	HMM* loaded = new HMM();
+	assert(loaded->load(filename));
+	std::remove(filename.c_str());
+	assert(loaded->_trigram_counts->is_dense() == false);
+	compare_with_assignments(loaded, dataset);
+	cout << "num_tags=" << num_tags << " num_threads=" << num_threads << " OK" << endl;
+	delete parallel;
+	delete hmm;
+	delete loaded;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_updates(true);
+	test_updates(false);
+	test_load_dense_array(10);
+	test_load_dense_array(BHMM_DENSE_TRIGRAM_MAX_TAGS + 1);
+	test_hmm(1);
+	test_hmm(4);
+	cout << "OK" << endl;
+	return 0;
+}
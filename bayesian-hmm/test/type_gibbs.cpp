@@ -0,0 +1,260 @@
+#include  <algorithm>
+#include  <iostream>
+#include  <vector>
+#include  <cassert>
+#include  <cmath>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/type_gibbs.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int max_length, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, max_length);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+// 現在の品詞の割り当てから数え直したカウントと一致するか
+void compare_with_assignments(HMM* hmm, WordSequences &dataset){
+	HMM* counted = new HMM(hmm->_num_tags, hmm->_num_words);
+	counted->count_assignments(dataset);
+	int num_tags = hmm->_num_tags;
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			for(int tag = 0;tag <= num_tags;tag++){
+				assert(hmm->_trigram_counts->get(tag_2, tag_1, tag) == counted->_trigram_counts->get(tag_2, tag_1, tag));
+			}
+			assert(hmm->_bigram_counts->at(tag_2, tag_1) == counted->_bigram_counts->at(tag_2, tag_1));
+		}
+		assert(hmm->_unigram_counts->at(tag_2) == counted->_unigram_counts->at(tag_2));
+	}
+	for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			assert(hmm->get_count_of_tag_word(tag, word_id) == counted->get_count_of_tag_word(tag, word_id));
+		}
+	}
+	delete counted;
+}
+
+// Gibbsサンプリングが従う同時確率の対数
+// 3-gramの文脈には2-gram、出力確率の分母には1-gramのカウントを使い、
+// 文末の位置の分だけ3-gramや品詞-単語ペアの和より大きい分は品詞によらない定数として扱う
+double compute_log_joint(HMM* hmm, WordSequences &dataset){
+	int num_tags = hmm->_num_tags;
+	HMM* counted = new HMM(num_tags, hmm->_num_words);
+	counted->count_assignments(dataset);
+	double alpha = hmm->_alpha;
+	double log_p = 0;
+	for(int tag_2 = 0;tag_2 <= num_tags;tag_2++){
+		for(int tag_1 = 0;tag_1 <= num_tags;tag_1++){
+			double n_context = 0;
+			for(int tag = 0;tag <= num_tags;tag++){
+				double n = counted->_trigram_counts->get(tag_2, tag_1, tag);
+				log_p += lgamma(n + alpha) - lgamma(alpha);
+				n_context += n;
+			}
+			if(tag_2 == 0 && tag_1 == 0){
+				log_p -= n_context * log(num_tags * alpha);
+				continue;
+			}
+			double n_offset = counted->_bigram_counts->at(tag_2, tag_1) - n_context;
+			log_p += lgamma(n_offset + num_tags * alpha) - lgamma(n_offset + n_context + num_tags * alpha);
+		}
+	}
+	for(int tag = 1;tag <= num_tags;tag++){
+		double beta = hmm->_beta[tag];
+		double W = hmm->_Wt[tag];
+		double n_tag = 0;
+		for(id word_id = 0;word_id < hmm->_num_words;word_id++){
+			double n = counted->get_count_of_tag_word(tag, word_id);
+			log_p += lgamma(n + beta) - lgamma(beta);
+			n_tag += n;
+		}
+		double n_offset = counted->_unigram_counts->at(tag) - n_tag;
+		log_p += lgamma(n_offset + W * beta) - lgamma(n_offset + n_tag + W * beta);
+	}
+	delete counted;
+	return log_p;
+}
+
+// 1つの単語だけが品詞を変えられるデータセットで、文単位のブロック化サンプリングと交互に使った時の
+// その単語の出現の品詞の分布が真の条件付き分布の1/temperature乗と一致するか
+// 出現が隣り合う文を含めて、3-gramを共有する場合の数え方も確かめる
+void test_stationary_distribution(int num_tags, double temperature){
+	int num_words = 4;
+	id target = 1;
+	WordSequences dataset;
+	std::vector<std::vector<id>> sentences = {{1, 2, 1, 1}, {3, 1}, {1}, {2, 3, 1, 1, 3}, {2, 2}};
+	for(std::vector<id> &word_ids: sentences){
+		dataset.add_sentence(word_ids.data(), word_ids.size());
+	}
+	HMM* hmm = new HMM(num_tags, num_words);
+	// 対象の単語以外は品詞を1つに固定する
+	std::vector<int> offsets = {0, 0, 0, 1, 2};
+	std::vector<int> tags = {1, num_tags};
+	hmm->set_tag_dictionary(new TagDictionary(num_tags, offsets, tags));
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.5);
+	hmm->_temperature = temperature;
+	std::vector<size_t> positions;
+	for(size_t position = 0;position < dataset._word_ids.size();position++){
+		if(dataset._word_ids[position] == target){
+			positions.push_back(position);
+		}
+	}
+	int num_occurrences = positions.size();
+	assert(num_occurrences == 7);
+	// 全ての割り当てを列挙して真の分布を求める
+	int num_assignments = 1;
+	for(int k = 0;k < num_occurrences;k++){
+		num_assignments *= num_tags;
+	}
+	std::vector<int> original_states = dataset._states;
+	std::vector<double> expected(num_assignments);
+	double max_log_p = -1e100;
+	for(int index = 0;index < num_assignments;index++){
+		int code = index;
+		for(size_t position: positions){
+			dataset._states[position] = code % num_tags + 1;
+			code /= num_tags;
+		}
+		expected[index] = compute_log_joint(hmm, dataset) / temperature;
+		max_log_p = std::max(max_log_p, expected[index]);
+	}
+	double sum = 0;
+	for(int index = 0;index < num_assignments;index++){
+		expected[index] = exp(expected[index] - max_log_p);
+		sum += expected[index];
+	}
+	for(int index = 0;index < num_assignments;index++){
+		expected[index] /= sum;
+	}
+	dataset._states = original_states;
+	// 経験分布
+	TypeGibbs* type_gibbs = new TypeGibbs(hmm, dataset);
+	int num_samples = 200000;
+	std::vector<double> actual(num_assignments, 0);
+	int num_changed = 0;
+	for(int n = 0;n < num_samples;n++){
+		if(n % 2 == 0){
+			int data_index = sampler::uniform_int(0, dataset.size() - 1);
+			Sentence sentence = dataset.get_sentence(data_index);
+			hmm->blocked_gibbs(sentence);
+		}else{
+			type_gibbs->count_totals();
+			if(type_gibbs->resample(target, sampler::rng)){
+				num_changed++;
+			}
+		}
+		int index = 0;
+		for(int k = num_occurrences - 1;k >= 0;k--){
+			index = index * num_tags + dataset._states[positions[k]] - 1;
+		}
+		actual[index] += 1.0 / num_samples;
+	}
+	compare_with_assignments(hmm, dataset);
+	double max_error = 0;
+	for(int index = 0;index < num_assignments;index++){
+		max_error = std::max(max_error, std::abs(actual[index] - expected[index]));
+	}
+	cout << "num_tags=" << num_tags << " temperature=" << temperature << " max_error=" << max_error << " changed=" << (double)num_changed / (num_samples / 2) << endl;
+	assert(max_error < 0.01);
+	delete type_gibbs;
+	delete hmm;
+}
+
+// 全ての出現が同じ品詞の単語は、その品詞をまとめて引き直した時の分布に従う
+void test_whole_type(){
+	int num_tags = 3;
+	int num_words = 4;
+	WordSequences dataset;
+	generate_dataset(dataset, 10, 5, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.5);
+	for(size_t position = 0;position < dataset._word_ids.size();position++){
+		if(dataset._states[position] > 0){
+			dataset._states[position] = 1 + dataset._word_ids[position] % num_tags;
+		}
+	}
+	hmm->count_assignments(dataset);
+	id target = 2;
+	std::vector<double> expected(num_tags + 1, 0);
+	for(int tag = 1;tag <= num_tags;tag++){
+		for(size_t position = 0;position < dataset._word_ids.size();position++){
+			if(dataset._word_ids[position] == target && dataset._states[position] > 0){
+				dataset._states[position] = tag;
+			}
+		}
+		expected[tag] = exp(compute_log_joint(hmm, dataset));
+	}
+	double sum = expected[1] + expected[2] + expected[3];
+	TypeGibbs* type_gibbs = new TypeGibbs(hmm, dataset);
+	assert(type_gibbs->_word_offsets[target + 1] > type_gibbs->_word_offsets[target]);
+	std::vector<double> actual(num_tags + 1, 0);
+	int num_samples = 100000;
+	for(int n = 0;n < num_samples;n++){
+		type_gibbs->resample(target, sampler::rng);
+		size_t position = type_gibbs->_positions[type_gibbs->_word_offsets[target]];
+		int tag = dataset._states[position];
+		for(size_t k = type_gibbs->_word_offsets[target];k < type_gibbs->_word_offsets[target + 1];k++){
+			assert(dataset._states[type_gibbs->_positions[k]] == tag);
+		}
+		actual[tag] += 1.0 / num_samples;
+	}
+	compare_with_assignments(hmm, dataset);
+	for(int tag = 1;tag <= num_tags;tag++){
+		assert(std::abs(actual[tag] - expected[tag] / sum) < 0.01);
+	}
+	delete type_gibbs;
+	delete hmm;
+	cout << "whole type OK" << endl;
+}
+
+// 大きなデータセットで単語ごとのサンプリングとトークン単位のサンプリングを交互に行ってもカウントが割り当てと一致する
+void test_consistency(int num_tags){
+	int num_words = 100;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, 20, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->_temperature = 1.5;
+	TypeGibbs* type_gibbs = new TypeGibbs(hmm, dataset);
+	assert(type_gibbs->_positions.size() == dataset.get_num_tokens() - (size_t)dataset.size() * BHMM_NUM_SENTINELS * 2);
+	for(int epoch = 0;epoch < 5;epoch++){
+		double changed = type_gibbs->sweep(sampler::rng);
+		assert(0 <= changed && changed <= 1);
+		compare_with_assignments(hmm, dataset);
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			hmm->gibbs(sentence);
+		}
+		compare_with_assignments(hmm, dataset);
+	}
+	delete type_gibbs;
+	delete hmm;
+	cout << "num_tags=" << num_tags << " OK" << endl;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_stationary_distribution(2, 1.0);
+	test_stationary_distribution(3, 1.0);
+	test_stationary_distribution(2, 2.0);
+	test_whole_type();
+	test_consistency(10);
+	test_consistency(200);	// 3-gramをハッシュ表に持つ
+	cout << "OK" << endl;
+	return 0;
+}
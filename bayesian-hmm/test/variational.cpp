@@ -0,0 +1,187 @@
+#include  <iostream>
+#include  <vector>
+#include  <cmath>
+#include  <cassert>
+#include "../src/bhmm/hmm.h"
+#include "../src/bhmm/variational.h"
+#include "../src/bhmm/sampler.h"
+using namespace bhmm;
+using std::cout;
+using std::endl;
+
+void generate_dataset(WordSequences &dataset, int num_sentences, int num_words){
+	std::vector<id> word_ids;
+	for(int n = 0;n < num_sentences;n++){
+		int length = sampler::uniform_int(1, 20);
+		word_ids.clear();
+		for(int i = 0;i < length;i++){
+			word_ids.push_back(sampler::uniform_int(0, num_words - 1));
+		}
+		dataset.add_sentence(word_ids.data(), length);
+	}
+}
+
+HMM* build_hmm(WordSequences &dataset, int num_tags, int num_words){
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	hmm->set_alpha(0.1);
+	return hmm;
+}
+
+size_t count_words(WordSequences &dataset){
+	return dataset.get_num_tokens() - (size_t)dataset.size() * BHMM_NUM_SENTINELS * 2;
+}
+
+// 変分下界は反復ごとに単調に増え、期待カウントの合計は単語数に等しい
+void test_lower_bound(){
+	int num_tags = 6;
+	int num_words = 40;
+	WordSequences dataset;
+	generate_dataset(dataset, 200, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	VariationalEM* vb = new VariationalEM(hmm, 1);
+	vb->initialize_with_assignments(dataset);
+	double previous = -INFINITY;
+	for(int iteration = 0;iteration < 30;iteration++){
+		double lower_bound = vb->iterate(dataset);
+		assert(lower_bound < 0);
+		assert(lower_bound >= previous - 1e-8 * std::abs(lower_bound));
+		previous = lower_bound;
+	}
+	double sum_trigram_counts = 0;
+	for(double count: vb->_trigram_counts){
+		sum_trigram_counts += count;
+	}
+	double sum_emission_counts = 0;
+	for(double count: vb->_emission_counts){
+		sum_emission_counts += count;
+	}
+	assert(std::abs(sum_trigram_counts - count_words(dataset)) < 1e-6);
+	assert(std::abs(sum_emission_counts - count_words(dataset)) < 1e-6);
+	delete vb;
+	delete hmm;
+	cout << "lower bound OK" << endl;
+}
+
+// 書き込んだカウントから計算した遷移確率と出力確率はそれぞれ和が1になる
+void test_written_counts(){
+	int num_tags = 5;
+	int num_words = 30;
+	WordSequences dataset;
+	generate_dataset(dataset, 300, num_words);
+	HMM* hmm = build_hmm(dataset, num_tags, num_words);
+	VariationalEM* vb = new VariationalEM(hmm, 2);
+	vb->initialize_with_assignments(dataset);
+	for(int iteration = 0;iteration < 5;iteration++){
+		vb->iterate(dataset);
+	}
+	for(int t_2 = 0;t_2 <= num_tags;t_2++){
+		for(int t_1 = 0;t_1 <= num_tags;t_1++){
+			double sum = 0;
+			for(int t = 1;t <= num_tags;t++){
+				sum += hmm->compute_p_ti_given_t(t, t_1, t_2);
+			}
+			assert(std::abs(sum - 1) < 1e-10);
+		}
+	}
+	for(int tag = 1;tag <= num_tags;tag++){
+		double sum = 0;
+		for(id word_id = 0;word_id < num_words;word_id++){
+			sum += hmm->compute_p_wi_given_ti(word_id, tag);
+			assert(hmm->get_count_of_tag_word(tag, word_id) == lround(vb->_emission_counts[word_id * (num_tags + 1) + tag]));
+		}
+		assert(std::abs(sum - 1) < 1e-10);
+	}
+	// 事後確率が最大の品詞から数え直すとGibbsサンプリングを続けられる
+	hmm->count_assignments(dataset);
+	for(int epoch = 0;epoch < 3;epoch++){
+		for(int data_index = 0;data_index < dataset.size();data_index++){
+			Sentence sentence = dataset.get_sentence(data_index);
+			hmm->gibbs(sentence);
+		}
+	}
+	delete vb;
+	delete hmm;
+	cout << "written counts OK" << endl;
+}
+
+// スレッド数を変えても足す順序が変わるだけ
+void test_threads(){
+	int num_tags = 6;
+	int num_words = 50;
+	std::vector<double> lower_bounds;
+	std::vector<std::vector<int>> states;
+	for(int num_threads: {1, 4}){
+		sampler::set_seed(3);
+		WordSequences dataset;
+		generate_dataset(dataset, 300, num_words);
+		HMM* hmm = build_hmm(dataset, num_tags, num_words);
+		VariationalEM* vb = new VariationalEM(hmm, num_threads);
+		vb->initialize_with_assignments(dataset);
+		double lower_bound = 0;
+		for(int iteration = 0;iteration < 10;iteration++){
+			lower_bound = vb->iterate(dataset);
+		}
+		lower_bounds.push_back(lower_bound);
+		states.push_back(dataset._states);
+		delete vb;
+		delete hmm;
+	}
+	assert(std::abs(lower_bounds[0] - lower_bounds[1]) < 1e-8 * std::abs(lower_bounds[0]));
+	assert(states[0] == states[1]);
+	cout << "threads OK" << endl;
+}
+
+// 品詞の一覧にない品詞には期待カウントが入らない
+void test_tag_dictionary(){
+	int num_tags = 4;
+	int num_words = 20;
+	WordSequences dataset;
+	generate_dataset(dataset, 200, num_words);
+	HMM* hmm = new HMM(num_tags, num_words);
+	std::vector<int> offsets;
+	std::vector<int> tags;
+	offsets.push_back(0);
+	for(id word_id = 0;word_id < num_words;word_id++){
+		if(word_id % 2 == 0){
+			tags.push_back(1 + word_id % num_tags);
+			tags.push_back(1 + (word_id + 1) % num_tags);
+		}
+		offsets.push_back(tags.size());
+	}
+	TagDictionary* dictionary = new TagDictionary(num_tags, offsets, tags);
+	hmm->set_tag_dictionary(dictionary);
+	std::vector<int> Wt(num_tags, num_words);
+	hmm->initialize_with_training_dataset(dataset, Wt);
+	VariationalEM* vb = new VariationalEM(hmm, 2);
+	vb->initialize_with_assignments(dataset);
+	for(int iteration = 0;iteration < 5;iteration++){
+		vb->iterate(dataset);
+	}
+	for(id word_id = 0;word_id < num_words;word_id++){
+		for(int tag = 1;tag <= num_tags;tag++){
+			if(dictionary->is_allowed(word_id, tag) == false){
+				assert(vb->_emission_counts[word_id * (num_tags + 1) + tag] == 0);
+			}
+		}
+	}
+	for(int data_index = 0;data_index < dataset.size();data_index++){
+		Sentence sentence = dataset.get_sentence(data_index);
+		for(int i = 2;i < sentence.size() - 2;i++){
+			assert(dictionary->is_allowed(sentence.get_word_id(i), sentence.get_state(i)));
+		}
+	}
+	delete vb;
+	delete hmm;
+	cout << "tag dictionary OK" << endl;
+}
+
+int main(){
+	sampler::set_seed(1);
+	test_lower_bound();
+	test_written_counts();
+	test_threads();
+	test_tag_dictionary();
+	return 0;
+}
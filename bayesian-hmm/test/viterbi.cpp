@@ -18,10 +18,12 @@ int main(){
 	dictionary->load("bhmm.dict");
 	Model* model = new Model("bhmm.model");
 	std::vector<int> sampled_state_sequence;
-	for(auto sentence: dataset->_word_sequences_train){
+	WordSequences &dataset_train = dataset->_word_sequences_train;
+	for(int data_index = 0;data_index < dataset_train.size();data_index++){
+		Sentence sentence = dataset_train.get_sentence(data_index);
 		model->viterbi_decode(sentence, sampled_state_sequence);
-		for(int i = 0;i < sentence.size();i++){
-			wcout << dictionary->word_id_to_string(sentence[i]->_id) << ", " << sampled_state_sequence[i] << endl;
+		for(int i = 0;i < sampled_state_sequence.size();i++){
+			wcout << dictionary->word_id_to_string(sentence.get_word_id(i + 2)) << ", " << sampled_state_sequence[i] << endl;
 		}
 	}
 	return 0;
@@ -0,0 +1,33 @@
+import ihmm
+
+# 不正な引数はGILを解放する前にValueErrorになる
+def build_model():
+	corpus = ihmm.corpus()
+	corpus.add_words(["the", "cat", "sat"])
+	corpus.add_words(["a", "dog", "ran"])
+	dataset = ihmm.dataset(corpus, 1, 0, 0)
+	return ihmm.model(3, dataset), dataset.get_num_words()
+
+def assert_value_error(model, word_ids, offsets, num_threads):
+	try:
+		model.viterbi_decode_batch(word_ids, offsets, num_threads)
+	except ValueError:
+		return
+	raise AssertionError("ValueError was not raised: {} {} {}".format(word_ids, offsets, num_threads))
+
+def main():
+	model, num_words = build_model()
+	word_ids = [1, 2, 3, 4]
+	assert len(model.viterbi_decode_batch(word_ids, [0, 2, 4], 2)) == len(word_ids)
+	assert_value_error(model, word_ids, [0, 2, 4], 0)
+	assert_value_error(model, word_ids, [0, 2, 4], -1)
+	assert_value_error(model, word_ids, [], 1)
+	assert_value_error(model, word_ids, [1, 4], 1)
+	assert_value_error(model, word_ids, [0, 3], 1)
+	assert_value_error(model, word_ids, [0, 3, 1, 4], 1)
+	assert_value_error(model, [1, -1, 3, 4], [0, 2, 4], 1)
+	assert_value_error(model, [1, num_words, 3, 4], [0, 2, 4], 1)
+	print("OK")
+
+if __name__ == "__main__":
+	main()
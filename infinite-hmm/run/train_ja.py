@@ -90,7 +90,14 @@ def main():
 		if epoch % 100 == 0:
 			printr("")
 			print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
-			model.save(os.path.join(args.working_directory, "ihmm.model"))
+			print("changed {:.4f} - log_p_joint {} - split_r_hat {:.3f}".format(trainer.get_changed_fraction(), trainer.get_log_p_joint(), trainer.get_split_r_hat()))
+			trainer.save_async(os.path.join(args.working_directory, "ihmm.model"))	# 書き出しは裏で行う
+		if args.early_stopping and trainer.converged():	# 状態の変化と同時確率が横ばいになったら打ち切る
+			printr("")
+			print("converged at epoch {}".format(epoch))
+			trainer.save_async(os.path.join(args.working_directory, "ihmm.model"))
+			break
+	trainer.wait_for_save()
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -106,5 +113,6 @@ if __name__ == "__main__":
 	parser.add_argument("--initial-gamma", "-gamma", type=int, default=1, help="gammaの初期値.")
 	parser.add_argument("--initial-gamma-emission", "-egamma", type=int, default=1, help="gamma_emissionの初期値.")
 	parser.add_argument("--initial-beta-emission", "-ebeta", type=int, default=1, help="beta_emissionの初期値.")
+	parser.add_argument("--early-stopping", dest="early_stopping", default=False, action="store_true", help="収束したら指定したepochより前に打ち切るかどうか.")
 	args = parser.parse_args()
 	main()
\ No newline at end of file
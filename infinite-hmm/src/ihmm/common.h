@@ -1,8 +0,0 @@
-#pragma once
-
-namespace ihmm {
-	typedef struct Word {
-		int _id;
-		int _tag;
-	} Word;
-}
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <cassert>
+#include <cmath>
+#include "convergence.h"
+
+namespace ihmm {
+	ConvergenceMonitor::ConvergenceMonitor(){
+		_window = 100;
+		_tolerance = 0.005;
+		_max_r_hat = 1.05;
+	}
+	void ConvergenceMonitor::set_criteria(int window, double tolerance, double max_r_hat){
+		assert(window >= IHMM_NUM_SPLITS * 2);
+		assert(tolerance >= 0);
+		assert(max_r_hat >= 1);
+		_window = window;
+		_tolerance = tolerance;
+		_max_r_hat = max_r_hat;
+	}
+	void ConvergenceMonitor::add_epoch(double changed_fraction, double log_p){
+		_changed_fractions.push_back(changed_fraction);
+		_log_p.push_back(log_p);
+	}
+	void ConvergenceMonitor::clear(){
+		_changed_fractions.clear();
+		_log_p.clear();
+	}
+	int ConvergenceMonitor::get_num_epochs() const {
+		return _log_p.size();
+	}
+	double ConvergenceMonitor::get_changed_fraction() const {
+		if(_changed_fractions.size() == 0){
+			return 1;
+		}
+		return _changed_fractions.back();
+	}
+	double ConvergenceMonitor::get_log_p() const {
+		if(_log_p.size() == 0){
+			return 0;
+		}
+		return _log_p.back();
+	}
+	// 直近_window個の記録をIHMM_NUM_SPLITS本の系列とみなし、
+	// 系列内の分散の平均Wと系列間の分散Bから R̂ = sqrt(((n - 1) / n * W + B / n) / W)
+	double ConvergenceMonitor::compute_split_r_hat() const {
+		if(_log_p.size() < _window){
+			return -1;
+		}
+		int length = _window / IHMM_NUM_SPLITS;
+		size_t begin = _log_p.size() - length * IHMM_NUM_SPLITS;
+		double means[IHMM_NUM_SPLITS];
+		double mean_of_means = 0;
+		double W = 0;
+		for(int split = 0;split < IHMM_NUM_SPLITS;split++){
+			const double* values = _log_p.data() + begin + split * length;
+			double mean = 0;
+			for(int i = 0;i < length;i++){
+				mean += values[i];
+			}
+			mean /= length;
+			double variance = 0;
+			for(int i = 0;i < length;i++){
+				variance += (values[i] - mean) * (values[i] - mean);
+			}
+			W += variance / (length - 1);
+			means[split] = mean;
+			mean_of_means += mean;
+		}
+		W /= IHMM_NUM_SPLITS;
+		mean_of_means /= IHMM_NUM_SPLITS;
+		double B = 0;
+		for(int split = 0;split < IHMM_NUM_SPLITS;split++){
+			B += (means[split] - mean_of_means) * (means[split] - mean_of_means);
+		}
+		B *= length / (double)(IHMM_NUM_SPLITS - 1);
+		if(W == 0){
+			return (B == 0) ? 1 : INFINITY;
+		}
+		return sqrt(((length - 1) * W / length + B / length) / W);
+	}
+	bool ConvergenceMonitor::converged() const {
+		if(_changed_fractions.size() < _window){
+			return false;
+		}
+		int half = _window / 2;
+		size_t begin = _changed_fractions.size() - half * 2;
+		double former = 0;
+		double latter = 0;
+		for(int i = 0;i < half;i++){
+			former += _changed_fractions[begin + i];
+			latter += _changed_fractions[begin + half + i];
+		}
+		if(std::abs(former - latter) / half > _tolerance){
+			return false;
+		}
+		double r_hat = compute_split_r_hat();
+		return 0 <= r_hat && r_hat <= _max_r_hat;
+	}
+}
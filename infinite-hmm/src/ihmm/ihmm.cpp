@@ -1,10 +1,12 @@
 #include <cassert>
+#include <cmath>
 #include <boost/serialization/base_object.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/split_free.hpp>
 #include <iostream>
+#include <sstream>
 #include <fstream>
 #include <set>
 #include "ihmm.h"
@@ -27,6 +29,7 @@ namespace ihmm {
 		_oracle_sum_n_over_j = 0;
 		_oracle_sum_m_over_q = 0;
 		_gibbs_sampling_table = NULL;
+		_log_p_joint_delta = 0;
 	}
 	InfiniteHMM::InfiniteHMM(int initial_num_tags, int num_words): InfiniteHMM(){
 		_initial_num_tags = initial_num_tags;
@@ -66,31 +69,33 @@ namespace ihmm {
 		}
 		return num_tags;
 	}
-	void InfiniteHMM::initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset){
+	void InfiniteHMM::initialize_with_training_dataset(WordSequences &dataset){
 		// 最初は品詞をランダムに割り当てる
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			std::vector<Word*> &word_ids = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
+			int* word_ids = sentence._word_ids;
+			int* tags = sentence._tags;
 			int ti_1 = 0;
-			for(int i = 1;i < word_ids.size() - 1;i++){
-				Word* word = word_ids[i];
+			for(int i = 1;i < sentence.size() - 1;i++){
 				int ti = sampler::uniform_int(1, _initial_num_tags);
-				int wi = word->_id;
+				int wi = word_ids[i];
 				_increment_tag_bigram_count(ti_1, ti);
 				_increment_tag_word_count(ti, wi);
-				word->_tag = ti;
+				tags[i] = ti;
 				ti_1 = ti;
 			}
 			_increment_tag_bigram_count(ti_1, 0);	// </s>への遷移
 		}
 	}
-	void InfiniteHMM::_remove_all_training_dataset(std::vector<std::vector<Word*>> &dataset){
+	void InfiniteHMM::_remove_all_training_dataset(WordSequences &dataset){
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			std::vector<Word*> &word_ids = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
+			int* word_ids = sentence._word_ids;
+			int* tags = sentence._tags;
 			int ti_1 = 0;
-			for(int i = 1;i < word_ids.size() - 1;i++){
-				Word* word = word_ids[i];
-				int ti = word->_tag;
-				int wi = word->_id;
+			for(int i = 1;i < sentence.size() - 1;i++){
+				int ti = tags[i];
+				int wi = word_ids[i];
 				_decrement_tag_bigram_count(ti_1, ti);
 				_decrement_tag_word_count(ti, wi);
 				ti_1 = ti;
@@ -449,12 +454,14 @@ namespace ihmm {
 		assert(false);
 		return stack_size;
 	}
-	void InfiniteHMM::gibbs(std::vector<Word*> &word_vec){
-		for(int i = 1;i < word_vec.size() - 1;i++){	// <s>と</s>の内側だけ考える
-			int ti_1 = word_vec[i - 1]->_tag;
-			int ti = word_vec[i]->_tag;
-			int wi = word_vec[i]->_id;
-			int ti1 = word_vec[i + 1]->_tag;
+	void InfiniteHMM::gibbs(Sentence &sentence){
+		int* word_ids = sentence._word_ids;
+		int* tags = sentence._tags;
+		for(int i = 1;i < sentence.size() - 1;i++){	// <s>と</s>の内側だけ考える
+			int ti_1 = tags[i - 1];
+			int ti = tags[i];
+			int wi = word_ids[i];
+			int ti1 = tags[i + 1];
 			// 現在のtiをモデルから除去
 			_decrement_tag_bigram_count(ti_1, ti);
 			_decrement_tag_bigram_count(ti, ti1);
@@ -463,6 +470,11 @@ namespace ihmm {
 			int new_ti = _perform_gibbs_sampling_on_markov_blanket(ti_1, ti1, wi);
 			// std::cout << "new_ti = " << new_ti << std::endl;
 			assert(1 <= new_ti && new_ti <= get_num_tags() + 1);	// 新しいタグも許可
+			// 条件付き確率の比は同時確率の比なので、変わった位置だけ足せば同時確率の変化を追える
+			// 同じ品詞が続く場合のカウントの補正はしていないので近似になる
+			if(new_ti != ti){
+				_log_p_joint_delta += log(_gibbs_sampling_table[new_ti]) - log(_gibbs_sampling_table[ti]);
+			}
 			if(new_ti == get_num_tags() + 1){
 				_add_new_tag();
 			}
@@ -470,7 +482,7 @@ namespace ihmm {
 			_increment_tag_bigram_count(ti_1, new_ti);
 			_increment_tag_bigram_count(new_ti, ti1);
 			_increment_tag_word_count(new_ti, wi);
-			word_vec[i]->_tag = new_ti;
+			tags[i] = new_ti;
 		}
 	}
 	template <class Archive>
@@ -488,6 +500,14 @@ namespace ihmm {
 		ofs.close();
 		return success;
 	}
+	void InfiniteHMM::save_to_string(std::string &buffer){
+		std::ostringstream oss(std::ios::binary);
+		{
+			boost::archive::binary_oarchive oarchive(oss);
+			oarchive << *this;
+		}
+		buffer = oss.str();
+	}
 	bool InfiniteHMM::load(std::string filename){
 		bool success = false;
 		std::ifstream ifs(filename);
@@ -1,7 +1,7 @@
 #pragma once
 #include <boost/serialization/serialization.hpp>
 #include <vector>
-#include "common.h"
+#include "sequences.h"
 #include "table.h"
 
 // <s>と</s>のIDは0
@@ -26,11 +26,12 @@ namespace ihmm {
 		double _gamma;
 		double _beta_emission;
 		double _gamma_emission;
+		double _log_p_joint_delta;	// gibbsで品詞を書き換えるたびに同時確率の変化を足す
 		InfiniteHMM();
 		InfiniteHMM(int initial_num_tags, int num_words);
 		~InfiniteHMM();
-		void initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset);
-		void _remove_all_training_dataset(std::vector<std::vector<Word*>> &dataset);
+		void initialize_with_training_dataset(WordSequences &dataset);
+		void _remove_all_training_dataset(WordSequences &dataset);
 		int get_num_tags() const;
 		int get_num_valid_tags() const;
 		int get_num_words() const;
@@ -57,9 +58,11 @@ namespace ihmm {
 		void _increment_oracle_word_count(int word_id);
 		void _decrement_oracle_word_count(int word_id);
 		int _perform_gibbs_sampling_on_markov_blanket(int ti_1, int ti1, int wi);
-		void gibbs(std::vector<Word*> &word_vec);
+		void gibbs(Sentence &sentence);
 		bool save(std::string filename);
 		bool load(std::string filename);
+		// saveと同じ内容をメモリ上に書き出す
+		void save_to_string(std::string &buffer);
 		template <class Archive>
 		void serialize(Archive &ar, unsigned int version);
 	};
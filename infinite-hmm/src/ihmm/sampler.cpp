@@ -1,17 +1,56 @@
 #include <chrono>
+#include <random>
 #include "sampler.h"
 
 namespace ihmm {
 	namespace sampler{
+		Xoshiro256::Xoshiro256(){
+			seed(0);
+		}
+		Xoshiro256::Xoshiro256(uint64_t seed){
+			this->seed(seed);
+		}
+		void Xoshiro256::seed(uint64_t seed){
+			uint64_t x = seed;
+			for(int i = 0;i < 4;i++){
+				x += 0x9e3779b97f4a7c15ULL;
+				uint64_t z = x;
+				z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+				z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+				_state[i] = z ^ (z >> 31);
+			}
+		}
+		void Xoshiro256::jump(){
+			static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+			uint64_t s[4] = {0, 0, 0, 0};
+			for(int i = 0;i < 4;i++){
+				for(int b = 0;b < 64;b++){
+					if(JUMP[i] & (1ULL << b)){
+						for(int k = 0;k < 4;k++){
+							s[k] ^= _state[k];
+						}
+					}
+					operator()();
+				}
+			}
+			for(int k = 0;k < 4;k++){
+				_state[k] = s[k];
+			}
+		}
+		void Xoshiro256::uniform(double* buffer, int size){
+			for(int i = 0;i < size;i++){
+				buffer[i] = uniform();
+			}
+		}
 		int seed = std::chrono::system_clock::now().time_since_epoch().count();
 		// int seed = 1;
-		std::mt19937 mt(seed);
+		Xoshiro256 rng(seed);
 		void set_seed(int seed){
-			mt = std::mt19937(seed);
+			rng.seed(seed);
 		}
 		double gamma(double a, double b){
 			std::gamma_distribution<double> distribution(a, 1.0 / b);
-			return distribution(mt);
+			return distribution(rng);
 		}
 		double beta(double a, double b){
 			double ga = gamma(a, 1.0);
@@ -19,24 +58,24 @@ namespace ihmm {
 			return ga / (ga + gb);
 		}
 		double bernoulli(double p){
-			std::uniform_real_distribution<double> rand(0, 1);
-			double r = rand(mt);
+			double r = rng.uniform();
 			if(r > p){
 				return 0;
 			}
 			return 1;
 		}
 		double uniform(double min, double max){
-			std::uniform_real_distribution<double> rand(min, max);
-			return rand(mt);
+			return min + (max - min) * rng.uniform();
 		}
+		// 64ビットの乱数に幅を掛けた上位64ビット. 偏りは幅/2^64以下
 		double uniform_int(int min, int max){
-			std::uniform_int_distribution<> rand(min, max);
-			return rand(mt);
+			uint64_t range = (uint64_t)((int64_t)max - min) + 1;
+			uint64_t k = ((unsigned __int128)rng() * range) >> 64;
+			return min + (int64_t)k;
 		}
 		double normal(double mean, double stddev){
 			std::normal_distribution<double> rand(mean, stddev);
-			return rand(mt);
+			return rand(rng);
 		}
 	}
-}
\ No newline at end of file
+}
@@ -1,9 +1,51 @@
 #pragma once
-#include <random>
+#include <cstdint>
+#include <limits>
 
 namespace ihmm {
 	namespace sampler{
-		extern std::mt19937 mt;
+		// xoshiro256++
+		// 状態は32バイトで、std::shuffleなどにもそのまま渡せる
+		// jumpで2^128回分進めた系列は重ならないので、スレッドごとにjumpした複製を使う
+		class Xoshiro256 {
+		private:
+			static inline uint64_t _rotl(uint64_t x, int k){
+				return (x << k) | (x >> (64 - k));
+			}
+		public:
+			typedef uint64_t result_type;
+			uint64_t _state[4];
+			Xoshiro256();
+			explicit Xoshiro256(uint64_t seed);
+			// splitmix64で状態を埋める
+			void seed(uint64_t seed);
+			void jump();
+			static constexpr result_type min(){
+				return 0;
+			}
+			static constexpr result_type max(){
+				return std::numeric_limits<uint64_t>::max();
+			}
+			inline result_type operator()(){
+				uint64_t* s = _state;
+				uint64_t result = _rotl(s[0] + s[3], 23) + s[0];
+				uint64_t t = s[1] << 17;
+				s[2] ^= s[0];
+				s[3] ^= s[1];
+				s[1] ^= s[2];
+				s[0] ^= s[3];
+				s[2] ^= t;
+				s[3] = _rotl(s[3], 45);
+				return result;
+			}
+			// [0, 1)の一様乱数. 上位53ビットを使う
+			inline double uniform(){
+				return (operator()() >> 11) * (1.0 / 9007199254740992.0);
+			}
+			// [0, 1)の一様乱数をsize個まとめて作る
+			void uniform(double* buffer, int size);
+		};
+		extern Xoshiro256 rng;
 		double gamma(double a, double b);
 		double beta(double a, double b);
 		double bernoulli(double p);
@@ -12,4 +54,4 @@ namespace ihmm {
 		double normal(double mean, double stddev);
 		void set_seed(int seed);
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,29 @@
+#include "sequences.h"
+
+namespace ihmm {
+	WordSequences::WordSequences(){
+		_offsets.push_back(0);
+	}
+	void WordSequences::add_sentence(const int* word_ids, int num_words){
+		assert(num_words > 0);
+		for(int i = 0;i < IHMM_NUM_SENTINELS;i++){
+			_word_ids.push_back(0);
+			_tags.push_back(0);
+		}
+		for(int i = 0;i < num_words;i++){
+			_word_ids.push_back(word_ids[i]);
+			_tags.push_back(1);
+		}
+		for(int i = 0;i < IHMM_NUM_SENTINELS;i++){
+			_word_ids.push_back(0);
+			_tags.push_back(0);
+		}
+		_offsets.push_back(_word_ids.size());
+	}
+	void WordSequences::clear(){
+		_word_ids.clear();
+		_tags.clear();
+		_offsets.clear();
+		_offsets.push_back(0);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+#define IHMM_NUM_SENTINELS 1	// 文頭と文末に置く<s>と</s>の数
+
+namespace ihmm {
+	// 1文分の単語IDと品詞への参照
+	// 添字は文頭の<s>と文末の</s>を含めた位置で数え、単語は[1, size() - 1)に並ぶ
+	class Sentence {
+	public:
+		int* _word_ids;
+		int* _tags;
+		int _length;	// <s>と</s>を含む
+		Sentence(int* word_ids, int* tags, int length){
+			_word_ids = word_ids;
+			_tags = tags;
+			_length = length;
+		}
+		inline int size() const {
+			return _length;
+		}
+		inline int get_word_id(int i) const {
+			assert(0 <= i && i < _length);
+			return _word_ids[i];
+		}
+		inline int get_tag(int i) const {
+			assert(0 <= i && i < _length);
+			return _tags[i];
+		}
+		inline void set_tag(int i, int tag){
+			assert(0 <= i && i < _length);
+			_tags[i] = tag;
+		}
+	};
+	// 全ての文の単語IDと品詞をそれぞれ1本の配列に並べる
+	// n番目の文は[_offsets[n], _offsets[n + 1])で、<s>と</s>の位置も含む
+	class WordSequences {
+	public:
+		std::vector<int> _word_ids;
+		std::vector<int> _tags;
+		std::vector<size_t> _offsets;
+		WordSequences();
+		// <s>と</s>で挟んで追加する. 品詞は<s>と</s>が0、単語が1
+		void add_sentence(const int* word_ids, int num_words);
+		void clear();
+		inline int size() const {
+			return _offsets.size() - 1;
+		}
+		inline size_t get_num_tokens() const {
+			return _word_ids.size();
+		}
+		inline Sentence get_sentence(int n){
+			assert(0 <= n && n < size());
+			size_t begin = _offsets[n];
+			return Sentence(_word_ids.data() + begin, _tags.data() + begin, _offsets[n + 1] - begin);
+		}
+	};
+}
@@ -3,28 +3,46 @@
 #include "python/dataset.h"
 #include "python/dictionary.h"
 #include "python/trainer.h"
+#include "ihmm/sampler.h"
 
 using namespace ihmm;
 
 BOOST_PYTHON_MODULE(ihmm){
-	boost::python::class_<Dictionary>("dictionary")
+	// 乱数の系列を固定する. 学習の前に呼ぶ
+	boost::python::def("set_seed", &sampler::set_seed);
+
+	boost::python::class_<Dictionary, boost::noncopyable>("dictionary")
 	.def("string_to_word_id", &Dictionary::string_to_word_id)
+	.def("string_to_word_ids", &Dictionary::python_string_to_word_ids)
 	.def("is_id_unk", &Dictionary::is_id_unk)
 	.def("is_string_unk", &Dictionary::is_string_unk)
 	.def("save", &Dictionary::save)
 	.def("load", &Dictionary::load);
 
 	boost::python::class_<Corpus>("corpus")
-	.def("add_words", &Corpus::python_add_words);
+	.def("add_words", &Corpus::python_add_words)
+	.def("add_textfile", &Corpus::add_textfile)
+	.def("save_binary", &Corpus::save_binary)
+	.def("set_blank_line_policy", &Corpus::python_set_blank_line_policy)
+	.def("get_num_words", &Corpus::get_num_words);
 
 	boost::python::class_<Dataset>("dataset", boost::python::init<Corpus*, double, int, int>())
+	.def(boost::python::init<std::string, double, int, int>())
 	.def("get_num_words", &Dataset::get_num_words)
 	.def("get_dict", &Dataset::get_dict_obj, boost::python::return_internal_reference<>());
 
-	boost::python::class_<Trainer>("trainer", boost::python::init<Dataset*, Model*>())
+	boost::python::class_<Trainer, boost::noncopyable>("trainer", boost::python::init<Dataset*, Model*>())
 	.def("compute_log_p_dataset_train", &Trainer::compute_log_p_dataset_train)
 	.def("compute_log_p_dataset_dev", &Trainer::compute_log_p_dataset_dev)
-	.def("gibbs", &Trainer::gibbs);
+	.def("gibbs", &Trainer::gibbs)
+	.def("set_convergence_criteria", &Trainer::set_convergence_criteria)
+	.def("converged", &Trainer::converged)
+	.def("get_changed_fraction", &Trainer::get_changed_fraction)
+	.def("get_log_p_joint", &Trainer::get_log_p_joint)
+	.def("get_split_r_hat", &Trainer::get_split_r_hat)
+	.def("save_async", &Trainer::save_async)
+	.def("is_saving", &Trainer::is_saving)
+	.def("wait_for_save", &Trainer::wait_for_save);
 
 	boost::python::class_<Model>("model", boost::python::init<int, Dataset*>())
 	.def(boost::python::init<std::string>())
@@ -35,6 +53,7 @@ BOOST_PYTHON_MODULE(ihmm){
 	.def("set_initial_gamma_emission", &Model::set_initial_gamma_emission)
 	.def("set_initial_beta_emission", &Model::set_initial_beta_emission)
 	.def("viterbi_decode", &Model::python_viterbi_decode)
+	.def("viterbi_decode_batch", &Model::python_viterbi_decode_batch)
 	.def("print_typical_words_assigned_to_each_tag", &Model::print_typical_words_assigned_to_each_tag)
 	.def("save", &Model::save)
 	.def("load", &Model::load);
@@ -1,73 +1,189 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <cstring>
 #include <iostream>
-#include <fstream>
-#include <unordered_set>
 #include "corpus.h"
+#include "../ihmm/corpus_file.h"
 #include "../ihmm/utils.h"
-#include "../ihmm/sampler.h"
+
+#define CORPUS_RELEASE_INTERVAL (64 << 20)	// 読み終えた領域をこの大きさごとに手放す
 
 namespace ihmm {
 	Corpus::Corpus(){
+		_blank_line_policy = BLANK_LINE_SKIP;
 		_max_num_words_in_line = -1;
 		_min_num_words_in_line = -1;
 	}
-	void Corpus::add_textfile(std::string filename){
-		std::wifstream ifs(filename.c_str());
-		std::wstring sentence_str;
-		assert(ifs.fail() == false);
-		std::vector<std::wstring> sentence_vec;
-		while (getline(ifs, sentence_str) && !sentence_str.empty()){
+	void Corpus::set_blank_line_policy(int policy){
+		assert(policy == BLANK_LINE_SKIP || policy == BLANK_LINE_STOP);
+		_blank_line_policy = policy;
+	}
+	// "skip"か"stop"
+	void Corpus::python_set_blank_line_policy(std::string policy){
+		if(policy == "skip"){
+			set_blank_line_policy(BLANK_LINE_SKIP);
+			return;
+		}
+		if(policy == "stop"){
+			set_blank_line_policy(BLANK_LINE_STOP);
+			return;
+		}
+		PyErr_SetString(PyExc_ValueError, "blank line policy must be 'skip' or 'stop'");
+		boost::python::throw_error_already_set();
+	}
+	static inline bool _is_space(char ch){
+		return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+	}
+	// UTF-8のファイルをmmapし、1行を1文として空白で区切る
+	// 単語は文字列を作らずにその場で単語IDに直すので、生のテキストも文字列の単語列も保持しない
+	bool Corpus::add_textfile(std::string filename){
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0){
+			std::cout << filename << " not found." << std::endl;
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0){
+			close(fd);
+			return false;
+		}
+		size_t size = st.st_size;
+		if(size == 0){
+			close(fd);
+			return true;
+		}
+		void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(address == MAP_FAILED){
+			return false;
+		}
+		madvise(address, size, MADV_SEQUENTIAL);
+		const char* begin = static_cast<const char*>(address);
+		const char* end = begin + size;
+		const char* released = begin;
+		size_t page_size = sysconf(_SC_PAGESIZE);
+		const char* line = begin;
+		if(size >= 3 && std::memcmp(begin, "\xEF\xBB\xBF", 3) == 0){
+			line += 3;	// BOM
+		}
+		std::vector<int> token_ids;
+		while(line < end){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
-				return;
+				break;
+			}
+			const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if(line_end == NULL){
+				line_end = end;
+			}
+			token_ids.clear();
+			const char* token = line;
+			while(token < line_end){
+				while(token < line_end && _is_space(*token)){
+					token++;
+				}
+				const char* token_end = token;
+				while(token_end < line_end && _is_space(*token_end) == false){
+					token_end++;
+				}
+				if(token < token_end){
+					token_ids.push_back(_intern_token(token, token_end));
+				}
+				token = token_end;
+			}
+			line = line_end + 1;
+			if(token_ids.size() == 0){
+				if(_blank_line_policy == BLANK_LINE_STOP){
+					break;
+				}
+				continue;
+			}
+			_add_token_ids_to_corpus(token_ids);
+			// 読み終えたページを手放してメモリ使用量を抑える
+			if(line - released >= CORPUS_RELEASE_INTERVAL){
+				size_t length = (line - released) / page_size * page_size;
+				madvise(const_cast<char*>(released), length, MADV_DONTNEED);
+				released += length;
 			}
-			sentence_vec.push_back(sentence_str);
 		}
-		for(std::wstring &sentence_str: sentence_vec){
-			std::vector<std::wstring> word_str_vec;
-			utils::split_word_by(sentence_str, L' ', word_str_vec);	// スペースで分割
-			_add_words_to_corpus(word_str_vec);
+		munmap(address, size);
+		return true;
+	}
+	// 初めて見た単語だけワイド文字列を作る
+	int Corpus::_intern_token(const char* begin, const char* end){
+		_token_buffer.assign(begin, end);
+		auto itr = _token_ids.find(_token_buffer);
+		if(itr != _token_ids.end()){
+			return itr->second;
 		}
+		int token_id = _token_strings.size();
+		_token_ids[_token_buffer] = token_id;
+		_token_strings.push_back(std::wstring());
+		utils::utf8_to_wstring(begin, end, _token_strings.back());
+		_token_counts.push_back(0);
+		return token_id;
 	}
-	void Corpus::_before_python_add_sentence_str(boost::python::list &py_word_str_list, std::vector<std::wstring> &word_str_vec){
+	void Corpus::python_add_words(boost::python::list py_word_str_list){
 		int num_words = boost::python::len(py_word_str_list);
+		std::vector<int> token_ids;
+		std::string utf8;
 		for(int i = 0;i < num_words;i++){
 			std::wstring word = boost::python::extract<std::wstring>(py_word_str_list[i]);
-			word_str_vec.push_back(word);
+			utils::wstring_to_utf8(word, utf8);
+			token_ids.push_back(_intern_token(utf8.data(), utf8.data() + utf8.size()));
 		}
+		_add_token_ids_to_corpus(token_ids);
 	}
-	void Corpus::python_add_words(boost::python::list py_word_str_list){
-		std::vector<std::wstring> word_str_vec;
-		_before_python_add_sentence_str(py_word_str_list, word_str_vec);
-		_add_words_to_corpus(word_str_vec);
-	}
-	void Corpus::_add_words_to_corpus(std::vector<std::wstring> &word_str_vec){
-		assert(word_str_vec.size() > 0);
+	void Corpus::_add_token_ids_to_corpus(std::vector<int> &token_ids){
+		assert(token_ids.size() > 0);
 		// 頻度をカウント
-		for(std::wstring word_str: word_str_vec){
-			auto itr = _word_count.find(word_str);
-			if(itr == _word_count.end()){
-				_word_count[word_str] = 1;
-				continue;
-			}
-			_word_count[word_str] += 1;
+		for(int token_id: token_ids){
+			_token_counts[token_id] += 1;
 		}
 		// コーパスに追加
-		_word_sequences.push_back(word_str_vec);
+		_word_sequences.push_back(token_ids);
 		// 行あたりの最大単語数を更新
-		if((int)word_str_vec.size() > _max_num_words_in_line){
-			_max_num_words_in_line = word_str_vec.size();
+		if((int)token_ids.size() > _max_num_words_in_line){
+			_max_num_words_in_line = token_ids.size();
+		}
+		if((int)token_ids.size() < _min_num_words_in_line || _min_num_words_in_line == -1){
+			_min_num_words_in_line = token_ids.size();
+		}
+	}
+	bool Corpus::save_binary(std::string filename){
+		int num_types = _token_strings.size();
+		std::vector<const std::string*> utf8_of_token(num_types, NULL);
+		for(const auto &pair: _token_ids){
+			utf8_of_token[pair.second] = &pair.first;
+		}
+		std::vector<uint64_t> type_offsets;
+		std::string strings;
+		type_offsets.push_back(0);
+		for(int token_id = 0;token_id < num_types;token_id++){
+			strings += *utf8_of_token[token_id];
+			type_offsets.push_back(strings.size());
 		}
-		if((int)word_str_vec.size() < _min_num_words_in_line || _min_num_words_in_line == -1){
-			_min_num_words_in_line = word_str_vec.size();
+		std::vector<int> tokens;
+		std::vector<uint64_t> sentence_offsets;
+		sentence_offsets.push_back(0);
+		for(const std::vector<int> &token_ids: _word_sequences){
+			tokens.insert(tokens.end(), token_ids.begin(), token_ids.end());
+			sentence_offsets.push_back(tokens.size());
 		}
+		return corpus_file::write(filename, type_offsets, strings, _token_counts, tokens, sentence_offsets);
 	}
 	int Corpus::get_num_words(){
-		return _word_count.size();
+		return _token_strings.size();
 	}
 	int Corpus::get_count_of_word(std::wstring word_str){
-		auto itr = _word_count.find(word_str);
-		if(itr == _word_count.end()){
+		std::string utf8;
+		utils::wstring_to_utf8(word_str, utf8);
+		auto itr = _token_ids.find(utf8);
+		if(itr == _token_ids.end()){
 			return 0;
 		}
-		return itr->second;
+		return _token_counts[itr->second];
 	}
 }
\ No newline at end of file
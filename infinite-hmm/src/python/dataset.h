@@ -1,8 +1,9 @@
 #pragma once
 #include <boost/python.hpp>
+#include <string>
 #include <unordered_map>
 #include <vector>
-#include "../ihmm/common.h"
+#include "../ihmm/sequences.h"
 #include "corpus.h"
 #include "dictionary.h"
 
@@ -10,15 +11,17 @@ namespace ihmm {
 	class Dataset{
 	private:
 		void _before_python_add_sentence_str(boost::python::list &py_word_str_list, std::vector<std::wstring> &word_str_vec);
-		void _add_words_to_dataset(std::vector<std::wstring> &word_str_vec, std::vector<std::vector<Word*>> &dataset, Corpus* corpus, int unknown_count);
-		void _mark_low_frequency_words_as_unknown(int threshold, std::vector<std::vector<Word*>> &word_sequence_vec);
+		void _add_words_to_dataset(const int* token_ids, int num_tokens, WordSequences &dataset, std::vector<int> &word_id_of_token);
+		void _split_indices(int num_sentences, double train_split, int seed, std::vector<int> &rand_indices, int &num_train_data);
 	public:
 		Dictionary* _dict;
-		std::vector<std::vector<Word*>> _word_sequences_train;
-		std::vector<std::vector<Word*>> _word_sequences_dev;
+		WordSequences _word_sequences_train;
+		WordSequences _word_sequences_dev;
 		int _max_num_words_in_line;
 		int _min_num_words_in_line;
 		Dataset(Corpus* corpus, double train_split, int unknown_count, int seed);
+		// 単語分割済みのコーパスの独自バイナリ形式から読み込む
+		Dataset(std::string filename, double train_split, int unknown_count, int seed);
 		~Dataset();
 		int get_num_words();
 		Dictionary &get_dict_obj();
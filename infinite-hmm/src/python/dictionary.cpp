@@ -1,50 +1,178 @@
 #include <boost/serialization/serialization.hpp>
-#include <boost/serialization/base_object.hpp>
 #include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/unordered_map.hpp>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
 #include <fstream>
 #include <cassert>
+#include <unordered_map>
+#include "../ihmm/utils.h"
 #include "dictionary.h"
 
 namespace ihmm {
+	static uint64_t _hash_string(const wchar_t* str, size_t length){
+		uint64_t hash = 14695981039346656037ULL;	// FNV-1a
+		for(size_t i = 0;i < length;i++){
+			hash ^= (uint32_t)str[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+	// 使用率が1/2以下になる2の累乗
+	static size_t _num_slots_for(size_t num_words){
+		size_t num_slots = 16;
+		while(num_slots < num_words * 2){
+			num_slots *= 2;
+		}
+		return num_slots;
+	}
+	static size_t _align(size_t offset){
+		return (offset + DICTIONARY_FILE_ALIGNMENT - 1) / DICTIONARY_FILE_ALIGNMENT * DICTIONARY_FILE_ALIGNMENT;
+	}
 	Dictionary::Dictionary(){
-		_id_to_str[ID_UNK] = L"<unk>";
-		_str_to_id[L"<unk>"] = ID_UNK;
-		_autoincrement = ID_UNK + 1;
+		_address = NULL;
+		_num_bytes = 0;
+		_offset_buffer.push_back(0);
+		_slot_buffer.assign(_num_slots_for(1), -1);
+		_update_views();
+		int word_id = add_word_string(L"<unk>");
+		assert(word_id == ID_UNK);
+	}
+	Dictionary::~Dictionary(){
+		_unmap();
+	}
+	void Dictionary::_update_views(){
+		_chars = _char_buffer.data();
+		_offsets = _offset_buffer.data();
+		_slots = _slot_buffer.data();
+		_num_words = _offset_buffer.size() - 1;
+		_num_slots = _slot_buffer.size();
+	}
+	// mmapした辞書を書き換える前に自前の配列に移す
+	void Dictionary::_detach(){
+		if(_address == NULL){
+			return;
+		}
+		_char_buffer.assign(_chars, _chars + _offsets[_num_words]);
+		_offset_buffer.assign(_offsets, _offsets + _num_words + 1);
+		_slot_buffer.assign(_slots, _slots + _num_slots);
+		_unmap();
+		_update_views();
+	}
+	void Dictionary::_unmap(){
+		if(_address != NULL){
+			munmap(_address, _num_bytes);
+		}
+		_address = NULL;
+		_num_bytes = 0;
+	}
+	void Dictionary::_append_string(const wchar_t* str, size_t length){
+		assert(_address == NULL);
+		_char_buffer.insert(_char_buffer.end(), str, str + length);
+		_offset_buffer.push_back(_char_buffer.size());
+		_update_views();
+	}
+	// 文字列が同じ単語があればそのスロット、なければ空きスロット
+	size_t Dictionary::_find_slot(const wchar_t* str, size_t length) const {
+		size_t mask = _num_slots - 1;
+		size_t k = _hash_string(str, length) & mask;
+		while(true){
+			int word_id = _slots[k];
+			if(word_id == -1){
+				return k;
+			}
+			uint64_t begin = _offsets[word_id];
+			if(_offsets[word_id + 1] - begin == length && std::wmemcmp(_chars + begin, str, length) == 0){
+				return k;
+			}
+			k = (k + 1) & mask;
+		}
+	}
+	// 同じ文字列の単語が既にあれば先に登録した単語IDを残す
+	void Dictionary::_rehash(size_t num_slots){
+		assert(_address == NULL);
+		_slot_buffer.assign(num_slots, -1);
+		_update_views();
+		for(int word_id = 0;word_id < _num_words;word_id++){
+			uint64_t begin = _offsets[word_id];
+			size_t k = _find_slot(_chars + begin, _offsets[word_id + 1] - begin);
+			if(_slot_buffer[k] == -1){
+				_slot_buffer[k] = word_id;
+			}
+		}
 	}
 	int Dictionary::add_word_string(std::wstring word){
-		auto itr = _str_to_id.find(word);
-		if(itr == _str_to_id.end()){
-			_id_to_str[_autoincrement] = word;
-			_str_to_id[word] = _autoincrement;
-			_autoincrement++;
-			return _autoincrement - 1;
+		size_t k = _find_slot(word.data(), word.size());
+		if(_slots[k] != -1){
+			return _slots[k];
 		}
-		return itr->second;
+		_detach();
+		_append_string(word.data(), word.size());
+		int word_id = _num_words - 1;
+		if((size_t)_num_words * 2 > _num_slots){
+			_rehash(_num_slots * 2);
+		}else{
+			_slot_buffer[k] = word_id;
+		}
+		return word_id;
 	}
 	int Dictionary::string_to_word_id(std::wstring word){
-		auto itr = _str_to_id.find(word);
-		if(itr == _str_to_id.end()){
+		size_t k = _find_slot(word.data(), word.size());
+		if(_slots[k] == -1){
 			return ID_UNK;
 		}
-		return itr->second;
+		return _slots[k];
+	}
+	boost::python::object Dictionary::python_string_to_word_ids(boost::python::object py_word_str_list){
+		int num_words = boost::python::len(py_word_str_list);
+		std::vector<int> word_ids(num_words);
+		for(int i = 0;i < num_words;i++){
+			std::wstring word = boost::python::extract<std::wstring>(py_word_str_list[i]);
+			word_ids[i] = string_to_word_id(word);
+		}
+		return utils::int_array_from_vector(word_ids);
 	}
 	std::wstring Dictionary::word_id_to_string(int word_id){
-		auto itr = _id_to_str.find(word_id);
-		assert(itr != _id_to_str.end());
-		return itr->second;
+		assert(0 <= word_id && word_id < _num_words);
+		uint64_t begin = _offsets[word_id];
+		return std::wstring(_chars + begin, _offsets[word_id + 1] - begin);
 	}
 	// <unk>に置き換える
 	void Dictionary::remove_ids(std::unordered_set<int> word_ids){
-		for(int word_id: word_ids){
-			std::wstring word = word_id_to_string(word_id);
-			_id_to_str[word_id] = L"<unk>";
-			_str_to_id[word] = ID_UNK;
+		_detach();
+		std::vector<wchar_t> chars;
+		std::vector<uint64_t> offsets;
+		chars.swap(_char_buffer);
+		offsets.swap(_offset_buffer);
+		_offset_buffer.push_back(0);
+		_update_views();
+		std::wstring unk = L"<unk>";
+		int num_words = offsets.size() - 1;
+		for(int word_id = 0;word_id < num_words;word_id++){
+			if(word_ids.find(word_id) == word_ids.end()){
+				_append_string(chars.data() + offsets[word_id], offsets[word_id + 1] - offsets[word_id]);
+			}else{
+				_append_string(unk.data(), unk.size());
+			}
+		}
+		_rehash(_num_slots);
+	}
+	void Dictionary::shrink_to_fit(){
+		_char_buffer.shrink_to_fit();
+		_offset_buffer.shrink_to_fit();
+		_slot_buffer.shrink_to_fit();
+		if(_address == NULL){
+			_update_views();
 		}
 	}
 	int Dictionary::get_vocabrary_size(){
-		return _str_to_id.size();
+		return _num_words;
 	}
 	bool Dictionary::is_string_unk(std::wstring word){
 		int word_id = string_to_word_id(word);
@@ -54,25 +182,157 @@ namespace ihmm {
 		return (word_id == ID_UNK);
 	}
 	bool Dictionary::load(std::string filename){
-		std::string dictionary_filename = filename;
-		std::ifstream ifs(dictionary_filename);
-		if(ifs.good()){
-			boost::archive::binary_iarchive iarchive(ifs);
-			iarchive >> _id_to_str;
-			iarchive >> _str_to_id;
-			iarchive >> _autoincrement;
-			ifs.close();
-			return true;
-		}
-		return false;
+		std::ifstream ifs(filename, std::ios::binary);
+		if(ifs.good() == false){
+			return false;
+		}
+		char magic[sizeof(DICTIONARY_FILE_MAGIC)] = {0};
+		ifs.read(magic, sizeof(magic));
+		ifs.close();
+		if(std::memcmp(magic, DICTIONARY_FILE_MAGIC, sizeof(magic)) == 0){
+			return _load_binary(filename);
+		}
+		return _load_archive(filename);
+	}
+	// 表がファイルに収まっていればその先頭を返す
+	static const char* _get_section(const char* base, size_t num_bytes, uint64_t offset, uint64_t num_elements, size_t element_size){
+		if(offset % DICTIONARY_FILE_ALIGNMENT != 0 || offset > num_bytes){
+			return NULL;
+		}
+		if(num_elements > (num_bytes - offset) / element_size){
+			return NULL;	// 途中で切れたファイル
+		}
+		return base + offset;
 	}
+	bool Dictionary::_load_binary(std::string filename){
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if(fd < 0){
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DictionaryFileHeader)){
+			::close(fd);
+			return false;
+		}
+		void* address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);	// 対応付けはファイルを閉じても残る
+		if(address == MAP_FAILED){
+			return false;
+		}
+		// 全て検査してから差し替える. 失敗しても今の辞書はそのまま
+		const char* base = static_cast<const char*>(address);
+		size_t num_bytes = st.st_size;
+		const DictionaryFileHeader* header = reinterpret_cast<const DictionaryFileHeader*>(base);
+		bool valid = header->byte_order == DICTIONARY_FILE_BYTE_ORDER && header->version <= DICTIONARY_FILE_VERSION
+			&& header->header_size == sizeof(DictionaryFileHeader) && header->char_size == sizeof(wchar_t)
+			&& header->num_words > 0 && header->num_words <= INT_MAX
+			&& header->num_slots > header->num_words && (header->num_slots & (header->num_slots - 1)) == 0;
+		const uint64_t* offsets = NULL;
+		const wchar_t* chars = NULL;
+		const int* slots = NULL;
+		if(valid){
+			offsets = reinterpret_cast<const uint64_t*>(_get_section(base, num_bytes, header->offsets_offset, header->num_words + 1, sizeof(uint64_t)));
+			chars = reinterpret_cast<const wchar_t*>(_get_section(base, num_bytes, header->chars_offset, header->num_chars, sizeof(wchar_t)));
+			slots = reinterpret_cast<const int*>(_get_section(base, num_bytes, header->slots_offset, header->num_slots, sizeof(int)));
+			valid = offsets != NULL && chars != NULL && slots != NULL;
+		}
+		if(valid){
+			valid = offsets[0] == 0 && offsets[header->num_words] == header->num_chars;
+			for(uint64_t word_id = 0;valid && word_id < header->num_words;word_id++){
+				valid = offsets[word_id] <= offsets[word_id + 1];
+			}
+		}
+		if(valid){
+			// 空きが1つもないと探索が終わらない
+			bool has_empty_slot = false;
+			for(uint64_t k = 0;valid && k < header->num_slots;k++){
+				valid = -1 <= slots[k] && slots[k] < (int64_t)header->num_words;
+				has_empty_slot |= slots[k] == -1;
+			}
+			valid = valid && has_empty_slot;
+		}
+		if(valid == false){
+			munmap(address, num_bytes);
+			return false;
+		}
+		_unmap();
+		std::vector<wchar_t>().swap(_char_buffer);
+		std::vector<uint64_t>().swap(_offset_buffer);
+		std::vector<int>().swap(_slot_buffer);
+		_address = address;
+		_num_bytes = num_bytes;
+		_chars = chars;
+		_offsets = offsets;
+		_slots = slots;
+		_num_words = header->num_words;
+		_num_slots = header->num_slots;
+		return true;
+	}
+	// Boost.Serializationでunordered_mapを2つ書き出していた旧形式
+	bool Dictionary::_load_archive(std::string filename){
+		std::unordered_map<int, std::wstring> id_to_str;
+		std::unordered_map<std::wstring, int> str_to_id;
+		int autoincrement;
+		std::ifstream ifs(filename);
+		if(ifs.good() == false){
+			return false;
+		}
+		boost::archive::binary_iarchive iarchive(ifs);
+		iarchive >> id_to_str;
+		iarchive >> str_to_id;
+		iarchive >> autoincrement;
+		ifs.close();
+		_unmap();
+		_char_buffer.clear();
+		_offset_buffer.assign(1, 0);
+		_update_views();
+		std::wstring unk = L"<unk>";
+		for(int word_id = 0;word_id < autoincrement;word_id++){
+			auto itr = id_to_str.find(word_id);
+			const std::wstring &word = (itr == id_to_str.end()) ? unk : itr->second;
+			_append_string(word.data(), word.size());
+		}
+		_rehash(_num_slots_for(_num_words));
+		return true;
+	}
+	// 一時ファイルに書いてから置き換えるので、途中で落ちても元のファイルは壊れない
 	bool Dictionary::save(std::string filename){
-		std::ofstream ofs(filename);
-		boost::archive::binary_oarchive oarchive(ofs);
-		oarchive << _id_to_str;
-		oarchive << _str_to_id;
-		oarchive << _autoincrement;
+		static_assert(sizeof(int) == 4, "word ids are stored as int32");
+		static_assert(sizeof(DICTIONARY_FILE_MAGIC) == sizeof(((DictionaryFileHeader*)0)->magic), "magic must be 8 bytes");
+		DictionaryFileHeader header;
+		std::memset(&header, 0, sizeof(DictionaryFileHeader));
+		std::memcpy(header.magic, DICTIONARY_FILE_MAGIC, sizeof(header.magic));
+		header.version = DICTIONARY_FILE_VERSION;
+		header.byte_order = DICTIONARY_FILE_BYTE_ORDER;
+		header.header_size = sizeof(DictionaryFileHeader);
+		header.char_size = sizeof(wchar_t);
+		header.num_words = _num_words;
+		header.num_chars = _offsets[_num_words];
+		header.num_slots = _num_slots;
+		size_t offset = _align(sizeof(DictionaryFileHeader));
+		header.offsets_offset = offset;
+		offset = _align(offset + (header.num_words + 1) * sizeof(uint64_t));
+		header.chars_offset = offset;
+		offset = _align(offset + header.num_chars * sizeof(wchar_t));
+		header.slots_offset = offset;
+		std::string tmp_filename = filename + ".tmp";
+		std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+		if(ofs.good() == false){
+			return false;
+		}
+		char padding[DICTIONARY_FILE_ALIGNMENT] = {0};
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(DictionaryFileHeader));
+		ofs.write(padding, header.offsets_offset - sizeof(DictionaryFileHeader));
+		ofs.write(reinterpret_cast<const char*>(_offsets), (header.num_words + 1) * sizeof(uint64_t));
+		ofs.write(padding, header.chars_offset - header.offsets_offset - (header.num_words + 1) * sizeof(uint64_t));
+		ofs.write(reinterpret_cast<const char*>(_chars), header.num_chars * sizeof(wchar_t));
+		ofs.write(padding, header.slots_offset - header.chars_offset - header.num_chars * sizeof(wchar_t));
+		ofs.write(reinterpret_cast<const char*>(_slots), header.num_slots * sizeof(int));
 		ofs.close();
-		return true;
+		if(ofs.fail()){
+			std::remove(tmp_filename.c_str());
+			return false;
+		}
+		return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
 	}
-}
\ No newline at end of file
+}
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <thread>
 #include <set>
 #include "../ihmm/utils.h"
 #include "model.h"
@@ -53,8 +54,9 @@ namespace ihmm {
 	}
 	// 文の確率
 	// 前向きアルゴリズム
-	double Model::compute_p_sentence(std::vector<Word*> &sentence, double** forward_table){
+	double Model::compute_p_sentence(Sentence &sentence, double** forward_table){
 		assert(sentence.size() > 2);	// <s>と</s>
+		int* word_ids = sentence._word_ids;
 		int tag_bos = 0;	// <s>
 		for(int ti = 1;ti <= _hmm->get_num_tags();ti++){
 			if(_hmm->is_tag_new(ti)){
@@ -62,7 +64,7 @@ namespace ihmm {
 				continue;
 			}
 			int ti_1 = tag_bos;	// <s>
-			int wi = sentence[1]->_id;
+			int wi = word_ids[1];
 			double p_transition = _hmm->compute_p_tag_given_context(ti, ti_1);
 			double p_emission = _hmm->compute_p_word_given_tag(wi, ti);
 			assert(p_transition > 0);
@@ -75,7 +77,7 @@ namespace ihmm {
 					forward_table[i][ti] = 0;
 					continue;
 				}
-				int wi = sentence[i]->_id;
+				int wi = word_ids[i];
 				double p_emission = _hmm->compute_p_word_given_tag(wi, ti);
 				assert(p_emission > 0);
 				forward_table[i][ti] = 0;
@@ -124,47 +126,124 @@ namespace ihmm {
 		double** forward_table = NULL;
 		double** decode_table = NULL;
 		_alloc_viterbi_tables(num_words + 2, forward_table, decode_table);
-		// Python側から渡された単語IDリストを変換
-		std::vector<Word*> sentence;
-		// <s>をセット
-		Word* bos = new Word();
-		bos->_tag = 0;
-		sentence.push_back(bos);
+		// Python側から渡された単語IDリストを<s>と</s>で挟む
+		std::vector<int> word_ids(num_words + 2, 0);
 		for(int i = 0;i < num_words;i++){
-			Word* word = new Word();
-			word->_id = boost::python::extract<int>(py_word_ids[i]);
-			word->_tag = 0;
-			sentence.push_back(word);
+			word_ids[i + 1] = boost::python::extract<int>(py_word_ids[i]);
 		}
-		// </s>をセット
-		Word* eos = new Word();
-		eos->_tag = 0;
-		sentence.push_back(eos);
 		// ビタビアルゴリズム
 		std::vector<int> sampled_state_sequence;
-		viterbi_decode(sentence, sampled_state_sequence, forward_table, decode_table);
+		viterbi_decode(word_ids.data(), word_ids.size(), sampled_state_sequence, forward_table, decode_table);
 		// 結果を返す
 		boost::python::list result;
 		for(int i = 0;i < sampled_state_sequence.size();i++){
 			result.append(sampled_state_sequence[i]);
 		}
 		_free_viterbi_tables(num_words + 2, forward_table, decode_table);
-		for(int i = 0;i < sentence.size();i++){
-			delete sentence[i];
-		}
 		return result;
 	}
+	// 複数の文をまとめて復号する
+	// word_idsは全ての文の単語IDを<s>と</s>なしで連結したもので、n番目の文は[offsets[n], offsets[n + 1])
+	// 結果はword_idsと同じ位置に品詞を書き込んだ配列で返す
+	boost::python::object Model::python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads){
+		std::vector<int> word_ids = utils::int_vector_from_object(py_word_ids);
+		std::vector<int> offsets = utils::int_vector_from_object(py_offsets);
+		// GILを解放した後の各スレッドは範囲を確かめずに読むので、ここで全て確かめておく
+		if(num_threads <= 0){
+			PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+			boost::python::throw_error_already_set();
+		}
+		if(offsets.size() == 0 || offsets.front() != 0 || (size_t)offsets.back() != word_ids.size()){
+			PyErr_SetString(PyExc_ValueError, "offsets must start at 0 and end at the number of word ids");
+			boost::python::throw_error_already_set();
+		}
+		for(size_t n = 0;n + 1 < offsets.size();n++){
+			if(offsets[n] > offsets[n + 1]){
+				PyErr_SetString(PyExc_ValueError, "offsets must be non-decreasing");
+				boost::python::throw_error_already_set();
+			}
+		}
+		for(int word_id: word_ids){
+			if(word_id < 0 || word_id >= _hmm->get_num_words()){
+				std::string message = "word id " + std::to_string(word_id) + " is out of range";
+				PyErr_SetString(PyExc_ValueError, message.c_str());
+				boost::python::throw_error_already_set();
+			}
+		}
+		std::vector<int> tags(word_ids.size(), 0);
+		// 復号中はPythonのオブジェクトに触れないのでGILを解放する
+		PyThreadState* thread_state = PyEval_SaveThread();
+		viterbi_decode_batch(word_ids.data(), offsets.data(), offsets.size() - 1, tags.data(), num_threads);
+		PyEval_RestoreThread(thread_state);
+		return utils::int_array_from_vector(tags);
+	}
+	// 文の長さがばらつくので各スレッドは終わり次第次の文を取りに行く
+	void Model::viterbi_decode_batch(const int* word_ids, const int* offsets, int num_sentences, int* tags, int num_threads){
+		assert(num_threads > 0);
+		std::atomic<int> next_sentence(0);
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < num_threads;thread_id++){
+			threads.push_back(std::thread(&Model::_viterbi_decode_batch_worker, this, word_ids, offsets, num_sentences, tags, &next_sentence));
+		}
+		_viterbi_decode_batch_worker(word_ids, offsets, num_sentences, tags, &next_sentence);
+		for(auto &thread: threads){
+			thread.join();
+		}
+	}
+	// テーブルはスレッドごとに持ち、それまでで最も長い文に合わせて確保し直す
+	void Model::_viterbi_decode_batch_worker(const int* word_ids, const int* offsets, int num_sentences, int* tags, std::atomic<int>* next_sentence){
+		double** forward_table = NULL;
+		double** decode_table = NULL;
+		int table_length = 0;
+		std::vector<int> sentence;
+		std::vector<int> sampled_state_sequence;
+		while(true){
+			int n = next_sentence->fetch_add(1);
+			if(n >= num_sentences){
+				break;
+			}
+			int begin = offsets[n];
+			int num_words = offsets[n + 1] - begin;
+			assert(num_words >= 0);
+			if(num_words == 0){
+				continue;
+			}
+			if(num_words + 2 > table_length){
+				if(table_length > 0){
+					_free_viterbi_tables(table_length, forward_table, decode_table);
+				}
+				table_length = num_words + 2;
+				_alloc_viterbi_tables(table_length, forward_table, decode_table);
+			}
+			sentence.assign(num_words + 2, 0);
+			for(int i = 0;i < num_words;i++){
+				sentence[i + 1] = word_ids[begin + i];
+			}
+			viterbi_decode(sentence.data(), sentence.size(), sampled_state_sequence, forward_table, decode_table);
+			for(int i = 0;i < num_words;i++){
+				tags[begin + i] = sampled_state_sequence[i];
+			}
+		}
+		if(table_length > 0){
+			_free_viterbi_tables(table_length, forward_table, decode_table);
+		}
+	}
 	// 状態系列の復号
 	// ビタビアルゴリズム
-	void Model::viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence){
+	void Model::viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence){
 		double** forward_table = NULL;
 		double** decode_table = NULL;
 		_alloc_viterbi_tables(sentence.size(), forward_table, decode_table);
 		viterbi_decode(sentence, sampled_state_sequence, forward_table, decode_table);
 		_free_viterbi_tables(sentence.size(), forward_table, decode_table);
 	}
-	void Model::viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table){
-		assert(sentence.size() > 2);	// <s>と</s>
+	// 単語ID列は<s>と</s>を含めて並んでいるのでそのまま渡す
+	void Model::viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table){
+		viterbi_decode(sentence._word_ids, sentence.size(), sampled_state_sequence, forward_table, decode_table);
+	}
+	// word_idsは<s>と</s>を含む
+	void Model::viterbi_decode(const int* word_ids, int sentence_length, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table){
+		assert(sentence_length > 2);	// <s>と</s>
 		int tag_bos = 0;	// <s>
 		for(int ti = 1;ti <= _hmm->get_num_tags();ti++){
 			if(_hmm->is_tag_new(ti)){
@@ -172,7 +251,7 @@ namespace ihmm {
 				continue;
 			}
 			int ti_1 = tag_bos;	// <s>
-			int wi = sentence[1]->_id;
+			int wi = word_ids[1];
 			double p_transition = _hmm->compute_p_tag_given_context(ti, ti_1);
 			double p_emission = _hmm->compute_p_word_given_tag(wi, ti);
 			assert(p_transition > 0);
@@ -182,14 +261,14 @@ namespace ihmm {
 			}
 			forward_table[1][ti] = log_p_emission + log(p_transition);
 		}
-		for(int i = 2;i < sentence.size() - 1;i++){
+		for(int i = 2;i < sentence_length - 1;i++){
 			for(int ti = 1;ti <= _hmm->get_num_tags();ti++){
 				if(_hmm->is_tag_new(ti)){
 					forward_table[i][ti] = -1000000;
 					decode_table[i][ti] = 0;
 					continue;
 				}
-				int wi = sentence[i]->_id;
+				int wi = word_ids[i];
 				double p_emission = _hmm->compute_p_word_given_tag(wi, ti);
 				double log_p_emission = -1000000;
 				if(p_emission > 0){
@@ -207,7 +286,7 @@ namespace ihmm {
 				}
 			}
 		}
-		int i = sentence.size() - 2;
+		int i = sentence_length - 2;
 		double max_p_x_s = 0;
 		double argmax_ti = 0;
 		for(int ti = 1;ti <= _hmm->get_num_tags();ti++){
@@ -221,14 +300,14 @@ namespace ihmm {
 		sampled_state_sequence.clear();
 		sampled_state_sequence.push_back(argmax_ti);
 		int ti = argmax_ti;
-		for(int i = sentence.size() - 2;i >= 2;i--){
+		for(int i = sentence_length - 2;i >= 2;i--){
 			int ti_1 = decode_table[i][ti];
 			assert(1 <= ti_1 && ti_1 <= _hmm->get_num_tags());
 			sampled_state_sequence.push_back(ti_1);
 			ti = ti_1;
 		}
 		std::reverse(sampled_state_sequence.begin(), sampled_state_sequence.end());
-		assert(sampled_state_sequence.size() == sentence.size() - 2);
+		assert(sampled_state_sequence.size() == sentence_length - 2);
 	}
 	struct value_comparator {
 		bool operator()(const std::pair<int, int> &a, const std::pair<int, int> &b) {
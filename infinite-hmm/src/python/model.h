@@ -1,5 +1,6 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
 #include <string>
 #include "../ihmm/ihmm.h"
 #include "dataset.h"
@@ -11,6 +12,7 @@ namespace ihmm {
 		void _alloc_viterbi_tables(int sentence_length, double** &forward_table, double** &decode_table);
 		void _free_viterbi_tables(int sentence_length, double** &forward_table, double** &decode_table);
 		void _set_locale();
+		void _viterbi_decode_batch_worker(const int* word_ids, const int* offsets, int num_sentences, int* tags, std::atomic<int>* next_sentence);
 	public:
 		InfiniteHMM* _hmm;
 		Model(int num_initial_tags, Dataset* dataset);
@@ -23,11 +25,14 @@ namespace ihmm {
 		void set_initial_gamma(double gamma);
 		void set_initial_gamma_emission(double gamma_emission);
 		void set_initial_beta_emission(double beta_emission);
-		void viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence);
-		void viterbi_decode(std::vector<Word*> &sentence, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table);
+		void viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence);
+		void viterbi_decode(Sentence &sentence, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table);
+		void viterbi_decode(const int* word_ids, int sentence_length, std::vector<int> &sampled_state_sequence, double** forward_table, double** decode_table);
 		boost::python::list python_viterbi_decode(boost::python::list py_word_ids);
+		void viterbi_decode_batch(const int* word_ids, const int* offsets, int num_sentences, int* tags, int num_threads);
+		boost::python::object python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads);
 		boost::python::list python_get_valid_tags();
-		double compute_p_sentence(std::vector<Word*> &sentence, double** forward_table);
+		double compute_p_sentence(Sentence &sentence, double** forward_table);
 		void print_typical_words_assigned_to_each_tag(int number_to_show, Dictionary* dict);
 	};
 }
\ No newline at end of file
@@ -9,25 +9,63 @@ namespace ihmm {
 		_model = model;
 		_dict = dataset->_dict;
 		_dataset = dataset;
+		_log_p_joint = 0;
+		_checkpoint_pending = false;
+		_checkpoint_succeeded = true;
+	}
+	Trainer::~Trainer(){
+		if(_checkpoint_thread.joinable()){
+			_checkpoint_thread.join();
+		}
 	}
 	void Trainer::gibbs(){
-		std::vector<std::vector<Word*>> &dataset = _dataset->_word_sequences_train;
+		WordSequences &dataset = _dataset->_word_sequences_train;
 		if(_rand_indices.size() != dataset.size()){
 			_rand_indices.clear();
 			for(int data_index = 0;data_index < dataset.size();data_index++){
 				_rand_indices.push_back(data_index);
 			}
 		}
-		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::mt);	// データをシャッフル
+		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::rng);	// データをシャッフル
+		_previous_tags.assign(dataset._tags.begin(), dataset._tags.end());
+		_model->_hmm->_log_p_joint_delta = 0;
 		for(int n = 0;n < dataset.size();n++){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return;
 			}
 			int data_index = _rand_indices[n];
-			std::vector<Word*> &word_vec = dataset[data_index];
-			_model->_hmm->gibbs(word_vec);
+			Sentence sentence = dataset.get_sentence(data_index);
+			_model->_hmm->gibbs(sentence);
 			
 		}
+		// 同時確率は全体を計算し直さずにサンプリング中に足した差分だけを追う
+		size_t num_changed = 0;
+		for(size_t i = 0;i < _previous_tags.size();i++){
+			num_changed += (_previous_tags[i] != dataset._tags[i]);
+		}
+		size_t num_words = dataset.get_num_tokens() - (size_t)dataset.size() * IHMM_NUM_SENTINELS * 2;
+		_log_p_joint += _model->_hmm->_log_p_joint_delta;
+		_convergence.add_epoch((num_words > 0) ? num_changed / (double)num_words : 0, _log_p_joint);
+	}
+	// 直近window個のエポックで品詞が変わった割合の前半と後半の平均の差がtolerance以下で、
+	// 同時確率のsplit-R̂がmax_r_hat以下なら収束とみなす
+	void Trainer::set_convergence_criteria(int window, double tolerance, double max_r_hat){
+		_convergence.set_criteria(window, tolerance, max_r_hat);
+	}
+	bool Trainer::converged(){
+		return _convergence.converged();
+	}
+	// 直前のエポックで品詞が変わった単語の割合
+	double Trainer::get_changed_fraction(){
+		return _convergence.get_changed_fraction();
+	}
+	// 最初のエポックの前を0とした同時確率の対数
+	double Trainer::get_log_p_joint(){
+		return _convergence.get_log_p();
+	}
+	// エポックが足りなければ-1
+	double Trainer::get_split_r_hat(){
+		return _convergence.compute_split_r_hat();
 	}
 	void Trainer::update_hyperparameters(){
 		// double old_log_p_x = _sample_new_alpha();
@@ -163,7 +201,7 @@ namespace ihmm {
 	double Trainer::compute_log_p_dataset_dev(){
 		return _compute_log_p_dataset(_dataset->_word_sequences_dev);
 	}
-	double Trainer::_compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset){
+	double Trainer::_compute_log_p_dataset(WordSequences &dataset){
 		_before_compute_log_p_dataset();
 		// データごとの対数尤度を足していく
 		double log_p_dataset = 0;
@@ -171,7 +209,7 @@ namespace ihmm {
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return 0;
 			}
-			std::vector<Word*> &sentence = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
 			double p_x = _model->compute_p_sentence(sentence, _forward_table);
 			if(p_x > 0){
 				log_p_dataset += log(p_x);
@@ -182,5 +220,36 @@ namespace ihmm {
 	}
 	void Trainer::set_model(Model* model){
 		_model = model;
+		_convergence.clear();
+		_log_p_joint = 0;
+	}
+	// 現在のモデルをメモリ上に書き出してから別スレッドでファイルに書く
+	// 書き出している間もサンプリングを続けられる. 前の保存が終わっていなければ先に待つ
+	bool Trainer::save_async(std::string filename){
+		wait_for_save();
+		_model->_hmm->save_to_string(_checkpoint);
+		_checkpoint_pending = true;
+		_checkpoint_thread = std::thread(&Trainer::_write_checkpoint, this, filename);
+		return true;
+	}
+	void Trainer::_write_checkpoint(std::string filename){
+		_checkpoint_succeeded = utils::write_file_atomically(filename, _checkpoint);
+		_checkpoint_pending = false;
+	}
+	bool Trainer::is_saving(){
+		return _checkpoint_pending;
+	}
+	// 保存中なら終わるまで待ち、最後の保存が成功したかを返す
+	bool Trainer::wait_for_save(){
+		if(_checkpoint_thread.joinable() == false){
+			return _checkpoint_succeeded;
+		}
+		// 書き出しはPythonのオブジェクトに触れないので待つ間はGILを解放する
+		PyThreadState* thread_state = (Py_IsInitialized() && PyGILState_Check()) ? PyEval_SaveThread() : NULL;
+		_checkpoint_thread.join();
+		if(thread_state != NULL){
+			PyEval_RestoreThread(thread_state);
+		}
+		return _checkpoint_succeeded;
 	}
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "../ihmm/convergence.h"
 #include "model.h"
 #include "dataset.h"
 #include "dictionary.h"
@@ -11,9 +15,10 @@ namespace ihmm {
 		void _after_viterbi_decode();
 		void _before_compute_log_p_dataset();
 		void _after_compute_log_p_dataset();
-		double _compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_log2_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_perplexity(std::vector<std::vector<Word*>> &dataset);
+		double _compute_log_p_dataset(WordSequences &dataset);
+		double _compute_log2_p_dataset(WordSequences &dataset);
+		double _compute_perplexity(WordSequences &dataset);
+		void _write_checkpoint(std::string filename);
 		// double _sample_new_alpha();
 		// void _sample_new_beta(double old_log_p_x);
 		Model* _model;
@@ -22,13 +27,31 @@ namespace ihmm {
 		std::vector<int> _rand_indices;
 		double** _forward_table;		// 前向き確率計算用
 		double** _decode_table;			// viterbiデコーディング用
+		// 収束判定用
+		ConvergenceMonitor _convergence;
+		std::vector<int> _previous_tags;	// エポック開始時の品詞
+		double _log_p_joint;				// 学習を始めてからの同時確率の変化の累計
+		// 非同期保存用
+		std::string _checkpoint;		// 保存を始めた時点のモデルを書き出したもの
+		std::thread _checkpoint_thread;
+		std::atomic<bool> _checkpoint_pending;
+		bool _checkpoint_succeeded;
 	public:
 		Trainer(Dataset* dataset, Model* model);
+		~Trainer();
 		void gibbs();
+		void set_convergence_criteria(int window, double tolerance, double max_r_hat);
+		bool converged();
+		double get_changed_fraction();
+		double get_log_p_joint();
+		double get_split_r_hat();
 		void update_hyperparameters();
 		// boost::python::list python_get_all_words_of_each_tag(int threshold = 0);
 		double compute_log_p_dataset_train();
 		double compute_log_p_dataset_dev();
 		void set_model(Model* model);
+		bool save_async(std::string filename);
+		bool is_saving();
+		bool wait_for_save();
 	};
 }
\ No newline at end of file
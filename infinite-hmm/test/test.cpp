@@ -194,62 +194,14 @@ void test5(){
 }
 
 void test6(){
-	std::vector<Word*> word_vec_1;
-	{
-		Word* word = new Word();
-		word->_id = 0;
-		word->_tag = 0;
-		word_vec_1.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 1;
-		word->_tag = 1;
-		word_vec_1.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 2;
-		word->_tag = 2;
-		word_vec_1.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 0;
-		word->_tag = 0;
-		word_vec_1.push_back(word);
-	}
-	std::vector<Word*> word_vec_2;
-	{
-		Word* word = new Word();
-		word->_id = 0;
-		word->_tag = 0;
-		word_vec_2.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 3;
-		word->_tag = 3;
-		word_vec_2.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 4;
-		word->_tag = 4;
-		word_vec_2.push_back(word);
-	}
-	{
-		Word* word = new Word();
-		word->_id = 0;
-		word->_tag = 0;
-		word_vec_2.push_back(word);
-	}
-	std::vector<std::vector<Word*>> word_sequences;
+	int word_ids_1[] = {1, 2};
+	int word_ids_2[] = {3, 4};
+	WordSequences word_sequences;
 	for(int i = 0;i < 10;i++){
-		word_sequences.push_back(word_vec_1);
+		word_sequences.add_sentence(word_ids_1, 2);
 	}
 	for(int i = 0;i < 5;i++){
-		word_sequences.push_back(word_vec_2);
+		word_sequences.add_sentence(word_ids_2, 2);
 	}
 
 	InfiniteHMM* hmm = new InfiniteHMM(10, 5);
@@ -261,10 +213,10 @@ void test6(){
 	}
 
 	for(int i = 0;i < 2;i++){
-		std::vector<Word*> &word_vec = word_sequences[i];
-		hmm->gibbs(word_vec);
-		for(int i = 1;i < word_vec.size() - 1;i++){
-			cout << word_vec[i]->_tag << endl;
+		Sentence sentence = word_sequences.get_sentence(i);
+		hmm->gibbs(sentence);
+		for(int i = 1;i < sentence.size() - 1;i++){
+			cout << sentence.get_tag(i) << endl;
 		}
 	}
 }
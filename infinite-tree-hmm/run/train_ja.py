@@ -94,7 +94,14 @@ def main():
 		if epoch % 100 == 0:
 			printr("")
 			print("log_likelihood: train {} - dev {}".format(trainer.compute_log_p_dataset_train(), trainer.compute_log_p_dataset_dev()))
-			model.save(os.path.join(args.working_directory, "ithmm.model"))
+			print("changed {:.4f} - log_p_emission {} - split_r_hat {:.3f}".format(trainer.get_changed_fraction(), trainer.get_log_p_emission(), trainer.get_split_r_hat()))
+			trainer.save_async(os.path.join(args.working_directory, "ithmm.model"))	# 書き出しは裏で行う
+		if args.early_stopping and trainer.converged():	# 状態の変化と対数尤度が横ばいになったら打ち切る
+			printr("")
+			print("converged at epoch {}".format(epoch))
+			trainer.save_async(os.path.join(args.working_directory, "ithmm.model"))
+			break
+	trainer.wait_for_save()
 
 if __name__ == "__main__":
 	parser = argparse.ArgumentParser()
@@ -113,5 +120,6 @@ if __name__ == "__main__":
 	parser.add_argument("--concentration-h", "-conch", type=float, default=1, help="HTSSBの横の集中度")
 	parser.add_argument("--tau0", "-tau0", type=float, default=1)
 	parser.add_argument("--tau1", "-tau1", type=float, default=100)
+	parser.add_argument("--early-stopping", dest="early_stopping", default=False, action="store_true", help="収束したら指定したepochより前に打ち切るかどうか.")
 	args = parser.parse_args()
 	main()
\ No newline at end of file
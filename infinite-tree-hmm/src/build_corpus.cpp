@@ -0,0 +1,136 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ithmm/corpus_file.h"
+using namespace ithmm;
+using std::cout;
+using std::endl;
+
+// テキストファイルを単語分割済みのコーパスの独自バイナリ形式に変換する
+// 1行を1文とし、ASCIIの空白で単語に区切る. Corpus::add_textfileと同じ規則
+// 使い方: build_corpus [-stop] 出力ファイル 入力ファイル...
+// -stopを付けると各ファイルの最初の空行で読み込みを終える. 付けなければ空行は読み飛ばす
+
+class Builder {
+public:
+	std::unordered_map<std::string, int> _token_ids;
+	std::vector<uint64_t> _type_offsets;
+	std::string _strings;
+	std::vector<int> _type_counts;
+	std::vector<int> _tokens;
+	std::vector<uint64_t> _sentence_offsets;
+	std::string _token_buffer;
+	Builder(){
+		_type_offsets.push_back(0);
+		_sentence_offsets.push_back(0);
+	}
+	int intern(const char* begin, const char* end){
+		_token_buffer.assign(begin, end);
+		auto itr = _token_ids.find(_token_buffer);
+		if(itr != _token_ids.end()){
+			return itr->second;
+		}
+		int token_id = _type_counts.size();
+		_token_ids[_token_buffer] = token_id;
+		_strings.append(begin, end);
+		_type_offsets.push_back(_strings.size());
+		_type_counts.push_back(0);
+		return token_id;
+	}
+	bool add_textfile(const std::string &filename, bool stop_at_blank_line){
+		int fd = open(filename.c_str(), O_RDONLY);
+		if(fd < 0){
+			return false;
+		}
+		struct stat st;
+		if(fstat(fd, &st) != 0){
+			close(fd);
+			return false;
+		}
+		size_t size = st.st_size;
+		if(size == 0){
+			close(fd);
+			return true;
+		}
+		void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if(address == MAP_FAILED){
+			return false;
+		}
+		madvise(address, size, MADV_SEQUENTIAL);
+		const char* line = static_cast<const char*>(address);
+		const char* end = line + size;
+		if(size >= 3 && std::memcmp(line, "\xEF\xBB\xBF", 3) == 0){
+			line += 3;	// BOM
+		}
+		while(line < end){
+			const char* line_end = static_cast<const char*>(std::memchr(line, '\n', end - line));
+			if(line_end == NULL){
+				line_end = end;
+			}
+			size_t num_tokens = _tokens.size();
+			const char* token = line;
+			while(token < line_end){
+				while(token < line_end && is_space(*token)){
+					token++;
+				}
+				const char* token_end = token;
+				while(token_end < line_end && is_space(*token_end) == false){
+					token_end++;
+				}
+				if(token < token_end){
+					int token_id = intern(token, token_end);
+					_type_counts[token_id] += 1;
+					_tokens.push_back(token_id);
+				}
+				token = token_end;
+			}
+			line = line_end + 1;
+			if(_tokens.size() == num_tokens){
+				if(stop_at_blank_line){
+					break;
+				}
+				continue;
+			}
+			_sentence_offsets.push_back(_tokens.size());
+		}
+		munmap(address, size);
+		return true;
+	}
+	static bool is_space(char ch){
+		return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\v' || ch == '\f';
+	}
+};
+
+int main(int argc, char* argv[]){
+	int arg_index = 1;
+	bool stop_at_blank_line = false;
+	if(arg_index < argc && std::strcmp(argv[arg_index], "-stop") == 0){
+		stop_at_blank_line = true;
+		arg_index++;
+	}
+	if(argc - arg_index < 2){
+		cout << "usage: " << argv[0] << " [-stop] output input..." << endl;
+		return 1;
+	}
+	std::string output_filename = argv[arg_index++];
+	Builder builder;
+	for(;arg_index < argc;arg_index++){
+		if(builder.add_textfile(argv[arg_index], stop_at_blank_line) == false){
+			cout << argv[arg_index] << " not found." << endl;
+			return 1;
+		}
+	}
+	if(corpus_file::write(output_filename, builder._type_offsets, builder._strings, builder._type_counts, builder._tokens, builder._sentence_offsets) == false){
+		cout << "failed to write " << output_filename << endl;
+		return 1;
+	}
+	cout << builder._sentence_offsets.size() - 1 << " sentences, " << builder._tokens.size() << " tokens, " << builder._type_counts.size() << " types" << endl;
+	return 0;
+}
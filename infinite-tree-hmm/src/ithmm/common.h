@@ -2,8 +2,4 @@
 
 namespace ithmm {
 	class Node;
-	typedef struct Word {
-		int _id;
-		Node* _state;
-	} Word;
-}
\ No newline at end of file
+}
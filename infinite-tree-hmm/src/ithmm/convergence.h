@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+
+#define ITHMM_NUM_SPLITS 4	// split-R̂で直近の記録を何本の系列に分けるか
+
+namespace ithmm {
+	// 学習の収束判定
+	// エポックごとに状態が変わった割合と対数尤度を記録し、直近_window個のエポックで両方が横ばいになったら収束とみなす
+	// 対数尤度は直近の記録を分割した系列のsplit-R̂、状態が変わった割合は前半と後半の平均の差で判定する
+	class ConvergenceMonitor {
+	public:
+		int _window;				// 判定に使う直近のエポック数
+		double _tolerance;			// 状態が変わった割合の前半と後半の平均の差の許容値
+		double _max_r_hat;
+		std::vector<double> _changed_fractions;
+		std::vector<double> _log_p;
+		ConvergenceMonitor();
+		void set_criteria(int window, double tolerance, double max_r_hat);
+		void add_epoch(double changed_fraction, double log_p);
+		void clear();
+		int get_num_epochs() const;
+		double get_changed_fraction() const;
+		double get_log_p() const;
+		// 記録が足りなければ-1を返す
+		double compute_split_r_hat() const;
+		bool converged() const;
+	};
+}
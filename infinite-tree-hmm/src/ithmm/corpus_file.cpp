@@ -0,0 +1,216 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include "corpus_file.h"
+
+namespace ithmm {
+	namespace corpus_file {
+		static size_t _align(size_t offset){
+			return (offset + CORPUS_FILE_ALIGNMENT - 1) / CORPUS_FILE_ALIGNMENT * CORPUS_FILE_ALIGNMENT;
+		}
+		bool is_corpus_file(const std::string &filename){
+			std::ifstream ifs(filename, std::ios::binary);
+			if(ifs.good() == false){
+				return false;
+			}
+			char magic[sizeof(CORPUS_FILE_MAGIC)] = {0};
+			ifs.read(magic, sizeof(magic));
+			if(ifs.gcount() != sizeof(magic)){
+				return false;
+			}
+			return std::memcmp(magic, CORPUS_FILE_MAGIC, sizeof(magic)) == 0;
+		}
+		static void _write_section(std::ofstream &ofs, size_t &position, uint64_t offset, const void* data, size_t num_bytes){
+			char padding[CORPUS_FILE_ALIGNMENT] = {0};
+			ofs.write(padding, offset - position);
+			ofs.write(static_cast<const char*>(data), num_bytes);
+			position = offset + num_bytes;
+		}
+		bool write(const std::string &filename,
+			const std::vector<uint64_t> &type_offsets, const std::string &strings, const std::vector<int> &type_counts,
+			const std::vector<int> &tokens, const std::vector<uint64_t> &sentence_offsets){
+			static_assert(sizeof(int) == 4, "token ids are stored as int32");
+			static_assert(sizeof(CORPUS_FILE_MAGIC) == sizeof(((Header*)0)->magic), "magic must be 8 bytes");
+			assert(type_offsets.size() == type_counts.size() + 1);
+			assert(type_offsets.back() == strings.size());
+			assert(sentence_offsets.size() > 0 && sentence_offsets.back() == tokens.size());
+			Header header;
+			std::memset(&header, 0, sizeof(Header));
+			std::memcpy(header.magic, CORPUS_FILE_MAGIC, sizeof(header.magic));
+			header.version = CORPUS_FILE_VERSION;
+			header.byte_order = CORPUS_FILE_BYTE_ORDER;
+			header.header_size = sizeof(Header);
+			header.num_types = type_counts.size();
+			header.num_sentences = sentence_offsets.size() - 1;
+			header.num_tokens = tokens.size();
+			header.num_string_bytes = strings.size();
+			size_t offset = _align(sizeof(Header));
+			header.type_offsets_offset = offset;
+			offset = _align(offset + type_offsets.size() * sizeof(uint64_t));
+			header.strings_offset = offset;
+			offset = _align(offset + strings.size());
+			header.type_counts_offset = offset;
+			offset = _align(offset + type_counts.size() * sizeof(int));
+			header.tokens_offset = offset;
+			offset = _align(offset + tokens.size() * sizeof(int));
+			header.sentence_offsets_offset = offset;
+			std::string tmp_filename = filename + ".tmp";
+			std::ofstream ofs(tmp_filename, std::ios::binary | std::ios::trunc);
+			if(ofs.good() == false){
+				return false;
+			}
+			ofs.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+			size_t position = sizeof(Header);
+			_write_section(ofs, position, header.type_offsets_offset, type_offsets.data(), type_offsets.size() * sizeof(uint64_t));
+			_write_section(ofs, position, header.strings_offset, strings.data(), strings.size());
+			_write_section(ofs, position, header.type_counts_offset, type_counts.data(), type_counts.size() * sizeof(int));
+			_write_section(ofs, position, header.tokens_offset, tokens.data(), tokens.size() * sizeof(int));
+			_write_section(ofs, position, header.sentence_offsets_offset, sentence_offsets.data(), sentence_offsets.size() * sizeof(uint64_t));
+			ofs.close();
+			if(ofs.fail()){
+				std::remove(tmp_filename.c_str());
+				return false;
+			}
+			return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+		}
+		MappedCorpus::MappedCorpus(){
+			_address = NULL;
+			_num_bytes = 0;
+			_header = NULL;
+			_type_offsets = NULL;
+			_strings = NULL;
+			_type_counts = NULL;
+			_tokens = NULL;
+			_sentence_offsets = NULL;
+		}
+		MappedCorpus::~MappedCorpus(){
+			close();
+		}
+		bool MappedCorpus::open(const std::string &filename){
+			close();
+			int fd = ::open(filename.c_str(), O_RDONLY);
+			if(fd < 0){
+				return false;
+			}
+			struct stat st;
+			if(fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(Header)){
+				::close(fd);
+				return false;
+			}
+			void* address = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);	// 対応付けはファイルを閉じても残る
+			if(address == MAP_FAILED){
+				return false;
+			}
+			_address = address;
+			_num_bytes = st.st_size;
+			_header = reinterpret_cast<const Header*>(address);
+			if(_validate() == false){
+				close();
+				return false;
+			}
+			return true;
+		}
+		void MappedCorpus::close(){
+			if(_address != NULL){
+				munmap(_address, _num_bytes);
+			}
+			_address = NULL;
+			_num_bytes = 0;
+			_header = NULL;
+			_type_offsets = NULL;
+			_strings = NULL;
+			_type_counts = NULL;
+			_tokens = NULL;
+			_sentence_offsets = NULL;
+		}
+		// 表がファイルに収まっていればその先頭を返す
+		static const char* _get_section(const char* base, size_t num_bytes, uint64_t offset, uint64_t num_elements, size_t element_size){
+			if(offset % CORPUS_FILE_ALIGNMENT != 0 || offset > num_bytes){
+				return NULL;
+			}
+			if(num_elements > (num_bytes - offset) / element_size){
+				return NULL;	// 途中で切れたファイル
+			}
+			return base + offset;
+		}
+		bool MappedCorpus::_validate(){
+			const Header* header = _header;
+			if(std::memcmp(header->magic, CORPUS_FILE_MAGIC, sizeof(header->magic)) != 0){
+				return false;
+			}
+			if(header->byte_order != CORPUS_FILE_BYTE_ORDER || header->version > CORPUS_FILE_VERSION || header->header_size != sizeof(Header)){
+				return false;
+			}
+			if(header->num_types > INT_MAX || header->num_sentences >= SIZE_MAX / sizeof(uint64_t)){
+				return false;
+			}
+			const char* base = static_cast<const char*>(_address);
+			_type_offsets = reinterpret_cast<const uint64_t*>(_get_section(base, _num_bytes, header->type_offsets_offset, header->num_types + 1, sizeof(uint64_t)));
+			_strings = _get_section(base, _num_bytes, header->strings_offset, header->num_string_bytes, 1);
+			_type_counts = reinterpret_cast<const int*>(_get_section(base, _num_bytes, header->type_counts_offset, header->num_types, sizeof(int)));
+			_tokens = reinterpret_cast<const int*>(_get_section(base, _num_bytes, header->tokens_offset, header->num_tokens, sizeof(int)));
+			_sentence_offsets = reinterpret_cast<const uint64_t*>(_get_section(base, _num_bytes, header->sentence_offsets_offset, header->num_sentences + 1, sizeof(uint64_t)));
+			if(_type_offsets == NULL || _strings == NULL || _type_counts == NULL || _tokens == NULL || _sentence_offsets == NULL){
+				return false;
+			}
+			// 単語の文字列の範囲
+			if(_type_offsets[0] != 0 || _type_offsets[header->num_types] != header->num_string_bytes){
+				return false;
+			}
+			for(uint64_t type_id = 0;type_id < header->num_types;type_id++){
+				if(_type_offsets[type_id] > _type_offsets[type_id + 1] || _type_counts[type_id] < 0){
+					return false;
+				}
+			}
+			// 空の文は作らないので開始位置は狭義単調増加
+			if(_sentence_offsets[0] != 0 || _sentence_offsets[header->num_sentences] != header->num_tokens){
+				return false;
+			}
+			for(uint64_t n = 0;n < header->num_sentences;n++){
+				if(_sentence_offsets[n] >= _sentence_offsets[n + 1] || _sentence_offsets[n + 1] - _sentence_offsets[n] > INT_MAX){
+					return false;
+				}
+			}
+			int num_types = header->num_types;
+			for(uint64_t i = 0;i < header->num_tokens;i++){
+				if(_tokens[i] < 0 || _tokens[i] >= num_types){
+					return false;
+				}
+			}
+			return true;
+		}
+		int MappedCorpus::get_num_types() const {
+			assert(_header != NULL);
+			return _header->num_types;
+		}
+		size_t MappedCorpus::get_num_sentences() const {
+			assert(_header != NULL);
+			return _header->num_sentences;
+		}
+		size_t MappedCorpus::get_num_tokens() const {
+			assert(_header != NULL);
+			return _header->num_tokens;
+		}
+		const int* MappedCorpus::get_sentence(size_t n, int &length) const {
+			assert(n < get_num_sentences());
+			length = _sentence_offsets[n + 1] - _sentence_offsets[n];
+			return _tokens + _sentence_offsets[n];
+		}
+		int MappedCorpus::get_type_count(int type_id) const {
+			assert(0 <= type_id && type_id < get_num_types());
+			return _type_counts[type_id];
+		}
+		void MappedCorpus::get_type_string(int type_id, const char* &begin, const char* &end) const {
+			assert(0 <= type_id && type_id < get_num_types());
+			begin = _strings + _type_offsets[type_id];
+			end = _strings + _type_offsets[type_id + 1];
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define CORPUS_FILE_MAGIC "HMMCORP"		// 終端の0を含めて8バイト
+#define CORPUS_FILE_VERSION 1
+#define CORPUS_FILE_BYTE_ORDER 0x01020304
+#define CORPUS_FILE_ALIGNMENT 64		// 各表の先頭はこの倍数の位置に置く
+
+namespace ithmm {
+	// 単語分割済みのコーパスの独自バイナリ形式
+	// bhmm, ihmm, ithmmで共通. 単語の種類の表と単語IDの列、文の開始位置の表からなる
+	// 単語IDはコーパス内の通し番号で、モデルの辞書のIDとは別
+	namespace corpus_file {
+		struct Header {
+			char magic[8];
+			uint32_t version;
+			uint32_t byte_order;	// 書き出したマシンと読み込むマシンのエンディアンが同じか確かめる
+			uint32_t header_size;
+			uint32_t reserved;
+			uint64_t num_types;
+			uint64_t num_sentences;
+			uint64_t num_tokens;
+			uint64_t num_string_bytes;
+			uint64_t type_offsets_offset;		// uint64[num_types + 1]. 単語ごとの文字列の開始位置
+			uint64_t strings_offset;			// char[num_string_bytes]. UTF-8の単語を区切りなしで並べる
+			uint64_t type_counts_offset;		// int32[num_types]. 単語ごとの頻度
+			uint64_t tokens_offset;				// int32[num_tokens]. 全ての文の単語IDを続けて並べる
+			uint64_t sentence_offsets_offset;	// uint64[num_sentences + 1]. 文ごとの開始位置
+		};
+		// 先頭がCORPUS_FILE_MAGICならtrue
+		bool is_corpus_file(const std::string &filename);
+		// 一時ファイルに書いてから置き換えるので、途中で落ちても元のファイルは壊れない
+		bool write(const std::string &filename,
+			const std::vector<uint64_t> &type_offsets, const std::string &strings, const std::vector<int> &type_counts,
+			const std::vector<int> &tokens, const std::vector<uint64_t> &sentence_offsets);
+		// 読み取り専用でmmapしたコーパス
+		// 開く時に全ての単語IDと文の範囲を検査するので、その後は範囲外の参照を気にせず使える
+		class MappedCorpus {
+		private:
+			MappedCorpus(const MappedCorpus &);
+			MappedCorpus &operator=(const MappedCorpus &);
+			bool _validate();
+		public:
+			void* _address;
+			size_t _num_bytes;
+			const Header* _header;
+			const uint64_t* _type_offsets;
+			const char* _strings;
+			const int* _type_counts;
+			const int* _tokens;
+			const uint64_t* _sentence_offsets;
+			MappedCorpus();
+			~MappedCorpus();
+			bool open(const std::string &filename);
+			void close();
+			int get_num_types() const;
+			size_t get_num_sentences() const;
+			size_t get_num_tokens() const;
+			// 文のn番目の単語IDの列
+			const int* get_sentence(size_t n, int &length) const;
+			int get_type_count(int type_id) const;
+			// UTF-8の文字列の範囲
+			void get_type_string(int type_id, const char* &begin, const char* &end) const;
+		};
+	}
+}
@@ -6,6 +6,8 @@
 #include <boost/format.hpp>
 #include <iostream>
 #include <cassert>
+#include <cmath>
+#include <numeric>
 #include <iostream>
 #include "sampler.h"
 #include "node.h"
@@ -2,6 +2,7 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/serialization/vector.hpp>
+#include <sstream>
 #include "ithmm.h"
 #include "sampler.h"
 #include "utils.h"
@@ -108,25 +109,25 @@ namespace ithmm {
 		delete _structure_tssb;
 		delete _bos_tssb;
 	}
-	void iTHMM::initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset){
+	void iTHMM::initialize_with_training_dataset(WordSequences &dataset){
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			std::vector<Word*> &data = dataset[data_index];
-			if(data.size() == 0){
+			Sentence sentence = dataset.get_sentence(data_index);
+			if(sentence.size() == 0){
 				continue;
 			}
+			int* word_ids = sentence._word_ids;
+			Node** states = sentence._states;
 			// 状態路ランダムに設定
-			for(int i = 0;i < data.size();i++){
-				Word* word = data[i];
+			for(int i = 0;i < sentence.size();i++){
 				Node* state = NULL;
 				state = sample_node_in_tssb(_structure_tssb, true);
 				assert(state != NULL);
-				word->_state = state;
+				states[i] = state;
 			}
 			Node* prev_state = NULL;						// <s>
-			for(int i = 0;i < data.size();i++){
-				Word* word = data[i];
-				Node* state = word->_state;
-				add_initial_parameters(prev_state, state, word->_id);
+			for(int i = 0;i < sentence.size();i++){
+				Node* state = states[i];
+				add_initial_parameters(prev_state, state, word_ids[i]);
 				prev_state = state;
 			}
 			add_initial_parameters(prev_state, NULL, 0);	// </s>
@@ -134,17 +135,18 @@ namespace ithmm {
 	}
 	// デバッグ用
 	// これを呼んで全パラメータが消えなかったらバグっている
-	void iTHMM::remove_all_data(std::vector<std::vector<Word*>> &dataset){
+	void iTHMM::remove_all_data(WordSequences &dataset){
 		for(int data_index = 0;data_index < dataset.size();data_index++){
-			std::vector<Word*> &data = dataset[data_index];
-			if(data.size() == 0){
+			Sentence sentence = dataset.get_sentence(data_index);
+			if(sentence.size() == 0){
 				continue;
 			}
+			int* word_ids = sentence._word_ids;
+			Node** states = sentence._states;
 			Node* prev_state = NULL;
-			for(int i = 0;i < data.size();i++){
-				Word* word = data[i];
-				Node* state = word->_state;
-				remove_initial_parameters(prev_state, state, word->_id);
+			for(int i = 0;i < sentence.size();i++){
+				Node* state = states[i];
+				remove_initial_parameters(prev_state, state, word_ids[i]);
 				prev_state = state;
 			}
 			remove_initial_parameters(prev_state, NULL, 0);
@@ -488,19 +490,21 @@ namespace ithmm {
 			assert(rest_stick_length > 0.0);
 		}
 	}
-	void iTHMM::gibbs(std::vector<Word*> &sentence){
+	void iTHMM::gibbs(Sentence &sentence){
 		assert(sentence.size() > 0);
+		int* word_ids = sentence._word_ids;
+		Node** states = sentence._states;
 		Node* prev_state = NULL;
-		Node* next_state = sentence.size() == 1 ? NULL : sentence[1]->_state;
+		Node* next_state = sentence.size() == 1 ? NULL : states[1];
 		for(int i = 0;i < sentence.size();i++){
-			Word* word = sentence[i];
-			Node* state = word->_state;
-			remove_parameters(prev_state, state, next_state, word->_id);
-			state = draw_state(prev_state, state, next_state, word->_id);
-			add_parameters(prev_state, state, next_state, word->_id);
+			Node* state = states[i];
+			int word_id = word_ids[i];
+			remove_parameters(prev_state, state, next_state, word_id);
+			state = draw_state(prev_state, state, next_state, word_id);
+			add_parameters(prev_state, state, next_state, word_id);
 			prev_state = state;
-			next_state = i < sentence.size() - 2 ? sentence[i + 2]->_state : NULL;
-			word->_state = state;
+			next_state = i < sentence.size() - 2 ? states[i + 2] : NULL;
+			states[i] = state;
 		}
 	}
 	// データ読み込み時の状態初期化時にのみ使う
@@ -1865,6 +1869,14 @@ namespace ithmm {
 		ofs.close();
 		return success;
 	}
+	void iTHMM::save_to_string(std::string &buffer){
+		std::ostringstream oss(std::ios::binary);
+		{
+			boost::archive::binary_oarchive oarchive(oss);
+			oarchive << *this;
+		}
+		buffer = oss.str();
+	}
 	bool iTHMM::load(std::string filename){
 		bool success = false;
 		std::ifstream ifs(filename);
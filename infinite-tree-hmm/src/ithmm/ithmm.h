@@ -9,6 +9,7 @@
 #include "node.h"
 #include "hpylm.h"
 #include "common.h"
+#include "sequences.h"
 #include "hyperparameters.h"
 
 namespace ithmm {
@@ -53,8 +54,8 @@ namespace ithmm {
 		iTHMM();
 		iTHMM(double alpha, double gamma, double lambda_alpha, double lambda_gamma, double conc_h, double conc_v, double tau0, double tau1, double word_g0, int depth_limit);
 		~iTHMM();
-		void initialize_with_training_dataset(std::vector<std::vector<Word*>> &dataset);
-		void remove_all_data(std::vector<std::vector<Word*>> &dataset);
+		void initialize_with_training_dataset(WordSequences &dataset);
+		void remove_all_data(WordSequences &dataset);
 		void set_depth_limit(int limit);
 		void set_word_g0(double g0);
 		bool is_node_in_bos_tssb(Node* node);
@@ -87,7 +88,7 @@ namespace ithmm {
 		Node* _retrospective_sampling_by_iterating_node(double uniform, Node* iterator);
 		void update_stick_length_of_tssb(TSSB* tssb, double total_stick_length);
 		void _update_stick_length_of_parent_node(Node* parent, double total_stick_length);
-		void gibbs(std::vector<Word*> &sentence);
+		void gibbs(Sentence &sentence);
 		void add_initial_parameters(Node* prev_state_in_structure, Node* state_in_structure, int word_id);
 		void add_temporal_parameters(Node* prev_state_in_structure, Node* state_in_structure);
 		void add_parameters(Node* prev_state_in_structure, Node* state_in_structure, Node* next_state_in_structure, int word_id);
@@ -116,5 +117,7 @@ namespace ithmm {
 		void geneerate_word_ranking_of_node(Node* node_in_structure, std::multiset<std::pair<int, double>, multiset_value_comparator> &ranking);
 		bool save(std::string filename);
 		bool load(std::string filename);
+		// saveと同じ内容をメモリ上に書き出す
+		void save_to_string(std::string &buffer);
 	};
 }
\ No newline at end of file
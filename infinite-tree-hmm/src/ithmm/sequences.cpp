@@ -0,0 +1,21 @@
+#include "sequences.h"
+
+namespace ithmm {
+	WordSequences::WordSequences(){
+		_offsets.push_back(0);
+	}
+	void WordSequences::add_sentence(const int* word_ids, int num_words){
+		assert(num_words > 0);
+		for(int i = 0;i < num_words;i++){
+			_word_ids.push_back(word_ids[i]);
+			_states.push_back(NULL);
+		}
+		_offsets.push_back(_word_ids.size());
+	}
+	void WordSequences::clear(){
+		_word_ids.clear();
+		_states.clear();
+		_offsets.clear();
+		_offsets.push_back(0);
+	}
+}
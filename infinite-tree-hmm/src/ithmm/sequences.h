@@ -0,0 +1,59 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include "common.h"
+
+namespace ithmm {
+	// 1文分の単語IDと状態への参照
+	// <s>と</s>は持たず、添字0が文頭の単語
+	class Sentence {
+	public:
+		int* _word_ids;
+		Node** _states;
+		int _length;
+		Sentence(int* word_ids, Node** states, int length){
+			_word_ids = word_ids;
+			_states = states;
+			_length = length;
+		}
+		inline int size() const {
+			return _length;
+		}
+		inline int get_word_id(int i) const {
+			assert(0 <= i && i < _length);
+			return _word_ids[i];
+		}
+		inline Node* get_state(int i) const {
+			assert(0 <= i && i < _length);
+			return _states[i];
+		}
+		inline void set_state(int i, Node* state){
+			assert(0 <= i && i < _length);
+			_states[i] = state;
+		}
+	};
+	// 全ての文の単語IDと状態をそれぞれ1本の配列に並べる
+	// n番目の文は[_offsets[n], _offsets[n + 1])
+	class WordSequences {
+	public:
+		std::vector<int> _word_ids;
+		std::vector<Node*> _states;
+		std::vector<size_t> _offsets;
+		WordSequences();
+		// 状態はNULLで追加する
+		void add_sentence(const int* word_ids, int num_words);
+		void clear();
+		inline int size() const {
+			return _offsets.size() - 1;
+		}
+		inline size_t get_num_tokens() const {
+			return _word_ids.size();
+		}
+		inline Sentence get_sentence(int n){
+			assert(0 <= n && n < size());
+			size_t begin = _offsets[n];
+			return Sentence(_word_ids.data() + begin, _states.data() + begin, _offsets[n + 1] - begin);
+		}
+	};
+}
@@ -1,6 +1,7 @@
 #include "table.h"
 #include "sampler.h"
 #include <iostream>
+#include <numeric>
 
 namespace ithmm {
 	Table::Table(){
@@ -1,9 +1,20 @@
 #pragma once
+#include <boost/python.hpp>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 namespace ithmm {
 	namespace utils {
 		void split_word_by(const std::wstring &str, wchar_t delim, std::vector<std::wstring> &elems);
+		// int32のバッファ(array.array('i')やnumpyの配列)ならそのままコピーし、それ以外は要素を1つずつ取り出す
+		std::vector<int> int_vector_from_object(boost::python::object &obj);
+		// array.array('i')にまとめて返す
+		boost::python::object int_array_from_vector(const std::vector<int> &vec);
+		// 一時ファイルに書いてから置き換える. 途中で失敗しても元のファイルは壊れない
+		bool write_file_atomically(const std::string &filename, const std::string &data);
+		// UTF-8のバイト列をワイド文字列に直す. 不正なバイトはU+FFFDにする
+		void utf8_to_wstring(const char* begin, const char* end, std::wstring &str);
+		void wstring_to_utf8(const std::wstring &str, std::string &utf8);
 	}
 }
\ No newline at end of file
@@ -1,26 +1,76 @@
 #pragma once
-#include <unordered_map>
+#include <boost/python.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <unordered_set>
 #include <string>
+#include <vector>
 #include "../ithmm/common.h"
 
 #define ID_UNK 0
 
+#define DICTIONARY_FILE_MAGIC "HMMDICT"		// 終端の0を含めて8バイト
+#define DICTIONARY_FILE_VERSION 1
+#define DICTIONARY_FILE_BYTE_ORDER 0x01020304
+#define DICTIONARY_FILE_ALIGNMENT 64		// 各表の先頭はこの倍数の位置に置く
+
 namespace ithmm {
+	// 辞書の独自バイナリ形式
+	// 文字列の表と単語IDの開始位置の表、文字列から単語IDを引くハッシュ表をそのまま書き出すのでmmapして使える
+	struct DictionaryFileHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order;
+		uint32_t header_size;
+		uint32_t char_size;			// sizeof(wchar_t). 環境によって違う
+		uint64_t num_words;
+		uint64_t num_chars;
+		uint64_t num_slots;
+		uint64_t offsets_offset;	// uint64[num_words + 1]. 単語ごとの文字列の開始位置
+		uint64_t chars_offset;		// wchar_t[num_chars]. 単語を区切りなしで並べる
+		uint64_t slots_offset;		// int32[num_slots]. 開番地法のハッシュ表
+	};
+	// 単語の文字列は全て1本の配列に並べ、単語IDから開始位置を引く
+	// 文字列から単語IDへは単語IDだけを入れた開番地法のハッシュ表で引く
+	// 1単語あたり文字列の他に16バイト程度で済む
 	class Dictionary{
+	private:
+		Dictionary(const Dictionary &);
+		Dictionary &operator=(const Dictionary &);
+		void* _address;			// loadでmmapした領域. NULLなら以下のベクタを使う
+		size_t _num_bytes;
+		std::vector<wchar_t> _char_buffer;
+		std::vector<uint64_t> _offset_buffer;
+		std::vector<int> _slot_buffer;
+		void _update_views();
+		void _detach();
+		void _unmap();
+		void _append_string(const wchar_t* str, size_t length);
+		void _rehash(size_t num_slots);
+		size_t _find_slot(const wchar_t* str, size_t length) const;
+		bool _load_binary(std::string filename);
+		bool _load_archive(std::string filename);
 	public:
-		std::unordered_map<int, std::wstring> _id_to_str;
-		std::unordered_map<std::wstring, int> _str_to_id;
-		int _autoincrement;
+		const wchar_t* _chars;
+		const uint64_t* _offsets;	// n番目の単語は[_offsets[n], _offsets[n + 1])
+		const int* _slots;			// 空きは-1
+		int _num_words;
+		size_t _num_slots;			// 2の累乗
 		Dictionary();
+		~Dictionary();
 		int add_word_string(std::wstring word);
 		int string_to_word_id(std::wstring word);
+		// array.array('i')にまとめて返す
+		boost::python::object python_string_to_word_ids(boost::python::object py_word_str_list);
 		std::wstring word_id_to_string(int word_id);
 		void remove_ids(std::unordered_set<int> word_ids);
+		// データセットを作り終えたら余分に確保した領域を返す
+		void shrink_to_fit();
 		int get_vocabrary_size();
 		bool is_string_unk(std::wstring word);
 		bool is_id_unk(int word_id);
+		// 独自のバイナリ形式で保存する. 読み込みは形式を判別して旧形式も読める
 		bool load(std::string filename);
 		bool save(std::string filename);
 	};
-}
\ No newline at end of file
+}
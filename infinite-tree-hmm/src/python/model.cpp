@@ -1,5 +1,10 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <numeric>
+#include <thread>
 #include "../ithmm/sampler.h"
+#include "../ithmm/utils.h"
 #include "model.h"
 
 namespace ithmm {
@@ -141,19 +146,18 @@ namespace ithmm {
 			decode_table[i] = new double[nodes.size()];
 		}
 		// Python側から渡された単語IDリストを変換
-		std::vector<Word*> words;
+		std::vector<int> word_ids(num_words);
+		std::vector<Node*> states(num_words, NULL);
 		for(int i = 0;i < num_words;i++){
-			Word* word = new Word();
-			word->_id = boost::python::extract<int>(py_word_ids[i]);
-			word->_state = NULL;
-			words.push_back(word);
+			word_ids[i] = boost::python::extract<int>(py_word_ids[i]);
 		}
+		Sentence sentence(word_ids.data(), states.data(), num_words);
 		// ビタビアルゴリズム
 		std::vector<Node*> sampled_state_sequence;
-		viterbi_decode(words, nodes, sampled_state_sequence, forward_table, decode_table);
+		viterbi_decode(sentence, nodes, sampled_state_sequence, forward_table, decode_table);
 		// 結果を返す
 		boost::python::list result;
-		for(int i = 0;i < words.size();i++){
+		for(int i = 0;i < num_words;i++){
 			std::wstring tag = L"[" + sampled_state_sequence[i]->_wdump_indices() + L"]";
 			result.append(tag);
 		}
@@ -163,41 +167,154 @@ namespace ithmm {
 		}
 		delete[] forward_table;
 		delete[] decode_table;
-		for(int i = 0;i < words.size();i++){
-			delete words[i];
-		}
 		return result;
 	}
+	// 複数の文をまとめて復号する
+	// word_idsは全ての文の単語IDを連結したもので、n番目の文は[offsets[n], offsets[n + 1])
+	// 結果はword_idsと同じ位置にget_tags()の並びでの状態の番号を書き込んだ配列で返す
+	boost::python::object Model::python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads){
+		std::vector<int> word_ids = utils::int_vector_from_object(py_word_ids);
+		std::vector<int> offsets = utils::int_vector_from_object(py_offsets);
+		// GILを解放した後の各スレッドは範囲を確かめずに読むので、ここで全て確かめておく
+		if(num_threads <= 0){
+			PyErr_SetString(PyExc_ValueError, "num_threads must be positive");
+			boost::python::throw_error_already_set();
+		}
+		if(offsets.size() == 0 || offsets.front() != 0 || (size_t)offsets.back() != word_ids.size()){
+			PyErr_SetString(PyExc_ValueError, "offsets must start at 0 and end at the number of word ids");
+			boost::python::throw_error_already_set();
+		}
+		for(size_t n = 0;n + 1 < offsets.size();n++){
+			if(offsets[n] > offsets[n + 1]){
+				PyErr_SetString(PyExc_ValueError, "offsets must be non-decreasing");
+				boost::python::throw_error_already_set();
+			}
+		}
+		// 語彙数は保存していないので基底測度の1/語彙数から戻す. 辞書の単語IDは<unk>の0と1〜語彙数
+		int num_words = std::round(1.0 / _ithmm->_word_g0);
+		for(int word_id: word_ids){
+			if(word_id < 0 || word_id > num_words){
+				std::string message = "word id " + std::to_string(word_id) + " is out of range";
+				PyErr_SetString(PyExc_ValueError, message.c_str());
+				boost::python::throw_error_already_set();
+			}
+		}
+		// 棒の長さの計算は木を書き換えるのでGILを解放する前に済ませる
+		std::vector<Node*> nodes;
+		enumerate_all_states(nodes);
+		precompute_all_stick_lengths(nodes);
+		std::vector<int> state_indices(word_ids.size(), 0);
+		PyThreadState* thread_state = PyEval_SaveThread();
+		viterbi_decode_batch(word_ids.data(), offsets.data(), offsets.size() - 1, nodes, state_indices.data(), num_threads);
+		PyEval_RestoreThread(thread_state);
+		return utils::int_array_from_vector(state_indices);
+	}
+	// 棒の長さは計算済みであること
+	// 遷移確率は全ての文で共通なので最初に表にしておき、各スレッドはそれを読むだけにする
+	void Model::viterbi_decode_batch(const int* word_ids, const int* offsets, int num_sentences, std::vector<Node*> &all_states, int* state_indices, int num_threads){
+		assert(num_threads > 0);
+		std::vector<double> p_bos;
+		std::vector<double> p_transition;
+		compute_transition_probabilities(all_states, p_bos, p_transition);
+		std::atomic<int> next_sentence(0);
+		std::vector<std::thread> threads;
+		for(int thread_id = 1;thread_id < num_threads;thread_id++){
+			threads.push_back(std::thread(&Model::_viterbi_decode_batch_worker, this, word_ids, offsets, num_sentences, std::ref(all_states), p_bos.data(), p_transition.data(), state_indices, &next_sentence));
+		}
+		_viterbi_decode_batch_worker(word_ids, offsets, num_sentences, all_states, p_bos.data(), p_transition.data(), state_indices, &next_sentence);
+		for(auto &thread: threads){
+			thread.join();
+		}
+	}
+	// テーブルはスレッドごとに持ち、それまでで最も長い文に合わせて確保し直す
+	void Model::_viterbi_decode_batch_worker(const int* word_ids, const int* offsets, int num_sentences, std::vector<Node*> &all_states, const double* p_bos, const double* p_transition, int* state_indices, std::atomic<int>* next_sentence){
+		int num_states = all_states.size();
+		std::vector<double*> forward_table;
+		std::vector<double*> decode_table;
+		std::vector<int> series_indices;
+		while(true){
+			int n = next_sentence->fetch_add(1);
+			if(n >= num_sentences){
+				break;
+			}
+			int begin = offsets[n];
+			int num_words = offsets[n + 1] - begin;
+			assert(num_words >= 0);
+			if(num_words == 0){
+				continue;
+			}
+			while(forward_table.size() < num_words){
+				forward_table.push_back(new double[num_states]);
+				decode_table.push_back(new double[num_states]);
+			}
+			viterbi_decode(word_ids + begin, num_words, all_states, p_bos, p_transition, series_indices, forward_table.data(), decode_table.data());
+			for(int i = 0;i < num_words;i++){
+				state_indices[begin + i] = series_indices[i];
+			}
+		}
+		for(int i = 0;i < forward_table.size();i++){
+			delete[] forward_table[i];
+			delete[] decode_table[i];
+		}
+	}
+	// p_bos[i]: <s>の次にall_states[i]に遷移する確率
+	// p_transition[i * N + j]: all_states[i]からall_states[j]に遷移する確率
+	void Model::compute_transition_probabilities(std::vector<Node*> &all_states, std::vector<double> &p_bos, std::vector<double> &p_transition){
+		int num_states = all_states.size();
+		p_bos.resize(num_states);
+		p_transition.resize(num_states * num_states);
+		for(int j = 0;j < num_states;j++){
+			Node* state = all_states[j];
+			Node* state_in_bos = _ithmm->_bos_tssb->find_node_by_tracing_horizontal_indices(state);
+			assert(state_in_bos != NULL);
+			p_bos[j] = state_in_bos->_probability;
+		}
+		for(int i = 0;i < num_states;i++){
+			Node* prev_state = all_states[i];
+			TSSB* transition_tssb = prev_state->get_transition_tssb();
+			assert(transition_tssb != NULL);
+			for(int j = 0;j < num_states;j++){
+				Node* state_in_prev_htssb = transition_tssb->find_node_by_tracing_horizontal_indices(all_states[j]);
+				assert(state_in_prev_htssb != NULL);
+				p_transition[i * num_states + j] = state_in_prev_htssb->_probability;
+			}
+		}
+	}
 	// 状態系列の復号
 	// ビタビアルゴリズム
-	void Model::viterbi_decode(std::vector<Word*> &sentence, std::vector<Node*> &all_states, std::vector<Node*> &sampled_state_sequence, double** forward_table, double** decode_table){
+	void Model::viterbi_decode(Sentence &sentence, std::vector<Node*> &all_states, std::vector<Node*> &sampled_state_sequence, double** forward_table, double** decode_table){
+		std::vector<double> p_bos;
+		std::vector<double> p_transition;
+		compute_transition_probabilities(all_states, p_bos, p_transition);
+		std::vector<int> series_indices;
+		viterbi_decode(sentence._word_ids, sentence.size(), all_states, p_bos.data(), p_transition.data(), series_indices, forward_table, decode_table);
+		// ノードをセット
+		sampled_state_sequence.clear();
+		for(int k: series_indices){
+			sampled_state_sequence.push_back(all_states[k]);
+		}
+	}
+	// 状態の番号の系列を返す
+	void Model::viterbi_decode(const int* word_ids, int num_words, std::vector<Node*> &all_states, const double* p_bos, const double* p_transition, std::vector<int> &series_indices, double** forward_table, double** decode_table){
+		int num_states = all_states.size();
 		// 初期化
-		Word* word = sentence[0];
-		for(int i = 0;i < all_states.size();i++){
+		for(int i = 0;i < num_states;i++){
 			Node* state = all_states[i];
-			Node* state_in_bos = _ithmm->_bos_tssb->find_node_by_tracing_horizontal_indices(state);
-			assert(state_in_bos != NULL);
-			double p_s = state_in_bos->_probability;
-			double p_w_given_s = _ithmm->compute_p_w_given_s(word->_id, state);
+			double p_s = p_bos[i];
+			double p_w_given_s = _ithmm->compute_p_w_given_s(word_ids[0], state);
 			assert(p_s > 0);
 			assert(p_w_given_s > 0);
 			forward_table[0][i] = p_w_given_s * p_s;
 			decode_table[0][i] = 0;
 		}
-		for(int t = 1;t < sentence.size();t++){
-			Word* word = sentence[t];
-			for(int j = 0;j < all_states.size();j++){
+		for(int t = 1;t < num_words;t++){
+			for(int j = 0;j < num_states;j++){
 				Node* state = all_states[j];
 				forward_table[t][j] = 0;
 				double max_value = 0;
-				double p_w_given_s = _ithmm->compute_p_w_given_s(word->_id, state);
-				for(int i = 0;i < all_states.size();i++){
-					Node* prev_state = all_states[i];
-					TSSB* transition_tssb = prev_state->get_transition_tssb();
-					assert(transition_tssb != NULL);
-					Node* state_in_prev_htssb = transition_tssb->find_node_by_tracing_horizontal_indices(state);
-					assert(state_in_prev_htssb != NULL);
-					double p_s_given_prev = state_in_prev_htssb->_probability;
+				double p_w_given_s = _ithmm->compute_p_w_given_s(word_ids[t], state);
+				for(int i = 0;i < num_states;i++){
+					double p_s_given_prev = p_transition[i * num_states + j];
 					double value = p_s_given_prev * forward_table[t - 1][i];
 					if(value > max_value){
 						max_value = value;
@@ -208,11 +325,11 @@ namespace ithmm {
 			}
 		}
 		// 後ろ向きに系列を復元
-		std::vector<int> series_indices;
-		int n = sentence.size() - 1;
+		series_indices.clear();
+		int n = num_words - 1;
 		int k = 0;
 		double max_value = 0;
-		for(int i = 0;i < all_states.size();i++){
+		for(int i = 0;i < num_states;i++){
 			if(forward_table[n][i] > max_value){
 				k = i;
 				max_value = forward_table[n][i];
@@ -224,34 +341,27 @@ namespace ithmm {
 			series_indices.push_back(k);
 		}
 		std::reverse(series_indices.begin(), series_indices.end());
-		// ノードをセット
-		sampled_state_sequence.clear();
-		for(int t = 0;t <= n;t++){
-			int k = series_indices[t];
-			sampled_state_sequence.push_back(all_states[k]);
-		}
 	}
 	// データの対数尤度を計算
 	// 前向きアルゴリズム
-	double Model::compute_p_sentence(std::vector<Word*> &sentence, std::vector<Node*> &states, double** forward_table){
+	double Model::compute_p_sentence(Sentence &sentence, std::vector<Node*> &states, double** forward_table){
+		int* word_ids = sentence._word_ids;
 		// 初期化
-		Word* word = sentence[0];
 		for(int i = 0;i < states.size();i++){
 			Node* state = states[i];
 			Node* state_in_bos = _ithmm->_bos_tssb->find_node_by_tracing_horizontal_indices(state);
 			assert(state_in_bos != NULL);
 			double p_s = state_in_bos->_probability;
-			double p_w_given_s = _ithmm->compute_p_w_given_s(word->_id, state);
+			double p_w_given_s = _ithmm->compute_p_w_given_s(word_ids[0], state);
 			assert(p_s > 0);
 			assert(p_w_given_s > 0);
 			forward_table[0][i] = p_w_given_s * p_s;
 		}
 		for(int t = 1;t < sentence.size();t++){
-			Word* word = sentence[t];
 			for(int j = 0;j < states.size();j++){
 				Node* state = states[j];
 				forward_table[t][j] = 0;
-				double p_w_given_s = _ithmm->compute_p_w_given_s(word->_id, state);
+				double p_w_given_s = _ithmm->compute_p_w_given_s(word_ids[t], state);
 				for(int i = 0;i < states.size();i++){
 					Node* prev_state = states[i];
 					TSSB* transition_tssb = prev_state->get_transition_tssb();
@@ -297,7 +407,7 @@ namespace ithmm {
 				if(dict->is_id_unk(word_id)){
 					continue;
 				}
-				std::wstring &word = dict->_id_to_str[word_id];
+				std::wstring word = dict->word_id_to_string(word_id);
 				double p = elem.second;
 				int count = node->_num_word_assignment[word_id];
 				wcout << "\x1b[1m" << word << "\x1b[0m" << L" (" << count;
@@ -326,7 +436,7 @@ namespace ithmm {
 			std::cout << "\x1b[32;1m" << "[" << indices << "]" << "\x1b[0m" << std::endl;
 			for(const auto &elem: ranking){
 				int word_id = elem.first;
-				std::wstring &word = dict->_id_to_str[word_id];
+				std::wstring word = dict->word_id_to_string(word_id);
 				for(int i = 0;i < std::max(0, 15 - (int)word.size());i++){
 					word += L" ";
 				}
@@ -362,7 +472,7 @@ namespace ithmm {
 			std::wcout << wtab;
 			for(const auto &table: node->_hpylm->_arrangement){
 				int word_id = table.first;
-				std::wstring &word = dict->_id_to_str[word_id];
+				std::wstring word = dict->word_id_to_string(word_id);
 				int num_tables = table.second.size();
 				int num_customers = std::accumulate(table.second.begin(), table.second.end(), 0);
 				std::wcout << "\x1b[1m" << word << "\x1b[0m" << L" (#t=" << num_tables << ";#c=" << num_customers << L") ";
@@ -1,5 +1,6 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
 #include "../ithmm/ithmm.h"
 #include "dataset.h"
 #include "dictionary.h"
@@ -8,6 +9,7 @@ namespace ithmm {
 	class Model{
 	private:
 		void _set_locale();
+		void _viterbi_decode_batch_worker(const int* word_ids, const int* offsets, int num_sentences, std::vector<Node*> &all_states, const double* p_bos, const double* p_transition, int* state_indices, std::atomic<int>* next_sentence);
 	public:
 		iTHMM* _ithmm;
 		Model(Dataset* dataset);
@@ -37,8 +39,12 @@ namespace ithmm {
 		void precompute_all_stick_lengths(std::vector<Node*> &all_states);
 		boost::python::list python_viterbi_decode(boost::python::list py_word_ids);
 		boost::python::list python_get_tags();
-		void viterbi_decode(std::vector<Word*> &data, std::vector<Node*> &all_states, std::vector<Node*> &sampled_state_sequence, double** forward_table, double** decode_table);
-		double compute_p_sentence(std::vector<Word*> &data, std::vector<Node*> &states, double** forward_table);
+		boost::python::object python_viterbi_decode_batch(boost::python::object py_word_ids, boost::python::object py_offsets, int num_threads);
+		void viterbi_decode_batch(const int* word_ids, const int* offsets, int num_sentences, std::vector<Node*> &all_states, int* state_indices, int num_threads);
+		void compute_transition_probabilities(std::vector<Node*> &all_states, std::vector<double> &p_bos, std::vector<double> &p_transition);
+		void viterbi_decode(Sentence &sentence, std::vector<Node*> &all_states, std::vector<Node*> &sampled_state_sequence, double** forward_table, double** decode_table);
+		void viterbi_decode(const int* word_ids, int num_words, std::vector<Node*> &all_states, const double* p_bos, const double* p_transition, std::vector<int> &series_indices, double** forward_table, double** decode_table);
+		double compute_p_sentence(Sentence &sentence, std::vector<Node*> &states, double** forward_table);
 		void show_assigned_words_for_each_tag(Dictionary* dict, int number_to_show_for_each_tag, bool show_probability = true);
 		void show_assigned_words_and_probability_for_each_tag(Dictionary* dict, int number_to_show_for_each_tag);
 		void show_hpylm_for_each_tag(Dictionary* dict);
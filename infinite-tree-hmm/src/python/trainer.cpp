@@ -1,5 +1,7 @@
 #include <cassert>
+#include <cmath>
 #include "../ithmm/sampler.h"
+#include "../ithmm/utils.h"
 #include "trainer.h"
 
 namespace ithmm {
@@ -9,9 +11,17 @@ namespace ithmm {
 		_dict = dataset->_dict;
 		_forward_table = NULL;
 		_decode_table = NULL;
+		_checkpoint_pending = false;
+		_checkpoint_succeeded = true;
+	}
+	Trainer::~Trainer(){
+		if(_checkpoint_thread.joinable()){
+			_checkpoint_thread.join();
+		}
 	}
 	void Trainer::set_model(Model* model){
 		_model = model;
+		_convergence.clear();
 	}
 	void Trainer::remove_all_data(){
 		_model->_ithmm->remove_all_data(_dataset->_word_sequences_train);
@@ -26,16 +36,51 @@ namespace ithmm {
 		}
 		_model->_ithmm->_num_mh_acceptance = 0;
 		_model->_ithmm->_num_mh_rejection = 0;
-		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::mt);	// データをシャッフル
-		for(int n = 0;n < _dataset->_word_sequences_train.size();n++){
+		shuffle(_rand_indices.begin(), _rand_indices.end(), sampler::rng);	// データをシャッフル
+		WordSequences &dataset = _dataset->_word_sequences_train;
+		_previous_states.assign(dataset._states.begin(), dataset._states.end());
+		// 遷移確率は木の棒の長さを辿る必要があり高くつくので、
+		// 文をサンプリングし終えた時点の出力確率の対数だけを足す
+		double log_p_emission = 0;
+		for(int n = 0;n < dataset.size();n++){
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return;
 			}
 			int data_index = _rand_indices[n];
-			std::vector<Word*> &sentence = _dataset->_word_sequences_train[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
 			_model->_ithmm->gibbs(sentence);
+			for(int i = 0;i < sentence.size();i++){
+				log_p_emission += log(_model->_ithmm->compute_p_w_given_s(sentence.get_word_id(i), sentence.get_state(i)));
+			}
 		}
 		_model->_ithmm->delete_unnecessary_children();
+		// 削除されたノードのアドレスは比べるだけで参照しない
+		size_t num_changed = 0;
+		for(size_t i = 0;i < _previous_states.size();i++){
+			num_changed += (_previous_states[i] != dataset._states[i]);
+		}
+		size_t num_words = dataset.get_num_tokens();
+		_convergence.add_epoch((num_words > 0) ? num_changed / (double)num_words : 0, log_p_emission);
+	}
+	// 直近window個のエポックで状態が変わった割合の前半と後半の平均の差がtolerance以下で、
+	// 出力確率の対数のsplit-R̂がmax_r_hat以下なら収束とみなす
+	void Trainer::set_convergence_criteria(int window, double tolerance, double max_r_hat){
+		_convergence.set_criteria(window, tolerance, max_r_hat);
+	}
+	bool Trainer::converged(){
+		return _convergence.converged();
+	}
+	// 直前のエポックで状態が変わった単語の割合
+	double Trainer::get_changed_fraction(){
+		return _convergence.get_changed_fraction();
+	}
+	// 直前のエポックで各文をサンプリングした直後のlog p(w|s)の和
+	double Trainer::get_log_p_emission(){
+		return _convergence.get_log_p();
+	}
+	// エポックが足りなければ-1
+	double Trainer::get_split_r_hat(){
+		return _convergence.compute_split_r_hat();
 	}
 	void Trainer::_before_viterbi_decode(std::vector<Node*> &nodes){
 		_before_compute_log_p_dataset(nodes);
@@ -79,7 +124,7 @@ namespace ithmm {
 	double Trainer::compute_log_p_dataset_dev(){
 		return _compute_log_p_dataset(_dataset->_word_sequences_dev);
 	}
-	double Trainer::_compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset){
+	double Trainer::_compute_log_p_dataset(WordSequences &dataset){
 		std::vector<Node*> nodes;
 		_before_compute_log_p_dataset(nodes);
 		// データごとの対数尤度を足していく
@@ -88,7 +133,7 @@ namespace ithmm {
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return 0;
 			}
-			std::vector<Word*> &sentence = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
 			double p_x = _model->compute_p_sentence(sentence, nodes, _forward_table);
 			if(p_x > 0){
 				log_p_dataset += log(p_x);
@@ -103,7 +148,7 @@ namespace ithmm {
 	double Trainer::compute_log2_p_dataset_dev(){
 		return _compute_log2_p_dataset(_dataset->_word_sequences_dev);
 	}
-	double Trainer::_compute_log2_p_dataset(std::vector<std::vector<Word*>> &dataset){
+	double Trainer::_compute_log2_p_dataset(WordSequences &dataset){
 		std::vector<Node*> nodes;
 		_before_compute_log_p_dataset(nodes);
 		// データごとの対数尤度を足していく
@@ -112,7 +157,7 @@ namespace ithmm {
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return 0;
 			}
-			std::vector<Word*> &sentence = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
 			double p_x = _model->compute_p_sentence(sentence, nodes, _forward_table);
 			if(p_x > 0){
 				log_p_dataset += log2(p_x);
@@ -127,7 +172,7 @@ namespace ithmm {
 	double Trainer::compute_perplexity_dev(){
 		return _compute_perplexity(_dataset->_word_sequences_dev);
 	}
-	double Trainer::_compute_perplexity(std::vector<std::vector<Word*>> &dataset){
+	double Trainer::_compute_perplexity(WordSequences &dataset){
 		std::vector<Node*> nodes;
 		_before_compute_log_p_dataset(nodes);
 		// データごとの対数尤度を足していく
@@ -136,7 +181,7 @@ namespace ithmm {
 			if (PyErr_CheckSignals() != 0) {		// ctrl+cが押されたかチェック
 				return 0;
 			}
-			std::vector<Word*> &sentence = dataset[data_index];
+			Sentence sentence = dataset.get_sentence(data_index);
 			double p_x = _model->compute_p_sentence(sentence, nodes, _forward_table);
 			if(p_x > 0){
 				log_p_dataset += log2(p_x) / sentence.size();
@@ -151,4 +196,33 @@ namespace ithmm {
 	void Trainer::show_assigned_words_for_each_tag(Dictionary* dict, int number_to_show_for_each_tag, bool show_probability){
 		_model->show_assigned_words_for_each_tag(dict, number_to_show_for_each_tag, show_probability);
 	}
+	// 現在のモデルをメモリ上に書き出してから別スレッドでファイルに書く
+	// 書き出している間もサンプリングを続けられる. 前の保存が終わっていなければ先に待つ
+	bool Trainer::save_async(std::string filename){
+		wait_for_save();
+		_model->_ithmm->save_to_string(_checkpoint);
+		_checkpoint_pending = true;
+		_checkpoint_thread = std::thread(&Trainer::_write_checkpoint, this, filename);
+		return true;
+	}
+	void Trainer::_write_checkpoint(std::string filename){
+		_checkpoint_succeeded = utils::write_file_atomically(filename, _checkpoint);
+		_checkpoint_pending = false;
+	}
+	bool Trainer::is_saving(){
+		return _checkpoint_pending;
+	}
+	// 保存中なら終わるまで待ち、最後の保存が成功したかを返す
+	bool Trainer::wait_for_save(){
+		if(_checkpoint_thread.joinable() == false){
+			return _checkpoint_succeeded;
+		}
+		// 書き出しはPythonのオブジェクトに触れないので待つ間はGILを解放する
+		PyThreadState* thread_state = (Py_IsInitialized() && PyGILState_Check()) ? PyEval_SaveThread() : NULL;
+		_checkpoint_thread.join();
+		if(thread_state != NULL){
+			PyEval_RestoreThread(thread_state);
+		}
+		return _checkpoint_succeeded;
+	}
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 #include <boost/python.hpp>
+#include <atomic>
+#include <string>
+#include <thread>
 #include <cassert>
+#include "../ithmm/convergence.h"
 #include "dataset.h"
 #include "model.h"
 #include "dictionary.h"
@@ -12,19 +16,34 @@ namespace ithmm {
 		void _after_viterbi_decode();
 		void _before_compute_log_p_dataset(std::vector<Node*> &nodes);
 		void _after_compute_log_p_dataset();
-		double _compute_log_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_log2_p_dataset(std::vector<std::vector<Word*>> &dataset);
-		double _compute_perplexity(std::vector<std::vector<Word*>> &dataset);
+		double _compute_log_p_dataset(WordSequences &dataset);
+		double _compute_log2_p_dataset(WordSequences &dataset);
+		double _compute_perplexity(WordSequences &dataset);
+		void _write_checkpoint(std::string filename);
 		std::vector<int> _rand_indices;
 		Dataset* _dataset;
 		Dictionary* _dict;
 		Model* _model;
 		double** _forward_table;		// 前向き確率計算用
 		double** _decode_table;			// viterbiデコーディング用
+		// 収束判定用
+		ConvergenceMonitor _convergence;
+		std::vector<Node*> _previous_states;	// エポック開始時の状態
+		// 非同期保存用
+		std::string _checkpoint;		// 保存を始めた時点のモデルを書き出したもの
+		std::thread _checkpoint_thread;
+		std::atomic<bool> _checkpoint_pending;
+		bool _checkpoint_succeeded;
 	public:
 		Trainer(Dataset* dataset, Model* model);
+		~Trainer();
 		void remove_all_data();
 		void gibbs();
+		void set_convergence_criteria(int window, double tolerance, double max_r_hat);
+		bool converged();
+		double get_changed_fraction();
+		double get_log_p_emission();
+		double get_split_r_hat();
 		double compute_log_p_dataset_train();
 		double compute_log_p_dataset_dev();
 		double compute_log2_p_dataset_train();
@@ -34,5 +53,8 @@ namespace ithmm {
 		void update_hyperparameters();
 		void show_assigned_words_for_each_tag(Dictionary* dict, int number_to_show_for_each_tag, bool show_probability = true);
 		void set_model(Model* model);
+		bool save_async(std::string filename);
+		bool is_saving();
+		bool wait_for_save();
 	};
 }
\ No newline at end of file
@@ -1482,15 +1482,12 @@ void test_add_and_remove_temporal_parameters(){
 void test_initialize_with_training_dataset(){
 	iTHMM* ithmm = new iTHMM();
 	ithmm->set_word_g0(0.001);
-	std::vector<std::vector<Word*>> dataset;
-	std::vector<Word*> words;
+	WordSequences dataset;
+	std::vector<int> word_ids;
 	for(int i = 0;i < 10000;i++){
-		Word* word = new Word();
-		word->_id = i;
-		word->_state = NULL;
-		words.push_back(word);
+		word_ids.push_back(i);
 	}
-	dataset.push_back(words);
+	dataset.add_sentence(word_ids.data(), word_ids.size());
 	ithmm->initialize_with_training_dataset(dataset);
 	ithmm->remove_all_data(dataset);
 	Node* root_in_structure = ithmm->_root_in_structure;
@@ -1502,9 +1499,6 @@ void test_initialize_with_training_dataset(){
 	// cout << ithmm->_structure_tssb->get_num_customers() << endl;
 	// cout << ithmm->_bos_tssb->get_num_nodes() << endl;
 	// cout << ithmm->_bos_tssb->get_num_customers() << endl;
-	for(int i = 0;i < 10000;i++){
-		delete words[i];
-	}
 	delete ithmm;
 }
 